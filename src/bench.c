@@ -0,0 +1,1109 @@
+/**
+ * \file bench.c
+ * \brief synthetic pipeline benchmark
+ * \author agent <agent@local>
+ * \date 2026
+
+    Copyright 2026 agent
+
+    This file is part of glcs.
+
+    glcs is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    glcs is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with glcs.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <glc/common/glc.h>
+#include <glc/common/core.h>
+#include <glc/common/log.h>
+#include <glc/common/util.h>
+#include <glc/common/state.h>
+#include <glc/common/thread.h>
+#include <glc/common/metrics.h>
+#include <glc/common/optimization.h>
+
+#include <glc/core/file.h>
+#include <glc/core/pipe.h>
+#include <glc/core/pack.h>
+#include <glc/core/rgb.h>
+#include <glc/core/color.h>
+#include <glc/core/ycbcr.h>
+#include <glc/core/scale.h>
+
+/** maximum number of filters in chain */
+#define BENCH_STAGES_MAX   16
+/** pregenerated frames, cycled through */
+#define BENCH_POOL          8
+
+enum bench_filter {filter_ycbcr, filter_scale, filter_color, filter_rgb,
+		   filter_pack, filter_unpack};
+
+enum bench_sink {sink_null, sink_file, sink_pipe};
+
+static const char *bench_filter_name[] = {
+	"ycbcr", "scale", "color", "rgb", "pack", "unpack"
+};
+
+struct bench_stage_s {
+	enum bench_filter filter;
+	union {
+		ycbcr_t ycbcr;
+		scale_t scale;
+		color_t color;
+		rgb_t rgb;
+		pack_t pack;
+		unpack_t unpack;
+	} u;
+};
+
+struct bench_s {
+	glc_t glc;
+
+	unsigned int width, height;
+	glc_video_format_t format;
+	double fps;
+	int unlimited;
+	unsigned long frames;
+	double entropy;
+	unsigned int audio_rate, audio_channels;
+
+	struct bench_stage_s stage[BENCH_STAGES_MAX];
+	unsigned int stages;
+
+	double scale_factor;
+	unsigned int scale_width, scale_height;
+	int scale_filter;
+
+	int compression, compression_level;
+	unsigned int keyframe_interval;
+
+	int override_color_correction;
+	float brightness, contrast;
+	float red_gamma, green_gamma, blue_gamma;
+
+	enum bench_sink sink_type;
+	sink_t sink;
+	glc_thread_t null_thread;
+	const char *out_file;
+	const char *pipe_exec_file;
+	char self[PATH_MAX];
+
+	size_t buffer_size;
+	ps_buffer_t *buffer;
+
+	double perf_interval;
+	const char *perf_file;
+	int log_level;
+	long int threads;
+	long int frame_threads;
+	const char *affinity, *avoid;
+
+	glc_stream_id_t video_id, audio_id;
+	size_t frame_size;
+	char *pool[BENCH_POOL];
+	char *audio_pool;
+	size_t audio_pool_size, audio_pos;
+	unsigned long audio_sent;
+	u_int64_t bytes;
+};
+
+/* set by pipe sink when consumer fails, callback has no argument */
+static volatile int bench_stop;
+
+static int bench_consume();
+static int bench_parse_chain(struct bench_s *bench, const char *chain);
+static int bench_parse_compression(struct bench_s *bench, const char *name);
+static int bench_check_chain(struct bench_s *bench);
+static int bench_generate(struct bench_s *bench);
+static int bench_run(struct bench_s *bench);
+
+static int bench_stage_init(struct bench_s *bench, struct bench_stage_s *stage);
+static int bench_stage_start(struct bench_stage_s *stage, ps_buffer_t *from,
+			     ps_buffer_t *to);
+static int bench_stage_wait(struct bench_stage_s *stage);
+static void bench_stage_destroy(struct bench_stage_s *stage);
+
+static int bench_sink_start(struct bench_s *bench, ps_buffer_t *from);
+static int bench_sink_wait(struct bench_s *bench);
+static int bench_null_read_callback(glc_thread_state_t *state);
+static int bench_pipe_stop();
+
+static int bench_feed(struct bench_s *bench, ps_buffer_t *to);
+static int bench_write_formats(struct bench_s *bench, ps_packet_t *packet);
+static int bench_write_audio(struct bench_s *bench, ps_packet_t *packet,
+			     unsigned long frame, glc_utime_t time);
+
+int main(int argc, char *argv[])
+{
+	struct bench_s bench;
+	ssize_t len;
+	int opt;
+
+	struct option long_options[] = {
+		{"size",		1, NULL, 's'},
+		{"pixel",		1, NULL, 'p'},
+		{"fps",			1, NULL, 'f'},
+		{"unlimited",		0, NULL, 'u'},
+		{"frames",		1, NULL, 'n'},
+		{"entropy",		1, NULL, 'e'},
+		{"audio",		1, NULL, 'a'},
+		{"chain",		1, NULL, 'c'},
+		{"sink",		1, NULL, 'k'},
+		{"out",			1, NULL, 'o'},
+		{"pipe",		1, NULL, 'x'},
+		{"resize",		1, NULL, 'r'},
+		{"resize-filter",	1, NULL, 'R'},
+		{"adjust",		1, NULL, 'g'},
+		{"compress",		1, NULL, 'z'},
+		{"delta",		1, NULL, 'd'},
+		{"buffer",		1, NULL, 'b'},
+		{"threads",		1, NULL, 'T'},
+		{"frame-threads",	1, NULL, 'F'},
+		{"affinity",		1, NULL, 'A'},
+		{"avoid",		1, NULL, 'W'},
+		{"interval",		1, NULL, 'i'},
+		{"json",		1, NULL, 'j'},
+		{"verbosity",		1, NULL, 'v'},
+		{"help",		0, NULL, 'h'},
+		{"version",		0, NULL, 'V'},
+		{0, 0, 0, 0}
+	};
+
+	/*
+	 Pipe sink starts its consumer as 'consumer WxH format fps target',
+	 glc-bench is its own default consumer and only reads stdin.
+	*/
+	if (argc == 5 && argv[1][0] != '-')
+		return bench_consume();
+
+	memset(&bench, 0, sizeof(struct bench_s));
+
+	/* 720p BGR at 30fps for 10 seconds */
+	bench.width  = 1280;
+	bench.height = 720;
+	bench.format = GLC_VIDEO_BGR;
+	bench.fps    = 30;
+	bench.frames = 300;
+	bench.entropy = 0.1;
+
+	bench.scale_factor = 1;
+	bench.scale_filter = SCALE_FILTER_BILINEAR;
+
+	bench.red_gamma   = 1.0;
+	bench.green_gamma = 1.0;
+	bench.blue_gamma  = 1.0;
+
+	bench.sink_type = sink_file;
+	bench.out_file  = "/dev/null";
+
+	/* only final dump, covering the whole run */
+	bench.perf_interval = 0;
+	bench.log_level = GLC_PERF;
+
+	while ((opt = getopt_long(argc, argv, "s:p:f:un:e:a:c:k:o:x:r:R:g:z:d:b:T:F:A:W:i:j:v:hV",
+				  long_options, &optind)) != -1) {
+		switch (opt) {
+		case 's':
+			if (sscanf(optarg, "%ux%u", &bench.width, &bench.height) != 2)
+				goto usage;
+			if ((!bench.width) || (!bench.height))
+				goto usage;
+			break;
+		case 'p':
+			if (!strcmp(optarg, "bgr"))
+				bench.format = GLC_VIDEO_BGR;
+			else if (!strcmp(optarg, "bgra"))
+				bench.format = GLC_VIDEO_BGRA;
+			else if (!strcmp(optarg, "420jpeg"))
+				bench.format = GLC_VIDEO_YCBCR_420JPEG;
+			else
+				goto usage;
+			break;
+		case 'f':
+			bench.fps = atof(optarg);
+			if (bench.fps <= 0)
+				goto usage;
+			break;
+		case 'u':
+			bench.unlimited = 1;
+			break;
+		case 'n':
+			bench.frames = strtoul(optarg, NULL, 10);
+			if (!bench.frames)
+				goto usage;
+			break;
+		case 'e':
+			bench.entropy = atof(optarg);
+			if ((bench.entropy < 0) || (bench.entropy > 1))
+				goto usage;
+			break;
+		case 'a':
+			bench.audio_channels = 2;
+			sscanf(optarg, "%u:%u", &bench.audio_rate, &bench.audio_channels);
+			if ((!bench.audio_rate) || (!bench.audio_channels))
+				goto usage;
+			break;
+		case 'c':
+			if (unlikely(bench_parse_chain(&bench, optarg)))
+				goto usage;
+			break;
+		case 'k':
+			if (!strcmp(optarg, "null"))
+				bench.sink_type = sink_null;
+			else if (!strcmp(optarg, "file"))
+				bench.sink_type = sink_file;
+			else if (!strcmp(optarg, "pipe"))
+				bench.sink_type = sink_pipe;
+			else
+				goto usage;
+			break;
+		case 'o':
+			bench.out_file = optarg;
+			break;
+		case 'x':
+			bench.pipe_exec_file = optarg;
+			break;
+		case 'r':
+			if (strstr(optarg, "x")) {
+				sscanf(optarg, "%ux%u", &bench.scale_width,
+					&bench.scale_height);
+				if ((!bench.scale_width) || (!bench.scale_height))
+					goto usage;
+			} else {
+				bench.scale_factor = atof(optarg);
+				if (bench.scale_factor <= 0)
+					goto usage;
+			}
+			break;
+		case 'R':
+			if (!strcmp(optarg, "bilinear"))
+				bench.scale_filter = SCALE_FILTER_BILINEAR;
+			else if (!strcmp(optarg, "area"))
+				bench.scale_filter = SCALE_FILTER_AREA;
+			else if (!strcmp(optarg, "lanczos"))
+				bench.scale_filter = SCALE_FILTER_LANCZOS3;
+			else
+				goto usage;
+			break;
+		case 'g':
+			bench.override_color_correction = 1;
+			sscanf(optarg, "%f;%f;%f;%f;%f", &bench.brightness, &bench.contrast,
+			       &bench.red_gamma, &bench.green_gamma, &bench.blue_gamma);
+			break;
+		case 'z':
+			if (unlikely(bench_parse_compression(&bench, optarg)))
+				goto usage;
+			break;
+		case 'd':
+			bench.keyframe_interval = atoi(optarg);
+			break;
+		case 'b':
+			bench.buffer_size = atoi(optarg) * 1024 * 1024;
+			if (bench.buffer_size <= 0)
+				goto usage;
+			break;
+		case 'T':
+			bench.threads = atoi(optarg);
+			if (bench.threads < 1)
+				goto usage;
+			break;
+		case 'F':
+			bench.frame_threads = atoi(optarg);
+			if (bench.frame_threads < 1)
+				goto usage;
+			break;
+		case 'A':
+			bench.affinity = optarg;
+			break;
+		case 'W':
+			bench.avoid = optarg;
+			break;
+		case 'i':
+			bench.perf_interval = atof(optarg);
+			if (bench.perf_interval < 0)
+				goto usage;
+			break;
+		case 'j':
+			bench.perf_file = optarg;
+			break;
+		case 'v':
+			bench.log_level = atoi(optarg);
+			if (bench.log_level < 0)
+				goto usage;
+			break;
+		case 'V':
+			printf("glc version %s\n", glc_version());
+			return EXIT_SUCCESS;
+			break;
+		case 'h':
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind < argc)
+		goto usage;
+
+	/* default chain is the one of a compressed capture */
+	if (!bench.stages)
+		bench_parse_chain(&bench, "pack");
+
+	if ((bench.format == GLC_VIDEO_YCBCR_420JPEG) &&
+	    ((bench.width % 2) || (bench.height % 2))) {
+		fprintf(stderr, "420jpeg frames must have even dimensions\n");
+		return EXIT_FAILURE;
+	}
+
+	if ((bench.sink_type == sink_pipe) && (!bench.pipe_exec_file)) {
+		len = readlink("/proc/self/exe", bench.self, sizeof(bench.self) - 1);
+		if (unlikely(len < 0)) {
+			fprintf(stderr, "can't find glc-bench path: %s (%d)\n",
+				strerror(errno), errno);
+			return EXIT_FAILURE;
+		}
+		bench.self[len] = '\0';
+		bench.pipe_exec_file = bench.self;
+	}
+
+	if (unlikely(bench_check_chain(&bench)))
+		return EXIT_FAILURE;
+
+	glc_init(&bench.glc);
+	glc_state_init(&bench.glc);
+	glc_log_set_level(&bench.glc, bench.log_level > GLC_PERF ?
+					bench.log_level : GLC_PERF);
+	glc_util_info_fps(&bench.glc, bench.fps);
+	if (bench.frame_threads)
+		glc_set_frame_threads(&bench.glc, bench.frame_threads);
+	if ((bench.affinity) &&
+	    (unlikely(glc_set_affinity(&bench.glc, bench.affinity, bench.avoid))))
+		return EXIT_FAILURE;
+	glc_util_log_version(&bench.glc);
+
+	if (unlikely(bench_generate(&bench)))
+		return EXIT_FAILURE;
+
+	if (unlikely(bench_run(&bench)))
+		return EXIT_FAILURE;
+
+	glc_state_destroy(&bench.glc);
+	glc_destroy(&bench.glc);
+
+	return EXIT_SUCCESS;
+
+usage:
+	printf("%s [option]...\n", argv[0]);
+	printf("  -s, --size=WxH           frame size, default is 1280x720\n"
+	       "  -p, --pixel=FORMAT       frame format, possible values are:\n"
+	       "                             bgr (default), bgra, 420jpeg\n"
+	       "  -f, --fps=FPS            capture rate, default is 30\n"
+	       "  -u, --unlimited          don't pace frames, feed as fast as\n"
+	       "                             the pipeline accepts them\n"
+	       "  -n, --frames=NUM         number of frames, default is 300\n"
+	       "  -e, --entropy=VAL        fraction of random bytes in frames and\n"
+	       "                             audio, 0 to 1, default is 0.1\n"
+	       "  -a, --audio=RATE[:CH]    add a S16_LE audio stream, 2 channels\n"
+	       "                             by default\n"
+	       "  -c, --chain=LIST         comma separated filters, possible values are:\n"
+	       "                             ycbcr, scale, color, rgb, pack, unpack\n"
+	       "                             default is pack\n"
+	       "  -k, --sink=NAME          sink, possible values are:\n"
+	       "                             file (default), pipe, null\n"
+	       "  -o, --out=FILE           file sink target, default is /dev/null\n"
+	       "  -x, --pipe=PROG          pipe sink consumer, default is glc-bench\n"
+	       "                             itself discarding what it reads\n"
+	       "  -r, --resize=VAL         scale factor VAL or WxH for scale and ycbcr\n"
+	       "  -R, --resize-filter=NAME resize filter, possible values are:\n"
+	       "                             bilinear (default), area, lanczos\n"
+	       "  -g, --adjust=ADJUST      color adjustment of color filter\n"
+	       "                             format is brightness;contrast;red;green;blue\n"
+	       "  -z, --compress=NAME      pack compression, as GLC_COMPRESS\n"
+	       "  -d, --delta=NUM          pack keyframe interval, default is 0\n"
+	       "  -b, --buffer=SIZE        buffers size in MiB, default is\n"
+	       "                             10 MiB or 4 frames if larger\n"
+	       "  -T, --threads=NUM        threads per filter, default is computed\n"
+	       "                             from the number of cpus\n"
+	       "  -F, --frame-threads=NUM  split each video frame into bands\n"
+	       "                             processed by NUM threads\n"
+	       "  -A, --affinity=POLICY    pin threads, as GLC_AFFINITY\n"
+	       "  -W, --avoid=CPUS         processors left out, as GLC_AFFINITY_AVOID\n"
+	       "  -i, --interval=SECONDS   metrics dump interval, default is 0\n"
+	       "                             for a single dump covering the run\n"
+	       "  -j, --json=FILE          write metrics as JSON lines to FILE\n"
+	       "  -v, --verbosity=LEVEL    verbosity level, at least 2\n"
+	       "  -h, --help               show help\n");
+
+	return EXIT_FAILURE;
+}
+
+/*
+ * Default pipe consumer, stands for an encoder that keeps up.
+ */
+int bench_consume()
+{
+	static char buf[1024 * 1024];
+	ssize_t ret;
+
+	while ((ret = read(STDIN_FILENO, buf, sizeof(buf))) != 0) {
+		if ((ret < 0) && (errno != EINTR))
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+int bench_parse_chain(struct bench_s *bench, const char *chain)
+{
+	const char *end;
+	size_t len;
+	unsigned int i;
+
+	bench->stages = 0;
+	while (*chain) {
+		end = strchr(chain, ',');
+		len = end ? end - chain : strlen(chain);
+
+		for (i = 0; i < sizeof(bench_filter_name) / sizeof(bench_filter_name[0]); i++) {
+			if ((strlen(bench_filter_name[i]) == len) &&
+			    (!strncmp(bench_filter_name[i], chain, len)))
+				break;
+		}
+		if (unlikely(i == sizeof(bench_filter_name) / sizeof(bench_filter_name[0])))
+			return EINVAL;
+		if (unlikely(bench->stages == BENCH_STAGES_MAX))
+			return EINVAL;
+		bench->stage[bench->stages++].filter = (enum bench_filter) i;
+
+		chain += len;
+		if (*chain)
+			chain++;
+	}
+	return 0;
+}
+
+int bench_parse_compression(struct bench_s *bench, const char *name)
+{
+	if (!strcmp(name, "lzo"))
+		bench->compression = PACK_LZO;
+	else if (!strcmp(name, "quicklz"))
+		bench->compression = PACK_QUICKLZ;
+	else if (!strcmp(name, "lzjb"))
+		bench->compression = PACK_LZJB;
+	else if (!strncmp(name, "lz4", 3) && (!name[3] || name[3] == ':')) {
+		bench->compression = PACK_LZ4;
+		if (name[3])
+			bench->compression_level = atoi(&name[4]);
+	} else if (!strncmp(name, "zstd", 4) && (!name[4] || name[4] == ':')) {
+		bench->compression = PACK_ZSTD;
+		if (name[4])
+			bench->compression_level = atoi(&name[5]);
+	} else if (!strncmp(name, "adaptive", 8) && (!name[8] || name[8] == ':')) {
+		bench->compression = PACK_ADAPTIVE;
+		/* level is the cpu budget */
+		if (name[8])
+			bench->compression_level = atoi(&name[9]);
+	} else
+		return EINVAL;
+	return 0;
+}
+
+/*
+ * Follow frame format through chain so a chain the sink can't
+ * consume fails here instead of stalling the pipeline.
+ */
+int bench_check_chain(struct bench_s *bench)
+{
+	glc_video_format_t format = bench->format;
+	int packed = 0;
+	unsigned int i;
+
+	for (i = 0; i < bench->stages; i++) {
+		switch (bench->stage[i].filter) {
+		case filter_ycbcr:
+			format = GLC_VIDEO_YCBCR_420JPEG;
+			break;
+		case filter_rgb:
+			if (format == GLC_VIDEO_YCBCR_420JPEG)
+				format = GLC_VIDEO_BGR;
+			break;
+		case filter_pack:
+			packed = 1;
+			break;
+		case filter_unpack:
+			packed = 0;
+			break;
+		default:
+			break;
+		}
+		if (unlikely(packed && (bench->stage[i].filter != filter_pack) &&
+			     (bench->stage[i].filter != filter_unpack))) {
+			fprintf(stderr, "%s can't process packed frames, add unpack before it\n",
+				bench_filter_name[bench->stage[i].filter]);
+			return EINVAL;
+		}
+	}
+
+	if (bench->sink_type != sink_pipe)
+		return 0;
+
+	if (unlikely(packed || (format == GLC_VIDEO_YCBCR_420JPEG))) {
+		fprintf(stderr, "pipe sink needs unpacked BGR or BGRA frames\n");
+		return EINVAL;
+	}
+	if (unlikely(bench->audio_rate)) {
+		fprintf(stderr, "pipe sink only consumes video\n");
+		return EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Frames are a gradient moving from one frame to the next where
+ * each byte is replaced by a random one with entropy probability.
+ * Generating them up front keeps generator cost out of the run and
+ * a fixed seed makes runs reproducible.
+ */
+int bench_generate(struct bench_s *bench)
+{
+	u_int32_t seed = 0x9e3779b9;
+	u_int32_t threshold = (u_int32_t) (bench->entropy * 16777216.0);
+	size_t row, i, n;
+	unsigned int p, c;
+	short sample;
+	char *frame;
+
+	if (bench->format == GLC_VIDEO_YCBCR_420JPEG) {
+		row = bench->width;
+		bench->frame_size = bench->width * bench->height +
+				    2 * (bench->width / 2) * (bench->height / 2);
+	} else {
+		row = bench->width * glc_util_get_videofmt_bpp(bench->format);
+		bench->frame_size = row * bench->height;
+	}
+
+	for (p = 0; p < BENCH_POOL; p++) {
+		if (unlikely(!(bench->pool[p] = (char *) malloc(bench->frame_size))))
+			return ENOMEM;
+		frame = bench->pool[p];
+
+		for (i = 0; i < bench->frame_size; i++) {
+			/* xorshift32 */
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+
+			if ((seed >> 8) < threshold)
+				frame[i] = (char) seed;
+			else
+				frame[i] = (char) (i % row + i / row + 3 * p);
+		}
+	}
+
+	if (!bench->audio_rate)
+		return 0;
+
+	/* one second of a triangle wave, looped */
+	n = bench->audio_rate * bench->audio_channels;
+	bench->audio_pool_size = n * sizeof(short);
+	if (unlikely(!(bench->audio_pool = (char *) malloc(bench->audio_pool_size))))
+		return ENOMEM;
+
+	for (i = 0; i < n; i += bench->audio_channels) {
+		for (c = 0; c < bench->audio_channels; c++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+
+			if ((seed >> 8) < threshold)
+				sample = (short) seed;
+			else
+				sample = (short) ((((i / bench->audio_channels) * 128) % 32768) - 16384);
+			memcpy(&bench->audio_pool[(i + c) * sizeof(short)], &sample,
+			       sizeof(short));
+		}
+	}
+	return 0;
+}
+
+int bench_run(struct bench_s *bench)
+{
+	/*
+	 Benchmark uses following pipeline:
+
+	 bench -(buffer 0)->        writes synthetic frames and audio
+	 filter 0 -(buffer 1)->     first filter of chain
+	 ...
+	 filter n-1 -(buffer n)->   last filter of chain
+	 sink                       file, pipe or discarding null sink
+
+	 Metrics registry times every stage, frames are traced from
+	 bench to sink for end-to-end latency.
+	*/
+	struct rusage start_usage, end_usage;
+	glc_utime_t start_time, elapsed;
+	ps_bufferattr_t attr;
+	double user, sys;
+	unsigned int i;
+	int ret = 0;
+
+	if (!bench->buffer_size) {
+		bench->buffer_size = 10 * 1024 * 1024;
+		if (bench->buffer_size < 4 * bench->frame_size)
+			bench->buffer_size = 4 * bench->frame_size;
+	}
+
+	bench->buffer = (ps_buffer_t *) calloc(bench->stages + 1, sizeof(ps_buffer_t));
+	if (unlikely(!bench->buffer))
+		return ENOMEM;
+
+	ps_bufferattr_init(&attr);
+	if (unlikely((ret = ps_bufferattr_setsize(&attr, bench->buffer_size))))
+		goto err;
+	for (i = 0; i <= bench->stages; i++) {
+		if (unlikely((ret = ps_buffer_init(&bench->buffer[i], &attr))))
+			goto err;
+	}
+	ps_bufferattr_destroy(&attr);
+
+	/* stages created from now on are instrumented */
+	if (bench->perf_file) {
+		if (unlikely((ret = glc_metrics_open_file(&bench->glc, bench->perf_file))))
+			goto err;
+	}
+	if (unlikely((ret = glc_metrics_start(&bench->glc,
+				(glc_utime_t) (bench->perf_interval * 1000000000.0)))))
+		goto err;
+
+	/* generator and sink are single, filters are multi */
+	glc_account_threads(&bench->glc, 2, bench->stages);
+	glc_compute_threads_hint(&bench->glc);
+	if (bench->threads)
+		glc_set_threads_hint(&bench->glc, bench->threads);
+
+	for (i = 0; i < bench->stages; i++) {
+		if (unlikely((ret = bench_stage_init(bench, &bench->stage[i]))))
+			goto err;
+	}
+
+	getrusage(RUSAGE_SELF, &start_usage);
+	start_time = glc_time(&bench->glc);
+	glc_state_time_reset(&bench->glc);
+
+	/* sink first, then filters from last to first */
+	if (unlikely((ret = bench_sink_start(bench, &bench->buffer[bench->stages]))))
+		goto err;
+	for (i = bench->stages; i > 0; i--) {
+		if (unlikely((ret = bench_stage_start(&bench->stage[i - 1],
+					&bench->buffer[i - 1], &bench->buffer[i]))))
+			goto err;
+	}
+
+	if (unlikely((ret = bench_feed(bench, &bench->buffer[0]))))
+		goto err;
+
+	/* sink quits last, once every filter has passed end of stream */
+	if (unlikely((ret = bench_sink_wait(bench))))
+		goto err;
+	for (i = bench->stages; i > 0; i--) {
+		if (unlikely((ret = bench_stage_wait(&bench->stage[i - 1]))))
+			goto err;
+	}
+
+	elapsed = glc_time(&bench->glc) - start_time;
+	getrusage(RUSAGE_SELF, &end_usage);
+
+	/* final dump */
+	glc_metrics_stop(&bench->glc);
+
+	user = (end_usage.ru_utime.tv_sec - start_usage.ru_utime.tv_sec) +
+	       (end_usage.ru_utime.tv_usec - start_usage.ru_utime.tv_usec) / 1000000.0;
+	sys  = (end_usage.ru_stime.tv_sec - start_usage.ru_stime.tv_sec) +
+	       (end_usage.ru_stime.tv_usec - start_usage.ru_stime.tv_usec) / 1000000.0;
+
+	printf("bench: %lu frames in %.3f s, %.1f fps, %.1f MiB/s, "
+	       "cpu: user %.3f s, sys %.3f s, %.0f%%\n",
+	       bench->frames, elapsed / 1000000000.0,
+	       elapsed ? bench->frames * 1000000000.0 / elapsed : 0.0,
+	       elapsed ? bench->bytes * 1000000000.0 / (elapsed * 1048576.0) : 0.0,
+	       user, sys,
+	       elapsed ? (user + sys) * 100000000000.0 / elapsed : 0.0);
+
+	for (i = 0; i < bench->stages; i++)
+		bench_stage_destroy(&bench->stage[i]);
+	for (i = 0; i <= bench->stages; i++)
+		ps_buffer_destroy(&bench->buffer[i]);
+	free(bench->buffer);
+	for (i = 0; i < BENCH_POOL; i++)
+		free(bench->pool[i]);
+	free(bench->audio_pool);
+
+	return 0;
+err:
+	fprintf(stderr, "benchmark failed: %s (%d)\n", strerror(ret), ret);
+	return ret;
+}
+
+int bench_stage_init(struct bench_s *bench, struct bench_stage_s *stage)
+{
+	int ret = 0;
+
+	switch (stage->filter) {
+	case filter_ycbcr:
+		if (unlikely((ret = ycbcr_init(&stage->u.ycbcr, &bench->glc))))
+			break;
+		ycbcr_set_scale(stage->u.ycbcr, bench->scale_factor);
+		break;
+	case filter_scale:
+		if (unlikely((ret = scale_init(&stage->u.scale, &bench->glc))))
+			break;
+		if (bench->scale_width && bench->scale_height)
+			scale_set_size(stage->u.scale, bench->scale_width,
+				       bench->scale_height);
+		else
+			scale_set_scale(stage->u.scale, bench->scale_factor);
+		scale_set_filter(stage->u.scale, bench->scale_filter);
+		break;
+	case filter_color:
+		if (unlikely((ret = color_init(&stage->u.color, &bench->glc))))
+			break;
+		if (bench->override_color_correction)
+			color_override(stage->u.color, bench->brightness, bench->contrast,
+				       bench->red_gamma, bench->green_gamma,
+				       bench->blue_gamma);
+		break;
+	case filter_rgb:
+		ret = rgb_init(&stage->u.rgb, &bench->glc);
+		break;
+	case filter_pack:
+		if (unlikely((ret = pack_init(&stage->u.pack, &bench->glc))))
+			break;
+		if (bench->compression)
+			pack_set_compression(stage->u.pack, bench->compression);
+		if (bench->compression == PACK_ADAPTIVE) {
+			if (bench->compression_level)
+				pack_set_cpu_budget(stage->u.pack, bench->compression_level);
+		} else
+			pack_set_compression_level(stage->u.pack, bench->compression_level);
+		pack_set_keyframe_interval(stage->u.pack, bench->keyframe_interval);
+		break;
+	case filter_unpack:
+		ret = unpack_init(&stage->u.unpack, &bench->glc);
+		break;
+	}
+	return ret;
+}
+
+int bench_stage_start(struct bench_stage_s *stage, ps_buffer_t *from, ps_buffer_t *to)
+{
+	switch (stage->filter) {
+	case filter_ycbcr:
+		return ycbcr_process_start(stage->u.ycbcr, from, to);
+	case filter_scale:
+		return scale_process_start(stage->u.scale, from, to);
+	case filter_color:
+		return color_process_start(stage->u.color, from, to);
+	case filter_rgb:
+		return rgb_process_start(stage->u.rgb, from, to);
+	case filter_pack:
+		return pack_process_start(stage->u.pack, from, to);
+	case filter_unpack:
+		return unpack_process_start(stage->u.unpack, from, to);
+	}
+	return EINVAL;
+}
+
+int bench_stage_wait(struct bench_stage_s *stage)
+{
+	switch (stage->filter) {
+	case filter_ycbcr:
+		return ycbcr_process_wait(stage->u.ycbcr);
+	case filter_scale:
+		return scale_process_wait(stage->u.scale);
+	case filter_color:
+		return color_process_wait(stage->u.color);
+	case filter_rgb:
+		return rgb_process_wait(stage->u.rgb);
+	case filter_pack:
+		return pack_process_wait(stage->u.pack);
+	case filter_unpack:
+		return unpack_process_wait(stage->u.unpack);
+	}
+	return EINVAL;
+}
+
+void bench_stage_destroy(struct bench_stage_s *stage)
+{
+	switch (stage->filter) {
+	case filter_ycbcr:
+		ycbcr_destroy(stage->u.ycbcr);
+		break;
+	case filter_scale:
+		scale_destroy(stage->u.scale);
+		break;
+	case filter_color:
+		color_destroy(stage->u.color);
+		break;
+	case filter_rgb:
+		rgb_destroy(stage->u.rgb);
+		break;
+	case filter_pack:
+		pack_destroy(stage->u.pack);
+		break;
+	case filter_unpack:
+		unpack_destroy(stage->u.unpack);
+		break;
+	}
+}
+
+int bench_sink_start(struct bench_s *bench, ps_buffer_t *from)
+{
+	glc_stream_info_t *stream_info;
+	char *info_name;
+	char info_date[26];
+	int ret;
+
+	if (bench->sink_type == sink_null) {
+		bench->null_thread.flags = GLC_THREAD_READ;
+		bench->null_thread.ptr = bench;
+		bench->null_thread.read_callback = &bench_null_read_callback;
+		bench->null_thread.threads = 1;
+		bench->null_thread.name = "null";
+		return glc_thread_create(&bench->glc, &bench->null_thread, from, NULL);
+	}
+
+	if (bench->sink_type == sink_pipe)
+		ret = pipe_sink_init(&bench->sink, &bench->glc, bench->pipe_exec_file,
+				     0, 0, 0, 0, &bench_pipe_stop);
+	else
+		ret = file_sink_init(&bench->sink, &bench->glc);
+	if (unlikely(ret))
+		return ret;
+
+	glc_util_info_create(&bench->glc, &stream_info, &info_name, info_date);
+
+	if (unlikely((ret = bench->sink->ops->set_sync(bench->sink, 0))))
+		goto finish;
+	if (unlikely((ret = bench->sink->ops->open_target(bench->sink, bench->out_file))))
+		goto finish;
+	if (unlikely((ret = bench->sink->ops->write_info(bench->sink, stream_info,
+						info_name, info_date))))
+		goto finish;
+	ret = bench->sink->ops->write_process_start(bench->sink, from);
+finish:
+	free(stream_info);
+	free(info_name);
+	return ret;
+}
+
+int bench_sink_wait(struct bench_s *bench)
+{
+	int ret;
+
+	if (bench->sink_type == sink_null)
+		return glc_thread_wait(&bench->null_thread);
+
+	if (unlikely((ret = bench->sink->ops->write_process_wait(bench->sink))))
+		return ret;
+	bench->sink->ops->close_target(bench->sink);
+	bench->sink->ops->destroy(bench->sink);
+	bench->sink = NULL;
+	return 0;
+}
+
+int bench_null_read_callback(glc_thread_state_t *state)
+{
+	struct bench_s *bench = (struct bench_s *) state->ptr;
+
+	glc_metrics_frame_written(&bench->glc, &state->header, state->read_data);
+	return 0;
+}
+
+int bench_pipe_stop()
+{
+	bench_stop = 1;
+	return 0;
+}
+
+int bench_feed(struct bench_s *bench, ps_buffer_t *to)
+{
+	glc_message_header_t msg_hdr;
+	glc_video_frame_header_t pic_hdr;
+	glc_utime_t start, next, now;
+	struct timespec delay;
+	ps_packet_t packet;
+	unsigned long i;
+	int ret;
+
+	if (unlikely((ret = ps_packet_init(&packet, to))))
+		return ret;
+	if (unlikely((ret = bench_write_formats(bench, &packet))))
+		goto finish;
+
+	msg_hdr.type = GLC_MESSAGE_VIDEO_FRAME;
+	pic_hdr.id = bench->video_id;
+	start = glc_time(&bench->glc);
+
+	for (i = 0; (i < bench->frames) && (!bench_stop); i++) {
+		if (!bench->unlimited) {
+			next = start + (glc_utime_t) (i * 1000000000.0 / bench->fps);
+			now = glc_time(&bench->glc);
+			if (now < next) {
+				delay.tv_sec  = (next - now) / 1000000000;
+				delay.tv_nsec = (next - now) % 1000000000;
+				while (nanosleep(&delay, &delay) && (errno == EINTR));
+			}
+		}
+
+		pic_hdr.time = glc_state_time(&bench->glc);
+
+		if (unlikely((ret = ps_packet_open(&packet, PS_PACKET_WRITE))))
+			goto finish;
+		if (unlikely((ret = ps_packet_write(&packet, &msg_hdr,
+					sizeof(glc_message_header_t)))))
+			goto finish;
+		if (unlikely((ret = ps_packet_write(&packet, &pic_hdr,
+					sizeof(glc_video_frame_header_t)))))
+			goto finish;
+		if (unlikely((ret = ps_packet_write(&packet, bench->pool[i % BENCH_POOL],
+					bench->frame_size))))
+			goto finish;
+		if (unlikely((ret = ps_packet_close(&packet))))
+			goto finish;
+		glc_metrics_frame_queued(&bench->glc, pic_hdr.time);
+		bench->bytes += bench->frame_size;
+
+		if (bench->audio_rate) {
+			if (unlikely((ret = bench_write_audio(bench, &packet, i,
+							      pic_hdr.time))))
+				goto finish;
+		}
+	}
+	bench->frames = i;
+
+	ret = glc_util_write_end_of_stream(&bench->glc, to);
+finish:
+	ps_packet_destroy(&packet);
+	return ret;
+}
+
+int bench_write_formats(struct bench_s *bench, ps_packet_t *packet)
+{
+	glc_message_header_t msg_hdr;
+	glc_video_format_message_t video_format;
+	glc_audio_format_message_t audio_format;
+	glc_state_video_t state_video;
+	glc_state_audio_t state_audio;
+	int ret;
+
+	glc_state_video_new(&bench->glc, &bench->video_id, &state_video);
+
+	msg_hdr.type = GLC_MESSAGE_VIDEO_FORMAT;
+	memset(&video_format, 0, sizeof(glc_video_format_message_t));
+	video_format.id     = bench->video_id;
+	video_format.width  = bench->width;
+	video_format.height = bench->height;
+	video_format.format = bench->format;
+
+	if (unlikely((ret = ps_packet_open(packet, PS_PACKET_WRITE))))
+		return ret;
+	if (unlikely((ret = ps_packet_write(packet, &msg_hdr,
+					    sizeof(glc_message_header_t)))))
+		return ret;
+	if (unlikely((ret = ps_packet_write(packet, &video_format,
+					    sizeof(glc_video_format_message_t)))))
+		return ret;
+	if (unlikely((ret = ps_packet_close(packet))))
+		return ret;
+
+	if (!bench->audio_rate)
+		return 0;
+
+	glc_state_audio_new(&bench->glc, &bench->audio_id, &state_audio);
+
+	msg_hdr.type = GLC_MESSAGE_AUDIO_FORMAT;
+	memset(&audio_format, 0, sizeof(glc_audio_format_message_t));
+	audio_format.id       = bench->audio_id;
+	audio_format.flags    = GLC_AUDIO_INTERLEAVED;
+	audio_format.rate     = bench->audio_rate;
+	audio_format.channels = bench->audio_channels;
+	audio_format.format   = GLC_AUDIO_S16_LE;
+
+	if (unlikely((ret = ps_packet_open(packet, PS_PACKET_WRITE))))
+		return ret;
+	if (unlikely((ret = ps_packet_write(packet, &msg_hdr,
+					    sizeof(glc_message_header_t)))))
+		return ret;
+	if (unlikely((ret = ps_packet_write(packet, &audio_format,
+					    sizeof(glc_audio_format_message_t)))))
+		return ret;
+	return ps_packet_close(packet);
+}
+
+/*
+ * Audio following a frame covers the time until next frame.
+ */
+int bench_write_audio(struct bench_s *bench, ps_packet_t *packet,
+		      unsigned long frame, glc_utime_t time)
+{
+	glc_message_header_t msg_hdr;
+	glc_audio_data_header_t audio_hdr;
+	unsigned long due;
+	size_t size, part;
+	int ret;
+
+	due = (unsigned long) ((frame + 1) * bench->audio_rate / bench->fps);
+	if (due <= bench->audio_sent)
+		return 0;
+
+	size = (due - bench->audio_sent) * bench->audio_channels * sizeof(short);
+	bench->audio_sent = due;
+
+	msg_hdr.type = GLC_MESSAGE_AUDIO_DATA;
+	audio_hdr.id   = bench->audio_id;
+	audio_hdr.time = time;
+	audio_hdr.size = size;
+
+	if (unlikely((ret = ps_packet_open(packet, PS_PACKET_WRITE))))
+		return ret;
+	if (unlikely((ret = ps_packet_write(packet, &msg_hdr,
+					    sizeof(glc_message_header_t)))))
+		return ret;
+	if (unlikely((ret = ps_packet_write(packet, &audio_hdr,
+					    sizeof(glc_audio_data_header_t)))))
+		return ret;
+
+	/* chunks wrap around the pool */
+	while (size) {
+		part = bench->audio_pool_size - bench->audio_pos;
+		if (part > size)
+			part = size;
+		if (unlikely((ret = ps_packet_write(packet,
+					&bench->audio_pool[bench->audio_pos], part))))
+			return ret;
+		bench->audio_pos = (bench->audio_pos + part) % bench->audio_pool_size;
+		size -= part;
+	}
+
+	bench->bytes += audio_hdr.size;
+	return ps_packet_close(packet);
+}
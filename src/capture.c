@@ -71,13 +71,22 @@ int main(int argc, char *argv[])
 		{ 0 , "reload",			"GLC_RELOAD_HOTKEY",		NULL},
 		{'n', "lock-fps",		"GLC_LOCK_FPS",			 "1"},
 		{ 0 , "pbo",			"GLC_TRY_PBO",			 "1"},
+		{ 0 , "pbo-depth",		"GLC_PBO_DEPTH",		NULL},
+		{ 0 , "no-pbo-async",		"GLC_PBO_ASYNC",		 "0"},
+		{ 0 , "fused",			"GLC_FUSED_CONVERT",		 "1"},
+		{ 0 , "no-fused",		"GLC_FUSED_CONVERT",		 "0"},
+		{ 0 , "gpu-convert",		"GLC_GPU_CONVERT",		 "1"},
 		{'z', "compression",		"GLC_COMPRESS",			NULL},
+		{ 0 , "delta",			"GLC_COMPRESS_DELTA",		NULL},
 		{ 0 , "sync",			"GLC_SYNC",			 "1"},
+		{ 0 , "batch",			"GLC_FILE_BATCH",		 "1"},
+		{ 0 , "direct",			"GLC_FILE_DIRECT",		 "1"},
 		{ 0 , "byte-aligned",		"GLC_CAPTURE_DWORD_ALIGNED",	 "0"},
 		{'i', "draw-indicator",		"GLC_INDICATOR",		 "1"},
 		{'v', "log",			"GLC_LOG",			NULL},
 		{'l', "log-file",		"GLC_LOG_FILE",			NULL},
 		{ 0 , "audio-skip",		"GLC_AUDIO_SKIP",		 "1"},
+		{ 0 , "audio-wait",		"GLC_AUDIO_SKIP",		 "0"},
 		{ 0 , "disable-audio",		"GLC_AUDIO",			 "0"},
 		{'g', "glfinish",		"GLC_CAPTURE_GLFINISH",		 "1"},
 		{'j', "force-sdl-alsa-drv",	"SDL_AUDIODRIVER",	      "alsa"},
@@ -86,9 +95,15 @@ int main(int argc, char *argv[])
 		{ 0 , "uncompressed",		"GLC_UNCOMPRESSED_BUFFER_SIZE",	NULL},
 		{ 0 , "unscaled",		"GLC_UNSCALED_BUFFER_SIZE",	NULL},
 		{'P', "rtprio",                 "GLC_RTPRIO",                   NULL},
+		{ 0 , "simd",			"GLC_SIMD",			NULL},
+		{ 0 , "frame-threads",		"GLC_FRAME_THREADS",		NULL},
+		{ 0 , "affinity",		"GLC_AFFINITY",			NULL},
+		{ 0 , "affinity-avoid",		"GLC_AFFINITY_AVOID",		NULL},
 		{ 0 , "pipe",                   "GLC_PIPE",                     NULL},
 		{ 0 , "pipe_invert",            "GLC_PIPE_INVERT",               "1"},
 		{ 0 , "pipe_delay",		"GLC_PIPE_DELAY",		 "0"},
+		{ 0 , "pipe_splice",		"GLC_PIPE_SPLICE",		 "1"},
+		{ 0 , "pipe_shm",		"GLC_PIPE_SHM",			NULL},
 		{ 0 , NULL,			NULL,				NULL}
 	};
 
@@ -185,10 +200,28 @@ usage:
 	       "                               default reload key is '<Shift>F9'\n"
 	       "  -n, --lock-fps             lock fps when capturing\n"
 	       "      --pbo                  use GL_ARB_pixel_buffer_object if available\n"
+	       "      --pbo-depth=NUM        frames in flight with PBO, 1 to 8, default is 3\n"
+	       "      --no-pbo-async         read PBO in application rendering thread\n"
+	       "      --fused                convert to '420jpeg' while capturing, default\n"
+	       "                               with --pbo unless --no-pbo-async is given\n"
+	       "      --no-fused             convert to '420jpeg' in a separate thread\n"
+	       "                               instead of while capturing\n"
+	       "      --gpu-convert          scale and convert to '420jpeg' on GPU before\n"
+	       "                               reading back, needs OpenGL 2.0 and FBO\n"
 	       "  -z, --compression=METHOD   compress stream using METHOD\n"
-	       "                               'none', 'quicklz' and 'lzo' are supported\n"
-	       "                               'quicklz' is used by default\n"
+	       "                               'none', 'quicklz', 'lzo', 'lzjb', 'lz4'\n"
+	       "                               and 'zstd' are supported, 'lz4' and\n"
+	       "                               'zstd' accept a ':LEVEL' suffix\n"
+	       "                               'adaptive[:CPU]' picks one per stream\n"
+	       "                               using at most CPU%% of pack threads\n"
+	       "                               'lzo' is used by default\n"
+	       "      --delta=NUM            compress video frames as differences from\n"
+	       "                               the previous frame, with a full frame\n"
+	       "                               every NUM frames\n"
 	       "      --sync                 force synchronized write mode\n"
+	       "      --batch                write stream file in large batches from\n"
+	       "                               a separate thread\n"
+	       "      --direct               same as --batch and bypass the page cache\n"
 	       "      --byte-aligned         use GL_PACK_ALIGNMENT 1 instead of 8\n"
 	       "  -i, --draw-indicator       draw indicator when capturing\n"
 	       "                               indicator does not work with -b 'front'\n"
@@ -200,7 +233,9 @@ usage:
 	       "                               4: debug\n"
 	       "  -l, --log-file=FILE        write log to FILE, pid-%%d.log by default\n"
 	       "      --audio-skip           skip audio packets if buffer is full\n"
-	       "                               or capture thread is busy\n"
+	       "                               or capture thread is busy (default)\n"
+	       "      --audio-wait           make application wait instead of skipping\n"
+	       "                               audio, except in asynchronous mode\n"
 	       "      --disable-audio        don't capture audio\n"
 	       "  -g, --glfinish             capture at glFinish()\n"
 	       "  -j, --force-sdl-alsa-drv   force SDL to use ALSA audio driver\n"
@@ -213,6 +248,14 @@ usage:
 	       "      --unscaled=SIZE        unscaled picture stream buffer size in MiB,\n"
 	       "                               default is 25 MiB\n"
 	       "  -P, --rtprio               use rt priority for alsa threads\n"
+	       "      --simd=LEVEL           highest instruction set used by conversion kernels\n"
+	       "                               'none', 'sse2', 'ssse3' or 'avx2' (default)\n"
+	       "      --frame-threads=NUM    split each video frame into bands processed\n"
+	       "                               by NUM threads, default is 1 (disabled)\n"
+	       "      --affinity=POLICY      pin glc threads to 'node', 'llc', 'node:N',\n"
+	       "                               'llc:CPU' or a cpu list like '0-3,8'\n"
+	       "      --affinity-avoid=CPUS  cpus left to the application, 'current' is\n"
+	       "                               the one glc is initialized on\n"
 	       "      --pipe=rhs_cmd         pipe the video stream to an ext. app (ie: ffmpeg)\n"
 	       "                               The external program will be invoked with 4 args:\n"
 	       "                                 1. video_size (wxh)\n"
@@ -222,6 +265,10 @@ usage:
 	       "      --pipe_invert          vertically flip images sent to the pipe\n"
 	       "      --pipe_delay           delay in ms to write frames into pipe after\n"
 	       "                             having created the pipe reader process\n"
+	       "      --pipe_splice          vmsplice frames into the pipe instead of\n"
+	       "                             copying them, the pipe is made smaller\n"
+	       "      --pipe_shm=NUM         pass frames through a shared memory ring of\n"
+	       "                             NUM frames instead of the pipe\n"
 	       "  -V, --version              print glc version and exit\n"
 	       "  -h, --help                 show this help\n");
 	return EXIT_FAILURE;
@@ -34,6 +34,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <packetstream.h>
@@ -48,6 +49,7 @@
 #include <glc/common/log.h>
 #include <glc/common/state.h>
 #include <glc/common/util.h>
+#include <glc/common/metrics.h>
 #include <glc/common/optimization.h>
 
 #include "alsa_hook.h"
@@ -55,6 +57,22 @@
 #define ALSA_HOOK_CAPTURING    0x1
 #define ALSA_HOOK_ALLOW_SKIP   0x2
 
+/** captured chunks waiting for the thread, power of two */
+#define ALSA_HOOK_SLOTS        16
+
+/** stream lookup buckets, log2 */
+#define ALSA_HOOK_BUCKET_BITS  5
+#define ALSA_HOOK_BUCKETS      (1 << ALSA_HOOK_BUCKET_BITS)
+
+/**
+ * \brief captured chunk
+ */
+struct alsa_hook_slot_s {
+	char *data;
+	size_t size, capacity;
+	glc_utime_t time;
+};
+
 struct alsa_hook_stream_s {
 	alsa_hook_t alsa_hook;
 	glc_state_audio_t state_audio;
@@ -78,21 +96,29 @@ struct alsa_hook_stream_s {
 	/* thread-related */
 	glc_simple_thread_t thread;
 
-	/* for communicating with capture thread */
-	sem_t capture_empty, capture_full;
+	/*
+	 * Single producer single consumer ring, writers hold the write
+	 * lock and fill slot at head, thread writes slot at tail into
+	 * packetstream. Slots are sized in hw_params, writers only
+	 * allocate and wait when skipping is disallowed and pcm is not
+	 * in asynchronous mode. Thread posts slot_free only when a
+	 * writer has set slot_waiting.
+	 */
+	struct alsa_hook_slot_s slot[ALSA_HOOK_SLOTS];
+	size_t slot_size;
+	volatile unsigned int slot_head, slot_tail;
+	sem_t slot_full, slot_free;
+	volatile int slot_waiting;
+	volatile unsigned int dropped;
+	unsigned int dropped_reported;
 
 	/* for locking access */
 	pthread_mutex_t write_mutex;
 	pthread_spinlock_t write_spinlock;
 
-	/* for busy waiting */
-	volatile int capture_ready;
-
-	char *capture_data;
-	ssize_t capture_size, capture_data_size;
-	glc_utime_t capture_time;
-
 	struct alsa_hook_stream_s *next;
+	/* next stream in same lookup bucket */
+	struct alsa_hook_stream_s *hnext;
 };
 
 struct alsa_hook_s {
@@ -102,7 +128,12 @@ struct alsa_hook_s {
 
 	int started;
 
+	/*
+	 * streams are never removed before destroy, both lists are
+	 * pushed with compare and swap as writers can't take locks
+	 */
 	struct alsa_hook_stream_s *stream;
+	struct alsa_hook_stream_s *bucket[ALSA_HOOK_BUCKETS];
 };
 
 static int alsa_hook_init_streams(alsa_hook_t alsa_hook);
@@ -116,11 +147,12 @@ static int alsa_hook_complex_to_interleaved(struct alsa_hook_stream_s *stream,
 				const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset,
 				snd_pcm_uframes_t frames, char *to);
 
-static int alsa_hook_wait_for_thread(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stream);
+static int alsa_hook_get_slot(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stream,
+			      size_t size, struct alsa_hook_slot_s **slot);
+static void alsa_hook_put_slot(struct alsa_hook_stream_s *stream);
+static int alsa_hook_alloc_slots(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stream);
 static int alsa_hook_lock_write(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stream);
 static int alsa_hook_unlock_write(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stream);
-static int alsa_hook_realloc_capture_buf(struct alsa_hook_stream_s *stream, ssize_t size);
-static int alsa_hook_set_data_size(struct alsa_hook_stream_s *stream, ssize_t size);
 static void *alsa_hook_thread(void *argptr);
 
 static glc_audio_format_t pcm_fmt_to_glc_fmt(snd_pcm_format_t pcm_fmt);
@@ -129,6 +161,7 @@ int alsa_hook_init(alsa_hook_t *alsa_hook, glc_t *glc)
 {
 	*alsa_hook = (alsa_hook_t) calloc(1, sizeof(struct alsa_hook_s));
 	(*alsa_hook)->glc = glc;
+	(*alsa_hook)->flags = ALSA_HOOK_ALLOW_SKIP;
 	return 0;
 }
 
@@ -213,8 +246,12 @@ int alsa_hook_stream_wait(struct alsa_hook_stream_s *stream)
 		stream->thread.running = 0;
 
 		/* tell thread to quit */
-		sem_post(&stream->capture_full);
+		sem_post(&stream->slot_full);
 		pthread_join(stream->thread.thread, NULL);
+
+		/* writer waiting for a slot drops its chunk */
+		if (__sync_bool_compare_and_swap(&stream->slot_waiting, 1, 0))
+			sem_post(&stream->slot_free);
 	}
 	return 0;
 }
@@ -222,6 +259,7 @@ int alsa_hook_stream_wait(struct alsa_hook_stream_s *stream)
 int alsa_hook_destroy(alsa_hook_t alsa_hook)
 {
 	struct alsa_hook_stream_s *del;
+	unsigned int i;
 
 	if (unlikely(alsa_hook == NULL))
 		return EINVAL;
@@ -232,14 +270,14 @@ int alsa_hook_destroy(alsa_hook_t alsa_hook)
 
 		alsa_hook_stream_wait(del);
 
-		sem_destroy(&del->capture_full);
-		sem_destroy(&del->capture_empty);
+		sem_destroy(&del->slot_full);
+		sem_destroy(&del->slot_free);
 
 		pthread_mutex_destroy(&del->write_mutex);
 		pthread_spin_destroy(&del->write_spinlock);
 
-		if (del->capture_data)
-			free(del->capture_data);
+		for (i = 0; i < ALSA_HOOK_SLOTS; i++)
+			free(del->slot[i].data);
 		if (del->initialized)
 			ps_packet_destroy(&del->packet);
 		free(del);
@@ -263,34 +301,80 @@ glc_audio_format_t pcm_fmt_to_glc_fmt(snd_pcm_format_t pcm_fmt)
 	}
 }
 
+/*
+ * Last stream looked up by calling thread, applications usually
+ * write a pcm from a single thread.
+ */
+static __thread struct alsa_hook_stream_s *alsa_hook_last_stream
+	__attribute__ ((tls_model ("initial-exec")));
+
+static inline unsigned int alsa_hook_bucket(snd_pcm_t *pcm)
+{
+	unsigned int key = (unsigned int) ((uintptr_t) pcm >> 4);
+	return (key * 2654435761u) >> (32 - ALSA_HOOK_BUCKET_BITS);
+}
+
+/*
+ * Might be called from signal handlers.
+ */
 int alsa_hook_get_stream(alsa_hook_t alsa_hook, snd_pcm_t *pcm, struct alsa_hook_stream_s **stream)
 {
-	struct alsa_hook_stream_s *find = alsa_hook->stream;
+	struct alsa_hook_stream_s *find = alsa_hook_last_stream;
+	struct alsa_hook_stream_s *head, **bucket;
+
+	if (likely((find != NULL) && (find->pcm == pcm) &&
+		   (find->alsa_hook == alsa_hook)))
+		goto found;
 
-	while (find != NULL) {
+	bucket = &alsa_hook->bucket[alsa_hook_bucket(pcm)];
+	for (find = *bucket; find != NULL; find = find->hnext) {
 		if (find->pcm == pcm)
-			break;
-		find = find->next;
+			goto found;
 	}
 
-	if (find == NULL) {
-		find = (struct alsa_hook_stream_s *) calloc(1, sizeof(struct alsa_hook_stream_s));
-		find->pcm = pcm;
+	find = (struct alsa_hook_stream_s *) calloc(1, sizeof(struct alsa_hook_stream_s));
+	find->pcm = pcm;
 
-		find->id = 0; /* zero until it is initialized */
+	find->id = 0; /* zero until it is initialized */
 
-		sem_init(&find->capture_full, 0, 0);
-		sem_init(&find->capture_empty, 0, 1);
+	sem_init(&find->slot_full, 0, 0);
+	sem_init(&find->slot_free, 0, 0);
 
-		pthread_mutex_init(&find->write_mutex, NULL);
-		pthread_spin_init(&find->write_spinlock, 0);
+	pthread_mutex_init(&find->write_mutex, NULL);
+	pthread_spin_init(&find->write_spinlock, 0);
 
-		find->alsa_hook     = alsa_hook;
-		find->thread.ask_rt = 1;
-		find->next          = alsa_hook->stream;
-		alsa_hook->stream = find;
-	}
+	find->alsa_hook     = alsa_hook;
+	find->thread.ask_rt = 1;
 
+	do {
+		/* rescan what was pushed since the bucket was last read */
+		head = *bucket;
+		for (*stream = head; *stream != NULL; *stream = (*stream)->hnext) {
+			if ((*stream)->pcm == pcm)
+				break;
+		}
+
+		if (*stream != NULL) {
+			/* another thread created it first */
+			sem_destroy(&find->slot_full);
+			sem_destroy(&find->slot_free);
+			pthread_mutex_destroy(&find->write_mutex);
+			pthread_spin_destroy(&find->write_spinlock);
+			free(find);
+			find = *stream;
+			goto found;
+		}
+
+		find->hnext = head;
+	} while (!__sync_bool_compare_and_swap(bucket, head, find));
+
+	do {
+		head = alsa_hook->stream;
+		find->next = head;
+	} while (!__sync_bool_compare_and_swap(&alsa_hook->stream, head, find));
+
+found:
+	alsa_hook_last_stream = find;
 	*stream = find;
 	return 0;
 }
@@ -303,28 +387,26 @@ int alsa_hook_get_stream(alsa_hook_t alsa_hook, snd_pcm_t *pcm, struct alsa_hook
 void *alsa_hook_thread(void *argptr)
 {
 	struct alsa_hook_stream_s *stream = (struct alsa_hook_stream_s *) argptr;
+	struct alsa_hook_slot_s *slot;
 	glc_audio_data_header_t hdr;
 	glc_message_header_t msg_hdr;
+	unsigned int dropped;
 	int ret = 0;
 
 	msg_hdr.type = GLC_MESSAGE_AUDIO_DATA;
 	hdr.id = stream->id;
 
-	stream->capture_ready = 1;
 	while (1) {
-		sem_wait(&stream->capture_full);
-		stream->capture_ready = 0;
+		sem_wait(&stream->slot_full);
 
 		if (unlikely(!stream->thread.running))
 			break;
 
-		if (unlikely(stream->capture_size < 0)) {
-			alsa_hook_realloc_capture_buf(stream,-stream->capture_size);
-			goto capture_ready;
-		}
-
-		hdr.time = stream->capture_time;
-		hdr.size = stream->capture_size;
+		/* slot content is visible once head is */
+		__sync_synchronize();
+		slot = &stream->slot[stream->slot_tail & (ALSA_HOOK_SLOTS - 1)];
+		hdr.time = slot->time;
+		hdr.size = slot->size;
 
 		if (unlikely((ret = ps_packet_open(&stream->packet, PS_PACKET_WRITE))))
 			break;
@@ -339,15 +421,27 @@ void *alsa_hook_thread(void *argptr)
 					sizeof(glc_audio_data_header_t)))))
 			break;
 		if (unlikely((ret = ps_packet_write(&stream->packet,
-					stream->capture_data, hdr.size))))
+					slot->data, hdr.size))))
 			break;
 		if (unlikely((ret = ps_packet_close(&stream->packet))))
 			break;
 
-		if (!(stream->mode & SND_PCM_ASYNC))
-			sem_post(&stream->capture_empty);
-capture_ready:
-		stream->capture_ready = 1;
+		/* hand slot back to writers */
+		__sync_synchronize();
+		stream->slot_tail++;
+		__sync_synchronize();
+		if (stream->slot_waiting &&
+		    __sync_bool_compare_and_swap(&stream->slot_waiting, 1, 0))
+			sem_post(&stream->slot_free);
+
+		/* writers can't log, they might be in a signal handler */
+		dropped = stream->dropped;
+		if (unlikely(dropped != stream->dropped_reported)) {
+			glc_log(stream->alsa_hook->glc, GLC_INFO, "alsa_hook",
+				"%p: dropped %u audio chunks, capture ring full",
+				stream->pcm, dropped - stream->dropped_reported);
+			stream->dropped_reported = dropped;
+		}
 	}
 
 	if (ret != 0)
@@ -359,28 +453,101 @@ capture_ready:
 
 /*
  * Might be called from signal handlers.
+ *
+ * Returns slot at head sized and timed for size bytes. When ring is
+ * full or chunk is larger than a slot, chunk is dropped unless
+ * skipping is disallowed and writer can sleep. EBUSY means chunk
+ * was dropped.
  */
-int alsa_hook_wait_for_thread(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stream)
+int alsa_hook_get_slot(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stream,
+		       size_t size, struct alsa_hook_slot_s **slot)
 {
-	if (stream->mode & SND_PCM_ASYNC) {
-		/**
-		* \note this is ugly, but snd_pcm_...() functions can be called from
-		*       signal handler (f.ex. async mode)
-		*/
-		while (!stream->capture_ready) {
-			struct timeval one_ms = { .tv_sec = 0, .tv_usec = 1000 };
-			if (alsa_hook->flags & ALSA_HOOK_ALLOW_SKIP)
-				goto busy;
-			select(0, NULL, NULL, NULL, &one_ms);
-		}
-	} else
-		sem_wait(&stream->capture_empty);
+	struct alsa_hook_slot_s *s;
+	int lossless = !(alsa_hook->flags & ALSA_HOOK_ALLOW_SKIP) &&
+		       !(stream->mode & SND_PCM_ASYNC);
+	char *data;
+
+	while (unlikely(stream->slot_head - stream->slot_tail >= ALSA_HOOK_SLOTS)) {
+		if ((!lossless) || (!stream->thread.running))
+			goto drop;
+		stream->slot_waiting = 1;
+		__sync_synchronize();
+		/*
+		 * running is read again after the flag is published, either
+		 * alsa_hook_stream_wait() sees the flag or this writer sees
+		 * the thread stopped and withdraws it
+		 */
+		if ((stream->slot_head - stream->slot_tail >= ALSA_HOOK_SLOTS) &&
+		    stream->thread.running)
+			sem_wait(&stream->slot_free);
+		else if (!__sync_bool_compare_and_swap(&stream->slot_waiting, 1, 0))
+			/* thread or alsa_hook_stream_wait() saw the flag, take its post */
+			sem_wait(&stream->slot_free);
+	}
 
+	s = &stream->slot[stream->slot_head & (ALSA_HOOK_SLOTS - 1)];
+	if (unlikely(size > s->capacity)) {
+		/* realloc() is not async-signal-safe */
+		if (!lossless)
+			goto drop;
+		/* thread doesn't touch slots from head to tail */
+		if (unlikely(!(data = (char *) realloc(s->data, size))))
+			return ENOMEM;
+		s->data     = data;
+		s->capacity = size;
+	}
+
+	s->size = size;
+	s->time = glc_state_time(alsa_hook->glc);
+	*slot = s;
 	return 0;
-busy:
+drop:
+	__sync_add_and_fetch(&stream->dropped, 1);
+	glc_metrics_drop(alsa_hook->glc, GLC_METRICS_DROP_AUDIO);
 	return EBUSY;
 }
 
+/*
+ * Might be called from signal handlers.
+ */
+void alsa_hook_put_slot(struct alsa_hook_stream_s *stream)
+{
+	__sync_synchronize();
+	stream->slot_head++;
+	sem_post(&stream->slot_full);
+}
+
+/*
+ * Slots are sized for the largest chunk a writer can commit without
+ * blocking, the hardware buffer. Only lossless writers grow slots
+ * for larger chunks.
+ */
+int alsa_hook_alloc_slots(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stream)
+{
+	unsigned int i;
+	char *data;
+
+	for (i = 0; i < ALSA_HOOK_SLOTS; i++) {
+		if (stream->slot[i].capacity >= stream->slot_size)
+			continue;
+		if (unlikely(!(data = (char *) realloc(stream->slot[i].data,
+						      stream->slot_size)))) {
+			glc_log(alsa_hook->glc, GLC_ERROR, "alsa_hook",
+				"can't allocate capture ring");
+			return ENOMEM;
+		}
+		stream->slot[i].data     = data;
+		stream->slot[i].capacity = stream->slot_size;
+	}
+
+	/* chunks left by previous thread were for previous format */
+	while (!sem_trywait(&stream->slot_full));
+	while (!sem_trywait(&stream->slot_free));
+	stream->slot_waiting = 0;
+	stream->slot_head = stream->slot_tail = 0;
+	return 0;
+}
+
 int alsa_hook_lock_write(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *stream)
 {
 	int ret = 0;
@@ -401,49 +568,6 @@ int alsa_hook_unlock_write(alsa_hook_t alsa_hook, struct alsa_hook_stream_s *str
 	return ret;
 }
 
-int alsa_hook_realloc_capture_buf(struct alsa_hook_stream_s *stream, ssize_t size)
-{
-	char *op = stream->capture_data;
-	int ret = 0;
-	stream->capture_data_size = size;
-	stream->capture_data = (char *) realloc(stream->capture_data,
-						stream->capture_data_size);
-
-	if (unlikely(!stream->capture_data)) {
-		glc_log(stream->alsa_hook->glc, GLC_ERROR, "alsa_hook",
-			"realloc() error");
-		free(op);
-		stream->capture_data_size = 0;
-		ret = ENOMEM;
-	}
-	return ret;
-}
-
-/*
- * Might be called from signal handlers.
- */
-int alsa_hook_set_data_size(struct alsa_hook_stream_s *stream, ssize_t size)
-{
-	int ret = 0;
-	stream->capture_size = size;
-	if (size <= stream->capture_data_size)
-		return 0;
-
-	if (!(stream->mode & SND_PCM_ASYNC)) {
-		ret = alsa_hook_realloc_capture_buf(stream,size);
-	} else {
-		/*
-		 * realloc is not an async-signal-safe function.
-		 * we ask the thread to enlarge the buffer for the next time
-		 * on our behalf.
-		 */
-		stream->capture_size = -size;
-		ret = EBUSY;
-		sem_post(&stream->capture_full);
-	}
-
-	return ret;
-}
 
 int alsa_hook_open(alsa_hook_t alsa_hook, snd_pcm_t *pcm, const char *name,
 			 snd_pcm_stream_t pcm_stream, int mode)
@@ -482,6 +606,7 @@ int alsa_hook_writei(alsa_hook_t alsa_hook, snd_pcm_t *pcm,
 		     const void *buffer, snd_pcm_uframes_t size)
 {
 	struct alsa_hook_stream_s *stream;
+	struct alsa_hook_slot_s *slot;
 	int ret = 0;
 	int savedErrno = errno;
 
@@ -498,16 +623,12 @@ int alsa_hook_writei(alsa_hook_t alsa_hook, snd_pcm_t *pcm,
 	if (unlikely((ret = alsa_hook_lock_write(alsa_hook, stream))))
 		goto leave;
 
-	if (unlikely((ret = alsa_hook_wait_for_thread(alsa_hook, stream))))
+	if (unlikely((ret = alsa_hook_get_slot(alsa_hook, stream,
+				snd_pcm_frames_to_bytes(pcm, size), &slot))))
 		goto unlock;
 
-	if (unlikely((ret = alsa_hook_set_data_size(stream,
-				snd_pcm_frames_to_bytes(pcm, size)))))
-		goto unlock;
-
-	stream->capture_time = glc_state_time(alsa_hook->glc);
-	memcpy(stream->capture_data, buffer, stream->capture_size);
-	sem_post(&stream->capture_full);
+	memcpy(slot->data, buffer, slot->size);
+	alsa_hook_put_slot(stream);
 
 unlock:
 	alsa_hook_unlock_write(alsa_hook, stream);
@@ -523,6 +644,7 @@ int alsa_hook_writen(alsa_hook_t alsa_hook, snd_pcm_t *pcm,
 		     void **bufs, snd_pcm_uframes_t size)
 {
 	struct alsa_hook_stream_s *stream;
+	struct alsa_hook_slot_s *slot;
 	int c, ret = 0;
 	int savedErrno = errno;
 
@@ -547,19 +669,15 @@ int alsa_hook_writen(alsa_hook_t alsa_hook, snd_pcm_t *pcm,
 		goto unlock;
 	}
 
-	if (unlikely((ret = alsa_hook_wait_for_thread(alsa_hook, stream))))
-		goto unlock;
-
-	if (unlikely((ret = alsa_hook_set_data_size(stream,
-				snd_pcm_frames_to_bytes(pcm, size)))))
+	if (unlikely((ret = alsa_hook_get_slot(alsa_hook, stream,
+				snd_pcm_frames_to_bytes(pcm, size), &slot))))
 		goto unlock;
 
-	stream->capture_time = glc_state_time(alsa_hook->glc);
 	for (c = 0; c < stream->channels; c++)
-		memcpy(&stream->capture_data[c * snd_pcm_samples_to_bytes(pcm, size)], bufs[c],
+		memcpy(&slot->data[c * snd_pcm_samples_to_bytes(pcm, size)], bufs[c],
 		       snd_pcm_samples_to_bytes(pcm, size));
 
-	sem_post(&stream->capture_full);
+	alsa_hook_put_slot(stream);
 
 unlock:
 	alsa_hook_unlock_write(alsa_hook, stream);
@@ -609,6 +727,7 @@ int alsa_hook_mmap_commit(alsa_hook_t alsa_hook, snd_pcm_t *pcm,
 				snd_pcm_uframes_t offset, snd_pcm_uframes_t frames)
 {
 	struct alsa_hook_stream_s *stream;
+	struct alsa_hook_slot_s *slot;
 	unsigned int c;
 	int ret = 0;
 	int savedErrno = errno;
@@ -637,30 +756,25 @@ int alsa_hook_mmap_commit(alsa_hook_t alsa_hook, snd_pcm_t *pcm,
 			glc_log(alsa_hook->glc, GLC_WARN, "alsa_hook",
 				 "offset=%lu != stream->offset=%lu", offset, stream->offset);
 
-	if (unlikely((ret = alsa_hook_wait_for_thread(alsa_hook, stream))))
-		goto unlock;
-
-	if (unlikely((ret = alsa_hook_set_data_size(stream,
-			snd_pcm_frames_to_bytes(pcm, frames)))))
+	if (unlikely((ret = alsa_hook_get_slot(alsa_hook, stream,
+			snd_pcm_frames_to_bytes(pcm, frames), &slot))))
 		goto unlock;
 
-	stream->capture_time = glc_state_time(alsa_hook->glc);
-
 	if (stream->flags & GLC_AUDIO_INTERLEAVED) {
-		memcpy(stream->capture_data,
+		memcpy(slot->data,
 		       alsa_hook_mmap_pos(stream->mmap_areas, offset),
-		       stream->capture_size);
+		       slot->size);
 	} else if (stream->complex) {
 		alsa_hook_complex_to_interleaved(stream, stream->mmap_areas, offset,
-		                                  frames, stream->capture_data);
+		                                  frames, slot->data);
 	} else {
 		for (c = 0; c < stream->channels; c++)
-			memcpy(&stream->capture_data[c * snd_pcm_samples_to_bytes(stream->pcm, frames)],
+			memcpy(&slot->data[c * snd_pcm_samples_to_bytes(stream->pcm, frames)],
 			       alsa_hook_mmap_pos(&stream->mmap_areas[c], offset),
 			       snd_pcm_samples_to_bytes(stream->pcm, frames));
 	}
 
-	sem_post(&stream->capture_full);
+	alsa_hook_put_slot(stream);
 
 unlock:
 	alsa_hook_unlock_write(alsa_hook, stream);
@@ -704,7 +818,7 @@ int alsa_hook_hw_params(alsa_hook_t alsa_hook, snd_pcm_t *pcm, snd_pcm_hw_params
 	struct alsa_hook_stream_s *stream;
 
 	snd_pcm_format_t format;
-	snd_pcm_uframes_t period_size;
+	snd_pcm_uframes_t period_size, buffer_size;
 	snd_pcm_access_t access;
 	int dir, ret;
 
@@ -733,6 +847,8 @@ int alsa_hook_hw_params(alsa_hook_t alsa_hook, snd_pcm_t *pcm, snd_pcm_hw_params
 		goto err;
 	if (unlikely((ret = snd_pcm_hw_params_get_period_size(params, &period_size, NULL)) < 0))
 		goto err;
+	if (unlikely((ret = snd_pcm_hw_params_get_buffer_size(params, &buffer_size)) < 0))
+		goto err;
 	if (unlikely((ret = snd_pcm_hw_params_get_access(params, &access)) < 0))
 		goto err;
 	if ((access == SND_PCM_ACCESS_RW_INTERLEAVED) ||
@@ -748,6 +864,9 @@ int alsa_hook_hw_params(alsa_hook_t alsa_hook, snd_pcm_t *pcm, snd_pcm_hw_params
 		goto err;
 	}
 
+	stream->slot_size = snd_pcm_format_physical_width(format) / 8 * stream->channels *
+			    buffer_size;
+
 	glc_log(alsa_hook->glc, GLC_DEBUG, "alsa_hook",
 		 "%p: %d channels, rate %d, flags 0x%02x",
 		 stream->pcm, stream->channels, stream->rate, stream->flags);
@@ -809,6 +928,9 @@ int alsa_hook_stream_init(alsa_hook_t alsa_hook,
 
 	alsa_hook_stream_wait(stream);
 
+	if (unlikely((ret = alsa_hook_alloc_slots(alsa_hook, stream))))
+		return ret;
+
 	ret = glc_simple_thread_create(alsa_hook->glc, &stream->thread,
 				alsa_hook_thread, stream);
 
@@ -42,8 +42,11 @@ __PUBLIC int alsa_hook_init(alsa_hook_t *alsa_hook, glc_t *glc);
 /**
  * \brief allow audio skipping in some cases
  *
- * If audio_skip is enabled, alsa_hook may skip some audio data
- * if buffer is not ready and pcm is opened in asynchronous mode.
+ * Written audio is queued in a small ring of chunks sized for the
+ * hardware buffer. When the ring is full or a chunk is larger than
+ * the hardware buffer, chunk is dropped so that writers never wait
+ * for glc. When skipping is disallowed, writers in blocking mode
+ * wait for a free slot instead. Skipping is allowed by default.
  * \param alsa_hook alsa_hook object
  * \param allow_skip 1 allows skipping, 0 disallows
  * \return 0 on success otherwise an error code
@@ -53,6 +53,8 @@
 #include <glc/common/util.h>
 #include <glc/common/rational.h>
 #include <glc/common/optimization.h>
+#include <glc/common/thread.h>
+#include <glc/common/metrics.h>
 
 #include "gl_capture.h"
 
@@ -63,43 +65,18 @@
 #define GL_CAPTURE_CROP            0x10
 #define GL_CAPTURE_LOCK_FPS        0x20
 #define GL_CAPTURE_IGNORE_TIME     0x40
+#define GL_CAPTURE_USE_SYNC        0x80
+#define GL_CAPTURE_ASYNC_READBACK 0x100
+#define GL_CAPTURE_TRY_GPU        0x200
+#define GL_CAPTURE_USE_GPU        0x400
+#define GL_CAPTURE_ARB_FBO        0x800
 
-/*
- * The next functions come from:
- * http://locklessinc.com/articles/locks/
- */
-
-/* Compile read-write barrier */
-#define barrier() asm volatile("": : :"memory")
-
-/* Pause instruction to prevent excess processor bus usage */
-#define cpu_relax() asm volatile("pause\n": : :"memory")
-
-static inline uint32_t xchg_32(volatile void *ptr, uint32_t x)
-{
-	__asm__ __volatile__("xchgl %0,%1"
-				:"=r" ((uint32_t) x)
-				:"m" (*(volatile uint32_t *)ptr), "0" (x)
-				:"memory");
-	return x;
-}
+/** maximum PBO ring depth */
+#define GL_CAPTURE_MAX_PBO            8
 
-#define SPINBUSY 1
-typedef volatile uint32_t spinlock_t;
-
-static void spin_lock(spinlock_t *lock)
-{
-	do {
-		if (likely(!xchg_32(lock, SPINBUSY))) return;
-		while (*lock) cpu_relax();
-	} while(1);
-}
-
-static void spin_unlock(spinlock_t *lock)
-{
-	barrier();
-	*lock = 0;
-}
+/** video stream lookup buckets, log2 */
+#define GL_CAPTURE_BUCKET_BITS        6
+#define GL_CAPTURE_BUCKETS            (1 << GL_CAPTURE_BUCKET_BITS)
 
 typedef void (*FuncPtr)(void);
 typedef FuncPtr (*GLXGetProcAddressProc)(const GLubyte *procName);
@@ -116,6 +93,140 @@ typedef void (*glBindBufferProc)(GLenum target,
 typedef GLvoid *(*glMapBufferProc)(GLenum target,
                                    GLenum access);
 typedef GLboolean (*glUnmapBufferProc)(GLenum target);
+typedef GLsync (*glFenceSyncProc)(GLenum condition,
+                                  GLbitfield flags);
+typedef GLenum (*glClientWaitSyncProc)(GLsync sync,
+                                       GLbitfield flags,
+                                       GLuint64 timeout);
+typedef void (*glDeleteSyncProc)(GLsync sync);
+typedef GLuint (*glCreateShaderProc)(GLenum type);
+typedef void (*glShaderSourceProc)(GLuint shader,
+                                   GLsizei count,
+                                   const GLchar **string,
+                                   const GLint *length);
+typedef void (*glCompileShaderProc)(GLuint shader);
+typedef void (*glGetShaderivProc)(GLuint shader,
+                                  GLenum pname,
+                                  GLint *params);
+typedef void (*glGetShaderInfoLogProc)(GLuint shader,
+                                       GLsizei size,
+                                       GLsizei *length,
+                                       GLchar *log);
+typedef void (*glDeleteShaderProc)(GLuint shader);
+typedef GLuint (*glCreateProgramProc)(void);
+typedef void (*glAttachShaderProc)(GLuint program,
+                                   GLuint shader);
+typedef void (*glLinkProgramProc)(GLuint program);
+typedef void (*glGetProgramivProc)(GLuint program,
+                                   GLenum pname,
+                                   GLint *params);
+typedef void (*glUseProgramProc)(GLuint program);
+typedef void (*glDeleteProgramProc)(GLuint program);
+typedef GLint (*glGetUniformLocationProc)(GLuint program,
+                                          const GLchar *name);
+typedef void (*glUniform1iProc)(GLint location,
+                                GLint v0);
+typedef void (*glUniform2fProc)(GLint location,
+                                GLfloat v0,
+                                GLfloat v1);
+typedef void (*glGenFramebuffersProc)(GLsizei n,
+                                      GLuint *framebuffers);
+typedef void (*glDeleteFramebuffersProc)(GLsizei n,
+                                         const GLuint *framebuffers);
+typedef void (*glBindFramebufferProc)(GLenum target,
+                                      GLuint framebuffer);
+typedef void (*glFramebufferTexture2DProc)(GLenum target,
+                                           GLenum attachment,
+                                           GLenum textarget,
+                                           GLuint texture,
+                                           GLint level);
+typedef GLenum (*glCheckFramebufferStatusProc)(GLenum target);
+
+/*
+ * GPU conversion draws a quad over an FBO holding the 420jpeg frame
+ * packed as RGBA texels, 4 output bytes per fragment, Y' plane then
+ * Cb and Cr planes. Plain glReadPixels() of the FBO gives the frame
+ * as ycbcr would write it.
+ */
+static const GLchar *gl_capture_gpu_vertex =
+	"void main()\n"
+	"{\n"
+	"	gl_Position = gl_Vertex;\n"
+	"}\n";
+
+static const GLchar *gl_capture_gpu_fragment =
+	"uniform sampler2D src;\n"
+	"uniform vec2 dst_size; /* Y' plane width and height */\n"
+	"uniform vec2 src_step; /* source texture coordinates per Y' pixel */\n"
+	"uniform int half_size; /* ycbcr half-size path */\n"
+	"\n"
+	"/* frame is top-down, source texture bottom-up */\n"
+	"vec3 source(float x, float y)\n"
+	"{\n"
+	"	return texture2D(src, vec2((x + 0.5) * src_step.x,\n"
+	"				   1.0 - (y + 0.5) * src_step.y)).rgb;\n"
+	"}\n"
+	"\n"
+	"/*\n"
+	" * chroma is sampled like ycbcr does: at half size, from the center\n"
+	" * of its 2x2 Y' block, otherwise averaging the block samples\n"
+	" */\n"
+	"vec3 block(float x, float y)\n"
+	"{\n"
+	"	if (half_size != 0)\n"
+	"		return source(x * 2.0 + 0.5, y * 2.0 + 0.5);\n"
+	"	return 0.25 * (source(x * 2.0, y * 2.0) +\n"
+	"		       source(x * 2.0 + 1.0, y * 2.0) +\n"
+	"		       source(x * 2.0, y * 2.0 + 1.0) +\n"
+	"		       source(x * 2.0 + 1.0, y * 2.0 + 1.0));\n"
+	"}\n"
+	"\n"
+	"float plane(float o)\n"
+	"{\n"
+	"	float cw = dst_size.x * 0.5;\n"
+	"	float cs = cw * dst_size.y * 0.5;\n"
+	"	float y;\n"
+	"\n"
+	"	if (o < dst_size.x * dst_size.y) {\n"
+	"		y = floor((o + 0.5) / dst_size.x);\n"
+	"		return dot(source(o - y * dst_size.x, y),\n"
+	"			   vec3(0.299, 0.587, 0.114));\n"
+	"	}\n"
+	"\n"
+	"	o -= dst_size.x * dst_size.y;\n"
+	"	if (o < cs) {\n"
+	"		y = floor((o + 0.5) / cw);\n"
+	"		return 0.5 + dot(block(o - y * cw, y),\n"
+	"				 vec3(-0.168736, -0.331264, 0.5));\n"
+	"	}\n"
+	"\n"
+	"	o -= cs;\n"
+	"	y = floor((o + 0.5) / cw);\n"
+	"	return 0.5 + dot(block(o - y * cw, y),\n"
+	"			 vec3(0.5, -0.418688, -0.081312));\n"
+	"}\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	float o = floor(gl_FragCoord.y) * dst_size.x + floor(gl_FragCoord.x) * 4.0;\n"
+	"	gl_FragColor = vec4(plane(o), plane(o + 1.0), plane(o + 2.0), plane(o + 3.0));\n"
+	"}\n";
+
+/*
+ * mapped PBO handed over to readback thread, stream format is copied
+ * so that the thread never reads the video stream
+ */
+struct gl_capture_readback_s {
+	glc_stream_id_t id;
+	size_t size;
+	int convert;
+	GLvoid *buf;
+	glc_utime_t time;
+	unsigned int frame;
+	/* set until readback thread is done with buf */
+	int busy;
+	struct gl_capture_readback_s *next;
+};
 
 struct gl_capture_video_stream_s {
 	glc_state_video_t state_video;
@@ -128,10 +239,15 @@ struct gl_capture_video_stream_s {
 	GLXDrawable drawable;
 	Window attribWin;
 	ps_packet_t packet;
-	glc_utime_t last, pbo_time;
+	glc_utime_t last;
 
 	unsigned int w, h;
 	unsigned int cw, ch, row, cx, cy;
+	size_t size;
+
+	/* converted by ycbcr, pixels is read back memory without PBO */
+	int convert;
+	unsigned char *pixels;
 
 	float brightness, contrast;
 	float gamma_red, gamma_green, gamma_blue;
@@ -139,9 +255,28 @@ struct gl_capture_video_stream_s {
 	int indicator_list;
 
 	struct gl_capture_video_stream_s *next;
+	/* next stream in same lookup bucket */
+	struct gl_capture_video_stream_s *hnext;
+
+	/*
+	 * PBO ring, transfers are started at head and read back from
+	 * tail, pbo_count transfers are in flight
+	 */
+	GLuint pbo[GL_CAPTURE_MAX_PBO];
+	GLsync pbo_fence[GL_CAPTURE_MAX_PBO];
+	glc_utime_t pbo_time[GL_CAPTURE_MAX_PBO];
+	struct gl_capture_readback_s pbo_read[GL_CAPTURE_MAX_PBO];
+	unsigned int pbo_depth, pbo_head, pbo_count;
+	/* reads that had to wait for an unfinished transfer or readback */
+	unsigned int pbo_stalls;
 
-	GLuint pbo;
-	int pbo_active;
+	/*
+	 * GPU conversion, capture area is copied to gpu_src and drawn
+	 * converted to gpu_dst, gpu_w x gpu_h RGBA texels
+	 */
+	int gpu;
+	GLuint gpu_program, gpu_fbo, gpu_src, gpu_dst;
+	unsigned int gpu_w, gpu_h;
 
 	/* stats related vars */
 	unsigned num_frames;
@@ -152,7 +287,6 @@ struct gl_capture_video_stream_s {
 
 struct gl_capture_s {
 	glc_t *glc;
-	spinlock_t capture_spinlock;
 	glc_flags_t flags;
 
 	GLenum capture_buffer;   /* GL_FRONT or GL_BACK */
@@ -165,9 +299,15 @@ struct gl_capture_s {
 	glc_utime_t fps_rem;     /* fix to apply every fps_rem_period frames */
 	unsigned fps_rem_period; /* period in frames which fps_rem is applied */
 
+	/*
+	 * streams are never removed before destroy, lookups walk
+	 * buckets without locking, creation holds mutex
+	 */
 	struct gl_capture_video_stream_s *video;
+	struct gl_capture_video_stream_s *bucket[GL_CAPTURE_BUCKETS];
 
 	ps_buffer_t *to;
+	ycbcr_t ycbcr;
 
 	pthread_mutex_t mutex;
 
@@ -186,8 +326,52 @@ struct gl_capture_s {
 	glBindBufferProc      glBindBuffer;
 	glMapBufferProc       glMapBuffer;
 	glUnmapBufferProc     glUnmapBuffer;
+	glFenceSyncProc       glFenceSync;
+	glClientWaitSyncProc  glClientWaitSync;
+	glDeleteSyncProc      glDeleteSync;
+
+	glCreateShaderProc           glCreateShader;
+	glShaderSourceProc           glShaderSource;
+	glCompileShaderProc          glCompileShader;
+	glGetShaderivProc            glGetShaderiv;
+	glGetShaderInfoLogProc       glGetShaderInfoLog;
+	glDeleteShaderProc           glDeleteShader;
+	glCreateProgramProc          glCreateProgram;
+	glAttachShaderProc           glAttachShader;
+	glLinkProgramProc            glLinkProgram;
+	glGetProgramivProc           glGetProgramiv;
+	glUseProgramProc             glUseProgram;
+	glDeleteProgramProc          glDeleteProgram;
+	glGetUniformLocationProc     glGetUniformLocation;
+	glUniform1iProc              glUniform1i;
+	glUniform2fProc              glUniform2f;
+	glGenFramebuffersProc        glGenFramebuffers;
+	glDeleteFramebuffersProc     glDeleteFramebuffers;
+	glBindFramebufferProc        glBindFramebuffer;
+	glFramebufferTexture2DProc   glFramebufferTexture2D;
+	glCheckFramebufferStatusProc glCheckFramebufferStatus;
+
+	/* output scale of GPU conversion */
+	double scale;
+
+	unsigned int pbo_depth;
+
+	/*
+	 * readback thread copies or converts mapped PBOs into target
+	 * buffer, queue is protected by readback_mutex
+	 */
+	glc_simple_thread_t readback_thread;
+	pthread_mutex_t readback_mutex;
+	pthread_cond_t readback_cond;
+	pthread_cond_t readback_done;
+	struct gl_capture_readback_s *readback_head, *readback_tail;
+	int readback_stop;
+	int readback_ret;
 };
 
+static int gl_capture_find_video_stream(gl_capture_t gl_capture,
+				struct gl_capture_video_stream_s **video,
+				Display *dpy, GLXDrawable drawable);
 static int gl_capture_get_video_stream(gl_capture_t gl_capture,
 				struct gl_capture_video_stream_s **video,
 				Display *dpy, GLXDrawable drawable);
@@ -218,16 +402,52 @@ static int gl_capture_get_pixels(gl_capture_t gl_capture,
 static int gl_capture_gen_indicator_list(gl_capture_t gl_capture,
 				struct gl_capture_video_stream_s *video);
 
+static int gl_capture_load_gl(gl_capture_t gl_capture);
 static int gl_capture_init_pbo(gl_capture_t gl);
 static int gl_capture_create_pbo(gl_capture_t gl_capture,
 				struct gl_capture_video_stream_s *video);
 static int gl_capture_destroy_pbo(gl_capture_t gl_capture,
 				struct gl_capture_video_stream_s *video);
 static int gl_capture_start_pbo(gl_capture_t gl_capture,
+				struct gl_capture_video_stream_s *video,
+				glc_utime_t now);
+static int gl_capture_pbo_ready(gl_capture_t gl_capture,
 				struct gl_capture_video_stream_s *video);
 static int gl_capture_read_pbo(gl_capture_t gl_capture,
 				struct gl_capture_video_stream_s *video);
 
+static int gl_capture_start_readback(gl_capture_t gl_capture);
+static int gl_capture_stop_readback(gl_capture_t gl_capture);
+static void *gl_capture_readback_thread(void *argptr);
+static int gl_capture_write_readback(gl_capture_t gl_capture,
+				struct gl_capture_readback_s *job, ps_packet_t *packet);
+static int gl_capture_map_pbo(gl_capture_t gl_capture,
+				struct gl_capture_video_stream_s *video,
+				glc_utime_t now, struct gl_capture_readback_s **job);
+static int gl_capture_queue_pbo(gl_capture_t gl_capture,
+				struct gl_capture_video_stream_s *video,
+				glc_utime_t now);
+static int gl_capture_flush_pbo(gl_capture_t gl_capture,
+				struct gl_capture_video_stream_s *video);
+static int gl_capture_unmap_pbo(gl_capture_t gl_capture,
+				struct gl_capture_video_stream_s *video,
+				unsigned int slot, int wait);
+static int gl_capture_readback_pbo(gl_capture_t gl_capture,
+				struct gl_capture_video_stream_s *video,
+				glc_utime_t now);
+
+static int gl_capture_init_gpu(gl_capture_t gl_capture);
+static int gl_capture_create_gpu(gl_capture_t gl_capture,
+				struct gl_capture_video_stream_s *video);
+static int gl_capture_destroy_gpu(gl_capture_t gl_capture,
+				struct gl_capture_video_stream_s *video);
+static int gl_capture_gpu_program(gl_capture_t gl_capture,
+				struct gl_capture_video_stream_s *video);
+static void gl_capture_gpu_save_fbo(gl_capture_t gl_capture, GLint fbo[2]);
+static void gl_capture_gpu_restore_fbo(gl_capture_t gl_capture, const GLint fbo[2]);
+static int gl_capture_gpu_read(gl_capture_t gl_capture,
+				struct gl_capture_video_stream_s *video, GLvoid *to);
+
 int gl_capture_init(gl_capture_t *gl_capture, glc_t *glc)
 {
 	*gl_capture = (gl_capture_t) calloc(1, sizeof(struct gl_capture_s));
@@ -240,8 +460,13 @@ int gl_capture_init(gl_capture_t *gl_capture, glc_t *glc)
 	(*gl_capture)->format = GL_BGRA;		/* capture as BGRA data by default */
 	(*gl_capture)->bpp = 4;				/* since we use BGRA */
 	(*gl_capture)->capture_buffer = GL_FRONT;	/* front buffer is default */
+	(*gl_capture)->pbo_depth = 3;			/* frames in flight with PBO */
+	(*gl_capture)->scale = 1.0;
 
 	pthread_mutex_init(&(*gl_capture)->mutex, NULL);
+	pthread_mutex_init(&(*gl_capture)->readback_mutex, NULL);
+	pthread_cond_init(&(*gl_capture)->readback_cond, NULL);
+	pthread_cond_init(&(*gl_capture)->readback_done, NULL);
 
 	return 0;
 }
@@ -255,6 +480,15 @@ int gl_capture_set_buffer(gl_capture_t gl_capture, ps_buffer_t *buffer)
 	return 0;
 }
 
+int gl_capture_set_ycbcr(gl_capture_t gl_capture, ycbcr_t ycbcr)
+{
+	if (unlikely(gl_capture->flags & GL_CAPTURE_CAPTURING))
+		return EBUSY;
+
+	gl_capture->ycbcr = ycbcr;
+	return 0;
+}
+
 int gl_capture_set_read_buffer(gl_capture_t gl_capture, GLenum buffer)
 {
 	if (buffer == GL_FRONT)
@@ -330,6 +564,59 @@ int gl_capture_try_pbo(gl_capture_t gl_capture, int try_pbo)
 	return 0;
 }
 
+int gl_capture_try_gpu(gl_capture_t gl_capture, int try_gpu)
+{
+	if (try_gpu) {
+		gl_capture->flags |= GL_CAPTURE_TRY_GPU;
+	} else {
+		if (unlikely(gl_capture->flags & GL_CAPTURE_USE_GPU)) {
+			glc_log(gl_capture->glc, GLC_WARN, "gl_capture",
+				 "can't disable GPU conversion; it is in use");
+			return EAGAIN;
+		}
+
+		gl_capture->flags &= ~GL_CAPTURE_TRY_GPU;
+	}
+
+	return 0;
+}
+
+int gl_capture_set_scale(gl_capture_t gl_capture, double scale)
+{
+	if (unlikely(scale <= 0))
+		return EINVAL;
+
+	if (unlikely(gl_capture->flags & GL_CAPTURE_CAPTURING))
+		return EBUSY;
+
+	gl_capture->scale = scale;
+	return 0;
+}
+
+int gl_capture_set_pbo_depth(gl_capture_t gl_capture, unsigned int depth)
+{
+	if (unlikely((depth < 1) || (depth > GL_CAPTURE_MAX_PBO)))
+		return EINVAL;
+
+	if (unlikely(gl_capture->flags & GL_CAPTURE_CAPTURING))
+		return EBUSY;
+
+	gl_capture->pbo_depth = depth;
+	return 0;
+}
+
+int gl_capture_async_readback(gl_capture_t gl_capture, int async_readback)
+{
+	if (unlikely(gl_capture->flags & GL_CAPTURE_CAPTURING))
+		return EBUSY;
+
+	if (async_readback)
+		gl_capture->flags |= GL_CAPTURE_ASYNC_READBACK;
+	else
+		gl_capture->flags &= ~GL_CAPTURE_ASYNC_READBACK;
+	return 0;
+}
+
 int gl_capture_set_pixel_format(gl_capture_t gl_capture, GLenum format)
 {
 	if (format == GL_BGRA) {
@@ -422,9 +709,8 @@ int gl_capture_start(gl_capture_t gl_capture)
 int gl_capture_stop(gl_capture_t gl_capture)
 {
 	if (gl_capture->flags & GL_CAPTURE_CAPTURING) {
-		spin_lock(&gl_capture->capture_spinlock);
-		gl_capture->flags &= ~GL_CAPTURE_CAPTURING;
-		spin_unlock(&gl_capture->capture_spinlock);
+		/* full barrier, see gl_capture_frame() */
+		__sync_and_and_fetch(&gl_capture->flags, ~GL_CAPTURE_CAPTURING);
 		glc_log(gl_capture->glc, GLC_INFO, "gl_capture",
 			 "stopping capturing");
 		gl_capture_clear_video_streams(gl_capture);
@@ -454,6 +740,10 @@ int gl_capture_destroy(gl_capture_t gl_capture)
 {
 	struct gl_capture_video_stream_s *del;
 
+	/* flushes frames still queued for readback */
+	if (gl_capture->readback_thread.running)
+		gl_capture_stop_readback(gl_capture);
+
 	while (gl_capture->video != NULL) {
 		del = gl_capture->video;
 		gl_capture->video = gl_capture->video->next;
@@ -461,19 +751,31 @@ int gl_capture_destroy(gl_capture_t gl_capture)
 		glc_log(gl_capture->glc, GLC_PERF, "gl_capture",
 			"captured %u frames in %" PRIu64 " nsec",
 			del->num_captured_frames, del->capture_time_ns);
+		if (del->pbo_depth)
+			glc_log(gl_capture->glc, GLC_PERF, "gl_capture",
+				"%u PBO reads of %u would have stalled (ring of %u%s)",
+				del->pbo_stalls, del->num_captured_frames, del->pbo_depth,
+				(gl_capture->flags & GL_CAPTURE_USE_SYNC) ? "" : ", no fences");
 
 		/* we might be in wrong thread */
 		if (del->indicator_list)
 			glDeleteLists(del->indicator_list, 1);
 
-		if (del->pbo)
+		if (del->pbo_depth)
 			gl_capture_destroy_pbo(gl_capture, del);
 
+		if (del->gpu_program)
+			gl_capture_destroy_gpu(gl_capture, del);
+
 		ps_packet_destroy(&del->packet);
+		free(del->pixels);
 		free(del);
 	}
 
 	pthread_mutex_destroy(&gl_capture->mutex);
+	pthread_mutex_destroy(&gl_capture->readback_mutex);
+	pthread_cond_destroy(&gl_capture->readback_cond);
+	pthread_cond_destroy(&gl_capture->readback_done);
 
 	if (gl_capture->libGL_handle)
 		dlclose(gl_capture->libGL_handle);
@@ -553,6 +855,9 @@ int gl_capture_calc_geometry(gl_capture_t gl_capture,
 int gl_capture_get_pixels(gl_capture_t gl_capture,
 			  struct gl_capture_video_stream_s *video, char *to)
 {
+	if (video->gpu)
+		return gl_capture_gpu_read(gl_capture, video, to);
+
 	glPushAttrib(GL_PIXEL_MODE_BIT);
 	glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
 
@@ -598,6 +903,25 @@ int gl_capture_gen_indicator_list(gl_capture_t gl_capture,
 	return 0;
 }
 
+/* shared by PBO and GPU conversion setup, both hold mutex */
+int gl_capture_load_gl(gl_capture_t gl_capture)
+{
+	if (gl_capture->glXGetProcAddress)
+		return 0;
+
+	if (!gl_capture->libGL_handle)
+		gl_capture->libGL_handle = dlopen("libGL.so.1", RTLD_LAZY);
+	if (unlikely(!gl_capture->libGL_handle))
+		return ENOTSUP;
+	gl_capture->glXGetProcAddress =
+		(GLXGetProcAddressProc)
+		dlsym(gl_capture->libGL_handle, "glXGetProcAddressARB");
+	if (unlikely(!gl_capture->glXGetProcAddress))
+		return ENOTSUP;
+
+	return 0;
+}
+
 int gl_capture_init_pbo(gl_capture_t gl_capture)
 {
 	const char *gl_extensions = (const char *) glGetString(GL_EXTENSIONS);
@@ -608,13 +932,7 @@ int gl_capture_init_pbo(gl_capture_t gl_capture)
 	if (unlikely(!strstr(gl_extensions, "GL_ARB_pixel_buffer_object")))
 		return ENOTSUP;
 
-	gl_capture->libGL_handle = dlopen("libGL.so.1", RTLD_LAZY);
-	if (unlikely(!gl_capture->libGL_handle))
-		return ENOTSUP;
-	gl_capture->glXGetProcAddress =
-		(GLXGetProcAddressProc)
-		dlsym(gl_capture->libGL_handle, "glXGetProcAddressARB");
-	if (unlikely(!gl_capture->glXGetProcAddress))
+	if (unlikely(gl_capture_load_gl(gl_capture)))
 		return ENOTSUP;
 	gl_capture->glGenBuffers =
 		(glGenBuffersProc)
@@ -650,6 +968,26 @@ int gl_capture_init_pbo(gl_capture_t gl_capture)
 	glc_log(gl_capture->glc, GLC_INFO, "gl_capture",
 		 "using GL_ARB_pixel_buffer_object");
 
+	/* fences are optional, without them oldest transfer is read when ring is full */
+	if (strstr(gl_extensions, "GL_ARB_sync")) {
+		gl_capture->glFenceSync =
+			(glFenceSyncProc)
+			gl_capture->glXGetProcAddress((const GLubyte *) "glFenceSync");
+		gl_capture->glClientWaitSync =
+			(glClientWaitSyncProc)
+			gl_capture->glXGetProcAddress((const GLubyte *) "glClientWaitSync");
+		gl_capture->glDeleteSync =
+			(glDeleteSyncProc)
+			gl_capture->glXGetProcAddress((const GLubyte *) "glDeleteSync");
+
+		if ((gl_capture->glFenceSync) && (gl_capture->glClientWaitSync) &&
+		    (gl_capture->glDeleteSync)) {
+			gl_capture->flags |= GL_CAPTURE_USE_SYNC;
+			glc_log(gl_capture->glc, GLC_INFO, "gl_capture",
+				 "using GL_ARB_sync for PBO readback");
+		}
+	}
+
 	return 0;
 }
 
@@ -657,16 +995,23 @@ int gl_capture_create_pbo(gl_capture_t gl_capture,
 			  struct gl_capture_video_stream_s *video)
 {
 	GLint binding;
+	unsigned int i;
 
-	glc_log(gl_capture->glc, GLC_DEBUG, "gl_capture", "creating PBO");
+	glc_log(gl_capture->glc, GLC_DEBUG, "gl_capture", "creating %u PBO ring",
+		gl_capture->pbo_depth);
 
 	glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING_ARB, &binding);
 	glPushAttrib(GL_ALL_ATTRIB_BITS);
 
-	gl_capture->glGenBuffers(1, &video->pbo);
-	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, video->pbo);
-	gl_capture->glBufferData(GL_PIXEL_PACK_BUFFER_ARB, video->row * video->ch,
-				NULL, GL_STREAM_READ);
+	video->pbo_depth = gl_capture->pbo_depth;
+	video->pbo_head = video->pbo_count = 0;
+	gl_capture->glGenBuffers(video->pbo_depth, video->pbo);
+	for (i = 0; i < video->pbo_depth; i++) {
+		gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, video->pbo[i]);
+		gl_capture->glBufferData(GL_PIXEL_PACK_BUFFER_ARB,
+					video->gpu ? video->size : video->row * video->ch,
+					NULL, GL_STREAM_READ);
+	}
 
 	glPopAttrib();
 	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, binding);
@@ -676,65 +1021,753 @@ int gl_capture_create_pbo(gl_capture_t gl_capture,
 int gl_capture_destroy_pbo(gl_capture_t gl_capture,
 			   struct gl_capture_video_stream_s *video)
 {
-	glc_log(gl_capture->glc, GLC_DEBUG, "gl_capture", "destroying PBO");
-	gl_capture->glDeleteBuffers(1, &video->pbo);
+	unsigned int i;
+	int ret;
+
+	glc_log(gl_capture->glc, GLC_DEBUG, "gl_capture", "destroying PBO ring");
+
+	if (unlikely((ret = gl_capture_flush_pbo(gl_capture, video))))
+		glc_log(gl_capture->glc, GLC_WARN, "gl_capture",
+			"frames left in PBO ring are lost: %s (%d)",
+			strerror(ret), ret);
+
+	for (i = 0; i < video->pbo_depth; i++) {
+		gl_capture_unmap_pbo(gl_capture, video, i, 1);
+
+		if (video->pbo_fence[i])
+			gl_capture->glDeleteSync(video->pbo_fence[i]);
+		video->pbo_fence[i] = NULL;
+	}
+
+	gl_capture->glDeleteBuffers(video->pbo_depth, video->pbo);
+	video->pbo_depth = video->pbo_head = video->pbo_count = 0;
 	return 0;
 }
 
-int gl_capture_start_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+static inline unsigned int gl_capture_pbo_tail(struct gl_capture_video_stream_s *video)
+{
+	return (video->pbo_head + video->pbo_depth - video->pbo_count) % video->pbo_depth;
+}
+
+int gl_capture_start_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			 glc_utime_t now)
 {
 	GLint binding;
+	unsigned int slot = video->pbo_head;
 
 	glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING_ARB, &binding);
 	glPushAttrib(GL_PIXEL_MODE_BIT);
 	glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
 
-	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, video->pbo);
+	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, video->pbo[slot]);
 
-	glReadBuffer(gl_capture->capture_buffer);
-	glPixelStorei(GL_PACK_ALIGNMENT, gl_capture->pack_alignment);
 	/* to = ((char *)NULL + (offset)) */
-	glReadPixels(video->cx, video->cy, video->cw, video->ch,
-		gl_capture->format, GL_UNSIGNED_BYTE, NULL);
+	if (video->gpu)
+		gl_capture_gpu_read(gl_capture, video, NULL);
+	else {
+		glReadBuffer(gl_capture->capture_buffer);
+		glPixelStorei(GL_PACK_ALIGNMENT, gl_capture->pack_alignment);
+		glReadPixels(video->cx, video->cy, video->cw, video->ch,
+			gl_capture->format, GL_UNSIGNED_BYTE, NULL);
+	}
+
+	if (gl_capture->flags & GL_CAPTURE_USE_SYNC)
+		video->pbo_fence[slot] =
+			gl_capture->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 
 	glPopClientAttrib();
 	glPopAttrib();
 	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, binding);
+
+	video->pbo_time[slot] = now;
+	video->pbo_head = (slot + 1) % video->pbo_depth;
+	video->pbo_count++;
 	return 0;
 }
 
+/*
+ * Tells if oldest transfer should be read back now. Transfer is read as
+ * soon as its fence is signaled, or when ring is full. Without fences
+ * transfers are always given as much time as the ring allows.
+ */
+int gl_capture_pbo_ready(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+{
+	unsigned int tail;
+
+	if (!video->pbo_count)
+		return 0;
+
+	tail = gl_capture_pbo_tail(video);
+	if (video->pbo_fence[tail]) {
+		if (gl_capture->glClientWaitSync(video->pbo_fence[tail], 0, 0) !=
+		    GL_TIMEOUT_EXPIRED)
+			return 1;
+		if (video->pbo_count < video->pbo_depth)
+			return 0;
+
+		/* ring is full, mapping will block */
+		video->pbo_stalls++;
+		return 1;
+	}
+
+	return video->pbo_count == video->pbo_depth;
+}
+
 int gl_capture_read_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
 {
 	GLvoid *buf;
 	GLint binding;
+	char *dma;
+	int ret = 0;
+	unsigned int tail = gl_capture_pbo_tail(video);
 
 	glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING_ARB, &binding);
 
-	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, video->pbo);
+	if (video->pbo_fence[tail]) {
+		gl_capture->glDeleteSync(video->pbo_fence[tail]);
+		video->pbo_fence[tail] = NULL;
+	}
+	video->pbo_count--;
+
+	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, video->pbo[tail]);
 	buf = gl_capture->glMapBuffer(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY);
 	if (unlikely(!buf))
 		return EINVAL;
 
-	ps_packet_write(&video->packet, buf, video->row * video->ch);
+	/* convert straight from mapped PBO */
+	if (video->convert) {
+		if (likely(!(ret = ps_packet_dma(&video->packet, (void *) &dma,
+						 video->size, PS_ACCEPT_FAKE_DMA))))
+			ret = ycbcr_convert_frame(gl_capture->ycbcr, video->id, buf,
+						  (unsigned char *) dma);
+	} else
+		ps_packet_write(&video->packet, buf, video->size);
 
 	gl_capture->glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
 
 	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, binding);
+	return ret;
+}
+
+/*
+ * Maps oldest transfer into its readback job. Mapping must be released
+ * from GL thread with gl_capture_unmap_pbo() once job is written.
+ */
+int gl_capture_map_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+		       glc_utime_t now, struct gl_capture_readback_s **job_out)
+{
+	struct gl_capture_readback_s *job;
+	GLint binding;
+	unsigned int tail = gl_capture_pbo_tail(video);
+
+	if (video->pbo_fence[tail]) {
+		gl_capture->glDeleteSync(video->pbo_fence[tail]);
+		video->pbo_fence[tail] = NULL;
+	}
+	video->pbo_count--;
+
+	job = &video->pbo_read[tail];
+	glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING_ARB, &binding);
+	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, video->pbo[tail]);
+	job->buf = gl_capture->glMapBuffer(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY);
+	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, binding);
+	if (unlikely(!job->buf))
+		return EINVAL;
+
+	/* see gl_capture_frame() about pbo_time in the future */
+	job->id      = video->id;
+	job->size    = video->size;
+	job->convert = video->convert;
+	job->time  = (video->pbo_time[tail] < now) ? video->pbo_time[tail] : now;
+	job->frame = video->num_frames;
+	job->next  = NULL;
+	*job_out = job;
 	return 0;
 }
 
-int gl_capture_get_video_stream(gl_capture_t gl_capture,
-				struct gl_capture_video_stream_s **video,
-				Display *dpy, GLXDrawable drawable)
+/*
+ * Maps oldest transfer and hands it over to readback thread.
+ */
+int gl_capture_queue_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			 glc_utime_t now)
+{
+	struct gl_capture_readback_s *job;
+	int ret;
+
+	if (unlikely((ret = gl_capture_map_pbo(gl_capture, video, now, &job))))
+		return ret;
+
+	pthread_mutex_lock(&gl_capture->readback_mutex);
+	job->busy = 1;
+	if (gl_capture->readback_tail)
+		gl_capture->readback_tail->next = job;
+	else
+		gl_capture->readback_head = job;
+	gl_capture->readback_tail = job;
+	pthread_cond_signal(&gl_capture->readback_cond);
+	pthread_mutex_unlock(&gl_capture->readback_mutex);
+
+	return 0;
+}
+
+/*
+ * Writes transfers still in flight before their PBOs go away, like the
+ * frame read back from the single PBO used to be. Readback thread
+ * takes them when it runs, they are written in place otherwise.
+ */
+int gl_capture_flush_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video)
+{
+	struct gl_capture_readback_s *job;
+	glc_utime_t now = glc_state_time(gl_capture->glc);
+	unsigned int slot;
+	int ret = 0;
+
+	while (video->pbo_count) {
+		if (gl_capture->readback_thread.running) {
+			if (unlikely((ret = gl_capture_queue_pbo(gl_capture, video, now))))
+				break;
+		} else {
+			slot = gl_capture_pbo_tail(video);
+			if (unlikely((ret = gl_capture_map_pbo(gl_capture, video, now, &job))))
+				break;
+			ret = gl_capture_write_readback(gl_capture, job, &video->packet);
+			gl_capture_unmap_pbo(gl_capture, video, slot, 1);
+			if (unlikely(ret))
+				break;
+		}
+		video->num_captured_frames++;
+	}
+
+	return ret;
+}
+
+/*
+ * Releases mapping of slot after readback thread has written it.
+ * Returns EAGAIN without waiting if readback is still in progress.
+ */
+int gl_capture_unmap_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			 unsigned int slot, int wait)
+{
+	struct gl_capture_readback_s *job = &video->pbo_read[slot];
+	GLint binding;
+
+	if (!job->buf)
+		return 0;
+
+	pthread_mutex_lock(&gl_capture->readback_mutex);
+	while (job->busy) {
+		if (!wait) {
+			pthread_mutex_unlock(&gl_capture->readback_mutex);
+			return EAGAIN;
+		}
+		pthread_cond_wait(&gl_capture->readback_done, &gl_capture->readback_mutex);
+	}
+	pthread_mutex_unlock(&gl_capture->readback_mutex);
+
+	glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING_ARB, &binding);
+	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, video->pbo[slot]);
+	gl_capture->glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+	gl_capture->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, binding);
+
+	job->buf = NULL;
+	return 0;
+}
+
+/*
+ * PBO capture with readback thread, only GL calls are made here:
+ * mappings the readback thread is done with are released, oldest
+ * transfer is mapped and queued when ready and a new transfer is
+ * started.
+ */
+int gl_capture_readback_pbo(gl_capture_t gl_capture, struct gl_capture_video_stream_s *video,
+			    glc_utime_t now)
+{
+	unsigned int i;
+	int ret;
+
+	pthread_mutex_lock(&gl_capture->readback_mutex);
+	ret = gl_capture->readback_ret;
+	gl_capture->readback_ret = 0;
+	pthread_mutex_unlock(&gl_capture->readback_mutex);
+	if (unlikely(ret))
+		return ret;
+
+	for (i = 0; i < video->pbo_depth; i++)
+		gl_capture_unmap_pbo(gl_capture, video, i, 0);
+
+	if (gl_capture_pbo_ready(gl_capture, video)) {
+		if (unlikely((ret = gl_capture_queue_pbo(gl_capture, video, now))))
+			return ret;
+		video->num_captured_frames++;
+	}
+
+	/* next transfer goes to a slot readback thread might still be reading */
+	if (gl_capture_unmap_pbo(gl_capture, video, video->pbo_head, 0) == EAGAIN) {
+		video->pbo_stalls++;
+		gl_capture_unmap_pbo(gl_capture, video, video->pbo_head, 1);
+	}
+
+	return gl_capture_start_pbo(gl_capture, video, now);
+}
+
+/*
+ * GPU conversion needs GLSL and framebuffer objects, texture and
+ * draw state of the application is saved around every use.
+ */
+int gl_capture_init_gpu(gl_capture_t gl_capture)
+{
+	const char *gl_extensions = (const char *) glGetString(GL_EXTENSIONS);
+	const char *gl_version = (const char *) glGetString(GL_VERSION);
+	const char *fbo;
+	char name[64];
+	int major = 0;
+
+	if (unlikely((gl_extensions == NULL) || (gl_version == NULL)))
+		return EINVAL;
+
+	/* shaders are core since 2.0 */
+	if (unlikely((sscanf(gl_version, "%d.", &major) != 1) || (major < 2)))
+		return ENOTSUP;
+
+	if (strstr(gl_extensions, "GL_ARB_framebuffer_object")) {
+		gl_capture->flags |= GL_CAPTURE_ARB_FBO;
+		fbo = "";
+	} else if (strstr(gl_extensions, "GL_EXT_framebuffer_object"))
+		fbo = "EXT";
+	else
+		return ENOTSUP;
+
+	if (unlikely(gl_capture_load_gl(gl_capture)))
+		return ENOTSUP;
+
+#define GL_CAPTURE_GPU_PROC(proc, suffix) \
+	snprintf(name, sizeof(name), "%s%s", #proc, suffix); \
+	gl_capture->proc = \
+		(proc##Proc) \
+		gl_capture->glXGetProcAddress((const GLubyte *) name); \
+	if (unlikely(!gl_capture->proc)) \
+		return ENOTSUP;
+
+	GL_CAPTURE_GPU_PROC(glCreateShader, "")
+	GL_CAPTURE_GPU_PROC(glShaderSource, "")
+	GL_CAPTURE_GPU_PROC(glCompileShader, "")
+	GL_CAPTURE_GPU_PROC(glGetShaderiv, "")
+	GL_CAPTURE_GPU_PROC(glGetShaderInfoLog, "")
+	GL_CAPTURE_GPU_PROC(glDeleteShader, "")
+	GL_CAPTURE_GPU_PROC(glCreateProgram, "")
+	GL_CAPTURE_GPU_PROC(glAttachShader, "")
+	GL_CAPTURE_GPU_PROC(glLinkProgram, "")
+	GL_CAPTURE_GPU_PROC(glGetProgramiv, "")
+	GL_CAPTURE_GPU_PROC(glUseProgram, "")
+	GL_CAPTURE_GPU_PROC(glDeleteProgram, "")
+	GL_CAPTURE_GPU_PROC(glGetUniformLocation, "")
+	GL_CAPTURE_GPU_PROC(glUniform1i, "")
+	GL_CAPTURE_GPU_PROC(glUniform2f, "")
+	GL_CAPTURE_GPU_PROC(glBindBuffer, "ARB")
+	GL_CAPTURE_GPU_PROC(glGenFramebuffers, fbo)
+	GL_CAPTURE_GPU_PROC(glDeleteFramebuffers, fbo)
+	GL_CAPTURE_GPU_PROC(glBindFramebuffer, fbo)
+	GL_CAPTURE_GPU_PROC(glFramebufferTexture2D, fbo)
+	GL_CAPTURE_GPU_PROC(glCheckFramebufferStatus, fbo)
+#undef GL_CAPTURE_GPU_PROC
+
+	glc_log(gl_capture->glc, GLC_INFO, "gl_capture",
+		 "converting to 420jpeg on GPU, using GL_%s_framebuffer_object",
+		 (gl_capture->flags & GL_CAPTURE_ARB_FBO) ? "ARB" : "EXT");
+	return 0;
+}
+
+int gl_capture_gpu_program(gl_capture_t gl_capture,
+			   struct gl_capture_video_stream_s *video)
+{
+	static const GLenum type[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+	const GLchar *source[2] = { gl_capture_gpu_vertex, gl_capture_gpu_fragment };
+	GLchar log[256];
+	GLuint shader;
+	GLint status;
+	unsigned int i;
+
+	video->gpu_program = gl_capture->glCreateProgram();
+	for (i = 0; i < 2; i++) {
+		shader = gl_capture->glCreateShader(type[i]);
+		gl_capture->glShaderSource(shader, 1, &source[i], NULL);
+		gl_capture->glCompileShader(shader);
+		gl_capture->glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+		if (unlikely(!status)) {
+			gl_capture->glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+			glc_log(gl_capture->glc, GLC_ERROR, "gl_capture",
+				"can't compile conversion shader: %s", log);
+			gl_capture->glDeleteShader(shader);
+			return ENOTSUP;
+		}
+
+		/* deleted along with program */
+		gl_capture->glAttachShader(video->gpu_program, shader);
+		gl_capture->glDeleteShader(shader);
+	}
+
+	gl_capture->glLinkProgram(video->gpu_program);
+	gl_capture->glGetProgramiv(video->gpu_program, GL_LINK_STATUS, &status);
+	if (unlikely(!status)) {
+		glc_log(gl_capture->glc, GLC_ERROR, "gl_capture",
+			"can't link conversion shader");
+		return ENOTSUP;
+	}
+
+	return 0;
+}
+
+/*
+ * Output is sized like ycbcr would, except width is a multiple of 4
+ * for 4 bytes per fragment. Byte offsets are computed as floats in
+ * the shader so frame must stay below 2^24 bytes.
+ */
+int gl_capture_create_gpu(gl_capture_t gl_capture,
+			  struct gl_capture_video_stream_s *video)
+{
+	GLint program, texture, unpack, fbo[2];
+	unsigned int w, h;
+	int ret = 0;
+
+	w = video->cw * gl_capture->scale;
+	h = video->ch * gl_capture->scale;
+	w -= w % 4;
+	h -= h % 2;
+
+	if (unlikely((!w) || (!h) || (w * h + w * h / 2 > (1 << 24)))) {
+		glc_log(gl_capture->glc, GLC_WARN, "gl_capture",
+			"can't convert %ux%u video %d on GPU, converting on CPU",
+			w, h, video->id);
+		return EINVAL;
+	}
+
+	if (video->gpu_program)
+		gl_capture_destroy_gpu(gl_capture, video);
+
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+	glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING_ARB, &unpack);
+	gl_capture_gpu_save_fbo(gl_capture, fbo);
+
+	if (unlikely((ret = gl_capture_gpu_program(gl_capture, video))))
+		goto out;
+
+	/* textures are allocated, not uploaded from any unpack buffer */
+	gl_capture->glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+
+	glGenTextures(1, &video->gpu_src);
+	glBindTexture(GL_TEXTURE_2D, video->gpu_src);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, video->cw, video->ch, 0,
+		     GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+
+	video->gpu_w = w / 4;
+	video->gpu_h = h + h / 2;
+	glGenTextures(1, &video->gpu_dst);
+	glBindTexture(GL_TEXTURE_2D, video->gpu_dst);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, video->gpu_w, video->gpu_h, 0,
+		     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	gl_capture->glGenFramebuffers(1, &video->gpu_fbo);
+	gl_capture->glBindFramebuffer(GL_FRAMEBUFFER_EXT, video->gpu_fbo);
+	gl_capture->glFramebufferTexture2D(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+					   GL_TEXTURE_2D, video->gpu_dst, 0);
+	if (unlikely(gl_capture->glCheckFramebufferStatus(GL_FRAMEBUFFER_EXT) !=
+		     GL_FRAMEBUFFER_COMPLETE_EXT)) {
+		glc_log(gl_capture->glc, GLC_ERROR, "gl_capture",
+			"conversion framebuffer is incomplete");
+		ret = ENOTSUP;
+		goto out;
+	}
+
+	gl_capture->glUseProgram(video->gpu_program);
+	gl_capture->glUniform1i(gl_capture->glGetUniformLocation(video->gpu_program,
+								 "src"), 0);
+	gl_capture->glUniform2f(gl_capture->glGetUniformLocation(video->gpu_program,
+								 "dst_size"), w, h);
+	gl_capture->glUniform2f(gl_capture->glGetUniformLocation(video->gpu_program,
+								 "src_step"),
+				1.0 / (gl_capture->scale * video->cw),
+				1.0 / (gl_capture->scale * video->ch));
+	gl_capture->glUniform1i(gl_capture->glGetUniformLocation(video->gpu_program,
+								 "half_size"),
+				gl_capture->scale == 0.5);
+
+	glc_log(gl_capture->glc, GLC_DEBUG, "gl_capture",
+		"converting video %d on GPU from %ux%u to %ux%u",
+		video->id, video->cw, video->ch, w, h);
+out:
+	gl_capture->glUseProgram(program);
+	gl_capture_gpu_restore_fbo(gl_capture, fbo);
+	gl_capture->glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, unpack);
+	glBindTexture(GL_TEXTURE_2D, texture);
+
+	if (unlikely(ret)) {
+		/* won't work any better for other streams */
+		gl_capture_destroy_gpu(gl_capture, video);
+		gl_capture->flags &= ~(GL_CAPTURE_TRY_GPU | GL_CAPTURE_USE_GPU);
+		glc_log(gl_capture->glc, GLC_WARN, "gl_capture",
+			"GPU conversion disabled, converting on CPU");
+	}
+	return ret;
+}
+
+int gl_capture_destroy_gpu(gl_capture_t gl_capture,
+			   struct gl_capture_video_stream_s *video)
+{
+	if (video->gpu_fbo)
+		gl_capture->glDeleteFramebuffers(1, &video->gpu_fbo);
+	if (video->gpu_src)
+		glDeleteTextures(1, &video->gpu_src);
+	if (video->gpu_dst)
+		glDeleteTextures(1, &video->gpu_dst);
+	if (video->gpu_program)
+		gl_capture->glDeleteProgram(video->gpu_program);
+
+	video->gpu_fbo = video->gpu_src = video->gpu_dst = video->gpu_program = 0;
+	video->gpu = 0;
+	return 0;
+}
+
+/* read and draw bindings differ only with GL_ARB_framebuffer_object */
+void gl_capture_gpu_save_fbo(gl_capture_t gl_capture, GLint fbo[2])
+{
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &fbo[0]);
+	if (gl_capture->flags & GL_CAPTURE_ARB_FBO)
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &fbo[1]);
+	else
+		fbo[1] = fbo[0];
+}
+
+void gl_capture_gpu_restore_fbo(gl_capture_t gl_capture, const GLint fbo[2])
+{
+	if (gl_capture->flags & GL_CAPTURE_ARB_FBO) {
+		gl_capture->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo[0]);
+		gl_capture->glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo[1]);
+	} else
+		gl_capture->glBindFramebuffer(GL_FRAMEBUFFER_EXT, fbo[0]);
+}
+
+/*
+ * Copies capture area into source texture, draws it converted into
+ * conversion framebuffer and reads that back to to, which is an
+ * offset when a PBO is bound.
+ */
+int gl_capture_gpu_read(gl_capture_t gl_capture,
+			struct gl_capture_video_stream_s *video, GLvoid *to)
+{
+	GLint program, fbo[2];
+
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	gl_capture_gpu_save_fbo(gl_capture, fbo);
+	glPushAttrib(GL_ALL_ATTRIB_BITS);
+	glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+
+	gl_capture->glBindFramebuffer(GL_FRAMEBUFFER_EXT, 0);
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_2D, video->gpu_src);
+	glReadBuffer(gl_capture->capture_buffer);
+	glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, video->cx, video->cy,
+			    video->cw, video->ch);
+
+	gl_capture->glBindFramebuffer(GL_FRAMEBUFFER_EXT, video->gpu_fbo);
+	glViewport(0, 0, video->gpu_w, video->gpu_h);
+	glDisable(GL_ALPHA_TEST);
+	glDisable(GL_BLEND);
+	glDisable(GL_COLOR_LOGIC_OP);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_POLYGON_SMOOTH);
+	glDisable(GL_POLYGON_STIPPLE);
+	glDisable(GL_SCISSOR_TEST);
+	glDisable(GL_STENCIL_TEST);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+	gl_capture->glUseProgram(video->gpu_program);
+	glRectf(-1.0f, -1.0f, 1.0f, 1.0f);
+
+	glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_PACK_SKIP_ROWS, 0);
+	glPixelStorei(GL_PACK_SKIP_PIXELS, 0);
+	glReadPixels(0, 0, video->gpu_w, video->gpu_h, GL_RGBA, GL_UNSIGNED_BYTE, to);
+
+	/* read buffer is popped into whichever framebuffer is bound */
+	gl_capture->glUseProgram(program);
+	gl_capture_gpu_restore_fbo(gl_capture, fbo);
+	glPopClientAttrib();
+	glPopAttrib();
+
+	return 0;
+}
+
+int gl_capture_start_readback(gl_capture_t gl_capture)
+{
+	gl_capture->readback_stop = 0;
+	gl_capture->readback_ret = 0;
+	return glc_simple_thread_create(gl_capture->glc, &gl_capture->readback_thread,
+					gl_capture_readback_thread, gl_capture);
+}
+
+int gl_capture_stop_readback(gl_capture_t gl_capture)
+{
+	pthread_mutex_lock(&gl_capture->readback_mutex);
+	gl_capture->readback_stop = 1;
+	pthread_cond_signal(&gl_capture->readback_cond);
+	pthread_mutex_unlock(&gl_capture->readback_mutex);
+
+	return glc_simple_thread_wait(gl_capture->glc, &gl_capture->readback_thread);
+}
+
+void *gl_capture_readback_thread(void *argptr)
+{
+	gl_capture_t gl_capture = (gl_capture_t) argptr;
+	struct gl_capture_readback_s *job;
+	ps_packet_t packet;
+	int ret;
+
+	ps_packet_init(&packet, gl_capture->to);
+
+	pthread_mutex_lock(&gl_capture->readback_mutex);
+	for (;;) {
+		while ((!gl_capture->readback_head) && (!gl_capture->readback_stop))
+			pthread_cond_wait(&gl_capture->readback_cond,
+					  &gl_capture->readback_mutex);
+
+		/* queue is drained before stopping */
+		if (!(job = gl_capture->readback_head))
+			break;
+		if (!(gl_capture->readback_head = job->next))
+			gl_capture->readback_tail = NULL;
+		pthread_mutex_unlock(&gl_capture->readback_mutex);
+
+		ret = gl_capture_write_readback(gl_capture, job, &packet);
+
+		pthread_mutex_lock(&gl_capture->readback_mutex);
+		/* reported from gl_capture_frame() */
+		if (unlikely(ret) && (!gl_capture->readback_ret))
+			gl_capture->readback_ret = ret;
+		job->busy = 0;
+		pthread_cond_broadcast(&gl_capture->readback_done);
+	}
+	pthread_mutex_unlock(&gl_capture->readback_mutex);
+
+	ps_packet_destroy(&packet);
+	return NULL;
+}
+
+int gl_capture_write_readback(gl_capture_t gl_capture, struct gl_capture_readback_s *job,
+			      ps_packet_t *packet)
+{
+	glc_message_header_t msg;
+	glc_video_frame_header_t pic;
+	char *dma;
+	int ret;
+
+	if (unlikely((ret = ps_packet_open(packet,
+				((gl_capture->flags & GL_CAPTURE_LOCK_FPS) ||
+				(gl_capture->flags & GL_CAPTURE_IGNORE_TIME)) ?
+				(PS_PACKET_WRITE) :
+				(PS_PACKET_WRITE | PS_PACKET_TRY)))))
+		goto drop;
+
+	if (unlikely((ret = ps_packet_setsize(packet, job->size
+						+ sizeof(glc_message_header_t)
+						+ sizeof(glc_video_frame_header_t)))))
+		goto cancel;
+
+	msg.type = GLC_MESSAGE_VIDEO_FRAME;
+	if (unlikely((ret = ps_packet_write(packet, &msg, sizeof(glc_message_header_t)))))
+		goto cancel;
+
+	pic.id   = job->id;
+	pic.time = job->time;
+	if (unlikely((ret = ps_packet_write(packet, &pic, sizeof(glc_video_frame_header_t)))))
+		goto cancel;
+
+	if (job->convert) {
+		if (likely(!(ret = ps_packet_dma(packet, (void *) &dma,
+						 job->size, PS_ACCEPT_FAKE_DMA))))
+			ret = ycbcr_convert_frame(gl_capture->ycbcr, job->id, job->buf,
+						  (unsigned char *) dma);
+	} else
+		ret = ps_packet_write(packet, job->buf, job->size);
+	if (unlikely(ret))
+		goto cancel;
+
+	if (unlikely((ret = ps_packet_close(packet))))
+		return ret;
+	glc_metrics_frame_queued(gl_capture->glc, pic.time);
+	return 0;
+cancel:
+	ps_packet_cancel(packet);
+drop:
+	/* opening fails also when buffer is cancelled, like in gl_capture_frame() */
+	if ((ret == EBUSY) || (ret == EINTR)) {
+		if (ret == EBUSY) {
+			glc_log(gl_capture->glc, GLC_INFO, "gl_capture",
+				"dropped frame #%u, buffer not ready", job->frame);
+			glc_metrics_drop(gl_capture->glc, GLC_METRICS_DROP_BUFFER);
+		}
+		ret = 0;
+	}
+	return ret;
+}
+
+/*
+ * Last stream looked up by calling thread. Applications usually
+ * swap a single drawable from their render thread, so most frames
+ * never reach the buckets.
+ */
+static __thread gl_capture_t gl_capture_last_owner
+	__attribute__ ((tls_model ("initial-exec")));
+static __thread struct gl_capture_video_stream_s *gl_capture_last_video
+	__attribute__ ((tls_model ("initial-exec")));
+
+static inline unsigned int gl_capture_bucket(Display *dpy, GLXDrawable drawable)
+{
+	unsigned int key = (unsigned int) drawable ^
+			   (unsigned int) ((uintptr_t) dpy >> 4);
+	return (key * 2654435761u) >> (32 - GL_CAPTURE_BUCKET_BITS);
+}
+
+int gl_capture_find_video_stream(gl_capture_t gl_capture,
+				 struct gl_capture_video_stream_s **video,
+				 Display *dpy, GLXDrawable drawable)
 {
 	struct gl_capture_video_stream_s *fvideo;
+	unsigned int bucket;
 
-	fvideo = gl_capture->video;
+	fvideo = gl_capture_last_video;
+	if (likely((gl_capture_last_owner == gl_capture) &&
+		   (fvideo->drawable == drawable) && (fvideo->dpy == dpy))) {
+		*video = fvideo;
+		return 0;
+	}
+
+	bucket = gl_capture_bucket(dpy, drawable);
+	fvideo = gl_capture->bucket[bucket];
 	while (fvideo != NULL) {
 		if ((fvideo->drawable == drawable) && (fvideo->dpy == dpy))
-			break;
+			goto found;
+		fvideo = fvideo->hnext;
+	}
 
-		fvideo = fvideo->next;
+	pthread_mutex_lock(&gl_capture->mutex);
+
+	/* retest after acquiring the lock */
+	fvideo = gl_capture->bucket[bucket];
+	while (fvideo != NULL) {
+		if ((fvideo->drawable == drawable) && (fvideo->dpy == dpy))
+			break;
+		fvideo = fvideo->hnext;
 	}
 
 	if (fvideo == NULL) {
@@ -749,16 +1782,32 @@ int gl_capture_get_video_stream(gl_capture_t gl_capture,
 
 		glc_state_video_new(gl_capture->glc, &fvideo->id, &fvideo->state_video);
 
-		fvideo->next      = gl_capture->video;
+		fvideo->next  = gl_capture->video;
+		fvideo->hnext = gl_capture->bucket[bucket];
 
-		/* linked list multithread sync RCU style! */
+		/* publish initialized stream to lockless readers */
+		__sync_synchronize();
+		gl_capture->bucket[bucket] = fvideo;
 		gl_capture->video = fvideo;
 	}
-	__sync_or_and_fetch(&fvideo->flags, GLC_VIDEO_CAPTURING);
+
+	pthread_mutex_unlock(&gl_capture->mutex);
+found:
+	gl_capture_last_owner = gl_capture;
+	gl_capture_last_video = fvideo;
 	*video = fvideo;
 	return 0;
 }
 
+int gl_capture_get_video_stream(gl_capture_t gl_capture,
+				struct gl_capture_video_stream_s **video,
+				Display *dpy, GLXDrawable drawable)
+{
+	gl_capture_find_video_stream(gl_capture, video, dpy, drawable);
+	__sync_or_and_fetch(&(*video)->flags, GLC_VIDEO_CAPTURING);
+	return 0;
+}
+
 static inline void gl_capture_release_video_stream(struct gl_capture_video_stream_s *video)
 {
 	__sync_and_and_fetch(&video->flags, ~GLC_VIDEO_CAPTURING);
@@ -806,6 +1855,14 @@ int gl_capture_write_video_format_message(gl_capture_t gl_capture,
 	glc_message_header_t msg;
 	glc_video_format_message_t format_msg;
 
+	/*
+	 * frames in flight have the old format, they are written and
+	 * every readback job is done before size, conversion or ycbcr
+	 * change
+	 */
+	if (video->pbo_depth)
+		gl_capture_destroy_pbo(gl_capture, video);
+
 	gl_capture_calc_geometry(gl_capture, video, w, h);
 
 	glc_log(gl_capture->glc, GLC_INFO, "gl_capture",
@@ -818,6 +1875,31 @@ int gl_capture_write_video_format_message(gl_capture_t gl_capture,
 	format_msg.id     = video->id;
 	format_msg.width  = video->cw;
 	format_msg.height = video->ch;
+	video->size = video->row * video->ch;
+	video->convert = 0;
+	video->gpu = 0;
+	free(video->pixels);
+	video->pixels = NULL;
+
+	if ((gl_capture->flags & GL_CAPTURE_USE_GPU) &&
+	    (!gl_capture_create_gpu(gl_capture, video))) {
+		video->gpu = 1;
+		format_msg.flags &= ~GLC_VIDEO_DWORD_ALIGNED;
+		format_msg.format = GLC_VIDEO_YCBCR_420JPEG;
+		format_msg.width  = video->gpu_w * 4;
+		format_msg.height = video->gpu_h - video->gpu_h / 3;
+		video->size = video->gpu_w * video->gpu_h * 4;
+	} else if (gl_capture->ycbcr) {
+		if (unlikely(ycbcr_convert_format(gl_capture->ycbcr, &format_msg,
+						  &video->size)))
+			glc_log(gl_capture->glc, GLC_WARN, "gl_capture",
+				"can't convert video %d while capturing", video->id);
+
+		if (video->size)
+			video->convert = 1;
+		else
+			video->size = video->row * video->ch;
+	}
 
 	ps_packet_open(&video->packet, PS_PACKET_WRITE);
 	ps_packet_write(&video->packet, &msg, sizeof(glc_message_header_t));
@@ -829,9 +1911,6 @@ int gl_capture_write_video_format_message(gl_capture_t gl_capture,
 		 video->cw, video->ch, video->w, video->h, video->flags);
 
 	if (gl_capture->flags & GL_CAPTURE_USE_PBO) {
-		if (video->pbo)
-			gl_capture_destroy_pbo(gl_capture, video);
-
 		if (gl_capture_create_pbo(gl_capture, video)) {
 			gl_capture->flags &= ~(GL_CAPTURE_TRY_PBO | GL_CAPTURE_USE_PBO);
 			/** \todo destroy pbo stuff? */
@@ -860,6 +1939,40 @@ int gl_capture_update_video_stream(gl_capture_t gl_capture,
 				gl_capture->flags |= GL_CAPTURE_USE_PBO;
 			else
 				gl_capture->flags &= ~GL_CAPTURE_TRY_PBO;
+
+			if ((gl_capture->flags & GL_CAPTURE_USE_PBO) &&
+			    (gl_capture->flags & GL_CAPTURE_ASYNC_READBACK) &&
+			    (!gl_capture->readback_thread.running) &&
+			    (gl_capture_start_readback(gl_capture))) {
+				glc_log(gl_capture->glc, GLC_WARN, "gl_capture",
+					"can't start readback thread, reading PBO in place");
+				gl_capture->flags &= ~GL_CAPTURE_ASYNC_READBACK;
+			}
+
+			if (gl_capture->ycbcr &&
+			    (gl_capture->flags & GL_CAPTURE_ASYNC_READBACK) &&
+			    !(gl_capture->flags & GL_CAPTURE_USE_PBO))
+				glc_log(gl_capture->glc, GLC_WARN, "gl_capture",
+					"no PBO support, converting in application rendering thread");
+		}
+
+		pthread_mutex_unlock(&gl_capture->mutex);
+	}
+
+	/* same for GPU conversion */
+	if (unlikely((!(gl_capture->flags & GL_CAPTURE_USE_GPU)) &&
+	    (gl_capture->flags & GL_CAPTURE_TRY_GPU))) {
+		pthread_mutex_lock(&gl_capture->mutex);
+
+		if (unlikely((!(gl_capture->flags & GL_CAPTURE_USE_GPU)) &&
+			     (gl_capture->flags & GL_CAPTURE_TRY_GPU))) {
+			if (!gl_capture_init_gpu(gl_capture))
+				gl_capture->flags |= GL_CAPTURE_USE_GPU;
+			else {
+				gl_capture->flags &= ~GL_CAPTURE_TRY_GPU;
+				glc_log(gl_capture->glc, GLC_WARN, "gl_capture",
+					"GPU conversion not supported, converting on CPU");
+			}
 		}
 
 		pthread_mutex_unlock(&gl_capture->mutex);
@@ -904,15 +2017,21 @@ int gl_capture_frame(gl_capture_t gl_capture, Display *dpy, GLXDrawable drawable
 	char *dma;
 	int ret = 0;
 
-	spin_lock(&gl_capture->capture_spinlock);
-
-	if (!(gl_capture->flags & GL_CAPTURE_CAPTURING)) {
-		spin_unlock(&gl_capture->capture_spinlock);
+	if (!(gl_capture->flags & GL_CAPTURE_CAPTURING))
 		return 0; /* capturing not active */
-	}
 
 	gl_capture_get_video_stream(gl_capture, &video, dpy, drawable);
-	spin_unlock(&gl_capture->capture_spinlock);
+
+	/*
+	 * Stream is marked capturing with a full barrier before flags
+	 * are tested again. gl_capture_stop() clears capturing before
+	 * waiting on streams so either it waits for this frame or the
+	 * frame sees capturing is stopped.
+	 */
+	if (unlikely(!(gl_capture->flags & GL_CAPTURE_CAPTURING))) {
+		gl_capture_release_video_stream(video);
+		return 0;
+	}
 
 	/* get current time */
 	if (unlikely(gl_capture->flags & GL_CAPTURE_IGNORE_TIME))
@@ -923,8 +2042,10 @@ int gl_capture_frame(gl_capture_t gl_capture, Display *dpy, GLXDrawable drawable
 	/* has gl_capture->fps nanoseconds elapsed since last capture */
 	if ((now - video->last < gl_capture->fps_period) &&
 	    !(gl_capture->flags & GL_CAPTURE_LOCK_FPS) &&
-	    !(gl_capture->flags & GL_CAPTURE_IGNORE_TIME))
+	    !(gl_capture->flags & GL_CAPTURE_IGNORE_TIME)) {
+		glc_metrics_drop(gl_capture->glc, GLC_METRICS_DROP_FPS);
 		goto finish;
+	}
 
 	if (unlikely(video->last && now - video->last > 8*gl_capture->fps_period))
 		glc_log(gl_capture->glc, GLC_WARN, "gl_capture",
@@ -935,22 +2056,43 @@ int gl_capture_frame(gl_capture_t gl_capture, Display *dpy, GLXDrawable drawable
 	gl_capture_update_video_stream(gl_capture, video);
 	video->num_frames++;
 
-	/* if PBO is not active, just start transfer and finish */
-	if (unlikely((gl_capture->flags & GL_CAPTURE_USE_PBO) &&
-	     __sync_bool_compare_and_swap(&video->pbo_active,0,1))) {
-		ret = gl_capture_start_pbo(gl_capture, video);
-		video->pbo_time = now;
-		goto finish;
+	/* copy or conversion is left to readback thread */
+	if ((gl_capture->flags & GL_CAPTURE_USE_PBO) &&
+	    (gl_capture->flags & GL_CAPTURE_ASYNC_READBACK)) {
+		if (video->gather_stats)
+			before_capture = glc_state_time(gl_capture->glc);
+		ret = gl_capture_readback_pbo(gl_capture, video, now);
+		if (video->gather_stats) {
+			after_capture = glc_state_time(gl_capture->glc);
+			video->capture_time_ns += after_capture - before_capture;
+		}
+		goto next;
 	}
 
-	if (unlikely(ps_packet_open(&video->packet,
+	/* with PBO, just queue transfer until oldest one can be read */
+	if ((gl_capture->flags & GL_CAPTURE_USE_PBO) &&
+	    (!gl_capture_pbo_ready(gl_capture, video))) {
+		ret = gl_capture_start_pbo(gl_capture, video, now);
+		goto next;
+	}
+
+	if (unlikely((ret = ps_packet_open(&video->packet,
 				((gl_capture->flags & GL_CAPTURE_LOCK_FPS) ||
 				(gl_capture->flags & GL_CAPTURE_IGNORE_TIME)) ?
 				(PS_PACKET_WRITE) :
-				(PS_PACKET_WRITE | PS_PACKET_TRY))))
+				(PS_PACKET_WRITE | PS_PACKET_TRY))))) {
+		/* failing to open is not an error, buffer can be cancelled */
+		if (ret == EBUSY) {
+			glc_log(gl_capture->glc, GLC_INFO, "gl_capture",
+				"dropped frame #%u, buffer not ready",
+				video->num_frames);
+			glc_metrics_drop(gl_capture->glc, GLC_METRICS_DROP_BUFFER);
+		}
+		ret = 0;
 		goto finish;
+	}
 
-	if (unlikely((ret = ps_packet_setsize(&video->packet, video->row * video->ch
+	if (unlikely((ret = ps_packet_setsize(&video->packet, video->size
 						+ sizeof(glc_message_header_t)
 						+ sizeof(glc_video_frame_header_t)))))
 		goto cancel;
@@ -961,13 +2103,15 @@ int gl_capture_frame(gl_capture_t gl_capture, Display *dpy, GLXDrawable drawable
 		goto cancel;
 
 	/*
-	 * if we are using PBO we will actually write previous picture to buffer.
+	 * if we are using PBO we will actually write oldest queued picture to buffer.
 	 * Also, make sure that pbo_time is not in the future. This could happen if
 	 * the state time is reset by reloading the capture between a pbo start
 	 * and a pbo read.
 	 */
-	pic.time = (gl_capture->flags & GL_CAPTURE_USE_PBO &&
-		    video->pbo_time < now)?video->pbo_time:now;
+	pic.time = now;
+	if ((gl_capture->flags & GL_CAPTURE_USE_PBO) &&
+	    (video->pbo_time[gl_capture_pbo_tail(video)] < now))
+		pic.time = video->pbo_time[gl_capture_pbo_tail(video)];
 	pic.id   = video->id;
 	if (unlikely((ret = ps_packet_write(&video->packet,
 					    &pic, sizeof(glc_video_frame_header_t)))))
@@ -979,14 +2123,24 @@ int gl_capture_frame(gl_capture_t gl_capture, Display *dpy, GLXDrawable drawable
 		if (unlikely((ret = gl_capture_read_pbo(gl_capture, video))))
 			goto cancel;
 
-		ret = gl_capture_start_pbo(gl_capture, video);
-		video->pbo_time = now;
+		ret = gl_capture_start_pbo(gl_capture, video, now);
 	} else {
 		if (unlikely((ret = ps_packet_dma(&video->packet, (void *) &dma,
-					video->row * video->ch, PS_ACCEPT_FAKE_DMA))))
+					video->size, PS_ACCEPT_FAKE_DMA))))
 			goto cancel;
 
-		ret = gl_capture_get_pixels(gl_capture, video, dma);
+		if (video->convert) {
+			if (unlikely((!video->pixels) &&
+				     (!(video->pixels = malloc(video->row * video->ch))))) {
+				ret = ENOMEM;
+				goto cancel;
+			}
+
+			gl_capture_get_pixels(gl_capture, video, (char *) video->pixels);
+			ret = ycbcr_convert_frame(gl_capture->ycbcr, video->id,
+						  video->pixels, (unsigned char *) dma);
+		} else
+			ret = gl_capture_get_pixels(gl_capture, video, dma);
 	}
 	if (video->gather_stats) {
 		after_capture = glc_state_time(gl_capture->glc);
@@ -994,7 +2148,9 @@ int gl_capture_frame(gl_capture_t gl_capture, Display *dpy, GLXDrawable drawable
 	}
 
 	ps_packet_close(&video->packet);
+	glc_metrics_frame_queued(gl_capture->glc, pic.time);
 	video->num_captured_frames++;
+next:
 	now = glc_state_time(gl_capture->glc);
 
 	if (unlikely((gl_capture->flags & GL_CAPTURE_LOCK_FPS) &&
@@ -1026,6 +2182,7 @@ cancel:
 		glc_log(gl_capture->glc, GLC_INFO, "gl_capture",
 			"dropped frame #%u, buffer not ready",
 			video->num_frames);
+		glc_metrics_drop(gl_capture->glc, GLC_METRICS_DROP_BUFFER);
 	}
 	ps_packet_cancel(&video->packet);
 	goto finish;
@@ -1105,7 +2262,7 @@ int gl_capture_set_attribute_window(gl_capture_t gl_capture, Display *dpy,
 				    GLXDrawable drawable, Window window)
 {
 	struct gl_capture_video_stream_s *video;
-	gl_capture_get_video_stream(gl_capture, &video, dpy, drawable);
+	gl_capture_find_video_stream(gl_capture, &video, dpy, drawable);
 
 	glc_log(gl_capture->glc, GLC_INFO, "gl_capture",
 		"setting attribute window %p for drawable %p",
@@ -20,6 +20,7 @@
 #include <GL/glx.h>
 #include <packetstream.h>
 #include <glc/common/glc.h>
+#include <glc/core/ycbcr.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -48,6 +49,20 @@ __PUBLIC int gl_capture_init(gl_capture_t *gl_capture, glc_t *glc);
  */
 __PUBLIC int gl_capture_set_buffer(gl_capture_t gl_capture, ps_buffer_t *buffer);
 
+/**
+ * \brief convert frames to Y'CbCr while capturing
+ *
+ * Captured pixels are converted (and scaled) straight from
+ * read back memory into target buffer in capturing thread.
+ * This saves a full frame copy through an intermediate buffer
+ * and separate ycbcr thread.
+ * \param gl_capture gl_capture object
+ * \param ycbcr ycbcr object used with ycbcr_convert_frame(),
+ *              must not be started
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_set_ycbcr(gl_capture_t gl_capture, ycbcr_t ycbcr);
+
 /**
  * \brief set OpenGL read buffer for capturing
  *
@@ -84,6 +99,55 @@ __PUBLIC int gl_capture_set_pack_alignment(gl_capture_t gl_capture,
  */
 __PUBLIC int gl_capture_try_pbo(gl_capture_t gl_capture, int try_pbo);
 
+/**
+ * \brief convert to Y'CbCr on GPU
+ *
+ * Capture area is copied to a texture and drawn scaled and
+ * converted to 420jpeg into a framebuffer object with a fragment
+ * shader, so only the converted frame is read back. Needs OpenGL
+ * 2.0 and framebuffer objects, otherwise frames are converted
+ * with the ycbcr object given to gl_capture_set_ycbcr().
+ * \param gl_capture gl_capture object
+ * \param try_gpu 1 means gl_capture tries to convert on GPU,
+ *                0 disables it, default
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_try_gpu(gl_capture_t gl_capture, int try_gpu);
+
+/**
+ * \brief set scale factor of GPU conversion
+ * \param gl_capture gl_capture object
+ * \param scale scale factor, default is 1.0
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_set_scale(gl_capture_t gl_capture, double scale);
+
+/**
+ * \brief set PBO ring depth
+ *
+ * With PBO, up to depth frames are transferred asynchronously.
+ * A frame is read back as soon as GL_ARB_sync reports its
+ * transfer done, or when the ring is full. Deeper ring means
+ * less stalls on busy GPU but more latency and video memory.
+ * \param gl_capture gl_capture object
+ * \param depth number of PBOs per video stream, 1 to 8, default is 3
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_set_pbo_depth(gl_capture_t gl_capture, unsigned int depth);
+
+/**
+ * \brief read back PBOs in a separate thread
+ *
+ * Finished PBO transfers are kept mapped and handed over to a
+ * readback thread which copies or converts them into target
+ * buffer, so application rendering thread only issues GL calls.
+ * Mapping is released on a later frame, once readback is done.
+ * \param gl_capture gl_capture object
+ * \param async_readback 1 enables readback thread, default is 0
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int gl_capture_async_readback(gl_capture_t gl_capture, int async_readback);
+
 /**
  * \brief set pixel format
  *
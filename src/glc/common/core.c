@@ -29,15 +29,20 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <time.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
 
 #include "glc.h"
 #include "core.h"
 #include "log.h"
 #include "util.h"
+#include "metrics.h"
 #include "optimization.h"
 
 struct glc_core_s {
@@ -45,9 +50,21 @@ struct glc_core_s {
 	long int single_process_num;
 	long int multi_process_num;
 	long int threads_hint;
+	long int frame_threads;
 	int      allow_rt;
+	glc_flags_t simd;
+
+	/* processors glc threads are pinned to */
+	int       affinity_set;
+	cpu_set_t affinity;
 };
 
+static glc_flags_t glc_simd_detect();
+static int glc_parse_cpu_list(const char *list, cpu_set_t *set);
+static int glc_read_cpu_list(const char *path, cpu_set_t *set);
+static int glc_node_cpus(long int node, long int cpu, cpu_set_t *set);
+static int glc_llc_cpus(long int cpu, cpu_set_t *set);
+
 const char *glc_version()
 {
 	return GLC_VERSION;
@@ -62,15 +79,20 @@ int glc_init(glc_t *glc)
 	glc->state = NULL;
 	glc->util  = NULL;
 	glc->log   = NULL;
+	glc->metrics = NULL;
 
 	glc->core = (glc_core_t) calloc(1, sizeof(struct glc_core_s));
 
 	clock_gettime(CLOCK_MONOTONIC, &glc->core->init_time);
 
 	glc->core->threads_hint = 1; /* safe conservative default value */
+	glc->core->frame_threads = 1;
+	glc->core->simd = glc_simd_detect();
 
 	if (unlikely((ret = glc_log_init(glc))))
 		return ret;
+	if (unlikely((ret = glc_metrics_init(glc))))
+		return ret;
 	ret = glc_util_init(glc);
 	return ret;
 }
@@ -78,6 +100,7 @@ int glc_init(glc_t *glc)
 int glc_destroy(glc_t *glc)
 {
 	glc_util_destroy(glc);
+	glc_metrics_destroy(glc);
 	glc_log_destroy(glc);
 
 	free(glc->core);
@@ -87,6 +110,7 @@ int glc_destroy(glc_t *glc)
 	glc->state = NULL;
 	glc->util = NULL;
 	glc->log = NULL;
+	glc->metrics = NULL;
 
 	return 0;
 }
@@ -121,6 +145,19 @@ int glc_set_threads_hint(glc_t *glc, long int count)
 	return 0;
 }
 
+long int glc_frame_threads(glc_t *glc)
+{
+	return glc->core->frame_threads;
+}
+
+int glc_set_frame_threads(glc_t *glc, long int count)
+{
+	if (unlikely(count <= 0))
+		return EINVAL;
+	glc->core->frame_threads = count;
+	return 0;
+}
+
 void glc_account_threads(glc_t *glc, long int single, long int multi)
 {
 	glc->core->single_process_num += single;
@@ -134,7 +171,11 @@ void glc_compute_threads_hint(glc_t *glc)
 		divisor = glc->core->multi_process_num; /* Avoid division by 0 */
 	else
 		divisor = 1;
-	glc->core->threads_hint  = sysconf(_SC_NPROCESSORS_ONLN) - glc->core->single_process_num;
+	if (glc->core->affinity_set)
+		glc->core->threads_hint = CPU_COUNT(&glc->core->affinity);
+	else
+		glc->core->threads_hint = sysconf(_SC_NPROCESSORS_ONLN);
+	glc->core->threads_hint -= glc->core->single_process_num;
 	glc->core->threads_hint /= divisor;
 	if (unlikely(glc->core->threads_hint <  1))
 		glc->core->threads_hint = 1;
@@ -154,4 +195,309 @@ int glc_allow_rt(glc_t *glc)
 	return glc->core->allow_rt;
 }
 
+/* parses processor list like "0-3,8" into set */
+int glc_parse_cpu_list(const char *list, cpu_set_t *set)
+{
+	unsigned long first, last;
+	char *end;
+
+	CPU_ZERO(set);
+	while (*list) {
+		first = last = strtoul(list, &end, 10);
+		if (unlikely(end == list))
+			return EINVAL;
+		if (*end == '-') {
+			list = end + 1;
+			last = strtoul(list, &end, 10);
+			if (unlikely((end == list) || (last < first)))
+				return EINVAL;
+		}
+		if (unlikely(last >= CPU_SETSIZE))
+			return EINVAL;
+		for (; first <= last; first++)
+			CPU_SET(first, set);
+
+		list = end;
+		if (*list == ',')
+			list++;
+		else if ((*list) && (*list != '\n'))
+			return EINVAL;
+		else
+			break;
+	}
+
+	return 0;
+}
+
+int glc_read_cpu_list(const char *path, cpu_set_t *set)
+{
+	char list[1024];
+	FILE *file;
+
+	if (unlikely(!(file = fopen(path, "r"))))
+		return errno;
+	if (unlikely(!fgets(list, sizeof(list), file))) {
+		fclose(file);
+		return EINVAL;
+	}
+	fclose(file);
+
+	return glc_parse_cpu_list(list, set);
+}
+
+/* processors of NUMA node or, without cpu, node itself */
+int glc_node_cpus(long int node, long int cpu, cpu_set_t *set)
+{
+	char path[128];
+	struct dirent *ent;
+	DIR *dir;
+
+	if (cpu >= 0) {
+		/* node of cpu is a nodeN entry in its sysfs directory */
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld", cpu);
+		if (unlikely(!(dir = opendir(path))))
+			return errno;
+		while ((ent = readdir(dir))) {
+			if ((!strncmp(ent->d_name, "node", 4)) &&
+			    (sscanf(ent->d_name + 4, "%ld", &node) == 1))
+				break;
+		}
+		closedir(dir);
+		if (unlikely(!ent))
+			return ENOENT;
+	}
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%ld/cpulist", node);
+	return glc_read_cpu_list(path, set);
+}
+
+/* processors sharing the highest level cache of cpu */
+int glc_llc_cpus(long int cpu, cpu_set_t *set)
+{
+	char path[128];
+	int index;
+
+	for (index = 3; index >= 0; index--) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%ld/cache/index%d/shared_cpu_list",
+			 cpu, index);
+		if (!glc_read_cpu_list(path, set))
+			return 0;
+	}
+
+	return ENOENT;
+}
+
+int glc_set_affinity(glc_t *glc, const char *policy, const char *avoid)
+{
+	cpu_set_t set, skip;
+	long int id = -1;
+	size_t len = 0;
+	int cpu = sched_getcpu();
+	char *end;
+	int ret = 0;
+
+	glc->core->affinity_set = 0;
+	if ((!policy) || (!strcmp(policy, "none")))
+		return 0;
+
+	if (!strncmp(policy, "node", 4))
+		len = 4;
+	else if (!strncmp(policy, "llc", 3))
+		len = 3;
+
+	/* exactly node, llc, or followed by ':' and a number */
+	if (len && (policy[len] == ':')) {
+		if (unlikely((policy[len + 1] < '0') || (policy[len + 1] > '9')))
+			ret = EINVAL;
+		else {
+			id = strtol(&policy[len + 1], &end, 10);
+			if (unlikely(*end))
+				ret = EINVAL;
+		}
+	} else if (unlikely(len && policy[len]))
+		ret = EINVAL;
+
+	/* without a number, domain of calling thread's processor */
+	if ((!ret) && (len == 4))
+		ret = glc_node_cpus(id, (id < 0) ? cpu : -1, &set);
+	else if ((!ret) && (len == 3))
+		ret = glc_llc_cpus((id < 0) ? cpu : id, &set);
+	else if (!ret)
+		ret = glc_parse_cpu_list(policy, &set);
+
+	/* stay within what process was allowed, like with taskset */
+	if ((!ret) && (!sched_getaffinity(0, sizeof(cpu_set_t), &skip)))
+		CPU_AND(&set, &set, &skip);
+	if ((!ret) && (!CPU_COUNT(&set)))
+		ret = EINVAL;
+
+	if (unlikely(ret)) {
+		glc_log(glc, GLC_ERROR, "core", "can't apply affinity '%s': %s (%d)",
+			policy, strerror(ret), ret);
+		return ret;
+	}
+
+	/* sched_getcpu() can fail, there is then no current processor */
+	if (avoid && (!strcmp(avoid, "current")) && unlikely(cpu < 0)) {
+		glc_log(glc, GLC_WARN, "core",
+			"can't tell current processor, not avoiding it");
+		avoid = NULL;
+	}
+
+	if (avoid) {
+		if (!strcmp(avoid, "current")) {
+			CPU_ZERO(&skip);
+			CPU_SET(cpu, &skip);
+		} else if (unlikely(glc_parse_cpu_list(avoid, &skip))) {
+			glc_log(glc, GLC_ERROR, "core", "invalid processor list '%s'", avoid);
+			return EINVAL;
+		}
+
+		/* when nothing is left, avoiding is given up */
+		CPU_XOR(&skip, &skip, &set);
+		CPU_AND(&skip, &skip, &set);
+		if (CPU_COUNT(&skip))
+			set = skip;
+		else
+			glc_log(glc, GLC_WARN, "core",
+				"no processor left for '%s' when avoiding '%s'", policy, avoid);
+	}
+
+	glc->core->affinity = set;
+	glc->core->affinity_set = 1;
+	glc_log(glc, GLC_INFO, "core",
+		"threads are pinned to %d processors (%s), set up on processor %d",
+		CPU_COUNT(&set), policy, cpu);
+	return 0;
+}
+
+int glc_apply_affinity(glc_t *glc)
+{
+	int ret;
+
+	if (!glc->core->affinity_set)
+		return 0;
+
+	if (unlikely((ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+						   &glc->core->affinity))))
+		glc_log(glc, GLC_WARN, "core", "can't set thread affinity: %s (%d)",
+			strerror(ret), ret);
+	return ret;
+}
+
+glc_flags_t glc_simd_detect()
+{
+	glc_flags_t simd = 0;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		simd |= GLC_SIMD_SSE2;
+	if (__builtin_cpu_supports("ssse3"))
+		simd |= GLC_SIMD_SSSE3;
+	if (__builtin_cpu_supports("avx2"))
+		simd |= GLC_SIMD_AVX2;
+#endif
+	return simd;
+}
+
+glc_flags_t glc_simd(glc_t *glc)
+{
+	return glc->core->simd;
+}
+
+void glc_set_simd_mask(glc_t *glc, glc_flags_t mask)
+{
+	glc->core->simd = glc_simd_detect() & mask;
+}
+
+/*
+ * Same pattern for every module, bytes i with i % 29 < 6 are
+ * saturated and make BGR pixels pure blue where they line up.
+ */
+static void glc_simd_test_fill(unsigned char *from, size_t size)
+{
+	unsigned int seed = 1;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		from[i] = (i % 29 < 6) ? ((i % 3) ? 0 : 255) : (seed >> 16);
+	}
+}
+
+const void *glc_simd_select(glc_t *glc, const char *module,
+			    const void *table, size_t entry_size,
+			    const void *fallback, glc_simd_test_func_t func,
+			    void *ptr, size_t from_size, size_t out_size)
+{
+	glc_flags_t simd = glc_simd(glc);
+	const glc_simd_kernels_t *k;
+	const void *selected = fallback;
+	glc_simd_test_t test;
+
+	memset(&test, 0, sizeof(glc_simd_test_t));
+	test.glc = glc;
+	test.module = module;
+	test.from_size = from_size;
+	test.out_size = out_size;
+
+	for (k = table; k->name != NULL;
+	     k = (const glc_simd_kernels_t *) ((const char *) k + entry_size)) {
+		if (!(simd & k->simd))
+			continue;
+
+		/* buffers only for cpus with something to test */
+		if (!test.from) {
+			test.from = malloc(from_size);
+			test.ref = malloc(out_size);
+			test.out = malloc(out_size);
+			if (unlikely((!test.from) || (!test.ref) || (!test.out))) {
+				glc_log(glc, GLC_WARN, module,
+					"can't allocate kernel self-test, SIMD kernels disabled");
+				break;
+			}
+			glc_simd_test_fill(test.from, from_size);
+		}
+
+		test.kernels = k->name;
+		test.check = 0;
+		if (unlikely(func(ptr, k, &test))) {
+			glc_log(glc, GLC_WARN, module,
+				"%s kernels don't match reference conversion, disabled",
+				k->name);
+			continue;
+		}
+		selected = k;
+		break;
+	}
+
+	if (selected)
+		glc_log(glc, GLC_DEBUG, module, "using %s kernels",
+			((const glc_simd_kernels_t *) selected)->name);
+
+	free(test.out);
+	free(test.ref);
+	free(test.from);
+	return selected;
+}
+
+int glc_simd_test_compare(glc_simd_test_t *test, const void *ref,
+			  const void *out, size_t size)
+{
+	const unsigned char *r = ref, *o = out;
+	size_t i;
+
+	test->check++;
+	for (i = 0; i < size; i++) {
+		if (r[i] == o[i])
+			continue;
+		glc_log(test->glc, GLC_DEBUG, test->module,
+			"%s: check %u: byte %zd is %u, expected %u",
+			test->kernels, test->check, i, o[i], r[i]);
+		return EINVAL;
+	}
+	return 0;
+}
+
 /**  \} */
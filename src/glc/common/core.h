@@ -97,6 +97,26 @@ __PUBLIC long int glc_threads_hint(glc_t *glc);
  */
 __PUBLIC int glc_set_threads_hint(glc_t *glc, long int count);
 
+/**
+ * \brief intra-frame thread count
+ *
+ * Video filters split each frame into horizontal bands processed
+ * by this many threads (see glc_band_pool_t). They then process
+ * one frame at a time instead of glc_threads_hint() frames in
+ * parallel. Default is 1 which disables band processing.
+ * \param glc glc
+ * \return threads working on one frame
+ */
+__PUBLIC long int glc_frame_threads(glc_t *glc);
+
+/**
+ * \brief set intra-frame thread count
+ * \param glc glc
+ * \param count threads working on one frame
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_set_frame_threads(glc_t *glc, long int count);
+
 __PUBLIC void glc_account_threads(glc_t *glc, long int single, long int multi);
 
 __PUBLIC void glc_compute_threads_hint(glc_t *glc);
@@ -104,6 +124,130 @@ __PUBLIC void glc_compute_threads_hint(glc_t *glc);
 __PUBLIC void glc_set_allow_rt(glc_t *glc, int allow);
 __PUBLIC int glc_allow_rt(glc_t *glc);
 
+/**
+ * \brief pin glc threads to a set of processors
+ *
+ * Policy is "none", "node" or "llc" for the NUMA node or last
+ * level cache domain of calling thread's processor, "node:N" for
+ * node N, "llc:N" for the cache domain of processor N, or a list
+ * of processors like "0-3,8". All stages share the set so frames
+ * stay in one node or cache between producer and consumer.
+ * glc_compute_threads_hint() then counts only processors of the set.
+ * Calling thread's processor is read once, by this call.
+ * \param glc glc
+ * \param policy placement policy, NULL is "none"
+ * \param avoid processor list left to application, "current"
+ *              for calling thread's processor, or NULL
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_set_affinity(glc_t *glc, const char *policy, const char *avoid);
+
+/**
+ * \brief pin calling thread according to glc_set_affinity()
+ * \param glc glc
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_apply_affinity(glc_t *glc);
+
+/** SSE2 kernels are usable */
+#define GLC_SIMD_SSE2                     0x1
+/** SSSE3 kernels are usable */
+#define GLC_SIMD_SSSE3                    0x2
+/** AVX2 kernels are usable */
+#define GLC_SIMD_AVX2                     0x4
+
+/**
+ * \brief usable SIMD instruction sets
+ *
+ * Processing filters use this to pick their kernels at runtime.
+ * Returned value is what the cpu supports filtered by the mask
+ * set with glc_set_simd_mask().
+ * \param glc glc
+ * \return GLC_SIMD_* flags
+ */
+__PUBLIC glc_flags_t glc_simd(glc_t *glc);
+
+/**
+ * \brief restrict usable SIMD instruction sets
+ *
+ * Default mask allows everything the cpu supports.
+ * \param glc glc
+ * \param mask GLC_SIMD_* flags allowed
+ */
+__PUBLIC void glc_set_simd_mask(glc_t *glc, glc_flags_t mask);
+
+/**
+ * \brief kernel set
+ *
+ * Filters keep their SIMD kernels in tables of structures starting
+ * with these members, best set first and ended by a NULL name.
+ */
+typedef struct {
+	/** name used in log messages */
+	const char *name;
+	/** GLC_SIMD_* flags the kernels need */
+	glc_flags_t simd;
+} glc_simd_kernels_t;
+
+/**
+ * \brief kernel self-test buffers
+ *
+ * from is filled with a fixed pseudo-random pattern with runs of
+ * saturated bytes, ref and out are scratch for the scalar and the
+ * tested results.
+ */
+typedef struct {
+	glc_t *glc;
+	const char *module;
+	const char *kernels;
+	unsigned char *from, *ref, *out;
+	size_t from_size, out_size;
+	/** comparisons done so far, identifies the failing one */
+	unsigned int check;
+} glc_simd_test_t;
+
+/**
+ * \brief kernel self-test callback
+ * \param ptr argument given to glc_simd_select()
+ * \param kernels table entry to test
+ * \param test test buffers
+ * \return 0 if kernels match the scalar code otherwise an error code
+ */
+typedef int (*glc_simd_test_func_t)(void *ptr, const void *kernels,
+				    glc_simd_test_t *test);
+
+/**
+ * \brief pick the first usable kernel set passing its self-test
+ *
+ * Sets needing instructions glc_simd() doesn't allow are skipped,
+ * sets failing the test are disabled with a warning.
+ * \param glc glc
+ * \param module module name for log messages
+ * \param table kernel sets, see glc_simd_kernels_t
+ * \param entry_size size of a table entry
+ * \param fallback returned when no set is usable, can be NULL
+ * \param func self-test
+ * \param ptr argument passed to func
+ * \param from_size size of test source
+ * \param out_size size of test results
+ * \return selected table entry or fallback
+ */
+__PUBLIC const void *glc_simd_select(glc_t *glc, const char *module,
+				     const void *table, size_t entry_size,
+				     const void *fallback, glc_simd_test_func_t func,
+				     void *ptr, size_t from_size, size_t out_size);
+
+/**
+ * \brief compare scalar and tested kernel results
+ * \param test test buffers
+ * \param ref scalar result
+ * \param out tested kernels result
+ * \param size bytes to compare
+ * \return 0 if equal, EINVAL otherwise
+ */
+__PUBLIC int glc_simd_test_compare(glc_simd_test_t *test, const void *ref,
+				   const void *out, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
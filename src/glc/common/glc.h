@@ -118,6 +118,8 @@ typedef struct glc_util_s* glc_util_t;
 typedef struct glc_log_s* glc_log_t;
 /** glc state */
 typedef struct glc_state_s* glc_state_t;
+/** glc metrics */
+typedef struct glc_metrics_s* glc_metrics_t;
 
 /**
  * \brief glc structure
@@ -131,6 +133,8 @@ typedef struct {
 	glc_log_t log;
 	/** state internal structure */
 	glc_state_t state;
+	/** metrics registry */
+	glc_metrics_t metrics;
 	/** state flags */
 	glc_flags_t state_flags;
 } glc_t;
@@ -208,6 +212,16 @@ typedef u_int8_t glc_message_type_t;
 #define GLC_MESSAGE_LZJB               0x0a
 /** callback request */
 #define GLC_CALLBACK_REQUEST           0x0b
+/** lz4-compressed packet */
+#define GLC_MESSAGE_LZ4                0x0c
+/** zstd-compressed packet */
+#define GLC_MESSAGE_ZSTD               0x0d
+/** video frame, reference for following delta frames */
+#define GLC_MESSAGE_VIDEO_KEYFRAME     0x0e
+/** video frame XORed with previous frame of same stream */
+#define GLC_MESSAGE_VIDEO_DELTA        0x0f
+/** packet compressed in independent tiles */
+#define GLC_MESSAGE_TILES              0x10
 
 /**
  * \brief stream message header
@@ -247,6 +261,43 @@ typedef struct {
 	glc_message_header_t header;
 } __attribute__((packed)) glc_lzjb_header_t;
 
+/**
+ * \brief lz4-compressed message header
+ */
+typedef struct {
+	/** uncompressed data size */
+	glc_size_t size;
+	/** original message header */
+	glc_message_header_t header;
+} __attribute__((packed)) glc_lz4_header_t;
+
+/**
+ * \brief zstd-compressed message header
+ */
+typedef struct {
+	/** uncompressed data size */
+	glc_size_t size;
+	/** original message header */
+	glc_message_header_t header;
+} __attribute__((packed)) glc_zstd_header_t;
+
+/**
+ * \brief tiled message header
+ *
+ * Followed by one container message per tile, each holding
+ * a compressed tile_size bytes slice of the original message.
+ */
+typedef struct {
+	/** uncompressed data size */
+	glc_size_t size;
+	/** original message header */
+	glc_message_header_t header;
+	/** number of tiles */
+	u_int32_t tiles;
+	/** uncompressed tile size, last tile can be smaller */
+	glc_size_t tile_size;
+} __attribute__((packed)) glc_tiles_header_t;
+
 /** video format type */
 typedef u_int8_t glc_video_format_t;
 /** 24bit BGR, last row first */
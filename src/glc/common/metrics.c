@@ -0,0 +1,758 @@
+/**
+ * \file glc/common/metrics.c
+ * \brief pipeline metrics registry
+ * \author agent <agent@local>
+ * \date 2026
+
+    Copyright 2026 agent
+
+    This file is part of glcs.
+
+    glcs is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    glcs is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with glcs.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+/**
+ * \addtogroup metrics
+ *  \{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "glc.h"
+#include "core.h"
+#include "log.h"
+#include "thread.h"
+#include "state.h"
+#include "metrics.h"
+#include "optimization.h"
+
+/**
+ * \brief latency histogram
+ */
+struct glc_metrics_timer_s {
+	u_int64_t count;
+	u_int64_t sum;
+	u_int64_t max;
+	u_int64_t bucket[GLC_METRICS_BUCKETS];
+};
+
+/**
+ * \brief message counter
+ */
+struct glc_metrics_type_s {
+	u_int64_t count;
+	u_int64_t bytes;
+};
+
+/*
+ * Shards are written by their thread only and read without
+ * locking by the dump, aligned to not share cache lines.
+ */
+struct glc_metrics_shard_s {
+	struct glc_metrics_type_s type[GLC_METRICS_TYPES];
+	struct glc_metrics_timer_s timer[GLC_METRICS_TIMERS];
+} __attribute__ ((aligned (64)));
+
+/**
+ * \brief registered stage
+ */
+struct glc_metrics_stage_s {
+	const char *name;
+	int active;
+
+	size_t shards;
+	struct glc_metrics_shard_s *storage;
+	glc_metrics_shard_t *shard;
+
+	/** counters of previous runs of the stage */
+	struct glc_metrics_shard_s base;
+	/** totals at previous dump */
+	struct glc_metrics_shard_s last;
+
+	struct glc_metrics_stage_s *next;
+};
+
+/** capture to packet close */
+#define GLC_METRICS_LATENCY_CAPTURE           0
+/** packet close to sink */
+#define GLC_METRICS_LATENCY_PIPELINE          1
+/** capture to sink */
+#define GLC_METRICS_LATENCY_TOTAL             2
+#define GLC_METRICS_LATENCIES                 3
+
+/**
+ * \brief traced frame, in glc_time()
+ */
+struct glc_metrics_trace_s {
+	glc_utime_t capture;
+	glc_utime_t queue;
+};
+
+struct glc_metrics_s {
+	int enabled;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	glc_simple_thread_t thread;
+	int stop;
+	glc_utime_t interval;
+	glc_utime_t last_dump;
+
+	FILE *stream;
+	struct glc_metrics_stage_s *stage;
+
+	/*
+	 * Frames leave the pipeline in the order they entered it, so
+	 * trace is a fifo. Capture threads are application threads,
+	 * trace has its own lock to never wait on a dump. Once trace
+	 * is full, frames are only counted in untraced_pending until
+	 * it is drained: queued frames are always the traced ones
+	 * followed by the untraced ones.
+	 */
+	pthread_mutex_t trace_mutex;
+	struct glc_metrics_trace_s *trace;
+	unsigned int trace_head, trace_count;
+	u_int64_t untraced, untraced_pending;
+	struct glc_metrics_timer_s latency[GLC_METRICS_LATENCIES];
+	struct glc_metrics_timer_s last_latency[GLC_METRICS_LATENCIES];
+
+	u_int64_t drop[GLC_METRICS_DROPS];
+	u_int64_t last_drop[GLC_METRICS_DROPS];
+};
+
+static const char *glc_metrics_timer_name[GLC_METRICS_TIMERS] = {
+	"open", "header", "read", "write", "close", "wait_in", "wait_out"
+};
+
+static const char *glc_metrics_latency_name[GLC_METRICS_LATENCIES] = {
+	"capture", "pipeline", "total"
+};
+
+static const char *glc_metrics_drop_name[GLC_METRICS_DROPS] = {
+	"buffer", "fps", "pipe", "audio"
+};
+
+static void *glc_metrics_thread(void *argptr);
+static void glc_metrics_timer_add(struct glc_metrics_timer_s *timer, glc_utime_t ns);
+static double glc_metrics_percentile(const struct glc_metrics_timer_s *timer,
+				     const struct glc_metrics_timer_s *last, double q);
+static int glc_metrics_is_video(const glc_message_header_t *header, const char *data);
+static void glc_metrics_add(struct glc_metrics_shard_s *to,
+			    const struct glc_metrics_shard_s *from);
+static void glc_metrics_total(struct glc_metrics_stage_s *stage,
+			      struct glc_metrics_shard_s *total);
+static void glc_metrics_log_stage(glc_t *glc, struct glc_metrics_stage_s *stage,
+				  const struct glc_metrics_shard_s *total, glc_utime_t elapsed);
+static void glc_metrics_write_stage(FILE *stream, struct glc_metrics_stage_s *stage,
+				    const struct glc_metrics_shard_s *total);
+static void glc_metrics_log_frames(glc_t *glc, const struct glc_metrics_timer_s *latency,
+				   const u_int64_t *drop, glc_utime_t elapsed);
+static void glc_metrics_write_frames(FILE *stream, const struct glc_metrics_timer_s *latency,
+				     const u_int64_t *drop, u_int64_t untraced);
+static void glc_metrics_write_timer(FILE *stream, const char *name,
+				    const struct glc_metrics_timer_s *timer);
+
+int glc_metrics_init(glc_t *glc)
+{
+	pthread_condattr_t attr;
+
+	if (unlikely(!(glc->metrics = (glc_metrics_t)
+		calloc(1, sizeof(struct glc_metrics_s)))))
+		return ENOMEM;
+
+	pthread_mutex_init(&glc->metrics->mutex, NULL);
+	pthread_mutex_init(&glc->metrics->trace_mutex, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&glc->metrics->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	return 0;
+}
+
+int glc_metrics_destroy(glc_t *glc)
+{
+	struct glc_metrics_stage_s *del;
+
+	if (glc->metrics->enabled)
+		glc_metrics_stop(glc);
+
+	while (glc->metrics->stage != NULL) {
+		del = glc->metrics->stage;
+		glc->metrics->stage = del->next;
+
+		free(del->storage);
+		free(del->shard);
+		free(del);
+	}
+
+	free(glc->metrics->trace);
+	pthread_cond_destroy(&glc->metrics->cond);
+	pthread_mutex_destroy(&glc->metrics->trace_mutex);
+	pthread_mutex_destroy(&glc->metrics->mutex);
+	free(glc->metrics);
+	glc->metrics = NULL;
+	return 0;
+}
+
+int glc_metrics_open_file(glc_t *glc, const char *filename)
+{
+	FILE *stream = fopen(filename, "w");
+	if (unlikely(!stream))
+		return errno;
+
+	pthread_mutex_lock(&glc->metrics->mutex);
+	if (glc->metrics->stream)
+		fclose(glc->metrics->stream);
+	glc->metrics->stream = stream;
+	pthread_mutex_unlock(&glc->metrics->mutex);
+
+	glc_log(glc, GLC_INFO, "metrics", "opened %s for metrics", filename);
+	return 0;
+}
+
+int glc_metrics_start(glc_t *glc, glc_utime_t interval)
+{
+	int ret;
+
+	if (unlikely(glc->metrics->enabled))
+		return EAGAIN;
+
+	if ((!glc->metrics->trace) &&
+	    (unlikely(!(glc->metrics->trace = (struct glc_metrics_trace_s *)
+		malloc(sizeof(struct glc_metrics_trace_s) * GLC_METRICS_TRACE)))))
+		return ENOMEM;
+	glc->metrics->trace_head  = 0;
+	glc->metrics->trace_count = 0;
+	glc->metrics->untraced_pending = 0;
+
+	glc->metrics->interval  = interval;
+	glc->metrics->last_dump = glc_time(glc);
+	glc->metrics->stop      = 0;
+	glc->metrics->enabled   = 1;
+
+	if (interval) {
+		if (unlikely((ret = glc_simple_thread_create(glc, &glc->metrics->thread,
+							     glc_metrics_thread, glc))))
+			return ret;
+	}
+
+	glc_log(glc, GLC_INFO, "metrics", "collecting metrics, dump interval %" PRIu64 " ms",
+		interval / 1000000);
+	return 0;
+}
+
+int glc_metrics_stop(glc_t *glc)
+{
+	if (unlikely(!glc->metrics->enabled))
+		return EAGAIN;
+
+	if (glc->metrics->thread.running) {
+		pthread_mutex_lock(&glc->metrics->mutex);
+		glc->metrics->stop = 1;
+		pthread_cond_signal(&glc->metrics->cond);
+		pthread_mutex_unlock(&glc->metrics->mutex);
+		glc_simple_thread_wait(glc, &glc->metrics->thread);
+	}
+
+	glc_metrics_dump(glc);
+	glc->metrics->enabled = 0;
+
+	if (glc->metrics->stream) {
+		fclose(glc->metrics->stream);
+		glc->metrics->stream = NULL;
+	}
+	return 0;
+}
+
+int glc_metrics_enabled(glc_t *glc)
+{
+	return glc->metrics->enabled;
+}
+
+int glc_metrics_dump(glc_t *glc)
+{
+	struct glc_metrics_stage_s *stage;
+	struct glc_metrics_shard_s total;
+	struct glc_metrics_timer_s latency[GLC_METRICS_LATENCIES];
+	u_int64_t drop[GLC_METRICS_DROPS], untraced;
+	glc_utime_t now, elapsed;
+	unsigned int i;
+	int first = 1;
+
+	pthread_mutex_lock(&glc->metrics->mutex);
+	now = glc_time(glc);
+	elapsed = now - glc->metrics->last_dump;
+	glc->metrics->last_dump = now;
+
+	pthread_mutex_lock(&glc->metrics->trace_mutex);
+	memcpy(latency, glc->metrics->latency, sizeof(latency));
+	untraced = glc->metrics->untraced;
+	pthread_mutex_unlock(&glc->metrics->trace_mutex);
+	for (i = 0; i < GLC_METRICS_DROPS; i++)
+		drop[i] = __sync_fetch_and_add(&glc->metrics->drop[i], 0);
+
+	glc_metrics_log_frames(glc, latency, drop, elapsed);
+	memcpy(glc->metrics->last_latency, latency, sizeof(latency));
+	memcpy(glc->metrics->last_drop, drop, sizeof(drop));
+
+	if (glc->metrics->stream) {
+		fprintf(glc->metrics->stream, "{\"time\":%" PRIu64 ",", now);
+		glc_metrics_write_frames(glc->metrics->stream, latency, drop, untraced);
+		fputs(",\"stages\":[", glc->metrics->stream);
+	}
+
+	for (stage = glc->metrics->stage; stage != NULL; stage = stage->next) {
+		glc_metrics_total(stage, &total);
+
+		glc_metrics_log_stage(glc, stage, &total, elapsed);
+		if (glc->metrics->stream) {
+			if (!first)
+				fputc(',', glc->metrics->stream);
+			glc_metrics_write_stage(glc->metrics->stream, stage, &total);
+			first = 0;
+		}
+
+		memcpy(&stage->last, &total, sizeof(struct glc_metrics_shard_s));
+	}
+
+	if (glc->metrics->stream) {
+		fputs("]}\n", glc->metrics->stream);
+		fflush(glc->metrics->stream);
+	}
+	pthread_mutex_unlock(&glc->metrics->mutex);
+
+	return 0;
+}
+
+int glc_metrics_stage_start(glc_t *glc, const char *name, size_t shards,
+			    glc_metrics_shard_t **shard)
+{
+	struct glc_metrics_stage_s *stage;
+	struct glc_metrics_shard_s *storage;
+	glc_metrics_shard_t *ptr;
+	size_t s;
+
+	if (unlikely(!shards))
+		return EINVAL;
+
+	if (unlikely(posix_memalign((void **) &storage, 64,
+				    sizeof(struct glc_metrics_shard_s) * shards)))
+		return ENOMEM;
+	if (unlikely(!(ptr = malloc(sizeof(glc_metrics_shard_t) * shards)))) {
+		free(storage);
+		return ENOMEM;
+	}
+	memset(storage, 0, sizeof(struct glc_metrics_shard_s) * shards);
+	for (s = 0; s < shards; s++)
+		ptr[s] = &storage[s];
+
+	pthread_mutex_lock(&glc->metrics->mutex);
+	for (stage = glc->metrics->stage; stage != NULL; stage = stage->next) {
+		if ((!stage->active) && (!strcmp(stage->name, name)))
+			break;
+	}
+
+	if (stage == NULL) {
+		if (unlikely(!(stage = calloc(1, sizeof(struct glc_metrics_stage_s))))) {
+			pthread_mutex_unlock(&glc->metrics->mutex);
+			free(ptr);
+			free(storage);
+			return ENOMEM;
+		}
+		stage->name = name;
+		stage->next = glc->metrics->stage;
+		glc->metrics->stage = stage;
+	} else {
+		/* previous run is kept in base */
+		for (s = 0; s < stage->shards; s++)
+			glc_metrics_add(&stage->base, &stage->storage[s]);
+		free(stage->storage);
+		free(stage->shard);
+	}
+
+	stage->storage = storage;
+	stage->shard   = ptr;
+	stage->shards  = shards;
+	stage->active  = 1;
+	pthread_mutex_unlock(&glc->metrics->mutex);
+
+	*shard = ptr;
+	return 0;
+}
+
+int glc_metrics_stage_finish(glc_t *glc, glc_metrics_shard_t *shard)
+{
+	struct glc_metrics_stage_s *stage;
+
+	pthread_mutex_lock(&glc->metrics->mutex);
+	for (stage = glc->metrics->stage; stage != NULL; stage = stage->next) {
+		if (stage->shard == shard) {
+			stage->active = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&glc->metrics->mutex);
+
+	return stage ? 0 : EINVAL;
+}
+
+void glc_metrics_drop(glc_t *glc, int cause)
+{
+	if (glc->metrics->enabled)
+		__sync_fetch_and_add(&glc->metrics->drop[cause], 1);
+}
+
+void glc_metrics_frame_queued(glc_t *glc, glc_utime_t time)
+{
+	struct glc_metrics_trace_s *trace;
+	glc_utime_t age, now;
+
+	if (!glc->metrics->enabled)
+		return;
+
+	/* time is state time, trace is kept in glc_time() */
+	age = glc_state_time(glc);
+	now = glc_time(glc);
+	age = (age > time) ? age - time : 0;
+
+	pthread_mutex_lock(&glc->metrics->trace_mutex);
+	if (likely((glc->metrics->trace_count < GLC_METRICS_TRACE) &&
+		   (!glc->metrics->untraced_pending))) {
+		trace = &glc->metrics->trace[(glc->metrics->trace_head +
+					      glc->metrics->trace_count) %
+					     GLC_METRICS_TRACE];
+		trace->capture = now - age;
+		trace->queue   = now;
+		glc->metrics->trace_count++;
+	} else {
+		glc->metrics->untraced++;
+		glc->metrics->untraced_pending++;
+	}
+	pthread_mutex_unlock(&glc->metrics->trace_mutex);
+}
+
+void glc_metrics_frame_written(glc_t *glc, const glc_message_header_t *header,
+			       const char *data)
+{
+	struct glc_metrics_trace_s *trace;
+	glc_utime_t now;
+
+	if ((!glc->metrics->enabled) || (!glc_metrics_is_video(header, data)))
+		return;
+
+	now = glc_time(glc);
+	pthread_mutex_lock(&glc->metrics->trace_mutex);
+	if (likely(glc->metrics->trace_count)) {
+		trace = &glc->metrics->trace[glc->metrics->trace_head];
+		glc->metrics->trace_head = (glc->metrics->trace_head + 1) % GLC_METRICS_TRACE;
+		glc->metrics->trace_count--;
+
+		glc_metrics_timer_add(&glc->metrics->latency[GLC_METRICS_LATENCY_CAPTURE],
+				      trace->queue - trace->capture);
+		glc_metrics_timer_add(&glc->metrics->latency[GLC_METRICS_LATENCY_PIPELINE],
+				      now - trace->queue);
+		glc_metrics_timer_add(&glc->metrics->latency[GLC_METRICS_LATENCY_TOTAL],
+				      now - trace->capture);
+	} else if (glc->metrics->untraced_pending)
+		glc->metrics->untraced_pending--;
+	pthread_mutex_unlock(&glc->metrics->trace_mutex);
+}
+
+/*
+ * Sinks see video frames as they are or wrapped by pack in a
+ * container and a compressed or tiled message, all of them
+ * starting with size and original header.
+ */
+int glc_metrics_is_video(const glc_message_header_t *header, const char *data)
+{
+	glc_message_type_t type = header->type;
+
+	if (type == GLC_MESSAGE_CONTAINER) {
+		type = ((const glc_container_message_header_t *) data)->header.type;
+		data = &data[sizeof(glc_container_message_header_t)];
+	}
+
+	switch (type) {
+	case GLC_MESSAGE_LZO:
+	case GLC_MESSAGE_QUICKLZ:
+	case GLC_MESSAGE_LZJB:
+	case GLC_MESSAGE_LZ4:
+	case GLC_MESSAGE_ZSTD:
+	case GLC_MESSAGE_TILES:
+		type = ((const glc_lzo_header_t *) data)->header.type;
+		break;
+	}
+
+	return (type == GLC_MESSAGE_VIDEO_FRAME) ||
+	       (type == GLC_MESSAGE_VIDEO_KEYFRAME) ||
+	       (type == GLC_MESSAGE_VIDEO_DELTA);
+}
+
+void glc_metrics_count(glc_metrics_shard_t shard, glc_message_type_t type, size_t size)
+{
+	struct glc_metrics_type_s *counter =
+		&shard->type[type < GLC_METRICS_TYPES ? type : GLC_METRICS_TYPES - 1];
+
+	counter->count++;
+	counter->bytes += size;
+}
+
+void glc_metrics_record(glc_metrics_shard_t shard, int timer, glc_utime_t ns)
+{
+	glc_metrics_timer_add(&shard->timer[timer], ns);
+}
+
+void glc_metrics_timer_add(struct glc_metrics_timer_s *timer, glc_utime_t ns)
+{
+	unsigned int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+
+	if (unlikely(bucket >= GLC_METRICS_BUCKETS))
+		bucket = GLC_METRICS_BUCKETS - 1;
+
+	timer->count++;
+	timer->sum += ns;
+	if (unlikely(ns > timer->max))
+		timer->max = ns;
+	timer->bucket[bucket]++;
+}
+
+/*
+ * Samples since last are assumed evenly spread in their bucket,
+ * estimate is capped by the largest sample.
+ */
+double glc_metrics_percentile(const struct glc_metrics_timer_s *timer,
+			      const struct glc_metrics_timer_s *last, double q)
+{
+	u_int64_t count = timer->count - (last ? last->count : 0);
+	u_int64_t rank, seen = 0, n;
+	double est;
+	unsigned int b;
+
+	if (!count)
+		return 0.0;
+
+	rank = (u_int64_t) (q * count);
+	if (rank < q * count)
+		rank++;
+	if (rank < 1)
+		rank = 1;
+
+	for (b = 0; b < GLC_METRICS_BUCKETS; b++) {
+		n = timer->bucket[b] - (last ? last->bucket[b] : 0);
+		if (seen + n >= rank) {
+			est = (double) (1ULL << b) * (1.0 + (double) (rank - seen) / n);
+			return (est < timer->max) ? est : (double) timer->max;
+		}
+		seen += n;
+	}
+	return (double) timer->max;
+}
+
+void glc_metrics_add(struct glc_metrics_shard_s *to, const struct glc_metrics_shard_s *from)
+{
+	unsigned int i, b;
+
+	for (i = 0; i < GLC_METRICS_TYPES; i++) {
+		to->type[i].count += from->type[i].count;
+		to->type[i].bytes += from->type[i].bytes;
+	}
+
+	for (i = 0; i < GLC_METRICS_TIMERS; i++) {
+		to->timer[i].count += from->timer[i].count;
+		to->timer[i].sum   += from->timer[i].sum;
+		if (from->timer[i].max > to->timer[i].max)
+			to->timer[i].max = from->timer[i].max;
+		for (b = 0; b < GLC_METRICS_BUCKETS; b++)
+			to->timer[i].bucket[b] += from->timer[i].bucket[b];
+	}
+}
+
+void glc_metrics_total(struct glc_metrics_stage_s *stage, struct glc_metrics_shard_s *total)
+{
+	size_t s;
+
+	memcpy(total, &stage->base, sizeof(struct glc_metrics_shard_s));
+	for (s = 0; s < stage->shards; s++)
+		glc_metrics_add(total, &stage->storage[s]);
+}
+
+/*
+ * Busy is the share of thread time spent in callbacks. A stage
+ * close to 100% busy with upstream waiting on output is the
+ * bottleneck.
+ */
+void glc_metrics_log_stage(glc_t *glc, struct glc_metrics_stage_s *stage,
+			   const struct glc_metrics_shard_s *total, glc_utime_t elapsed)
+{
+	u_int64_t count = 0, bytes = 0, busy = 0, n[GLC_METRICS_TIMERS];
+	double avg[GLC_METRICS_TIMERS];
+	unsigned int i;
+
+	for (i = 0; i < GLC_METRICS_TYPES; i++) {
+		count += total->type[i].count - stage->last.type[i].count;
+		bytes += total->type[i].bytes - stage->last.type[i].bytes;
+	}
+
+	for (i = 0; i < GLC_METRICS_TIMERS; i++) {
+		n[i] = total->timer[i].count - stage->last.timer[i].count;
+		avg[i] = n[i] ? (double) (total->timer[i].sum - stage->last.timer[i].sum) /
+				(n[i] * 1000000.0) : 0.0;
+		if (i < GLC_METRICS_WAIT_IN)
+			busy += total->timer[i].sum - stage->last.timer[i].sum;
+	}
+
+	if ((!count) && (!stage->active))
+		return;
+
+	glc_log(glc, GLC_PERF, "metrics",
+		"%s: %.1f msg/s, %.1f MiB/s, busy %.0f%%, wait in %.3f ms, out %.3f ms, "
+		"read %.3f ms, write %.3f ms",
+		stage->name,
+		elapsed ? count * 1000000000.0 / elapsed : 0.0,
+		elapsed ? bytes * 1000000000.0 / (elapsed * 1048576.0) : 0.0,
+		elapsed ? busy * 100.0 / ((double) elapsed * stage->shards) : 0.0,
+		avg[GLC_METRICS_WAIT_IN], avg[GLC_METRICS_WAIT_OUT],
+		avg[GLC_METRICS_READ], avg[GLC_METRICS_WRITE]);
+}
+
+void glc_metrics_write_stage(FILE *stream, struct glc_metrics_stage_s *stage,
+			     const struct glc_metrics_shard_s *total)
+{
+	unsigned int i;
+	int first = 1;
+
+	fprintf(stream, "{\"name\":\"%s\",\"threads\":%zu,\"active\":%d,\"types\":[",
+		stage->name, stage->shards, stage->active);
+	for (i = 0; i < GLC_METRICS_TYPES; i++) {
+		if (!total->type[i].count)
+			continue;
+		fprintf(stream, "%s{\"type\":%u,\"count\":%" PRIu64 ",\"bytes\":%" PRIu64 "}",
+			first ? "" : ",", i, total->type[i].count, total->type[i].bytes);
+		first = 0;
+	}
+
+	fputs("],\"timers\":{", stream);
+	first = 1;
+	for (i = 0; i < GLC_METRICS_TIMERS; i++) {
+		if (!total->timer[i].count)
+			continue;
+		if (!first)
+			fputc(',', stream);
+		glc_metrics_write_timer(stream, glc_metrics_timer_name[i], &total->timer[i]);
+		first = 0;
+	}
+	fputs("}}", stream);
+}
+
+void glc_metrics_log_frames(glc_t *glc, const struct glc_metrics_timer_s *latency,
+			    const u_int64_t *drop, glc_utime_t elapsed)
+{
+	const struct glc_metrics_timer_s *total = &latency[GLC_METRICS_LATENCY_TOTAL];
+	const struct glc_metrics_timer_s *last =
+		&glc->metrics->last_latency[GLC_METRICS_LATENCY_TOTAL];
+	u_int64_t frames = total->count - last->count;
+	u_int64_t d[GLC_METRICS_DROPS];
+	unsigned int i;
+
+	for (i = 0; i < GLC_METRICS_DROPS; i++)
+		d[i] = drop[i] - glc->metrics->last_drop[i];
+
+	if ((!frames) && (!d[GLC_METRICS_DROP_BUFFER]) && (!d[GLC_METRICS_DROP_PIPE]) &&
+	    (!d[GLC_METRICS_DROP_AUDIO]))
+		return;
+
+	glc_log(glc, GLC_PERF, "metrics",
+		"frames: %.1f/s, latency p50 %.3f ms, p99 %.3f ms, "
+		"dropped: buffer %" PRIu64 ", fps %" PRIu64 ", pipe %" PRIu64
+		", audio %" PRIu64,
+		elapsed ? frames * 1000000000.0 / elapsed : 0.0,
+		glc_metrics_percentile(total, last, 0.50) / 1000000.0,
+		glc_metrics_percentile(total, last, 0.99) / 1000000.0,
+		d[GLC_METRICS_DROP_BUFFER], d[GLC_METRICS_DROP_FPS], d[GLC_METRICS_DROP_PIPE],
+		d[GLC_METRICS_DROP_AUDIO]);
+}
+
+void glc_metrics_write_frames(FILE *stream, const struct glc_metrics_timer_s *latency,
+			      const u_int64_t *drop, u_int64_t untraced)
+{
+	unsigned int i;
+
+	fputs("\"drops\":{", stream);
+	for (i = 0; i < GLC_METRICS_DROPS; i++)
+		fprintf(stream, "%s\"%s\":%" PRIu64, i ? "," : "",
+			glc_metrics_drop_name[i], drop[i]);
+
+	fprintf(stream, "},\"untraced\":%" PRIu64 ",\"latency\":{", untraced);
+	for (i = 0; i < GLC_METRICS_LATENCIES; i++) {
+		if (i)
+			fputc(',', stream);
+		glc_metrics_write_timer(stream, glc_metrics_latency_name[i], &latency[i]);
+	}
+	fputc('}', stream);
+}
+
+void glc_metrics_write_timer(FILE *stream, const char *name,
+			     const struct glc_metrics_timer_s *timer)
+{
+	unsigned int b;
+
+	fprintf(stream, "\"%s\":{\"count\":%" PRIu64 ",\"sum\":%" PRIu64
+		",\"max\":%" PRIu64 ",\"p50\":%.0f,\"p99\":%.0f,\"buckets\":[",
+		name, timer->count, timer->sum, timer->max,
+		glc_metrics_percentile(timer, NULL, 0.50),
+		glc_metrics_percentile(timer, NULL, 0.99));
+	for (b = 0; b < GLC_METRICS_BUCKETS; b++)
+		fprintf(stream, "%s%" PRIu64, b ? "," : "", timer->bucket[b]);
+	fputs("]}", stream);
+}
+
+void *glc_metrics_thread(void *argptr)
+{
+	glc_t *glc = (glc_t *) argptr;
+	struct timespec ts;
+	glc_utime_t next;
+
+	pthread_mutex_lock(&glc->metrics->mutex);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	next = (glc_utime_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+	while (!glc->metrics->stop) {
+		next += glc->metrics->interval;
+		ts.tv_sec  = next / 1000000000;
+		ts.tv_nsec = next % 1000000000;
+
+		while ((!glc->metrics->stop) &&
+		       (pthread_cond_timedwait(&glc->metrics->cond, &glc->metrics->mutex,
+					       &ts) != ETIMEDOUT));
+		if (glc->metrics->stop)
+			break;
+
+		pthread_mutex_unlock(&glc->metrics->mutex);
+		glc_metrics_dump(glc);
+		pthread_mutex_lock(&glc->metrics->mutex);
+	}
+	pthread_mutex_unlock(&glc->metrics->mutex);
+
+	return NULL;
+}
+
+/**  \} */
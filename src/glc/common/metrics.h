@@ -0,0 +1,225 @@
+/**
+ * \file glc/common/metrics.h
+ * \brief pipeline metrics registry
+ * \author agent <agent@local>
+ * \date 2026
+
+    Copyright 2026 agent
+
+    This file is part of glcs.
+
+    glcs is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    glcs is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with glcs.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+/**
+ * \addtogroup common
+ *  \{
+ * \defgroup metrics pipeline metrics
+ *  \{
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <glc/common/glc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** open callback */
+#define GLC_METRICS_OPEN                      0
+/** header callback */
+#define GLC_METRICS_HEADER                    1
+/** read callback */
+#define GLC_METRICS_READ                      2
+/** write callback */
+#define GLC_METRICS_WRITE                     3
+/** close callback */
+#define GLC_METRICS_CLOSE                     4
+/** waiting for a packet from the source buffer */
+#define GLC_METRICS_WAIT_IN                   5
+/** waiting for room in the target buffer */
+#define GLC_METRICS_WAIT_OUT                  6
+/** number of timers */
+#define GLC_METRICS_TIMERS                    7
+
+/** message types counted separately, others share the last slot */
+#define GLC_METRICS_TYPES                    32
+/** latency histogram buckets, bucket i holds [2^i, 2^(i+1)) ns */
+#define GLC_METRICS_BUCKETS                  32
+
+/** frame dropped because target buffer was full */
+#define GLC_METRICS_DROP_BUFFER               0
+/** frame skipped because it came before next capture period */
+#define GLC_METRICS_DROP_FPS                  1
+/** frame not delivered because pipe consumer was too slow */
+#define GLC_METRICS_DROP_PIPE                 2
+/** chunk of audio dropped because capture ring was full */
+#define GLC_METRICS_DROP_AUDIO                3
+/** number of drop causes */
+#define GLC_METRICS_DROPS                     4
+
+/** frames traced between capture and sink, older ones are not traced */
+#define GLC_METRICS_TRACE                  4096
+
+/**
+ * \brief metrics shard
+ *
+ * Each thread of a stage updates its own shard so recording
+ * needs neither locks nor atomic operations.
+ */
+typedef struct glc_metrics_shard_s* glc_metrics_shard_t;
+
+/**
+ * \brief initialize metrics registry
+ *
+ * Registry is disabled until glc_metrics_start() is called.
+ * \param glc glc
+ * \return 0 on success otherwise an error code
+ */
+__PRIVATE int glc_metrics_init(glc_t *glc);
+
+/**
+ * \brief destroy metrics registry
+ * \param glc glc
+ * \return 0 on success otherwise an error code
+ */
+__PRIVATE int glc_metrics_destroy(glc_t *glc);
+
+/**
+ * \brief write machine-readable metrics to a file
+ *
+ * Each dump appends one JSON object per line with cumulative
+ * counters of every stage. File can be a named pipe.
+ * \param glc glc
+ * \param filename file name
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_metrics_open_file(glc_t *glc, const char *filename);
+
+/**
+ * \brief enable metrics
+ *
+ * Stages created after this call are instrumented. If interval
+ * is not 0, a thread dumps metrics every interval nanoseconds.
+ * \param glc glc
+ * \param interval dump interval in nanoseconds, 0 dumps only
+ *                 from glc_metrics_stop()
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_metrics_start(glc_t *glc, glc_utime_t interval);
+
+/**
+ * \brief stop periodic dumps, write final dump and close file
+ * \param glc glc
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_metrics_stop(glc_t *glc);
+
+/**
+ * \brief metrics are collected
+ * \param glc glc
+ * \return 1 if enabled, 0 otherwise
+ */
+__PUBLIC int glc_metrics_enabled(glc_t *glc);
+
+/**
+ * \brief log metrics at GLC_PERF level and write them to file
+ *
+ * Logged rates and averages cover the time since previous dump.
+ * \param glc glc
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_metrics_dump(glc_t *glc);
+
+/**
+ * \brief register a pipeline stage
+ *
+ * A finished stage with the same name is reused so restarted
+ * filters keep accumulating in the same entry.
+ * \param glc glc
+ * \param name stage name, must stay valid until glc_metrics_destroy()
+ * \param shards number of threads recording into the stage
+ * \param shard returned array of shards pointers
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_metrics_stage_start(glc_t *glc, const char *name, size_t shards,
+				     glc_metrics_shard_t **shard);
+
+/**
+ * \brief mark stage as finished
+ * \param glc glc
+ * \param shard shards returned by glc_metrics_stage_start()
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_metrics_stage_finish(glc_t *glc, glc_metrics_shard_t *shard);
+
+/**
+ * \brief count a dropped frame
+ * \param glc glc
+ * \param cause GLC_METRICS_DROP_* cause
+ */
+__PUBLIC void glc_metrics_drop(glc_t *glc, int cause);
+
+/**
+ * \brief trace a video frame entering the pipeline
+ *
+ * Call after the frame packet is closed. Frames are matched with
+ * glc_metrics_frame_written() in stream order.
+ * \param glc glc
+ * \param time frame capture time, in state time like
+ *             glc_video_frame_header_t time
+ */
+__PUBLIC void glc_metrics_frame_queued(glc_t *glc, glc_utime_t time);
+
+/**
+ * \brief trace a message leaving the pipeline
+ *
+ * Sinks call this for every message they write. Video frames,
+ * compressed or not, complete the oldest traced frame and add to
+ * end-to-end latency histograms.
+ * \param glc glc
+ * \param header message header
+ * \param data message data
+ */
+__PUBLIC void glc_metrics_frame_written(glc_t *glc, const glc_message_header_t *header,
+					const char *data);
+
+/**
+ * \brief count a message
+ * \param shard shard
+ * \param type message type
+ * \param size message size excluding header
+ */
+__PUBLIC void glc_metrics_count(glc_metrics_shard_t shard, glc_message_type_t type,
+				size_t size);
+
+/**
+ * \brief add a sample to a latency histogram
+ * \param shard shard
+ * \param timer GLC_METRICS_* timer
+ * \param ns elapsed time in nanoseconds
+ */
+__PUBLIC void glc_metrics_record(glc_metrics_shard_t shard, int timer, glc_utime_t ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/**  \} */
+/**  \} */
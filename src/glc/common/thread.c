@@ -33,6 +33,9 @@
 #include <pthread.h>
 #include <signal.h>
 #include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <packetstream.h>
 #include <errno.h>
 
@@ -42,8 +45,34 @@
 #include "util.h"
 #include "log.h"
 #include "state.h"
+#include "metrics.h"
 #include "optimization.h"
 
+/** spins before sleeping on a turn */
+#define GLC_THREAD_TURN_SPIN 64
+
+/**
+ * \brief ticket turn slot
+ *
+ * Thread with ticket equal to grant has the turn. Each
+ * waiting thread spins and sleeps on its own slot.
+ */
+struct glc_thread_slot_s {
+	volatile unsigned int grant;
+	volatile unsigned int waiting;
+} __attribute__ ((aligned (64)));
+
+/**
+ * \brief ticket turn
+ *
+ * Ticket selects slot, there are at least as many slots as
+ * threads so no two pending tickets share one.
+ */
+struct glc_thread_turn_s {
+	struct glc_thread_slot_s *slot;
+	unsigned int mask;
+};
+
 /**
  * \brief thread private variables
  */
@@ -53,18 +82,71 @@ struct glc_thread_private_s {
 	ps_buffer_t *to;
 
 	pthread_t *pthread_thread;
-	pthread_mutex_t open, finish;
+	pthread_mutex_t finish;
+
+	/*
+	 * every packet takes a ticket, read packets are opened and read
+	 * callbacks run in ticket order, write packets are opened in
+	 * ticket order too
+	 */
+	unsigned int ticket;
+	struct glc_thread_turn_s read_turn, write_turn;
+	int spin;
 
 	glc_thread_t *thread;
 	size_t running_threads;
 
-	int stop;
+	/* one shard per thread, NULL if metrics are disabled */
+	glc_metrics_shard_t *metrics;
+	unsigned int next_shard;
+
+	volatile int stop;
 	int ret;
 };
 
+/**
+ * \brief band pool private variables
+ */
+struct glc_band_pool_s {
+	glc_t *glc;
+	size_t threads;
+	pthread_t *pthread_thread;
+
+	/** held while a frame is processed */
+	pthread_mutex_t run;
+	pthread_mutex_t mutex;
+	pthread_cond_t start, done;
+
+	unsigned int generation;
+	size_t active;
+	int stop;
+
+	/* current job */
+	glc_band_func_t func;
+	void *arg;
+	unsigned int rows, band;
+	unsigned int next;
+
+	/* handed out to pool threads as they start */
+	unsigned int workers;
+};
+
+/* 0 unless calling thread is a band pool thread */
+static __thread unsigned int glc_band_worker_index;
+
 static void *glc_thread(void *argptr);
+static inline glc_utime_t glc_thread_clock(glc_t *glc, glc_metrics_shard_t shard);
+static inline void glc_thread_record(glc_t *glc, glc_metrics_shard_t shard, int timer,
+				     glc_utime_t start);
+static int glc_thread_turn_wait(struct glc_thread_private_s *private,
+				struct glc_thread_turn_s *turn, unsigned int ticket);
+static void glc_thread_turn_next(struct glc_thread_turn_s *turn, unsigned int ticket);
+static int glc_thread_turn_init(struct glc_thread_turn_s *turn, size_t threads);
+static void glc_thread_turn_stop(struct glc_thread_turn_s *turn);
 static int glc_thread_block_signals(void);
 static int glc_thread_set_rt_priority(glc_t *glc, int ask_rt);
+static void *glc_band_thread(void *argptr);
+static void glc_band_pool_work(glc_band_pool_t pool);
 
 int glc_thread_create(glc_t *glc, glc_thread_t *thread, ps_buffer_t *from,
 			ps_buffer_t *to)
@@ -86,9 +168,32 @@ int glc_thread_create(glc_t *glc, glc_thread_t *thread, ps_buffer_t *from,
 	private->to     = to;
 	private->thread = thread;
 
-	pthread_mutex_init(&private->open, NULL);
+	if ((thread->flags & GLC_THREAD_WRITE) && (thread->flags & GLC_THREAD_READ)) {
+		if (unlikely(glc_thread_turn_init(&private->read_turn, thread->threads))) {
+			free(private);
+			thread->priv = NULL;
+			return ENOMEM;
+		}
+		if (unlikely(glc_thread_turn_init(&private->write_turn, thread->threads))) {
+			free(private->read_turn.slot);
+			free(private);
+			thread->priv = NULL;
+			return ENOMEM;
+		}
+	}
+	/* spinning only delays the thread having the turn on single cpu */
+	private->spin = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? GLC_THREAD_TURN_SPIN : 0;
+
 	pthread_mutex_init(&private->finish, NULL);
 
+	if (glc_metrics_enabled(glc)) {
+		if (unlikely((ret = glc_metrics_stage_start(glc,
+				thread->name ? thread->name : "thread",
+				thread->threads, &private->metrics))))
+			glc_log(glc, GLC_WARN, "glc_thread", "can't collect metrics: %s (%d)",
+				strerror(ret), ret);
+	}
+
 	private->pthread_thread = malloc(sizeof(pthread_t) * thread->threads);
 	for (t = 0; t < thread->threads; t++) {
 		private->running_threads++;
@@ -118,9 +223,13 @@ int glc_thread_wait(glc_thread_t *thread)
 		}
 	}
 
+	if (private->metrics)
+		glc_metrics_stage_finish(private->glc, private->metrics);
+
 	free(private->pthread_thread);
 	pthread_mutex_destroy(&private->finish);
-	pthread_mutex_destroy(&private->open);
+	free(private->read_turn.slot);
+	free(private->write_turn.slot);
 	free(private);
 	thread->priv = NULL;
 
@@ -137,7 +246,10 @@ int glc_thread_wait(glc_thread_t *thread)
  */
 void *glc_thread(void *argptr)
 {
-	int has_locked, ret, write_size_set, packets_init;
+	int ordered, ret, write_size_set, packets_init;
+	unsigned int ticket = 0;
+	glc_metrics_shard_t shard = NULL;
+	glc_utime_t start;
 
 	struct glc_thread_private_s *private = (struct glc_thread_private_s *) argptr;
 	glc_thread_t *thread = private->thread;
@@ -145,12 +257,16 @@ void *glc_thread(void *argptr)
 	ps_packet_t read, write;
 
 	memset(&state, 0, sizeof(state));
-	write_size_set = ret = has_locked = packets_init = 0;
+	write_size_set = ret = packets_init = 0;
 	state.ptr   = thread->ptr;
 	state.from  = private->from;
+	ordered = (thread->flags & GLC_THREAD_WRITE) && (thread->flags & GLC_THREAD_READ);
+	if (private->metrics)
+		shard = private->metrics[__sync_fetch_and_add(&private->next_shard, 1)];
 
 	glc_thread_block_signals();
 	glc_thread_set_rt_priority(private->glc, thread->ask_rt);
+	glc_apply_affinity(private->glc);
 
 	if (thread->flags & GLC_THREAD_READ) {
 		if (unlikely((ret = ps_packet_init(&read, private->from))))
@@ -174,18 +290,26 @@ void *glc_thread(void *argptr)
 	do {
 		/* open callback */
 		if (thread->open_callback) {
-			if (unlikely((ret = thread->open_callback(&state))))
+			start = glc_thread_clock(private->glc, shard);
+			ret = thread->open_callback(&state);
+			glc_thread_record(private->glc, shard, GLC_METRICS_OPEN, start);
+			if (unlikely(ret))
 				goto err;
 		}
 
-		if ((thread->flags & GLC_THREAD_WRITE) && (thread->flags & GLC_THREAD_READ)) {
-			pthread_mutex_lock(&private->open); /* preserve packet order */
-			has_locked = 1;
+		/* preserve packet order without holding a lock */
+		if (ordered) {
+			ticket = __sync_fetch_and_add(&private->ticket, 1);
+			if (unlikely((ret = glc_thread_turn_wait(private, &private->read_turn,
+								 ticket))))
+				goto err;
 		}
 
 		if ((thread->flags & GLC_THREAD_READ) && (!(state.flags & GLC_THREAD_STATE_SKIP_READ))) {
+			start = glc_thread_clock(private->glc, shard);
 			if (unlikely((ret = ps_packet_open(&read, PS_PACKET_READ))))
 				goto err;
+			glc_thread_record(private->glc, shard, GLC_METRICS_WAIT_IN, start);
 			if (unlikely((ret = ps_packet_read(&read, &state.header,
 						  sizeof(glc_message_header_t)))))
 				goto err;
@@ -193,10 +317,15 @@ void *glc_thread(void *argptr)
 				goto err;
 			state.read_size -= sizeof(glc_message_header_t);
 			state.write_size = state.read_size;
+			if (shard)
+				glc_metrics_count(shard, state.header.type, state.read_size);
 
 			/* header callback */
 			if (thread->header_callback) {
-				if (unlikely((ret = thread->header_callback(&state))))
+				start = glc_thread_clock(private->glc, shard);
+				ret = thread->header_callback(&state);
+				glc_thread_record(private->glc, shard, GLC_METRICS_HEADER, start);
+				if (unlikely(ret))
 					goto err;
 			}
 
@@ -206,21 +335,50 @@ void *glc_thread(void *argptr)
 
 			/* read callback */
 			if (thread->read_callback) {
-				if (unlikely((ret = thread->read_callback(&state))))
+				start = glc_thread_clock(private->glc, shard);
+				ret = thread->read_callback(&state);
+				glc_thread_record(private->glc, shard, GLC_METRICS_READ, start);
+				if (unlikely(ret))
 					goto err;
 			}
 		}
 
-		if ((thread->flags & GLC_THREAD_WRITE) &&
-		    (!(state.flags & GLC_THREAD_STATE_SKIP_WRITE))) {
-			if (unlikely((ret = ps_packet_open(&write, PS_PACKET_WRITE))))
+		/*
+		 * Next thread can read while this one opens its write
+		 * packet, write packets are still opened in packet order.
+		 */
+		if (ordered)
+			glc_thread_turn_next(&private->read_turn, ticket);
+
+		start = glc_thread_clock(private->glc, shard);
+		if (ordered) {
+			/* earlier thread might still be opening its write packet */
+			if (unlikely((ret = glc_thread_turn_wait(private, &private->write_turn,
+								 ticket))))
 				goto err;
 
-			if (has_locked) {
-				has_locked = 0;
-				pthread_mutex_unlock(&private->open);
+			if ((!(state.flags & GLC_THREAD_STATE_SKIP_WRITE)) &&
+			    (unlikely((ret = ps_packet_open(&write,
+						PS_PACKET_WRITE | PS_PACKET_TRY))))) {
+				if (unlikely(ret != EBUSY))
+					goto err;
+
+				state.flags |= GLC_THREAD_STATE_WRITE_BLOCKED;
+				if (unlikely((ret = ps_packet_open(&write, PS_PACKET_WRITE))))
+					goto err;
 			}
 
+			glc_thread_turn_next(&private->write_turn, ticket);
+		} else if ((thread->flags & GLC_THREAD_WRITE) &&
+			   (!(state.flags & GLC_THREAD_STATE_SKIP_WRITE))) {
+			if (unlikely((ret = ps_packet_open(&write, PS_PACKET_WRITE))))
+				goto err;
+		}
+
+		if ((thread->flags & GLC_THREAD_WRITE) &&
+		    (!(state.flags & GLC_THREAD_STATE_SKIP_WRITE))) {
+			glc_thread_record(private->glc, shard, GLC_METRICS_WAIT_OUT, start);
+
 			/* reserve space for header */
 			if (unlikely((ret = ps_packet_seek(&write,
 							sizeof(glc_message_header_t)))))
@@ -247,7 +405,11 @@ void *glc_thread(void *argptr)
 
 				/* write callback */
 				if (thread->write_callback) {
-					if (unlikely((ret = thread->write_callback(&state))))
+					start = glc_thread_clock(private->glc, shard);
+					ret = thread->write_callback(&state);
+					glc_thread_record(private->glc, shard, GLC_METRICS_WRITE,
+							  start);
+					if (unlikely(ret))
 						goto err;
 				}
 			}
@@ -260,12 +422,6 @@ void *glc_thread(void *argptr)
 				goto err;
 		}
 
-		/* in case of we skipped writing */
-		if (has_locked) {
-			has_locked = 0;
-			pthread_mutex_unlock(&private->open);
-		}
-
 		if ((thread->flags & GLC_THREAD_READ) &&
 		    (!(state.flags & GLC_THREAD_STATE_SKIP_READ))) {
 			ps_packet_close(&read);
@@ -287,7 +443,10 @@ void *glc_thread(void *argptr)
 
 		/* close callback */
 		if (thread->close_callback) {
-			if (unlikely((ret = thread->close_callback(&state))))
+			start = glc_thread_clock(private->glc, shard);
+			ret = thread->close_callback(&state);
+			glc_thread_record(private->glc, shard, GLC_METRICS_CLOSE, start);
+			if (unlikely(ret))
 				goto err;
 		}
 
@@ -313,6 +472,12 @@ finish:
 		private->stop = 1;
 		ps_buffer_cancel(private->from);
 
+		/* threads waiting for their turn */
+		if (ordered) {
+			glc_thread_turn_stop(&private->read_turn);
+			glc_thread_turn_stop(&private->write_turn);
+		}
+
 		/* error might have happened @ write buffer
 		   so there could be blocking threads */
 		if ((glc_state_test(private->glc, GLC_STATE_CANCEL)) &&
@@ -346,9 +511,7 @@ finish:
 	return NULL;
 
 err:
-	if (has_locked)
-		pthread_mutex_unlock(&private->open);
-
+	/* turn is not passed on, other threads are stopped in finish */
 	if (ret == EINTR)
 		ret = 0;
 	else {
@@ -359,6 +522,100 @@ err:
 	goto finish;
 }
 
+glc_utime_t glc_thread_clock(glc_t *glc, glc_metrics_shard_t shard)
+{
+	return shard ? glc_time(glc) : 0;
+}
+
+void glc_thread_record(glc_t *glc, glc_metrics_shard_t shard, int timer,
+		       glc_utime_t start)
+{
+	if (shard)
+		glc_metrics_record(shard, timer, glc_time(glc) - start);
+}
+
+int glc_thread_turn_init(struct glc_thread_turn_s *turn, size_t threads)
+{
+	unsigned int slots = 1;
+
+	/* power of two keeps slots consistent when tickets wrap */
+	while (slots < threads)
+		slots <<= 1;
+
+	/* slots are cache line aligned, calloc() only guarantees 16 bytes */
+	if (unlikely(posix_memalign((void **) &turn->slot, 64,
+				    slots * sizeof(struct glc_thread_slot_s))))
+		return ENOMEM;
+	/* ticket 0 is granted, slot 0 grant is 0 */
+	memset(turn->slot, 0, slots * sizeof(struct glc_thread_slot_s));
+	turn->mask = slots - 1;
+	return 0;
+}
+
+/*
+ * Spins shortly, since turn is usually held only for opening a
+ * packet or a short read callback, then sleeps until grant changes.
+ * Returns EINTR if threads are stopping.
+ */
+int glc_thread_turn_wait(struct glc_thread_private_s *private,
+			 struct glc_thread_turn_s *turn, unsigned int ticket)
+{
+	struct glc_thread_slot_s *slot = &turn->slot[ticket & turn->mask];
+	unsigned int grant;
+	int spin = private->spin;
+
+	for (;;) {
+		/* stop is tested first, see glc_thread_turn_stop() */
+		if (unlikely(private->stop))
+			return EINTR;
+
+		grant = slot->grant;
+		if (grant == ticket) {
+			__sync_synchronize();
+			return 0;
+		}
+
+		if (spin) {
+			spin--;
+			asm volatile("pause\n": : :"memory");
+			continue;
+		}
+
+		slot->waiting = 1;
+		__sync_synchronize();
+		syscall(SYS_futex, &slot->grant, FUTEX_WAIT_PRIVATE, grant,
+			NULL, NULL, 0);
+		slot->waiting = 0;
+	}
+}
+
+void glc_thread_turn_next(struct glc_thread_turn_s *turn, unsigned int ticket)
+{
+	struct glc_thread_slot_s *slot = &turn->slot[(ticket + 1) & turn->mask];
+
+	__sync_synchronize();
+	slot->grant = ticket + 1;
+	__sync_synchronize();
+	if (slot->waiting)
+		syscall(SYS_futex, &slot->grant, FUTEX_WAKE_PRIVATE, 1,
+			NULL, NULL, 0);
+}
+
+/*
+ * Called after setting private->stop. Changing grant makes sure a
+ * thread about to sleep with old value does not miss the wake up.
+ */
+void glc_thread_turn_stop(struct glc_thread_turn_s *turn)
+{
+	unsigned int i;
+
+	for (i = 0; i <= turn->mask; i++) {
+		__sync_add_and_fetch(&turn->slot[i].grant, UINT_MAX / 2 + 1);
+		syscall(SYS_futex, &turn->slot[i].grant, FUTEX_WAKE_PRIVATE, INT_MAX,
+			NULL, NULL, 0);
+	}
+}
+
 int glc_thread_set_rt_priority(glc_t *glc, int ask_rt)
 {
 	int ret = 0;
@@ -415,6 +672,7 @@ static void *glc_simple_thread_start_routine(void *arg)
 
 	glc_thread_block_signals();
 	glc_thread_set_rt_priority(param->glc, param->ask_rt);
+	glc_apply_affinity(param->glc);
 	res  = param->start_routine(param->arg);
 	free(param);
 	return res;
@@ -473,4 +731,147 @@ int glc_simple_thread_wait(glc_t *glc, glc_simple_thread_t *thread)
         return ret;
 }
 
+int glc_band_pool_create(glc_t *glc, glc_band_pool_t *pool, size_t threads)
+{
+	int ret;
+	size_t t;
+
+	if (unlikely(threads < 1))
+		return EINVAL;
+
+	if (unlikely(!(*pool = (glc_band_pool_t)
+		calloc(1, sizeof(struct glc_band_pool_s)))))
+		return ENOMEM;
+
+	/* calling thread is one of the workers */
+	if (unlikely(!((*pool)->pthread_thread = malloc(sizeof(pthread_t) * threads)))) {
+		free(*pool);
+		return ENOMEM;
+	}
+
+	(*pool)->glc = glc;
+	pthread_mutex_init(&(*pool)->run, NULL);
+	pthread_mutex_init(&(*pool)->mutex, NULL);
+	pthread_cond_init(&(*pool)->start, NULL);
+	pthread_cond_init(&(*pool)->done, NULL);
+
+	for (t = 1; t < threads; t++) {
+		if (unlikely((ret = pthread_create(&(*pool)->pthread_thread[(*pool)->threads],
+						   NULL, glc_band_thread, *pool)))) {
+			glc_log(glc, GLC_ERROR, "glc_thread",
+				"can't create band thread: %s (%d)", strerror(ret), ret);
+			break;
+		}
+		(*pool)->threads++;
+	}
+
+	glc_log(glc, GLC_DEBUG, "glc_thread", "band pool with %zd threads",
+		(*pool)->threads + 1);
+	return 0;
+}
+
+int glc_band_pool_destroy(glc_band_pool_t pool)
+{
+	size_t t;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (t = 0; t < pool->threads; t++)
+		pthread_join(pool->pthread_thread[t], NULL);
+
+	free(pool->pthread_thread);
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_mutex_destroy(&pool->run);
+	free(pool);
+	return 0;
+}
+
+int glc_band_pool_run(glc_band_pool_t pool, glc_band_func_t func, void *arg,
+		      unsigned int rows, size_t row_size)
+{
+	unsigned int band;
+
+	band = GLC_BAND_SIZE / (row_size ? row_size : 1);
+	if (band < 1)
+		band = 1;
+	/* give every thread something to do */
+	if (band > (rows + pool->threads) / (pool->threads + 1))
+		band = (rows + pool->threads) / (pool->threads + 1);
+
+	if ((!pool->threads) || (band >= rows) ||
+	    (pthread_mutex_trylock(&pool->run))) {
+		func(arg, 0, rows);
+		return 0;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->func = func;
+	pool->arg = arg;
+	pool->rows = rows;
+	pool->band = band;
+	pool->next = 0;
+	pool->active = pool->threads;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->mutex);
+
+	glc_band_pool_work(pool);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->active)
+		pthread_cond_wait(&pool->done, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+
+	pthread_mutex_unlock(&pool->run);
+	return 0;
+}
+
+unsigned int glc_band_pool_worker(void)
+{
+	return glc_band_worker_index;
+}
+
+void glc_band_pool_work(glc_band_pool_t pool)
+{
+	unsigned int first;
+
+	while ((first = __sync_fetch_and_add(&pool->next, 1) * pool->band) < pool->rows)
+		pool->func(pool->arg, first, (first + pool->band < pool->rows) ?
+					     first + pool->band : pool->rows);
+}
+
+void *glc_band_thread(void *argptr)
+{
+	glc_band_pool_t pool = (glc_band_pool_t) argptr;
+	unsigned int generation = 0;
+
+	glc_thread_block_signals();
+	glc_apply_affinity(pool->glc);
+	glc_band_worker_index = __sync_add_and_fetch(&pool->workers, 1);
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while ((pool->generation == generation) && (!pool->stop))
+			pthread_cond_wait(&pool->start, &pool->mutex);
+		if (pool->stop)
+			break;
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+
+		glc_band_pool_work(pool);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->active == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
 /**  \} */
@@ -55,6 +55,9 @@ extern "C" {
 #define GLC_THREAD_COPY                      32
 /** thread wants to stop */
 #define GLC_THREAD_STOP                      64
+/** write packet could not be opened right away, target
+    buffer was full */
+#define GLC_THREAD_STATE_WRITE_BLOCKED      128
 
 /**
  * \brief thread state
@@ -115,6 +118,8 @@ typedef struct {
 	int    ask_rt;
 	/** implementation specific */
 	void *priv;
+	/** stage name in metrics, optional */
+	const char *name;
 
 	/** thread create callback is called when a thread starts */
 	int (*thread_create_callback)(void *, void **);
@@ -172,6 +177,71 @@ __PUBLIC int glc_simple_thread_create(glc_t *glc, glc_simple_thread_t *thread,
 
 __PUBLIC int glc_simple_thread_wait(glc_t *glc, glc_simple_thread_t *thread);
 
+/**
+ * \brief band callback
+ *
+ * Processes rows [first, last) of the current job. Called
+ * concurrently from all pool threads for disjoint ranges.
+ */
+typedef void (*glc_band_func_t)(void *arg, unsigned int first, unsigned int last);
+
+/**
+ * \brief band pool
+ *
+ * Band pool splits a single frame into horizontal bands and
+ * processes them in parallel. Thread calling glc_band_pool_run()
+ * works on bands too.
+ */
+typedef struct glc_band_pool_s* glc_band_pool_t;
+
+/**
+ * \brief create band pool
+ * \param glc glc
+ * \param pool returned pool
+ * \param threads number of threads working on a frame, including
+ *                the one calling glc_band_pool_run()
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_band_pool_create(glc_t *glc, glc_band_pool_t *pool, size_t threads);
+
+/**
+ * \brief process rows in bands and block until all bands are done
+ *
+ * Band height is chosen so that each band reads about
+ * GLC_BAND_SIZE bytes. If pool is already busy with another
+ * frame, rows are processed by the calling thread alone.
+ * \param pool band pool
+ * \param func band callback
+ * \param arg argument passed to func
+ * \param rows number of rows
+ * \param row_size approximative number of bytes read per row
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_band_pool_run(glc_band_pool_t pool, glc_band_func_t func, void *arg,
+			       unsigned int rows, size_t row_size);
+
+/**
+ * \brief index of band pool thread running the band callback
+ *
+ * Lets band callbacks keep scratch state per worker. Pool threads
+ * are numbered from 1 to threads - 1, only one frame is processed
+ * by them at a time. Any other thread, including the one calling
+ * glc_band_pool_run(), gets 0 and may run callbacks of a busy pool
+ * concurrently with pool threads.
+ * \return worker index
+ */
+__PUBLIC unsigned int glc_band_pool_worker(void);
+
+/**
+ * \brief stop pool threads and free the pool
+ * \param pool band pool
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int glc_band_pool_destroy(glc_band_pool_t pool);
+
+/** bytes read per band, keeps band working set in L2 */
+#define GLC_BAND_SIZE                 (256 * 1024)
+
 #ifdef __cplusplus
 }
 #endif
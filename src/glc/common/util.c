@@ -416,6 +416,21 @@ const char *glc_util_msgtype_to_str(glc_message_type_t type)
 	case GLC_CALLBACK_REQUEST:
 		res = "GLC_CALLBACK_REQUEST";
 		break;
+	case GLC_MESSAGE_LZ4:
+		res = "GLC_MESSAGE_LZ4";
+		break;
+	case GLC_MESSAGE_ZSTD:
+		res = "GLC_MESSAGE_ZSTD";
+		break;
+	case GLC_MESSAGE_VIDEO_KEYFRAME:
+		res = "GLC_MESSAGE_VIDEO_KEYFRAME";
+		break;
+	case GLC_MESSAGE_VIDEO_DELTA:
+		res = "GLC_MESSAGE_VIDEO_DELTA";
+		break;
+	case GLC_MESSAGE_TILES:
+		res = "GLC_MESSAGE_TILES";
+		break;
 	default:
 		res = "unknown";
 		break;
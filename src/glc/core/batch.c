@@ -0,0 +1,639 @@
+/**
+ * \file glc/core/batch.c
+ * \brief Batched asynchronous file implementation of the sink interface.
+ * \author agent <agent@local>
+ * \date 2026
+
+    Copyright 2026 agent
+
+    This file is part of glcs.
+
+    glcs is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    glcs is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with glcs.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glc/common/state.h>
+#include <glc/common/log.h>
+#include <glc/common/thread.h>
+#include <glc/common/metrics.h>
+#include <glc/common/optimization.h>
+
+#include <glc/core/tracker.h>
+
+#include "batch.h"
+
+#define BATCH_WRITING       0x1
+#define BATCH_RUNNING       0x2
+#define BATCH_INFO_WRITTEN  0x4
+
+/*
+ * Buffer size and file offsets are multiples of BATCH_ALIGN so that
+ * full buffers can be written with O_DIRECT. Only the last, partial,
+ * buffer is padded with zeroes and the file truncated back to its
+ * real size.
+ */
+#define BATCH_BUFFERS       4
+#define BATCH_BUFFER_SIZE   (8 * 1024 * 1024)
+#define BATCH_ALIGN         4096
+
+#define FILE_MODE (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
+
+struct batch_buffer_s {
+	char *data;
+	size_t len;
+	off_t offset;
+	/* bytes already written by flushes */
+	size_t flushed;
+};
+
+typedef struct {
+	struct sink_s sink_base;
+	glc_t *glc;
+	glc_flags_t flags;
+	glc_thread_t thread;
+	tracker_t state_tracker;
+	callback_request_func_t callback;
+	int sync;
+	int direct;
+	int fd;
+	/* O_DIRECT is effectively used on fd */
+	int fd_direct;
+
+	/*
+	 * Sink thread fills buffer[submitted % BATCH_BUFFERS]. Buffers
+	 * [written, submitted) are full and owned by the writer thread.
+	 * Counters are only modified under mutex, submitted by the sink
+	 * thread and written by the writer thread.
+	 */
+	struct batch_buffer_s buffer[BATCH_BUFFERS];
+	unsigned int submitted;
+	unsigned int written;
+	int io_error;
+	int stop;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	glc_simple_thread_t writer;
+} batch_sink_t;
+
+static void batch_finish_callback(void *ptr, int err);
+static int batch_read_callback(glc_thread_state_t *state);
+static void *batch_writer_thread(void *argptr);
+static int batch_append(batch_sink_t *batch, const void *data, size_t size);
+static int batch_write_message(batch_sink_t *batch, glc_message_header_t *header,
+			       void *message, size_t message_size);
+static int batch_write_state_callback(glc_message_header_t *header, void *message,
+				      size_t message_size, void *arg);
+static int batch_submit(batch_sink_t *batch);
+static int batch_drain(batch_sink_t *batch);
+static int batch_flush(batch_sink_t *batch);
+static int batch_pwrite(int fd, const char *data, size_t size, off_t offset);
+
+static int batch_can_resume(sink_t sink);
+static int batch_set_sync(sink_t sink, int sync);
+static int batch_set_callback(sink_t sink, callback_request_func_t callback);
+static int batch_open_target(sink_t sink, const char *filename);
+static int batch_close_target(sink_t sink);
+static int batch_write_info(sink_t sink, glc_stream_info_t *info,
+			const char *info_name, const char *info_date);
+static int batch_write_eof(sink_t sink);
+static int batch_write_state(sink_t sink);
+static int batch_write_process_start(sink_t sink, ps_buffer_t *from);
+static int batch_write_process_wait(sink_t sink);
+static int batch_sink_destroy(sink_t sink);
+
+static sink_ops_t batch_sink_ops = {
+	.can_resume          = batch_can_resume,
+	.set_sync            = batch_set_sync,
+	.set_callback        = batch_set_callback,
+	.open_target         = batch_open_target,
+	.close_target        = batch_close_target,
+	.write_info          = batch_write_info,
+	.write_eof           = batch_write_eof,
+	.write_state         = batch_write_state,
+	.write_process_start = batch_write_process_start,
+	.write_process_wait  = batch_write_process_wait,
+	.destroy             = batch_sink_destroy,
+};
+
+int batch_sink_init(sink_t *sink, glc_t *glc, int direct)
+{
+	int i;
+	batch_sink_t *batch = (batch_sink_t*)calloc(1, sizeof(batch_sink_t));
+	*sink = (sink_t)batch;
+	if (unlikely(!batch))
+		return ENOMEM;
+
+	for (i = 0; i < BATCH_BUFFERS; i++) {
+		if (unlikely(posix_memalign((void **) &batch->buffer[i].data,
+					    BATCH_ALIGN, BATCH_BUFFER_SIZE))) {
+			while (i--)
+				free(batch->buffer[i].data);
+			free(batch);
+			*sink = NULL;
+			return ENOMEM;
+		}
+	}
+
+	batch->sink_base.ops = &batch_sink_ops;
+	batch->glc           = glc;
+	batch->direct        = direct;
+	batch->fd            = -1;
+	batch->thread.flags  = GLC_THREAD_READ;
+	batch->thread.ptr    = batch;
+	batch->thread.read_callback   = &batch_read_callback;
+	batch->thread.finish_callback = &batch_finish_callback;
+	batch->thread.threads = 1;
+	batch->thread.name   = "batch";
+
+	pthread_mutex_init(&batch->mutex, NULL);
+	pthread_cond_init(&batch->cond, NULL);
+
+	tracker_init(&batch->state_tracker, batch->glc);
+
+	return 0;
+}
+
+int batch_sink_destroy(sink_t sink)
+{
+	int i;
+	batch_sink_t *batch = (batch_sink_t*)sink;
+	tracker_destroy(batch->state_tracker);
+	pthread_cond_destroy(&batch->cond);
+	pthread_mutex_destroy(&batch->mutex);
+	for (i = 0; i < BATCH_BUFFERS; i++)
+		free(batch->buffer[i].data);
+	free(batch);
+	return 0;
+}
+
+int batch_can_resume(sink_t sink)
+{
+	return 1;
+}
+
+int batch_set_sync(sink_t sink, int sync)
+{
+	batch_sink_t *batch = (batch_sink_t*)sink;
+	batch->sync = sync;
+	return 0;
+}
+
+int batch_set_callback(sink_t sink, callback_request_func_t callback)
+{
+	batch_sink_t *batch = (batch_sink_t*)sink;
+	batch->callback = callback;
+	return 0;
+}
+
+int batch_open_target(sink_t sink, const char *filename)
+{
+	int flags, ret;
+	struct flock lock;
+	batch_sink_t *batch = (batch_sink_t*)sink;
+	if (unlikely(batch->fd >= 0))
+		return EBUSY;
+
+	glc_log(batch->glc, GLC_INFO, "batch",
+		 "opening %s for writing stream (%s%s)",
+		 filename,
+		 batch->sync ? "sync" : "no sync",
+		 batch->direct ? ", direct" : "");
+
+	flags = O_CREAT | O_WRONLY | (batch->sync ? O_SYNC : 0);
+	batch->fd_direct = batch->direct;
+	batch->fd = open(filename, flags | (batch->direct ? O_DIRECT : 0), FILE_MODE);
+	if (unlikely(batch->fd < 0 && batch->direct && errno == EINVAL)) {
+		glc_log(batch->glc, GLC_WARN, "batch",
+			 "%s does not support O_DIRECT, using page cache", filename);
+		batch->fd_direct = 0;
+		batch->fd = open(filename, flags, FILE_MODE);
+	}
+
+	if (unlikely(batch->fd < 0)) {
+		ret = errno;
+		glc_log(batch->glc, GLC_ERROR, "batch", "can't open %s: %s (%d)",
+			 filename, strerror(ret), ret);
+		return ret;
+	}
+
+	lock.l_type   = F_WRLCK;
+	lock.l_start  = 0;
+	lock.l_whence = SEEK_SET;
+	lock.l_len    = 0;
+	if (unlikely(fcntl(batch->fd, F_SETLK, &lock) < 0)) {
+		ret = errno;
+		glc_log(batch->glc, GLC_ERROR, "batch",
+			 "can't lock file: %s (%d)", strerror(ret), ret);
+		goto err;
+	}
+
+	/* truncate file when we have locked it */
+	if (unlikely(ftruncate(batch->fd, 0) != 0))
+		glc_log(batch->glc, GLC_WARN, "batch", "ftruncate error: %s (%d)",
+			strerror(errno), errno);
+
+	batch->submitted        = 0;
+	batch->written          = 0;
+	batch->io_error         = 0;
+	batch->stop             = 0;
+	batch->buffer[0].len     = 0;
+	batch->buffer[0].offset  = 0;
+	batch->buffer[0].flushed = 0;
+
+	if (unlikely((ret = glc_simple_thread_create(batch->glc, &batch->writer,
+						     batch_writer_thread, batch))))
+		goto err;
+
+	batch->flags |= BATCH_WRITING;
+	return 0;
+err:
+	close(batch->fd);
+	batch->fd = -1;
+	return ret;
+}
+
+static inline int is_write_open_not_running(batch_sink_t *batch)
+{
+	return batch->fd >= 0 && (batch->flags & BATCH_WRITING) &&
+		!(batch->flags & BATCH_RUNNING);
+}
+
+int batch_close_target(sink_t sink)
+{
+	int ret;
+	struct batch_buffer_s *buf;
+	batch_sink_t *batch = (batch_sink_t*)sink;
+	if (unlikely(!is_write_open_not_running(batch)))
+		return EAGAIN;
+
+	ret = batch_flush(batch);
+
+	pthread_mutex_lock(&batch->mutex);
+	batch->stop = 1;
+	pthread_cond_broadcast(&batch->cond);
+	pthread_mutex_unlock(&batch->mutex);
+	glc_simple_thread_wait(batch->glc, &batch->writer);
+
+	/* drop the padding of the last direct write */
+	buf = &batch->buffer[batch->submitted % BATCH_BUFFERS];
+	if (batch->fd_direct &&
+	    unlikely(ftruncate(batch->fd, buf->offset + buf->len) != 0) && !ret)
+		ret = errno;
+
+	if (unlikely(close(batch->fd)) && !ret)
+		ret = errno;
+	if (unlikely(ret))
+		glc_log(batch->glc, GLC_ERROR, "batch",
+			 "can't close file: %s (%d)", strerror(ret), ret);
+
+	batch->fd = -1;
+	batch->flags &= ~(BATCH_WRITING | BATCH_INFO_WRITTEN);
+
+	return ret;
+}
+
+int batch_write_info(sink_t sink, glc_stream_info_t *info,
+		     const char *info_name, const char *info_date)
+{
+	int ret;
+	batch_sink_t *batch = (batch_sink_t*)sink;
+	if (unlikely(!is_write_open_not_running(batch)))
+		return EAGAIN;
+
+	if (unlikely((ret = batch_append(batch, info, sizeof(glc_stream_info_t)))))
+		goto err;
+	if (unlikely((ret = batch_append(batch, info_name, info->name_size))))
+		goto err;
+	if (unlikely((ret = batch_append(batch, info_date, info->date_size))))
+		goto err;
+
+	if (unlikely(batch->sync))
+		if (unlikely((ret = batch_flush(batch))))
+			goto err;
+
+	batch->flags |= BATCH_INFO_WRITTEN;
+	return 0;
+err:
+	glc_log(batch->glc, GLC_ERROR, "batch",
+		 "can't write stream information: %s (%d)",
+		 strerror(ret), ret);
+	return ret;
+}
+
+int batch_write_message(batch_sink_t *batch, glc_message_header_t *header,
+			void *message, size_t message_size)
+{
+	int ret;
+	glc_size_t glc_size = (glc_size_t) message_size;
+
+	if (unlikely((ret = batch_append(batch, &glc_size, sizeof(glc_size_t)))))
+		return ret;
+	if (unlikely((ret = batch_append(batch, header, sizeof(glc_message_header_t)))))
+		return ret;
+	if (unlikely((ret = batch_append(batch, message, message_size))))
+		return ret;
+
+	if (unlikely(batch->sync))
+		return batch_flush(batch);
+	return 0;
+}
+
+int batch_write_eof(sink_t sink)
+{
+	int ret;
+	batch_sink_t *batch = (batch_sink_t*)sink;
+	glc_message_header_t hdr;
+
+	if (unlikely(!is_write_open_not_running(batch))) {
+	    ret = EAGAIN;
+	    goto err;
+	}
+
+	hdr.type = GLC_MESSAGE_CLOSE;
+	if (unlikely((ret = batch_write_message(batch, &hdr, NULL, 0))))
+		goto err;
+
+	return 0;
+err:
+	glc_log(batch->glc, GLC_ERROR, "batch",
+		 "can't write eof: %s (%d)",
+		 strerror(ret), ret);
+	return ret;
+}
+
+int batch_write_state_callback(glc_message_header_t *header, void *message,
+			       size_t message_size, void *arg)
+{
+	batch_sink_t *batch = arg;
+	return batch_write_message(batch, header, message, message_size);
+}
+
+int batch_write_state(sink_t sink)
+{
+	int ret;
+	batch_sink_t *batch = (batch_sink_t*)sink;
+	if (unlikely(!is_write_open_not_running(batch))) {
+	    ret = EAGAIN;
+	    goto err;
+	}
+
+	if (unlikely((ret = tracker_iterate_state(batch->state_tracker,
+						  &batch_write_state_callback, batch))))
+		goto err;
+
+	return 0;
+err:
+	glc_log(batch->glc, GLC_ERROR, "batch",
+		 "can't write state: %s (%d)",
+		 strerror(ret), ret);
+	return ret;
+}
+
+int batch_write_process_start(sink_t sink, ps_buffer_t *from)
+{
+	int ret;
+	batch_sink_t *batch = (batch_sink_t*)sink;
+	if (unlikely(!is_write_open_not_running(batch) ||
+		     !(batch->flags & BATCH_INFO_WRITTEN)))
+		return EAGAIN;
+
+	if (unlikely((ret = glc_thread_create(batch->glc, &batch->thread,
+					from, NULL))))
+		return ret;
+	batch->flags |= BATCH_RUNNING;
+
+	return 0;
+}
+
+int batch_write_process_wait(sink_t sink)
+{
+	batch_sink_t *batch = (batch_sink_t*)sink;
+	if (unlikely(batch->fd < 0 ||
+		!(batch->flags & BATCH_RUNNING) ||
+		!(batch->flags & BATCH_WRITING) ||
+		!(batch->flags & BATCH_INFO_WRITTEN)))
+		return EAGAIN;
+
+	glc_thread_wait(&batch->thread);
+	batch->flags &= ~BATCH_RUNNING;
+
+	return 0;
+}
+
+void batch_finish_callback(void *ptr, int err)
+{
+	batch_sink_t *batch = (batch_sink_t*) ptr;
+
+	if (unlikely(err))
+		glc_log(batch->glc, GLC_ERROR, "batch", "%s (%d)",
+			strerror(err), err);
+}
+
+int batch_read_callback(glc_thread_state_t *state)
+{
+	batch_sink_t *batch = (batch_sink_t*) state->ptr;
+	glc_container_message_header_t *container;
+	glc_callback_request_t *callback_req;
+	int ret = 0;
+
+	/* let state tracker to process this message */
+	tracker_submit(batch->state_tracker, &state->header, state->read_data, state->read_size);
+
+	if (state->header.type == GLC_CALLBACK_REQUEST) {
+		/* callback request messages are never written to disk */
+		if (batch->callback != NULL) {
+			/* callbacks may manipulate target file so remove BATCH_RUNNING flag */
+			batch->flags &= ~BATCH_RUNNING;
+			callback_req = (glc_callback_request_t *) state->read_data;
+			batch->callback(callback_req->arg);
+			batch->flags |= BATCH_RUNNING;
+		}
+	} else if (state->header.type == GLC_MESSAGE_CONTAINER) {
+		container = (glc_container_message_header_t *) state->read_data;
+		ret = batch_append(batch, state->read_data,
+			sizeof(glc_container_message_header_t) + container->size);
+		if (likely(!ret) && unlikely(batch->sync))
+			ret = batch_flush(batch);
+	} else {
+		/* emulate container message */
+		ret = batch_write_message(batch, &state->header, state->read_data,
+					  state->read_size);
+	}
+
+	if (unlikely(ret))
+		glc_log(batch->glc, GLC_ERROR, "batch",
+			 "can't write message: %s (%d)", strerror(ret), ret);
+	else
+		glc_metrics_frame_written(batch->glc, &state->header, state->read_data);
+	return ret;
+}
+
+int batch_append(batch_sink_t *batch, const void *data, size_t size)
+{
+	struct batch_buffer_s *buf = &batch->buffer[batch->submitted % BATCH_BUFFERS];
+	size_t len;
+	int ret;
+
+	while (size) {
+		len = BATCH_BUFFER_SIZE - buf->len;
+		if (len > size)
+			len = size;
+		memcpy(&buf->data[buf->len], data, len);
+		buf->len += len;
+		data = (const char *) data + len;
+		size -= len;
+
+		if (buf->len == BATCH_BUFFER_SIZE) {
+			if (unlikely((ret = batch_submit(batch))))
+				return ret;
+			buf = &batch->buffer[batch->submitted % BATCH_BUFFERS];
+		}
+	}
+	return 0;
+}
+
+/*
+ * Hands the full current buffer to the writer thread and waits
+ * until the next one is free.
+ */
+int batch_submit(batch_sink_t *batch)
+{
+	struct batch_buffer_s *buf;
+	off_t offset = batch->buffer[batch->submitted % BATCH_BUFFERS].offset +
+		       BATCH_BUFFER_SIZE;
+	int ret;
+
+	pthread_mutex_lock(&batch->mutex);
+	batch->submitted++;
+	pthread_cond_broadcast(&batch->cond);
+	while (batch->submitted - batch->written >= BATCH_BUFFERS)
+		pthread_cond_wait(&batch->cond, &batch->mutex);
+	ret = batch->io_error;
+	pthread_mutex_unlock(&batch->mutex);
+
+	buf = &batch->buffer[batch->submitted % BATCH_BUFFERS];
+	buf->len = 0;
+	buf->offset = offset;
+	buf->flushed = 0;
+	return ret;
+}
+
+int batch_drain(batch_sink_t *batch)
+{
+	int ret;
+
+	pthread_mutex_lock(&batch->mutex);
+	while (batch->written != batch->submitted)
+		pthread_cond_wait(&batch->cond, &batch->mutex);
+	ret = batch->io_error;
+	pthread_mutex_unlock(&batch->mutex);
+	return ret;
+}
+
+/*
+ * Writes out everything appended since the last flush. The current
+ * buffer stays current, with O_DIRECT the partial block written last
+ * is written again by the next flush or the final buffer write. The
+ * padding is zeroed and cut off so that the file always ends with a
+ * complete message.
+ */
+int batch_flush(batch_sink_t *batch)
+{
+	struct batch_buffer_s *buf = &batch->buffer[batch->submitted % BATCH_BUFFERS];
+	size_t start = buf->flushed, end = buf->len;
+	int ret;
+
+	if (unlikely((ret = batch_drain(batch))))
+		return ret;
+	if (start == end)
+		return 0;
+	if (batch->fd_direct) {
+		start &= ~((size_t) BATCH_ALIGN - 1);
+		end = (end + BATCH_ALIGN - 1) & ~((size_t) BATCH_ALIGN - 1);
+		memset(&buf->data[buf->len], 0, end - buf->len);
+	}
+
+	if (unlikely((ret = batch_pwrite(batch->fd, &buf->data[start], end - start,
+					 buf->offset + start))))
+		return ret;
+	buf->flushed = buf->len;
+
+	if (batch->fd_direct && (end != buf->len) &&
+	    unlikely(ftruncate(batch->fd, buf->offset + buf->len) != 0))
+		return errno;
+	return 0;
+}
+
+void *batch_writer_thread(void *argptr)
+{
+	batch_sink_t *batch = (batch_sink_t *) argptr;
+	struct batch_buffer_s *buf;
+	size_t start;
+	int ret;
+
+	pthread_mutex_lock(&batch->mutex);
+	for (;;) {
+		while (batch->written == batch->submitted && !batch->stop)
+			pthread_cond_wait(&batch->cond, &batch->mutex);
+		if (batch->written == batch->submitted)
+			break;
+		buf = &batch->buffer[batch->written % BATCH_BUFFERS];
+		/* skip what flushes already wrote */
+		start = buf->flushed & ~((size_t) BATCH_ALIGN - 1);
+		pthread_mutex_unlock(&batch->mutex);
+
+		ret = batch_pwrite(batch->fd, &buf->data[start], BATCH_BUFFER_SIZE - start,
+				   buf->offset + start);
+
+		pthread_mutex_lock(&batch->mutex);
+		/* buffers are still consumed on error so the sink never blocks */
+		if (unlikely(ret && !batch->io_error)) {
+			glc_log(batch->glc, GLC_ERROR, "batch",
+				 "write failed: %s (%d)", strerror(ret), ret);
+			batch->io_error = ret;
+		}
+		batch->written++;
+		pthread_cond_broadcast(&batch->cond);
+	}
+	pthread_mutex_unlock(&batch->mutex);
+	return NULL;
+}
+
+int batch_pwrite(int fd, const char *data, size_t size, off_t offset)
+{
+	ssize_t ret;
+
+	while (size) {
+		ret = pwrite(fd, data, size, offset);
+		if (unlikely(ret < 0)) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		} else if (unlikely(!ret))
+			return EIO;
+		data += ret;
+		size -= ret;
+		offset += ret;
+	}
+	return 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * \file glc/core/batch.h
+ * \brief Batched asynchronous file implementation of the sink interface.
+ * \author agent <agent@local>
+ * \date 2026
+
+    Copyright 2026 agent
+
+    This file is part of glcs.
+
+    glcs is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    glcs is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with glcs.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <glc/core/sink.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief initialize batched file sink object
+ *
+ * Writes the same stream file as file_sink_init() but messages
+ * are gathered into large aligned buffers that a writer thread
+ * writes with pwrite() while the next buffer is being filled.
+ * \param sink sink object
+ * \param glc glc
+ * \param direct open target with O_DIRECT to bypass the page cache
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int batch_sink_init(sink_t *sink, glc_t *glc, int direct);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -45,20 +45,48 @@
 #include <glc/common/optimization.h>
 
 #include "color.h"
+#include "colorspace.h"
 
-#define LOOKUP_BITS 8
-#define YCBCR_LOOKUP_POS(Y, Cb, Cr) \
-	(((((Y)  >> (8 - LOOKUP_BITS)) << (LOOKUP_BITS * 2)) + \
-	  (((Cb) >> (8 - LOOKUP_BITS)) << LOOKUP_BITS) + \
-	  ( (Cr) >> (8 - LOOKUP_BITS))) * 3)
+#ifdef __x86_64__
+# include <immintrin.h>
+# define COLOR_SIMD
+#endif
 
+/*
+ * Y'CbCr is corrected by converting to R'G'B' with the same fixed
+ * point arithmetic as rgb, applying the per channel curves and
+ * converting back with the same arithmetic as ycbcr.
+ */
 #define COLOR_RUNNING     0x1
 #define COLOR_OVERRIDE    0x2
 
 struct color_video_stream_s;
 
+/**
+ * \brief SIMD kernel set
+ *
+ * Curves are int tables so that they can be gathered, curve[0] is
+ * red, curve[1] green and curve[2] blue.
+ */
+struct color_kernels_s {
+	/* same first members as glc_simd_kernels_t */
+	const char *name;
+	glc_flags_t simd;
+	/** correct n BGR or BGRA pixels, alpha is kept */
+	void (*bgr)(const int curve[3][256], const unsigned char *from,
+		    unsigned char *to, unsigned int n, unsigned int bpp);
+	/** correct n 2x2 Y'CbCr blocks */
+	void (*ycbcr)(const int curve[3][256],
+		      const unsigned char *Ytop, const unsigned char *Ybottom,
+		      const unsigned char *Cb, const unsigned char *Cr, unsigned int n,
+		      unsigned char *Ytop_to, unsigned char *Ybottom_to,
+		      unsigned char *Cb_to, unsigned char *Cr_to);
+};
+
+/* Y'CbCr procs process row pairs [first, last), BGR procs rows */
 typedef void (*color_proc)(color_t color, struct color_video_stream_s *video,
-			   unsigned char *from, unsigned char *to);
+			   unsigned char *from, unsigned char *to,
+			   unsigned int first, unsigned int last);
 
 struct color_video_stream_s {
 	glc_stream_id_t id;
@@ -70,7 +98,9 @@ struct color_video_stream_s {
 	float brightness, contrast;
 	float red_gamma, green_gamma, blue_gamma;
 
-	unsigned char *lookup_table;
+	/* got color message */
+	int corrected;
+	int curve[3][256];
 	color_proc proc;
 
 	pthread_rwlock_t update;
@@ -81,6 +111,8 @@ struct color_s {
 	glc_t *glc;
 	glc_flags_t flags;
 	glc_thread_t thread;
+	glc_band_pool_t bands;
+	const struct color_kernels_s *kernels;
 
 	struct color_video_stream_s *video;
 
@@ -88,9 +120,16 @@ struct color_s {
 	float red_gamma, green_gamma, blue_gamma;
 };
 
+struct color_band_job_s {
+	color_t color;
+	struct color_video_stream_s *video;
+	unsigned char *from, *to;
+};
+
 static int color_read_callback(glc_thread_state_t *state);
 static int color_write_callback(glc_thread_state_t *state);
 static void color_finish_callback(void *ptr, int err);
+static void color_band(void *arg, unsigned int first, unsigned int last);
 
 static void color_get_video_stream(color_t color, glc_stream_id_t id,
 		   struct color_video_stream_s **video);
@@ -98,15 +137,25 @@ static void color_get_video_stream(color_t color, glc_stream_id_t id,
 static int color_video_format_msg(color_t color, glc_video_format_message_t *msg);
 static int color_color_msg(color_t color, glc_color_message_t *msg);
 
-static int color_generate_ycbcr_lookup_table(color_t color,
-				      struct color_video_stream_s *video);
-static int color_generate_rgb_lookup_table(color_t color,
-				    struct color_video_stream_s *video);
+static void color_update(color_t color, struct color_video_stream_s *video);
+static int color_generate_lookup_table(struct color_video_stream_s *video);
 
 static void color_ycbcr(color_t color, struct color_video_stream_s *video,
-		 unsigned char *from, unsigned char *to);
+		 unsigned char *from, unsigned char *to,
+		 unsigned int first, unsigned int last);
 static void color_bgr(color_t color, struct color_video_stream_s *video,
-	       unsigned char *from, unsigned char *to);
+	       unsigned char *from, unsigned char *to,
+	       unsigned int first, unsigned int last);
+static void color_bgr_c(const int curve[3][256], const unsigned char *from,
+			unsigned char *to, unsigned int n, unsigned int bpp);
+static void color_ycbcr_c(const int curve[3][256],
+			  const unsigned char *Ytop, const unsigned char *Ybottom,
+			  const unsigned char *Cb, const unsigned char *Cr, unsigned int n,
+			  unsigned char *Ytop_to, unsigned char *Ybottom_to,
+			  unsigned char *Cb_to, unsigned char *Cr_to);
+
+static void color_select_kernels(color_t color);
+static int color_test_kernels(void *ptr, const void *kernels, glc_simd_test_t *test);
 
 /* unfortunately over- and underflows will occur */
 __inline__ static unsigned char color_clamp(int val)
@@ -130,6 +179,9 @@ int color_init(color_t *color, glc_t *glc)
 	(*color)->thread.finish_callback = &color_finish_callback;
 	(*color)->thread.ptr = *color;
 	(*color)->thread.threads = glc_threads_hint(glc);
+	(*color)->thread.name = "color";
+
+	color_select_kernels(*color);
 
 	return 0;
 }
@@ -146,8 +198,21 @@ int color_process_start(color_t color, ps_buffer_t *from, ps_buffer_t *to)
 	if (unlikely(color->flags & COLOR_RUNNING))
 		return EAGAIN;
 
-	if (unlikely((ret = glc_thread_create(color->glc, &color->thread, from, to))))
+	if (glc_frame_threads(color->glc) > 1) {
+		if (unlikely((ret = glc_band_pool_create(color->glc, &color->bands,
+							 glc_frame_threads(color->glc)))))
+			return ret;
+		color->thread.threads = 1;
+	} else
+		color->thread.threads = glc_threads_hint(color->glc);
+
+	if (unlikely((ret = glc_thread_create(color->glc, &color->thread, from, to)))) {
+		if (color->bands) {
+			glc_band_pool_destroy(color->bands);
+			color->bands = NULL;
+		}
 		return ret;
+	}
 	color->flags |= COLOR_RUNNING;
 
 	return 0;
@@ -161,6 +226,11 @@ int color_process_wait(color_t color)
 	glc_thread_wait(&color->thread);
 	color->flags &= ~COLOR_RUNNING;
 
+	if (color->bands) {
+		glc_band_pool_destroy(color->bands);
+		color->bands = NULL;
+	}
+
 	return 0;
 }
 
@@ -196,7 +266,6 @@ void color_finish_callback(void *ptr, int err)
 		color->video = color->video->next;
 
 		pthread_rwlock_destroy(&del->update);
-		free(del->lookup_table);
 		free(del);
 	}
 }
@@ -237,17 +306,36 @@ int color_read_callback(glc_thread_state_t *state)
 
 int color_write_callback(glc_thread_state_t *state)
 {
+	color_t color = (color_t) state->ptr;
 	struct color_video_stream_s *video = state->threadptr;
+	struct color_band_job_s job;
+	unsigned int rows;
 
 	memcpy(state->write_data, state->read_data, sizeof(glc_video_frame_header_t));
-	video->proc(state->ptr, video,
-		  (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)],
-		  (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)]);
+
+	job.color = color;
+	job.video = video;
+	job.from = (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)];
+	job.to = (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)];
+	rows = (video->format == GLC_VIDEO_YCBCR_420JPEG) ? video->h / 2 : video->h;
+
+	if (color->bands)
+		glc_band_pool_run(color->bands, color_band, &job, rows,
+				  (video->format == GLC_VIDEO_YCBCR_420JPEG) ?
+				  3 * video->w : video->row);
+	else
+		video->proc(color, video, job.from, job.to, 0, rows);
 
 	pthread_rwlock_unlock(&video->update);
 	return 0;
 }
 
+void color_band(void *arg, unsigned int first, unsigned int last)
+{
+	struct color_band_job_s *job = arg;
+	job->video->proc(job->color, job->video, job->from, job->to, first, last);
+}
+
 void color_get_video_stream(color_t color, glc_stream_id_t id,
 		   struct color_video_stream_s **video)
 {
@@ -312,41 +400,15 @@ int color_video_format_msg(color_t color, glc_video_format_message_t *msg)
 			 msg->id, video->brightness, video->contrast,
 			 video->red_gamma, video->green_gamma, video->blue_gamma);
 
-		if ((video->brightness == 0) &&
-		    (video->contrast == 0) &&
-		    (video->red_gamma == 1) &&
-		    (video->green_gamma == 1) &&
-		    (video->blue_gamma == 1)) {
-			glc_log(color->glc, GLC_INFO, "color",
-				"skipping color correction");
-			video->proc = NULL;
-		} else if (video->format == GLC_VIDEO_YCBCR_420JPEG) {
-			color_generate_ycbcr_lookup_table(color, video);
-			video->proc = &color_ycbcr;
-		} else if ((video->format == GLC_VIDEO_BGR) ||
-			   (video->format == GLC_VIDEO_BGRA)) {
-			color_generate_rgb_lookup_table(color, video);
-			video->proc = &color_bgr;
-		} else {
-			/* set proc NULL -> no conversion done */
+		if ((video->format != GLC_VIDEO_YCBCR_420JPEG) &&
+		    (video->format != GLC_VIDEO_BGR) &&
+		    (video->format != GLC_VIDEO_BGRA))
 			glc_log(color->glc, GLC_WARN, "color",
 				"unsupported video %d", msg->id);
-			video->proc = NULL;
-		}
-	} else if (((old_format == GLC_VIDEO_BGR) ||
-		    (old_format == GLC_VIDEO_BGRA)) &&
-		   (msg->format == GLC_VIDEO_YCBCR_420JPEG)) {
-		glc_log(color->glc, GLC_WARN, "color",
-			 "colorspace switched from RGB to Y'CbCr, recalculating lookup table");
-		color_generate_ycbcr_lookup_table(color, video);
-		video->proc = &color_ycbcr;
-	} else if (((msg->format == GLC_VIDEO_BGR) ||
-		    (msg->format == GLC_VIDEO_BGRA)) &&
-		   (old_format == GLC_VIDEO_YCBCR_420JPEG)) {
-		glc_log(color->glc, GLC_WARN, "color",
-			 "colorspace switched from Y'CbCr to RGB, recalculating lookup table");
-		color_generate_rgb_lookup_table(color, video);
-		video->proc = &color_bgr;
+		color_update(color, video);
+	} else if ((video->corrected) && (old_format != video->format)) {
+		/* curves don't depend on colorspace, only proc changes */
+		color_update(color, video);
 	}
 
 	pthread_rwlock_unlock(&video->update);
@@ -374,183 +436,393 @@ int color_color_msg(color_t color, glc_color_message_t *msg)
 		 msg->id, video->brightness, video->contrast,
 		 video->red_gamma, video->green_gamma, video->blue_gamma);
 
-	if ((video->brightness == 0) &&
-	    (video->contrast == 0) &&
-	    (video->red_gamma == 1) &&
-	    (video->green_gamma == 1) &&
-	    (video->blue_gamma == 1)) {
+	video->corrected = 1;
+	color_update(color, video);
+
+	pthread_rwlock_unlock(&video->update);
+	return 0;
+}
+
+void color_update(color_t color, struct color_video_stream_s *video)
+{
+	if (color_generate_lookup_table(video)) {
 		glc_log(color->glc, GLC_INFO, "color", "skipping color correction");
 		video->proc = NULL;
-	} else if (video->format == GLC_VIDEO_YCBCR_420JPEG) {
-		color_generate_ycbcr_lookup_table(color, video);
+	} else if (video->format == GLC_VIDEO_YCBCR_420JPEG)
 		video->proc = &color_ycbcr;
-	} else if ((video->format == GLC_VIDEO_BGR) ||
-		   (video->format == GLC_VIDEO_BGRA)) {
-		color_generate_rgb_lookup_table(color, video);
+	else if ((video->format == GLC_VIDEO_BGR) ||
+		 (video->format == GLC_VIDEO_BGRA))
 		video->proc = &color_bgr;
-	} else
+	else
 		video->proc = NULL; /* don't attempt anything... */
-
-	pthread_rwlock_unlock(&video->update);
-	return 0;
 }
 
 void color_ycbcr(color_t color,
 		 struct color_video_stream_s *video,
-		 unsigned char *from, unsigned char *to)
+		 unsigned char *from, unsigned char *to,
+		 unsigned int first, unsigned int last)
 {
-	unsigned int x, y, Cpix, Y;
-	unsigned int pos;
+	unsigned int y, cw = video->w / 2;
 	unsigned char *Y_from, *Cb_from, *Cr_from;
 	unsigned char *Y_to, *Cb_to, *Cr_to;
 
 	Y_from = from;
 	Cb_from = &from[video->h * video->w];
-	Cr_from = &from[video->h * video->w + (video->h / 2) * (video->w / 2)];
+	Cr_from = &from[video->h * video->w + (video->h / 2) * cw];
 
 	Y_to = to;
 	Cb_to = &to[video->h * video->w];
-	Cr_to = &to[video->h * video->w + (video->h / 2) * (video->w / 2)];
-
-	Cpix = 0;
+	Cr_to = &to[video->h * video->w + (video->h / 2) * cw];
+
+	for (y = first * 2; y < last * 2; y += 2)
+		color->kernels->ycbcr((const int (*)[256]) video->curve,
+				      &Y_from[y * video->w], &Y_from[(y + 1) * video->w],
+				      &Cb_from[(y / 2) * cw], &Cr_from[(y / 2) * cw], cw,
+				      &Y_to[y * video->w], &Y_to[(y + 1) * video->w],
+				      &Cb_to[(y / 2) * cw], &Cr_to[(y / 2) * cw]);
+}
 
-#define CONVERT_Y(xadd, yadd) 								\
-	pos = YCBCR_LOOKUP_POS(Y_from[(x + (xadd)) + (y + (yadd)) * video->w],		\
-			       Cb_from[Cpix], Cr_from[Cpix]);				\
-	Y_to[(x + (xadd)) + (y + (yadd)) * video->w] = video->lookup_table[pos + 0];	\
-	Y += video->lookup_table[pos + 0];
+void color_bgr(color_t color,
+	       struct color_video_stream_s *video,
+	       unsigned char *from, unsigned char *to,
+	       unsigned int first, unsigned int last)
+{
+	unsigned int y;
 
-	for (y = 0; y < video->h; y += 2) {
-		for (x = 0; x < video->w; x += 2) {
-			Y = 0;
+	for (y = first; y < last; y++)
+		color->kernels->bgr((const int (*)[256]) video->curve,
+				    &from[video->row * y], &to[video->row * y],
+				    video->w, video->bpp);
+}
 
-			CONVERT_Y(0, 0)
-			CONVERT_Y(0, 1)
-			CONVERT_Y(1, 0)
-			CONVERT_Y(1, 1)
+void color_bgr_c(const int curve[3][256], const unsigned char *from,
+		 unsigned char *to, unsigned int n, unsigned int bpp)
+{
+	unsigned int x, p;
+
+	for (x = 0, p = 0; x < n; x++, p += bpp) {
+		to[p + 0] = curve[2][from[p + 0]];
+		to[p + 1] = curve[1][from[p + 1]];
+		to[p + 2] = curve[0][from[p + 2]];
+		if (bpp == 4)
+			to[p + 3] = from[p + 3];
+	}
+}
 
-			pos = YCBCR_LOOKUP_POS(Y >> 2, Cb_from[Cpix], Cr_from[Cpix]);
-			Cb_to[Cpix] = video->lookup_table[pos + 1];
-			Cr_to[Cpix] = video->lookup_table[pos + 2];
+/* corrected Y' of one sample, Cb and Cr already have 128 subtracted */
+__inline__ static int color_ycbcr_y(const int curve[3][256], int Y, int Cb, int Cr)
+{
+	return RGB_TO_YCbCrJPEG_Y(curve[0][color_clamp(Y + YCbCrJPEG_Cr_R(Cr))],
+			      curve[1][color_clamp(Y + YCbCrJPEG_CbCr_G(Cb, Cr))],
+			      curve[2][color_clamp(Y + YCbCrJPEG_Cb_B(Cb))]);
+}
 
-			Cpix++;
-		}
+void color_ycbcr_c(const int curve[3][256],
+		   const unsigned char *Ytop, const unsigned char *Ybottom,
+		   const unsigned char *Cb, const unsigned char *Cr, unsigned int n,
+		   unsigned char *Ytop_to, unsigned char *Ybottom_to,
+		   unsigned char *Cb_to, unsigned char *Cr_to)
+{
+	unsigned int i, x;
+	int cb, cr, Y, R, G, B;
+
+	for (i = 0; i < n; i++) {
+		cb = Cb[i] - 128;
+		cr = Cr[i] - 128;
+		x = i * 2;
+
+		Y  = Ytop_to[x]        = color_ycbcr_y(curve, Ytop[x], cb, cr);
+		Y += Ytop_to[x + 1]    = color_ycbcr_y(curve, Ytop[x + 1], cb, cr);
+		Y += Ybottom_to[x]     = color_ycbcr_y(curve, Ybottom[x], cb, cr);
+		Y += Ybottom_to[x + 1] = color_ycbcr_y(curve, Ybottom[x + 1], cb, cr);
+
+		/* chroma from the corrected average luma */
+		Y >>= 2;
+		R = curve[0][color_clamp(Y + YCbCrJPEG_Cr_R(cr))];
+		G = curve[1][color_clamp(Y + YCbCrJPEG_CbCr_G(cb, cr))];
+		B = curve[2][color_clamp(Y + YCbCrJPEG_Cb_B(cb))];
+		Cb_to[i] = color_clamp(RGB_TO_YCbCrJPEG_Cb(R, G, B));
+		Cr_to[i] = color_clamp(RGB_TO_YCbCrJPEG_Cr(R, G, B));
 	}
 }
 
-void color_bgr(color_t color,
-	       struct color_video_stream_s *video,
-	       unsigned char *from, unsigned char *to)
+#ifdef COLOR_SIMD
+
+/*
+ * AVX2 kernels do the curve lookups with gathers, everything else is
+ * the same integer arithmetic as the scalar kernels on 32 bit lanes.
+ */
+
+__attribute__((target("avx2")))
+static inline __m256i color_avx2_clamp(__m256i v)
+{
+	return _mm256_min_epi32(_mm256_max_epi32(v, _mm256_setzero_si256()),
+				_mm256_set1_epi32(255));
+}
+
+/* BGRX pixels in 32 bit lanes, X is kept */
+__attribute__((target("avx2")))
+static inline __m256i color_avx2_bgrx(const int curve[3][256], __m256i p)
 {
-	unsigned int x, y, p;
+	const __m256i m = _mm256_set1_epi32(0xff);
+	__m256i B, G, R;
+
+	B = _mm256_i32gather_epi32(curve[2], _mm256_and_si256(p, m), 4);
+	G = _mm256_i32gather_epi32(curve[1], _mm256_and_si256(_mm256_srli_epi32(p, 8), m), 4);
+	R = _mm256_i32gather_epi32(curve[0], _mm256_and_si256(_mm256_srli_epi32(p, 16), m), 4);
 
-	for (y = 0; y < video->h; y++) {
-		for (x = 0; x < video->w; x++) {
-			p = video->row * y + x * video->bpp;
+	return _mm256_or_si256(_mm256_or_si256(B, _mm256_slli_epi32(G, 8)),
+			       _mm256_or_si256(_mm256_slli_epi32(R, 16),
+					       _mm256_andnot_si256(_mm256_set1_epi32(0xffffff), p)));
+}
 
-			to[p + 0] = video->lookup_table[256 + 256 + from[p + 0]];
-			to[p + 1] = video->lookup_table[256       + from[p + 1]];
-			to[p + 2] = video->lookup_table[            from[p + 2]];
+__attribute__((target("avx2")))
+static void color_bgr_avx2(const int curve[3][256], const unsigned char *from,
+			   unsigned char *to, unsigned int n, unsigned int bpp)
+{
+	/* 8 BGR pixels are 24 bytes, spread them over the two lanes */
+	const __m256i spread = _mm256_setr_epi32(0, 1, 2, 2, 3, 4, 5, 5);
+	const __m256i expand = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+						6, 7, 8, -1, 9, 10, 11, -1,
+						0, 1, 2, -1, 3, 4, 5, -1,
+						6, 7, 8, -1, 9, 10, 11, -1);
+	const __m256i shrink = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9,
+						10, 12, 13, 14, -1, -1, -1, -1,
+						0, 1, 2, 4, 5, 6, 8, 9,
+						10, 12, 13, 14, -1, -1, -1, -1);
+	const __m256i gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	__m256i p;
+	unsigned int x = 0;
+
+	if (bpp == 4) {
+		for (; x + 8 <= n; x += 8)
+			_mm256_storeu_si256((__m256i *) &to[x * 4],
+					    color_avx2_bgrx(curve,
+						_mm256_loadu_si256((const __m256i *) &from[x * 4])));
+	} else {
+		/* 32 byte loads, stay clear of the end of the row */
+		for (; x + 11 <= n; x += 8) {
+			p = _mm256_loadu_si256((const __m256i *) &from[x * 3]);
+			p = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(p, spread), expand);
+			p = _mm256_shuffle_epi8(color_avx2_bgrx(curve, p), shrink);
+			p = _mm256_permutevar8x32_epi32(p, gather);
+			_mm_storeu_si128((__m128i *) &to[x * 3], _mm256_castsi256_si128(p));
+			_mm_storel_epi64((__m128i *) &to[x * 3 + 16],
+					 _mm256_extracti128_si256(p, 1));
 		}
 	}
-}
 
-#define CLAMP_256(val) \
-	(val) < 0 ? 0 : ((val) > 255 ? 255 : (val))
+	color_bgr_c(curve, &from[x * bpp], &to[x * bpp], n - x, bpp);
+}
 
-unsigned char YCbCr_TO_RGB_Rd(unsigned char Y, unsigned char Cb, unsigned char Cr)
+__attribute__((target("avx2")))
+static inline __m256i color_avx2_dot(__m256i R, __m256i G, __m256i B,
+				     int kR, int kG, int kB)
 {
-	int R = Y + 1.402 * (Cr - 128);
-	return CLAMP_256(R);
+	return _mm256_srai_epi32(
+		_mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(R, _mm256_set1_epi32(kR)),
+						  _mm256_mullo_epi32(G, _mm256_set1_epi32(kG))),
+				 _mm256_mullo_epi32(B, _mm256_set1_epi32(kB))), 10);
 }
 
-unsigned char YCbCr_TO_RGB_Gd(unsigned char Y, unsigned char Cb, unsigned char Cr)
+__attribute__((target("avx2")))
+static inline void color_avx2_rgb(const int curve[3][256], __m256i Y,
+				  __m256i dR, __m256i dG, __m256i dB,
+				  __m256i *R, __m256i *G, __m256i *B)
 {
-	int G = Y - 0.344136 * (Cb - 128) - 0.714136 * (Cr - 128);
-	return CLAMP_256(G);
+	*R = _mm256_i32gather_epi32(curve[0], color_avx2_clamp(_mm256_add_epi32(Y, dR)), 4);
+	*G = _mm256_i32gather_epi32(curve[1], color_avx2_clamp(_mm256_add_epi32(Y, dG)), 4);
+	*B = _mm256_i32gather_epi32(curve[2], color_avx2_clamp(_mm256_add_epi32(Y, dB)), 4);
 }
 
-unsigned char YCbCr_TO_RGB_Bd(unsigned char Y, unsigned char Cb, unsigned char Cr)
+__attribute__((target("avx2")))
+static inline __m256i color_avx2_y(const int curve[3][256], __m256i Y,
+				   __m256i dR, __m256i dG, __m256i dB)
 {
-	int B = Y + 1.772 * (Cb - 128);
-	return CLAMP_256(B);
+	__m256i R, G, B;
+	color_avx2_rgb(curve, Y, dR, dG, dB, &R, &G, &B);
+	return color_avx2_dot(R, G, B, YCbCrJPEG_K_R_Y, YCbCrJPEG_K_G_Y, YCbCrJPEG_K_B_Y);
 }
 
-#define RGB_TO_YCbCrJPEG_Y(Rd, Gd, Bd) \
-	(    + 0.299    * (Rd) +    0.587 * (Gd) + 0.114 *    (Bd))
-#define RGB_TO_YCbCrJPEG_Cb(Rd, Gd, Bd) \
-	(128 - 0.168736 * (Rd) - 0.331264 * (Gd) + 0.5      * (Bd))
-#define RGB_TO_YCbCrJPEG_Cr(Rd, Gd, Bd) \
-	(128 + 0.5      * (Rd) - 0.418688 * (Gd) - 0.081312 * (Bd))
+/* even and odd samples of 8 blocks as 32 bit values into 16 bytes */
+__attribute__((target("avx2")))
+static inline void color_avx2_store_y(unsigned char *to, __m256i even, __m256i odd)
+{
+	__m256i v = _mm256_or_si256(even, _mm256_slli_epi32(odd, 16));
+	_mm_storeu_si128((__m128i *) to, _mm_packus_epi16(_mm256_castsi256_si128(v),
+							  _mm256_extracti128_si256(v, 1)));
+}
 
-int color_generate_ycbcr_lookup_table(color_t color,
-				      struct color_video_stream_s *video)
+__attribute__((target("avx2")))
+static void color_ycbcr_avx2(const int curve[3][256],
+			     const unsigned char *Ytop, const unsigned char *Ybottom,
+			     const unsigned char *Cb, const unsigned char *Cr, unsigned int n,
+			     unsigned char *Ytop_to, unsigned char *Ybottom_to,
+			     unsigned char *Cb_to, unsigned char *Cr_to)
 {
-	unsigned int Y, Cb, Cr, pos;
-	unsigned char R, G, B;
-	size_t lookup_size = (1 << LOOKUP_BITS) * (1 << LOOKUP_BITS) * (1 << LOOKUP_BITS) * 3;
+	const __m256i lo = _mm256_set1_epi32(0xffff);
+	const __m256i c128 = _mm256_set1_epi32(128);
+	const __m256i round = _mm256_set1_epi32(YCbCrJPEG_ROUND);
+	__m256i cb, cr, dR, dG, dB, t, b, te, to, be, bo, R, G, B;
+	__m128i v;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		cb = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) &Cb[i])), c128);
+		cr = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) &Cr[i])), c128);
+
+		dR = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(cr, _mm256_set1_epi32(YCbCrJPEG_K_Cr_R)),
+							round), YCbCrJPEG_FIX_BITS);
+		dG = _mm256_srai_epi32(_mm256_sub_epi32(round, _mm256_add_epi32(
+					_mm256_mullo_epi32(cb, _mm256_set1_epi32(YCbCrJPEG_K_Cb_G)),
+					_mm256_mullo_epi32(cr, _mm256_set1_epi32(YCbCrJPEG_K_Cr_G)))),
+				       YCbCrJPEG_FIX_BITS);
+		dB = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(cb, _mm256_set1_epi32(YCbCrJPEG_K_Cb_B)),
+							round), YCbCrJPEG_FIX_BITS);
+
+		/* 16 samples as 16 bit, even samples in the low halves */
+		t = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) &Ytop[i * 2]));
+		b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) &Ybottom[i * 2]));
+
+		te = color_avx2_y(curve, _mm256_and_si256(t, lo), dR, dG, dB);
+		to = color_avx2_y(curve, _mm256_srli_epi32(t, 16), dR, dG, dB);
+		be = color_avx2_y(curve, _mm256_and_si256(b, lo), dR, dG, dB);
+		bo = color_avx2_y(curve, _mm256_srli_epi32(b, 16), dR, dG, dB);
+
+		color_avx2_store_y(&Ytop_to[i * 2], te, to);
+		color_avx2_store_y(&Ybottom_to[i * 2], be, bo);
+
+		t = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(te, to),
+						       _mm256_add_epi32(be, bo)), 2);
+		color_avx2_rgb(curve, t, dR, dG, dB, &R, &G, &B);
+		cb = _mm256_sub_epi32(c128, color_avx2_dot(R, G, B, YCbCrJPEG_K_R_Cb,
+							   YCbCrJPEG_K_G_Cb, -YCbCrJPEG_K_B_Cb));
+		cr = _mm256_add_epi32(c128, color_avx2_dot(R, G, B, YCbCrJPEG_K_R_Cr,
+							   -YCbCrJPEG_K_G_Cr, -YCbCrJPEG_K_B_Cr));
+
+		/* in-lane pack gives Cb 0-3, Cr 0-3, Cb 4-7, Cr 4-7 */
+		t = _mm256_permute4x64_epi64(_mm256_packs_epi32(cb, cr), _MM_SHUFFLE(3, 1, 2, 0));
+		v = _mm_packus_epi16(_mm256_castsi256_si128(t), _mm256_extracti128_si256(t, 1));
+		_mm_storel_epi64((__m128i *) &Cb_to[i], v);
+		_mm_storel_epi64((__m128i *) &Cr_to[i], _mm_srli_si128(v, 8));
+	}
 
-	glc_log(color->glc, GLC_INFO, "color",
-		 "using %d bit lookup table (%zd bytes)", LOOKUP_BITS, lookup_size);
-	video->lookup_table = malloc(lookup_size);
+	color_ycbcr_c(curve, &Ytop[i * 2], &Ybottom[i * 2], &Cb[i], &Cr[i], n - i,
+		      &Ytop_to[i * 2], &Ybottom_to[i * 2], &Cb_to[i], &Cr_to[i]);
+}
 
-#define CALC(value, brightness, contrast, gamma) \
-	((pow((double) value / 255.0, 1.0 / gamma) - 0.5) * (1.0 + contrast) \
-	 + brightness + 0.5) * 255.0
-
-	pos = 0;
-	for (Y = 0; Y < 256; Y += (1 << (8 - LOOKUP_BITS))) {
-		for (Cb = 0; Cb < 256; Cb += (1 << (8 - LOOKUP_BITS))) {
-			for (Cr = 0; Cr < 256; Cr += (1 << (8 - LOOKUP_BITS))) {
-				R = color_clamp(CALC(YCbCr_TO_RGB_Rd(Y, Cb, Cr),
-						video->brightness, video->contrast,
-						video->red_gamma));
-				G = color_clamp(CALC(YCbCr_TO_RGB_Gd(Y, Cb, Cr),
-						video->brightness, video->contrast,
-						video->green_gamma));
-				B = color_clamp(CALC(YCbCr_TO_RGB_Bd(Y, Cb, Cr),
-						video->brightness, video->contrast,
-						video->blue_gamma));
-
-				video->lookup_table[pos + 0] = RGB_TO_YCbCrJPEG_Y(R, G, B);
-				video->lookup_table[pos + 1] = RGB_TO_YCbCrJPEG_Cb(R, G, B);
-				video->lookup_table[pos + 2] = RGB_TO_YCbCrJPEG_Cr(R, G, B);
-				pos += 3;
-			}
-		}
+static const struct color_kernels_s color_kernels[] = {
+	{"avx2", GLC_SIMD_AVX2, &color_bgr_avx2, &color_ycbcr_avx2},
+	{NULL, 0, NULL, NULL}
+};
+
+#else
+
+static const struct color_kernels_s color_kernels[] = {
+	{NULL, 0, NULL, NULL}
+};
+
+#endif
+
+static const struct color_kernels_s color_kernels_c = {"c", 0, &color_bgr_c, &color_ycbcr_c};
+
+/* 2x2 blocks of the self-test, leave a scalar tail for every kernel */
+#define COLOR_TEST_BLOCKS (2 * 8 + 7)
+
+void color_select_kernels(color_t color)
+{
+	color->kernels = glc_simd_select(color->glc, "color", color_kernels,
+					 sizeof(struct color_kernels_s), &color_kernels_c,
+					 &color_test_kernels, color,
+					 COLOR_TEST_BLOCKS * 2 * 4, COLOR_TEST_BLOCKS * 2 * 4);
+}
+
+/**
+ * Self-test: correct synthetic rows with both the scalar and the
+ * given kernels using a steep curve so that clamping is exercised.
+ */
+int color_test_kernels(void *ptr, const void *kernels, glc_simd_test_t *test)
+{
+	const struct color_kernels_s *k = kernels;
+	struct color_video_stream_s *video;
+	const int (*curve)[256];
+	unsigned char *from = test->from, *ref = test->ref, *out = test->out;
+	unsigned int n = COLOR_TEST_BLOCKS, bpp;
+	int ret = 0;
+
+	if (unlikely(!(video = calloc(1, sizeof(struct color_video_stream_s)))))
+		return ENOMEM;
+	video->brightness = 0.1;
+	video->contrast = 0.5;
+	video->red_gamma = 0.7;
+	video->green_gamma = 1.3;
+	video->blue_gamma = 2.0;
+	color_generate_lookup_table(video);
+	curve = (const int (*)[256]) video->curve;
+
+	for (bpp = 3; bpp <= 4 && !ret; bpp++) {
+		memset(out, 0xaa, test->out_size);
+		color_bgr_c(curve, from, ref, n * 2, bpp);
+		k->bgr(curve, from, out, n * 2, bpp);
+		ret = glc_simd_test_compare(test, ref, out, n * 2 * bpp);
 	}
 
-#undef CALC
+	if (!ret) {
+		memset(out, 0xaa, test->out_size);
+		color_ycbcr_c(curve, from, &from[n * 2], &from[n * 4], &from[n * 5], n,
+			      ref, &ref[n * 2], &ref[n * 4], &ref[n * 5]);
+		k->ycbcr(curve, from, &from[n * 2], &from[n * 4], &from[n * 5], n,
+			 out, &out[n * 2], &out[n * 4], &out[n * 5]);
+		ret = glc_simd_test_compare(test, ref, out, n * 6);
+	}
 
-	return 0;
+	free(video);
+	return ret;
 }
 
-int color_generate_rgb_lookup_table(color_t color,
-				    struct color_video_stream_s *video)
+int color_generate_lookup_table(struct color_video_stream_s *video)
 {
 	unsigned int c;
-
-	video->lookup_table = malloc(256 + 256 + 256);
+	int identity = 1;
 
 #define CALC(value, brightness, contrast, gamma) \
 	color_clamp( \
 		(((pow((double) value / 255.0, 1.0 / gamma) - 0.5) * (1.0 + contrast) + 0.5) \
-		 + brightness) * 255.0 \
+		 + brightness) * 255.0 + 0.5 \
 		)
 
-	for (c = 0; c < 256; c++)
-		video->lookup_table[c + 0] = CALC(c, video->brightness, video->contrast,
-						  video->red_gamma);
+	for (c = 0; c < 256; c++) {
+		video->curve[0][c] = CALC(c, video->brightness, video->contrast,
+					  video->red_gamma);
+		video->curve[1][c] = CALC(c, video->brightness, video->contrast,
+					  video->green_gamma);
+		video->curve[2][c] = CALC(c, video->brightness, video->contrast,
+					  video->blue_gamma);
+		if ((video->curve[0][c] != c) || (video->curve[1][c] != c) ||
+		    (video->curve[2][c] != c))
+			identity = 0;
+	}
 
-	for (c = 0; c < 256; c++)
-		video->lookup_table[c + 256] = CALC(c, video->brightness, video->contrast,
-						    video->green_gamma);
+#undef CALC
 
-	for (c = 0; c < 256; c++)
-		video->lookup_table[c + 256 + 256] = CALC(c, video->brightness, video->contrast,
-							  video->blue_gamma);
+	return identity;
+}
 
-#undef CALC
+int color_neutral(float brightness, float contrast,
+		  float red, float green, float blue, int *neutral)
+{
+	struct color_video_stream_s *video;
+
+	video = calloc(1, sizeof(struct color_video_stream_s));
+	if (unlikely(!video))
+		return ENOMEM;
+	video->brightness = brightness;
+	video->contrast = contrast;
+	video->red_gamma = red;
+	video->green_gamma = green;
+	video->blue_gamma = blue;
+	*neutral = color_generate_lookup_table(video);
+	free(video);
 
 	return 0;
 }
@@ -63,6 +63,22 @@ __PUBLIC int color_override(color_t color, float brightness, float contrast,
  */
 __PUBLIC int color_override_clear(color_t color);
 
+/**
+ * \brief check if correction values leave colors untouched
+ *
+ * Frames are passed through unmodified when correction is neutral,
+ * this allows leaving color out of a pipeline altogether.
+ * \param brightness brightness value
+ * \param contrast contrast value
+ * \param red red gamma
+ * \param green green gamma
+ * \param blue blue gamma
+ * \param neutral set to 1 if correction is neutral, 0 otherwise
+ * \return 0 on success, otherwise an error code
+ */
+__PUBLIC int color_neutral(float brightness, float contrast,
+			   float red, float green, float blue, int *neutral);
+
 /**
  * \brief start color process
  *
@@ -0,0 +1,84 @@
+/**
+ * \file glc/core/colorspace.h
+ * \brief fixed-point JPEG Y'CbCr conversion shared by filters
+ * \author agent <agent@local>
+ * \date 2026
+
+    Copyright 2026 agent
+
+    This file is part of glcs.
+
+    glcs is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    glcs is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with glcs.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+/**
+ * \addtogroup core
+ *  \{
+ * \defgroup colorspace JPEG Y'CbCr arithmetic
+ *  \{
+ */
+
+#ifndef _COLORSPACE_H
+#define _COLORSPACE_H
+
+/*
+ * R'G'B' to Y'CbCr with 10 fractional bits, truncated. Results are
+ * not clamped, Cb is 256 for pure blue.
+ */
+#define YCbCrJPEG_K_R_Y    306
+#define YCbCrJPEG_K_G_Y    601
+#define YCbCrJPEG_K_B_Y    117
+#define YCbCrJPEG_K_R_Cb   173
+#define YCbCrJPEG_K_G_Cb   339
+#define YCbCrJPEG_K_B_Cb   512
+#define YCbCrJPEG_K_R_Cr   512
+#define YCbCrJPEG_K_G_Cr   429
+#define YCbCrJPEG_K_B_Cr    83
+
+#define RGB_TO_YCbCrJPEG_Y(Rd, Gd, Bd) \
+	(    + ((YCbCrJPEG_K_R_Y * (Rd) + YCbCrJPEG_K_G_Y * (Gd) + \
+		 YCbCrJPEG_K_B_Y * (Bd)) >> 10))
+#define RGB_TO_YCbCrJPEG_Cb(Rd, Gd, Bd) \
+	(128 - ((YCbCrJPEG_K_R_Cb * (Rd) + YCbCrJPEG_K_G_Cb * (Gd) - \
+		 YCbCrJPEG_K_B_Cb * (Bd)) >> 10))
+#define RGB_TO_YCbCrJPEG_Cr(Rd, Gd, Bd) \
+	(128 + ((YCbCrJPEG_K_R_Cr * (Rd) - YCbCrJPEG_K_G_Cr * (Gd) - \
+		 YCbCrJPEG_K_B_Cr * (Bd)) >> 10))
+
+/*
+ * Y'CbCr to R'G'B' offsets with YCbCrJPEG_FIX_BITS fractional bits,
+ * rounded to nearest. Coefficients fit in 16 bits so SIMD kernels can
+ * use pmaddwd and still match the scalar conversion exactly.
+ */
+#define YCbCrJPEG_FIX_BITS 14
+#define YCbCrJPEG_ROUND    (1 << (YCbCrJPEG_FIX_BITS - 1))
+#define YCbCrJPEG_K_Cr_R   22970 /* 1.402 */
+#define YCbCrJPEG_K_Cb_G    5638 /* 0.344136 */
+#define YCbCrJPEG_K_Cr_G   11700 /* 0.714136 */
+#define YCbCrJPEG_K_Cb_B   29032 /* 1.772 */
+
+/* offsets added to Y', Cb and Cr already have 128 subtracted */
+#define YCbCrJPEG_Cr_R(Cr) \
+	((YCbCrJPEG_K_Cr_R * (Cr) + YCbCrJPEG_ROUND) >> YCbCrJPEG_FIX_BITS)
+#define YCbCrJPEG_CbCr_G(Cb, Cr) \
+	((-YCbCrJPEG_K_Cb_G * (Cb) - YCbCrJPEG_K_Cr_G * (Cr) + YCbCrJPEG_ROUND) >> \
+	 YCbCrJPEG_FIX_BITS)
+#define YCbCrJPEG_Cb_B(Cb) \
+	((YCbCrJPEG_K_Cb_B * (Cb) + YCbCrJPEG_ROUND) >> YCbCrJPEG_FIX_BITS)
+
+#endif
+
+/**  \} */
+/**  \} */
@@ -41,17 +41,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
 
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 
 #include <glc/common/state.h>
 #include <glc/common/core.h>
 #include <glc/common/log.h>
 #include <glc/common/thread.h>
+#include <glc/common/metrics.h>
 #include <glc/common/util.h>
 #include <glc/common/optimization.h>
 
@@ -66,6 +69,9 @@
 #define FILE_INFO_READ    0x10
 #define FILE_INFO_VALID   0x20
 
+/* read-ahead window of the mmap source, multiple of page size */
+#define FILE_MMAP_WINDOW  (16 * 1024 * 1024)
+
 struct file_private_s {
 	glc_t *glc;
 	glc_flags_t flags;
@@ -92,6 +98,16 @@ typedef struct {
 	struct source_s source_base;
 	struct file_private_s mpriv;
 	u_int32_t stream_version;
+	/*
+	 * mmap source reads packets straight from the file mapping.
+	 * map_ahead is where WILLNEED read-ahead has been requested up to,
+	 * map_released where already consumed pages have been dropped up to.
+	 */
+	char *map;
+	size_t map_size;
+	size_t map_pos;
+	size_t map_ahead;
+	size_t map_released;
 } file_source_t;
 
 static void file_finish_callback(void *ptr, int err);
@@ -101,6 +117,7 @@ static int file_write_message(file_sink_t *file, glc_message_header_t *header,
 static int file_write_state_callback(glc_message_header_t *header, void *message,
 				     size_t message_size, void *arg);
 static int file_test_stream_version(u_int32_t version);
+static int file_test_info(file_source_t *file, glc_stream_info_t *info);
 static int file_set_target(struct file_private_s *mpriv, int fd);
 
 static int file_can_resume(sink_t sink);
@@ -123,6 +140,15 @@ static int file_read_info(source_t source, glc_stream_info_t *info,
 			char **info_name, char **info_date);
 static int file_read(source_t source, ps_buffer_t *to);
 static int file_source_destroy(source_t source);
+static void file_normalize_time(file_source_t *file, glc_message_header_t *header,
+				char *data);
+
+static int file_mmap_open_source(source_t source, const char *filename);
+static int file_mmap_close_source(source_t source);
+static int file_mmap_read_info(source_t source, glc_stream_info_t *info,
+			char **info_name, char **info_date);
+static int file_mmap_read(source_t source, ps_buffer_t *to);
+static void *file_mmap_take(file_source_t *file, size_t size);
 
 static sink_ops_t file_sink_ops = {
 	.can_resume          = file_can_resume,
@@ -146,6 +172,14 @@ static source_ops_t file_source_ops = {
 	.destroy             = file_source_destroy,
 };
 
+static source_ops_t file_mmap_source_ops = {
+	.open_source         = file_mmap_open_source,
+	.close_source        = file_mmap_close_source,
+	.read_info           = file_mmap_read_info,
+	.read                = file_mmap_read,
+	.destroy             = file_source_destroy,
+};
+
 int file_sink_init(sink_t *sink, glc_t *glc)
 {
 	file_sink_t *file = (file_sink_t*)calloc(1, sizeof(file_sink_t));
@@ -160,6 +194,7 @@ int file_sink_init(sink_t *sink, glc_t *glc)
 	file->thread.read_callback   = &file_read_callback;
 	file->thread.finish_callback = &file_finish_callback;
 	file->thread.threads = 1;
+	file->thread.name    = "file";
 
 	tracker_init(&file->state_tracker, file->mpriv.glc);
 
@@ -191,6 +226,14 @@ int file_source_init(source_t *source, glc_t *glc)
 	return 0;
 }
 
+int file_mmap_source_init(source_t *source, glc_t *glc)
+{
+	int ret = file_source_init(source, glc);
+	if (likely(!ret))
+		(*source)->ops = &file_mmap_source_ops;
+	return ret;
+}
+
 int file_source_destroy(source_t source)
 {
 	free(source);
@@ -517,14 +560,17 @@ int file_read_callback(glc_thread_state_t *state)
 					1, file->mpriv.handle)
 		    != 1))
 			goto err;
-		if (unlikely(fwrite_unlocked(state->read_data,
-				   state->read_size, 1, file->mpriv.handle) != 1))
+		/* close message has no data, fwrite() would return 0 */
+		if (unlikely(state->read_size &&
+			     (fwrite_unlocked(state->read_data,
+				   state->read_size, 1, file->mpriv.handle) != 1)))
 			goto err;
 		if (unlikely(file->sync))
 			if (unlikely(fflush_unlocked(file->mpriv.handle)))
 				goto err;
 	}
 
+	glc_metrics_frame_written(file->mpriv.glc, &state->header, state->read_data);
 	return 0;
 
 err:
@@ -623,10 +669,30 @@ int file_test_stream_version(u_int32_t version)
 	return ENOTSUP;
 }
 
+int file_test_info(file_source_t *file, glc_stream_info_t *info)
+{
+	if (unlikely(info->signature != GLC_SIGNATURE)) {
+		glc_log(file->mpriv.glc, GLC_ERROR, "file",
+			 "signature 0x%08x does not match 0x%08x",
+			 info->signature, GLC_SIGNATURE);
+		return EINVAL;
+	}
+
+	if (file_test_stream_version(info->version)) {
+		glc_log(file->mpriv.glc, GLC_ERROR, "file",
+			 "unsupported stream version 0x%02x", info->version);
+		return ENOTSUP;
+	}
+	glc_log(file->mpriv.glc, GLC_INFO, "file", "stream version 0x%02x", info->version);
+	file->stream_version = info->version; /* copy version */
+	return 0;
+}
+
 int file_read_info(source_t source, glc_stream_info_t *info,
 		   char **info_name, char **info_date)
 {
 	file_source_t *file = (file_source_t*)source;
+	int ret;
 	*info_name = NULL;
 	*info_date = NULL;
 	if (unlikely(!is_read_open(&file->mpriv)))
@@ -640,20 +706,8 @@ int file_read_info(source_t source, glc_stream_info_t *info,
 	}
 	file->mpriv.flags |= FILE_INFO_READ;
 
-	if (unlikely(info->signature != GLC_SIGNATURE)) {
-		glc_log(file->mpriv.glc, GLC_ERROR, "file",
-			 "signature 0x%08x does not match 0x%08x",
-			 info->signature, GLC_SIGNATURE);
-		return EINVAL;
-	}
-
-	if (file_test_stream_version(info->version)) {
-		glc_log(file->mpriv.glc, GLC_ERROR, "file",
-			 "unsupported stream version 0x%02x", info->version);
-		return ENOTSUP;
-	}
-	glc_log(file->mpriv.glc, GLC_INFO, "file", "stream version 0x%02x", info->version);
-	file->stream_version = info->version; /* copy version */
+	if (unlikely((ret = file_test_info(file, info))))
+		return ret;
 
 	if (info->name_size > 0) {
 		*info_name = (char *) malloc(info->name_size);
@@ -733,19 +787,8 @@ int file_read(source_t source, ps_buffer_t *to)
 		if (unlikely(fread_unlocked(dma, 1, packet_size, file->mpriv.handle) != packet_size))
 			goto read_fail;
 
-		if (unlikely(file->stream_version < 0x05)) {
-			if (header.type == GLC_MESSAGE_VIDEO_FRAME ||
-			    header.type == GLC_MESSAGE_AUDIO_DATA) {
-				/*
-				 * because glc_video_frame_header_t and glc_audio_data_header_t
-				 * start with the same data members, it is ok use the same pointer
-				 * type for both types.
-				 */
-				glc_video_frame_header_t *data_hdr = (glc_video_frame_header_t *)dma;
-				/* transform uSec in nsec */
-				data_hdr->time *= 1000;
-			}
-		}
+		if (unlikely(file->stream_version < 0x05))
+			file_normalize_time(file, &header, dma);
 
 		if (unlikely((ret = ps_packet_close(&packet))))
 			goto err;
@@ -784,5 +827,265 @@ err:
 	return ret;
 }
 
-/**  \} */
+void file_normalize_time(file_source_t *file, glc_message_header_t *header,
+			 char *data)
+{
+	if (header->type == GLC_MESSAGE_VIDEO_FRAME ||
+	    header->type == GLC_MESSAGE_AUDIO_DATA) {
+		/*
+		 * because glc_video_frame_header_t and glc_audio_data_header_t
+		 * start with the same data members, it is ok use the same pointer
+		 * type for both types.
+		 */
+		glc_video_frame_header_t *data_hdr = (glc_video_frame_header_t *)data;
+		/* transform uSec in nsec */
+		data_hdr->time *= 1000;
+	}
+}
+
+int file_mmap_open_source(source_t source, const char *filename)
+{
+	int fd, ret = 0;
+	struct stat st;
+	void *map;
+	file_source_t *file = (file_source_t*)source;
+	if (unlikely(file->mpriv.handle || file->map))
+		return EBUSY;
+
+	glc_log(file->mpriv.glc, GLC_INFO, "file",
+		 "opening %s for reading stream", filename);
+
+	fd = open(filename, O_RDONLY);
+
+	if (unlikely(fd == -1)) {
+		glc_log(file->mpriv.glc, GLC_ERROR, "file", "can't open %s: %s (%d)",
+			 filename, strerror(errno), errno);
+		return errno;
+	}
+
+	if (unlikely(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || !st.st_size ||
+		     (uintmax_t) st.st_size > SIZE_MAX ||
+		     (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+				 fd, 0)) == MAP_FAILED)) {
+		/*
+		 * not mappable (fifo, larger than address space,
+		 * address space exhausted...), use stdio
+		 */
+		glc_log(file->mpriv.glc, GLC_INFO, "file",
+			 "can't map %s, reading it through stdio", filename);
+		source->ops = &file_source_ops;
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		if (unlikely((ret = file_set_source(&file->mpriv, fd))))
+			close(fd);
+		return ret;
+	}
+	close(fd);
+
+	file->map          = (char *) map;
+	file->map_size     = st.st_size;
+	file->map_pos      = 0;
+	file->map_ahead    = 0;
+	file->map_released = 0;
+	madvise(file->map, file->map_size, MADV_SEQUENTIAL);
+	file->mpriv.flags |= FILE_READING;
+	return 0;
+}
+
+static inline int is_map_open(file_source_t *file)
+{
+	return file->map && (file->mpriv.flags & FILE_READING);
+}
+
+int file_mmap_close_source(source_t source)
+{
+	file_source_t *file = (file_source_t*)source;
+	if (unlikely(!is_map_open(file)))
+		return EAGAIN;
+
+	munmap(file->map, file->map_size);
+	file->map = NULL;
+	file->mpriv.flags &= ~(FILE_READING | FILE_INFO_READ | FILE_INFO_VALID);
+
+	return 0;
+}
+
+/*
+ * Returns pointer to the next size bytes of the mapping, NULL past end of file.
+ * Keeps a window of read-ahead in front of the read position and drops
+ * consumed pages behind it so that the mapping of large files does not
+ * grow the resident set.
+ */
+void *file_mmap_take(file_source_t *file, size_t size)
+{
+	char *ptr;
+	size_t consumed;
+
+	if (unlikely(size > file->map_size - file->map_pos))
+		return NULL;
+	ptr = &file->map[file->map_pos];
+	file->map_pos += size;
+
+	if (file->map_pos + FILE_MMAP_WINDOW / 2 > file->map_ahead &&
+	    file->map_ahead < file->map_size) {
+		/* packet was larger than the window, don't read ahead behind it */
+		if (file->map_ahead < file->map_pos)
+			file->map_ahead = file->map_pos &
+					  ~((size_t) sysconf(_SC_PAGESIZE) - 1);
+		madvise(&file->map[file->map_ahead],
+			file->map_size - file->map_ahead < FILE_MMAP_WINDOW ?
+			file->map_size - file->map_ahead : FILE_MMAP_WINDOW,
+			MADV_WILLNEED);
+		file->map_ahead += FILE_MMAP_WINDOW;
+	}
+
+	/* keep one window behind, packets are copied out right after take */
+	consumed = file->map_pos - file->map_pos % FILE_MMAP_WINDOW;
+	if (consumed > file->map_released + FILE_MMAP_WINDOW) {
+		madvise(&file->map[file->map_released],
+			consumed - FILE_MMAP_WINDOW - file->map_released, MADV_DONTNEED);
+		file->map_released = consumed - FILE_MMAP_WINDOW;
+	}
+	return ptr;
+}
+
+int file_mmap_read_info(source_t source, glc_stream_info_t *info,
+			char **info_name, char **info_date)
+{
+	file_source_t *file = (file_source_t*)source;
+	void *data;
+	int ret;
+	*info_name = NULL;
+	*info_date = NULL;
+	if (unlikely(!is_map_open(file)))
+		return EAGAIN;
 
+	if (unlikely(!(data = file_mmap_take(file, sizeof(glc_stream_info_t))))) {
+		glc_log(file->mpriv.glc, GLC_ERROR, "file",
+			 "can't read stream info header");
+		return EBADMSG;
+	}
+	memcpy(info, data, sizeof(glc_stream_info_t));
+	file->mpriv.flags |= FILE_INFO_READ;
+
+	if (unlikely((ret = file_test_info(file, info))))
+		return ret;
+
+	if (info->name_size > 0) {
+		if (unlikely(!(data = file_mmap_take(file, info->name_size))))
+			return EBADMSG;
+		*info_name = (char *) malloc(info->name_size);
+		memcpy(*info_name, data, info->name_size);
+	}
+
+	if (info->date_size > 0) {
+		if (unlikely(!(data = file_mmap_take(file, info->date_size))))
+			return EBADMSG;
+		*info_date = (char *) malloc(info->date_size);
+		memcpy(*info_date, data, info->date_size);
+	}
+
+	file->mpriv.flags |= FILE_INFO_VALID;
+	return 0;
+}
+
+int file_mmap_read(source_t source, ps_buffer_t *to)
+{
+	file_source_t *file = (file_source_t*)source;
+	int ret = 0;
+	glc_message_header_t header;
+	size_t packet_size = 0;
+	ps_packet_t packet;
+	char *dma, *data;
+	glc_size_t glc_ps;
+
+	if (unlikely(!is_map_open(file)))
+		return EAGAIN;
+
+	if (unlikely(!(file->mpriv.flags & FILE_INFO_READ))) {
+		glc_log(file->mpriv.glc, GLC_ERROR, "file",
+			 "stream info header not read");
+		return EAGAIN;
+	}
+
+	if (unlikely(!(file->mpriv.flags & FILE_INFO_VALID))) {
+		glc_log(file->mpriv.glc, GLC_ERROR, "file",
+			 "stream info header not valid");
+		file->mpriv.flags &= ~FILE_INFO_READ;
+		return EINVAL;
+	}
+
+	ps_packet_init(&packet, to);
+
+	do {
+		if (unlikely(!(data = file_mmap_take(file, sizeof(glc_size_t) +
+						     sizeof(glc_message_header_t)))))
+			goto send_eof;
+		if (unlikely(file->stream_version == 0x03)) {
+			/* old order */
+			memcpy(&header, data, sizeof(glc_message_header_t));
+			memcpy(&glc_ps, &data[sizeof(glc_message_header_t)],
+			       sizeof(glc_size_t));
+		} else {
+			/* same header format as in container messages */
+			memcpy(&glc_ps, data, sizeof(glc_size_t));
+			memcpy(&header, &data[sizeof(glc_size_t)],
+			       sizeof(glc_message_header_t));
+		}
+
+		packet_size = glc_ps;
+
+		if (unlikely(!(data = file_mmap_take(file, packet_size))))
+			goto read_fail;
+
+		if (unlikely((ret = ps_packet_open(&packet, PS_PACKET_WRITE))))
+			goto err;
+		if (unlikely((ret = ps_packet_write(&packet, &header,
+						sizeof(glc_message_header_t)))))
+			goto err;
+		if (unlikely((ret = ps_packet_dma(&packet, (void **)&dma,
+					packet_size, PS_ACCEPT_FAKE_DMA))))
+			goto err;
+
+		memcpy(dma, data, packet_size);
+
+		if (unlikely(file->stream_version < 0x05))
+			file_normalize_time(file, &header, dma);
+
+		if (unlikely((ret = ps_packet_close(&packet))))
+			goto err;
+	} while ((header.type != GLC_MESSAGE_CLOSE) &&
+		 (!glc_state_test(file->mpriv.glc, GLC_STATE_CANCEL)));
+
+finish:
+	ps_packet_destroy(&packet);
+
+	file->mpriv.flags &= ~(FILE_INFO_READ | FILE_INFO_VALID);
+	return 0;
+
+send_eof:
+	header.type = GLC_MESSAGE_CLOSE;
+	ps_packet_open(&packet, PS_PACKET_WRITE);
+	ps_packet_write(&packet, &header, sizeof(glc_message_header_t));
+	ps_packet_close(&packet);
+
+	glc_log(file->mpriv.glc, GLC_ERROR, "file", "unexpected EOF");
+	goto finish;
+
+read_fail:
+	ret = EBADMSG;
+	glc_log(file->mpriv.glc, GLC_ERROR, "file",
+		"read_file while reading a packet type %s (%d) at offset %zu",
+		glc_util_msgtype_to_str(header.type), header.type, file->map_pos);
+err:
+	if (ret == EINTR)
+		goto finish; /* just cancel */
+
+	glc_log(file->mpriv.glc, GLC_ERROR, "file", "%s (%d)", strerror(ret), ret);
+	glc_log(file->mpriv.glc, GLC_DEBUG, "file", "packet size is %zd", packet_size);
+	ps_buffer_cancel(to);
+
+	file->mpriv.flags &= ~(FILE_INFO_READ | FILE_INFO_VALID);
+	return ret;
+}
+
+/**  \} */
@@ -96,6 +96,18 @@ __PUBLIC int file_sink_init(sink_t *sink, glc_t *glc);
  */
 __PUBLIC int file_source_init(source_t *source, glc_t *glc);
 
+/**
+ * \brief initialize memory mapped file source object
+ *
+ * Same as file_source_init() but packets are copied straight from
+ * a mapping of the file, without going through stdio. Files that
+ * can't be mapped are read through stdio.
+ * \param file file object
+ * \param glc glc
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int file_mmap_source_init(source_t *source, glc_t *glc);
+
 #ifdef __cplusplus
 }
 #endif
@@ -26,6 +26,7 @@
 #include <limits.h> // For IOV_MAX
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h> // for vmsplice and F_GETPIPE_SZ
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/uio.h> // for writev
@@ -68,6 +69,35 @@ static int invert_write_init(frame_writer_t writer, char *frame);
 static int invert_write(frame_writer_t writer, int fd);
 static int invert_destroy(frame_writer_t writer);
 
+/*
+ * vmsplice() maps frame pages into the pipe instead of copying them.
+ * The pipe references these pages until the consumer reads them while
+ * frame data lives in a packet released as soon as write returns 0.
+ * Last rows, at least pipe capacity, are therefore copied with writev:
+ * once they all are in the pipe, no spliced page of the frame can still
+ * be in it. Gifting pages is not possible since buffer memory is reused.
+ */
+typedef struct
+{
+	struct frame_writer_s writer_base;
+	int    frame_size;
+	int    left;
+	struct iovec *iov;
+	size_t iov_capacity;
+	unsigned cur_idx;
+	int    row_sz;
+	int    num_lines;
+	int    invert;
+	/* rows before splice_end are spliced, 0 once vmsplice is unsupported */
+	int    splice;
+	int    splice_end;
+} splice_frame_writer_t;
+
+static int splice_configure(frame_writer_t writer, int r_sz, int h);
+static int splice_write_init(frame_writer_t writer, char *frame);
+static int splice_write(frame_writer_t writer, int fd);
+static int splice_destroy(frame_writer_t writer);
+
 static write_ops_t std_ops = {
 	.configure  = std_configure,
 	.write_init = std_write_init,
@@ -236,3 +266,143 @@ int invert_destroy(frame_writer_t writer)
 	return 0;
 }
 
+
+static write_ops_t splice_ops = {
+	.configure  = splice_configure,
+	.write_init = splice_write_init,
+	.write      = splice_write,
+	.destroy    = splice_destroy,
+};
+
+int glcs_splice_create( frame_writer_t *writer, int invert )
+{
+	splice_frame_writer_t *splice_writer = (splice_frame_writer_t*)
+		calloc(1,sizeof(splice_frame_writer_t));
+	*writer = (frame_writer_t)splice_writer;
+	if (unlikely(!splice_writer))
+		return ENOMEM;
+	splice_writer->writer_base.ops = &splice_ops;
+	splice_writer->invert = invert;
+	splice_writer->splice = 1;
+	return 0;
+}
+
+int splice_configure(frame_writer_t writer, int r_sz, int h)
+{
+	splice_frame_writer_t *splice_writer = (splice_frame_writer_t *)writer;
+	if (unlikely(h > splice_writer->iov_capacity)) {
+		struct iovec *ptr = (struct iovec *)realloc(splice_writer->iov,
+					h*sizeof(struct iovec));
+		if (unlikely(!ptr))
+			return ENOMEM;
+		splice_writer->iov = ptr;
+		splice_writer->iov_capacity = h;
+	}
+	splice_writer->row_sz     = r_sz;
+	splice_writer->num_lines  = h;
+	splice_writer->frame_size = r_sz*h;
+	return 0;
+}
+
+int splice_write_init(frame_writer_t writer, char *frame)
+{
+	splice_frame_writer_t *splice_writer = (splice_frame_writer_t *)writer;
+	int i, step = splice_writer->row_sz;
+
+	if (splice_writer->invert) {
+		frame = &frame[(splice_writer->num_lines-1)*splice_writer->row_sz];
+		step = -step;
+	}
+	for (i = 0; i < splice_writer->num_lines; ++i) {
+		splice_writer->iov[i].iov_base = frame;
+		splice_writer->iov[i].iov_len  = splice_writer->row_sz;
+		frame += step;
+	}
+	splice_writer->cur_idx    = 0;
+	splice_writer->splice_end = -1;
+	splice_writer->left       = splice_writer->frame_size;
+	return splice_writer->left;
+}
+
+/*
+ * Rows to splice are decided on first write of a frame as consumer
+ * might resize the pipe.
+ */
+static void splice_set_end(splice_frame_writer_t *splice_writer, int fd)
+{
+	int pipe_sz, copy_lines;
+
+	splice_writer->splice_end = 0;
+	if (!splice_writer->splice)
+		return;
+
+	if (unlikely((pipe_sz = fcntl(fd, F_GETPIPE_SZ)) < 0)) {
+		splice_writer->splice = 0;
+		return;
+	}
+
+	copy_lines = (pipe_sz + splice_writer->row_sz - 1) / splice_writer->row_sz;
+	if (copy_lines < splice_writer->num_lines)
+		splice_writer->splice_end = splice_writer->num_lines - copy_lines;
+}
+
+int splice_write(frame_writer_t writer, int fd)
+{
+	splice_frame_writer_t *splice_writer = (splice_frame_writer_t *)writer;
+	struct iovec *iov;
+	int iovcnt, end;
+	int max_write, written;
+	int ret;
+
+	if (unlikely(splice_writer->splice_end < 0))
+		splice_set_end(splice_writer, fd);
+
+	for (;;) {
+		end = splice_writer->num_lines;
+		if (splice_writer->cur_idx < splice_writer->splice_end)
+			end = splice_writer->splice_end;
+
+		iov    = &splice_writer->iov[splice_writer->cur_idx];
+		iovcnt = end - splice_writer->cur_idx;
+		if (iovcnt > IOV_MAX)
+			iovcnt = IOV_MAX;
+		max_write = (iovcnt-1)*splice_writer->row_sz + iov->iov_len;
+
+		if (end == splice_writer->splice_end) {
+			ret = vmsplice(fd, iov, iovcnt, SPLICE_F_NONBLOCK);
+			if (unlikely(ret < 0 && (errno == EINVAL || errno == ENOSYS))) {
+				/* not supported, copy from now on */
+				splice_writer->splice     = 0;
+				splice_writer->splice_end = 0;
+				continue;
+			}
+		} else
+			ret = writev(fd, iov, iovcnt);
+
+		if (unlikely(ret < 0))
+			return ret;
+
+		splice_writer->left -= ret;
+		if (!splice_writer->left)
+			return 0;
+
+		// skip written rows and adjust partially written one
+		written = ret;
+		while (written >= (int) splice_writer->iov[splice_writer->cur_idx].iov_len)
+			written -= splice_writer->iov[splice_writer->cur_idx++].iov_len;
+		splice_writer->iov[splice_writer->cur_idx].iov_base += written;
+		splice_writer->iov[splice_writer->cur_idx].iov_len  -= written;
+
+		// pipe is full
+		if (ret < max_write)
+			return splice_writer->left;
+	}
+}
+
+int splice_destroy(frame_writer_t writer)
+{
+	splice_frame_writer_t *splice_writer = (splice_frame_writer_t *)writer;
+	free(splice_writer->iov);
+	free(splice_writer);
+	return 0;
+}
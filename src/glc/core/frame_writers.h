@@ -52,6 +52,8 @@ struct frame_writer_s
 
 int glcs_std_create( frame_writer_t *writer );
 int glcs_invert_create( frame_writer_t *writer );
+/* vmsplice() frames into the pipe, falls back to writev if unsupported */
+int glcs_splice_create( frame_writer_t *writer, int invert );
 
 #ifdef __cplusplus
 }
@@ -121,6 +121,7 @@ int info_init(info_t *info, glc_t *glc)
 	(*info)->thread.read_callback = &info_read_callback;
 	(*info)->thread.finish_callback = &info_finish_callback;
 	(*info)->thread.threads = 1;
+	(*info)->thread.name = "info";
 
 	return 0;
 }
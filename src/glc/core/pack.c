@@ -35,6 +35,7 @@
 #include <errno.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 #include <glc/common/glc.h>
 #include <glc/common/core.h>
@@ -69,6 +70,16 @@
 # include <lzjb.h>
 #endif
 
+#ifdef __LZ4
+# include <lz4.h>
+#endif
+
+#ifdef __ZSTD
+# include <zstd.h>
+/* low levels are about as fast as LZO and compress much better */
+# define __zstd_default_level 1
+#endif
+
 struct pack_stat_s {
 	uint64_t pack_size;
 	uint64_t unpack_size;
@@ -76,13 +87,122 @@ struct pack_stat_s {
 
 typedef struct pack_stat_s pack_stat_t;
 
+/*
+ * Algorithms tried by adaptive compression, from fastest
+ * to strongest.
+ */
+struct pack_codec_s {
+	int compression;
+	int level;
+	const char *name;
+};
+
+static const struct pack_codec_s pack_codecs[] = {
+#ifdef __LZ4
+	{PACK_LZ4,     0, "LZ4"},
+#endif
+#ifdef __LZO
+	{PACK_LZO,     0, "LZO"},
+#endif
+#ifdef __QUICKLZ
+	{PACK_QUICKLZ, 0, "QuickLZ"},
+#endif
+#ifdef __ZSTD
+	{PACK_ZSTD,    1, "Zstandard"},
+	{PACK_ZSTD,    3, "Zstandard"},
+	{PACK_ZSTD,    6, "Zstandard"},
+#endif
+	{0, 0, NULL}
+};
+
+#define PACK_CODECS_MAX    (sizeof(pack_codecs) / sizeof(pack_codecs[0]))
+/* frames of at least two tiles are split when frame threads are used */
+#define PACK_TILE_SIZE       (1024 * 1024)
+/* adaptive compression decisions are taken every 500 ms */
+#define PACK_ADAPTIVE_WINDOW 500000000
+
+/* per stream state, keyed by message type and stream id */
+struct pack_stream_s {
+	glc_message_type_t type;
+	glc_stream_id_t id;
+
+	/* last frame of a video stream, for delta coding */
+	char *prev;
+	size_t size;
+	unsigned int frames;
+
+	/* adaptive compression, counters are updated by write callbacks */
+	unsigned int codec;
+	glc_utime_t window_start;
+	uint64_t codec_ns[PACK_CODECS_MAX];
+	uint64_t codec_in[PACK_CODECS_MAX];
+	uint64_t codec_out[PACK_CODECS_MAX];
+	unsigned int blocked;
+	/* averaged measures, 0 until codec has been used */
+	double ns_per_byte[PACK_CODECS_MAX];
+	double ratio[PACK_CODECS_MAX];
+
+	struct pack_stream_s *next;
+};
+
+/* per thread adaptive compression state */
+struct pack_thread_s {
+	void *work[PACK_ADAPTIVE];
+	/* codec selected by read callback for current packet */
+	unsigned int codec;
+	struct pack_stream_s *stream;
+};
+
 struct pack_s {
 	glc_t *glc;
 	glc_thread_t thread;
 	size_t compress_min;
 	int running;
 	int compression;
+	int level;
+	unsigned int keyframe_interval;
+	unsigned int cpu_budget;
+	struct pack_stream_s *streams;
 	pack_stat_t stats;
+
+	/* tiles, pool threads have their own compression state */
+	glc_band_pool_t bands;
+	struct pack_thread_s *band_work;
+	unsigned int band_work_count;
+};
+
+struct pack_tiles_job_s {
+	pack_t pack;
+	glc_thread_state_t *state;
+	int compression;
+	void *work;
+	int level;
+	unsigned int tiles;
+	char *dst;
+	size_t slot;
+	int ret;
+};
+
+/* per thread decompression state, allocated when first needed */
+struct unpack_thread_s {
+	void *quicklz;
+	void *zstd;
+	/* delta or keyframe in progress, its turn is delta_ticket */
+	int delta;
+	unsigned int delta_ticket;
+	/* tiles decompressed by this thread */
+	struct unpack_thread_s *tile;
+	glc_container_message_header_t **tiles;
+	unsigned int tile_count;
+};
+
+struct unpack_tiles_job_s {
+	unpack_t unpack;
+	glc_thread_state_t *state;
+	glc_tiles_header_t *header;
+	glc_container_message_header_t **tiles;
+	struct unpack_thread_s *thread_state;
+	int ret;
 };
 
 struct unpack_s {
@@ -90,25 +210,79 @@ struct unpack_s {
 	glc_thread_t thread;
 	int running;
 	pack_stat_t stats;
+
+	/*
+	 * Frames are decompressed in parallel but delta frames
+	 * are restored one at a time, in stream order.
+	 */
+	pthread_mutex_t delta_mutex;
+	pthread_cond_t delta_cond;
+	unsigned int delta_next, delta_turn;
+	int delta_cancel;
+	struct pack_stream_s *streams;
+
+	/* tiles, pool threads have their own decompression state */
+	glc_band_pool_t bands;
+	struct unpack_thread_s *band_states;
+	unsigned int band_state_count;
 };
 
 static int pack_thread_create_callback(void *ptr, void **threadptr);
 static void pack_thread_finish_callback(void *ptr, void *threadptr, int err);
 static int pack_read_callback(glc_thread_state_t *state);
-static int pack_quicklz_write_callback(glc_thread_state_t *state);
-static int pack_lzo_write_callback(glc_thread_state_t *state);
-static int pack_lzjb_write_callback(glc_thread_state_t *state);
+static int pack_write_callback(glc_thread_state_t *state);
+static int pack_adaptive_write_callback(glc_thread_state_t *state);
+static size_t pack_bound(int compression, size_t size);
+static int pack_compress(glc_thread_state_t *state, int compression,
+			 void *work, int level);
+static int pack_codec_compress(glc_thread_state_t *state, int compression,
+			       void *work, int level);
+static unsigned int pack_tiles(pack_t pack, size_t size);
+static int pack_tiles_compress(glc_thread_state_t *state, int compression,
+			       void *work, int level);
+static void pack_tile_band(void *arg, unsigned int first, unsigned int last);
+static int pack_quicklz_compress(glc_thread_state_t *state, void *work, int level);
+static int pack_lzo_compress(glc_thread_state_t *state, void *work, int level);
+static int pack_lzjb_compress(glc_thread_state_t *state, void *work, int level);
+static int pack_lz4_compress(glc_thread_state_t *state, void *work, int level);
+static int pack_zstd_compress(glc_thread_state_t *state, void *work, int level);
+static int pack_work_alloc(int compression, void **work);
+static void pack_work_free(int compression, void *work);
+static void pack_band_work_free(pack_t pack);
+static int pack_adaptive_select(pack_t pack, glc_thread_state_t *state,
+				int *compression);
+static void pack_adaptive_update(pack_t pack, struct pack_stream_s *stream,
+				 glc_utime_t now);
 static void pack_finish_callback(void *ptr, int err);
+static int pack_delta(pack_t pack, glc_thread_state_t *state);
+static struct pack_stream_s *pack_get_stream(struct pack_stream_s **streams,
+					     glc_message_type_t type,
+					     glc_stream_id_t id);
+static void pack_free_streams(struct pack_stream_s *streams);
+static void pack_delta_reset(pack_t pack, int all, glc_stream_id_t id);
 
 static void unpack_thread_finish_callback(void *ptr, void *threadptr, int err);
 static int unpack_read_callback(glc_thread_state_t *state);
 static int unpack_write_callback(glc_thread_state_t *state);
+static int unpack_decompress(glc_thread_state_t *state);
+static int unpack_tiles(unpack_t unpack, glc_thread_state_t *state);
+static void unpack_tile_band(void *arg, unsigned int first, unsigned int last);
+static int unpack_tile(struct unpack_tiles_job_s *job,
+		       glc_container_message_header_t *tile, unsigned int t,
+		       struct unpack_thread_s *thread_state);
+static void unpack_thread_free(struct unpack_thread_s *thread_state);
+static void unpack_band_states_free(unpack_t unpack);
 static void unpack_finish_callback(void *ptr, int err);
+static struct unpack_thread_s *unpack_thread_state(glc_thread_state_t *state);
+static int unpack_delta_ticket(glc_thread_state_t *state,
+			       glc_message_header_t *header);
+static int unpack_delta_apply(unpack_t unpack, glc_thread_state_t *state);
 static void print_stats(glc_t *glc, pack_stat_t *stat);
 
 int pack_init(pack_t *pack, glc_t *glc)
 {
-#if !defined(__QUICKLZ) && !defined(__LZO) && !defined(__LZJB)
+#if !defined(__QUICKLZ) && !defined(__LZO) && !defined(__LZJB) && \
+    !defined(__LZ4) && !defined(__ZSTD)
 	glc_log(glc, GLC_ERROR, "pack",
 		 "no supported compression algorithms found");
 	return ENOTSUP;
@@ -117,6 +291,7 @@ int pack_init(pack_t *pack, glc_t *glc)
 
 	(*pack)->glc = glc;
 	(*pack)->compress_min = 1024;
+	(*pack)->cpu_budget = 50;
 
 	(*pack)->thread.flags = GLC_THREAD_WRITE | GLC_THREAD_READ;
 	(*pack)->thread.ptr = *pack;
@@ -125,6 +300,7 @@ int pack_init(pack_t *pack, glc_t *glc)
 	(*pack)->thread.read_callback = &pack_read_callback;
 	(*pack)->thread.finish_callback = &pack_finish_callback;
 	(*pack)->thread.threads = glc_threads_hint(glc);
+	(*pack)->thread.name = "pack";
 
 	return 0;
 #endif
@@ -137,7 +313,6 @@ int pack_set_compression(pack_t pack, int compression)
 
 	if (compression == PACK_QUICKLZ) {
 #ifdef __QUICKLZ
-		pack->thread.write_callback = &pack_quicklz_write_callback;
 		glc_log(pack->glc, GLC_INFO, "pack",
 			 "compressing using QuickLZ");
 #else
@@ -147,7 +322,6 @@ int pack_set_compression(pack_t pack, int compression)
 #endif
 	} else if (compression == PACK_LZO) {
 #ifdef __LZO
-		pack->thread.write_callback = &pack_lzo_write_callback;
 		glc_log(pack->glc, GLC_INFO, "pack",
 			 "compressing using LZO");
 		lzo_init();
@@ -158,7 +332,6 @@ int pack_set_compression(pack_t pack, int compression)
 #endif
 	} else if (compression == PACK_LZJB) {
 #ifdef __LZJB
-		pack->thread.write_callback = &pack_lzjb_write_callback;
 		glc_log(pack->glc, GLC_INFO, "pack",
 			"compressing using LZJB");
 #else
@@ -166,6 +339,38 @@ int pack_set_compression(pack_t pack, int compression)
 			"LZJB not supported");
 		return ENOTSUP;
 #endif
+	} else if (compression == PACK_LZ4) {
+#ifdef __LZ4
+		glc_log(pack->glc, GLC_INFO, "pack",
+			"compressing using LZ4");
+#else
+		glc_log(pack->glc, GLC_ERROR, "pack",
+			"LZ4 not supported");
+		return ENOTSUP;
+#endif
+	} else if (compression == PACK_ZSTD) {
+#ifdef __ZSTD
+		glc_log(pack->glc, GLC_INFO, "pack",
+			"compressing using Zstandard");
+#else
+		glc_log(pack->glc, GLC_ERROR, "pack",
+			"Zstandard not supported");
+		return ENOTSUP;
+#endif
+	} else if (compression == PACK_ADAPTIVE) {
+		if (unlikely(!pack_codecs[0].name)) {
+			glc_log(pack->glc, GLC_ERROR, "pack",
+				"no algorithm available for adaptive compression");
+			return ENOTSUP;
+		}
+#ifdef __LZO
+		lzo_init();
+#endif
+		pack->thread.write_callback = &pack_adaptive_write_callback;
+		glc_log(pack->glc, GLC_INFO, "pack",
+			"adaptive compression, %u%% cpu budget", pack->cpu_budget);
+		pack->compression = compression;
+		return 0;
 	} else {
 		glc_log(pack->glc, GLC_ERROR, "pack",
 			 "unknown/unsupported compression algorithm 0x%02x",
@@ -173,10 +378,48 @@ int pack_set_compression(pack_t pack, int compression)
 		return ENOTSUP;
 	}
 
+	pack->thread.write_callback = &pack_write_callback;
 	pack->compression = compression;
 	return 0;
 }
 
+int pack_set_compression_level(pack_t pack, int level)
+{
+	if (unlikely(pack->running))
+		return EALREADY;
+
+	if (unlikely(level < 0))
+		return EINVAL;
+
+	pack->level = level;
+	return 0;
+}
+
+int pack_set_cpu_budget(pack_t pack, unsigned int percent)
+{
+	if (unlikely(pack->running))
+		return EALREADY;
+
+	if (unlikely(!percent || percent > 100))
+		return EINVAL;
+
+	pack->cpu_budget = percent;
+	return 0;
+}
+
+int pack_set_keyframe_interval(pack_t pack, unsigned int interval)
+{
+	if (unlikely(pack->running))
+		return EALREADY;
+
+	pack->keyframe_interval = interval;
+	if (interval)
+		glc_log(pack->glc, GLC_INFO, "pack",
+			"delta coding video frames, keyframe every %u frames",
+			interval);
+	return 0;
+}
+
 int pack_set_minimum_size(pack_t pack, size_t min_size)
 {
 	if (unlikely(pack->running))
@@ -201,8 +444,30 @@ int pack_process_start(pack_t pack, ps_buffer_t *from, ps_buffer_t *to)
 		return EINVAL;
 	}
 
-	if (unlikely((ret = glc_thread_create(pack->glc, &pack->thread, from, to))))
+	if (glc_frame_threads(pack->glc) > 1) {
+		/* big frames are also split in tiles */
+		pack->band_work_count = glc_frame_threads(pack->glc) - 1;
+		if (unlikely(!(pack->band_work = calloc(pack->band_work_count,
+							sizeof(struct pack_thread_s)))))
+			return ENOMEM;
+		if (unlikely((ret = glc_band_pool_create(pack->glc, &pack->bands,
+							 glc_frame_threads(pack->glc))))) {
+			pack_band_work_free(pack);
+			return ret;
+		}
+	}
+
+	/* restarted stream must begin with keyframes */
+	pack_delta_reset(pack, 1, 0);
+
+	if (unlikely((ret = glc_thread_create(pack->glc, &pack->thread, from, to)))) {
+		if (pack->bands) {
+			glc_band_pool_destroy(pack->bands);
+			pack->bands = NULL;
+		}
+		pack_band_work_free(pack);
 		return ret;
+	}
 	pack->running = 1;
 
 	return 0;
@@ -216,16 +481,37 @@ int pack_process_wait(pack_t pack)
 	glc_thread_wait(&pack->thread);
 	pack->running = 0;
 
+	if (pack->bands) {
+		glc_band_pool_destroy(pack->bands);
+		pack->bands = NULL;
+	}
+	pack_band_work_free(pack);
+
 	return 0;
 }
 
 int pack_destroy(pack_t pack)
 {
 	print_stats(pack->glc,&pack->stats);
+	pack_free_streams(pack->streams);
 	free(pack);
 	return 0;
 }
 
+void pack_band_work_free(pack_t pack)
+{
+	unsigned int w;
+	int compression;
+
+	for (w = 0; w < pack->band_work_count; w++) {
+		for (compression = 0; compression < PACK_ADAPTIVE; compression++)
+			pack_work_free(compression, pack->band_work[w].work[compression]);
+	}
+	free(pack->band_work);
+	pack->band_work = NULL;
+	pack->band_work_count = 0;
+}
+
 void pack_finish_callback(void *ptr, int err)
 {
 	pack_t pack = (pack_t) ptr;
@@ -237,71 +523,525 @@ void pack_finish_callback(void *ptr, int err)
 int pack_thread_create_callback(void *ptr, void **threadptr)
 {
 	pack_t pack = (pack_t) ptr;
+	struct pack_thread_s *thread;
+	unsigned int i;
+	int ret;
+
+	if (pack->compression != PACK_ADAPTIVE)
+		return pack_work_alloc(pack->compression, threadptr);
+
+	if (unlikely(!(thread = calloc(1, sizeof(struct pack_thread_s)))))
+		return ENOMEM;
+	*threadptr = thread;
+
+	for (i = 0; pack_codecs[i].name; i++) {
+		if (thread->work[pack_codecs[i].compression])
+			continue;
+		if (unlikely((ret = pack_work_alloc(pack_codecs[i].compression,
+					&thread->work[pack_codecs[i].compression]))))
+			return ret;
+	}
+
+	return 0;
+}
+
+void pack_thread_finish_callback(void *ptr, void *threadptr, int err)
+{
+	pack_t pack = (pack_t) ptr;
+	struct pack_thread_s *thread;
+	int compression;
+
+	if (pack->compression != PACK_ADAPTIVE) {
+		pack_work_free(pack->compression, threadptr);
+		return;
+	}
+
+	if (!(thread = threadptr))
+		return;
+	for (compression = 0; compression < PACK_ADAPTIVE; compression++)
+		pack_work_free(compression, thread->work[compression]);
+	free(thread);
+}
 
-	if (pack->compression == PACK_QUICKLZ) {
+int pack_work_alloc(int compression, void **work)
+{
+	if (compression == PACK_QUICKLZ) {
 #ifdef __QUICKLZ
-		*threadptr = malloc(sizeof(qlz_state_compress));
+		*work = malloc(sizeof(qlz_state_compress));
 #endif
-	} else if (pack->compression == PACK_LZO) {
+	} else if (compression == PACK_LZO) {
 #ifdef __LZO
-		*threadptr = malloc(__lzo_wrk_mem);
+		*work = malloc(__lzo_wrk_mem);
+#endif
+	} else if (compression == PACK_ZSTD) {
+#ifdef __ZSTD
+		if (unlikely(!(*work = ZSTD_createCCtx())))
+			return ENOMEM;
 #endif
 	}
 
 	return 0;
 }
 
-void pack_thread_finish_callback(void *ptr, void *threadptr, int err)
+void pack_work_free(int compression, void *work)
 {
-	free(threadptr);
+#ifdef __ZSTD
+	if (compression == PACK_ZSTD) {
+		ZSTD_freeCCtx((ZSTD_CCtx *) work);
+		return;
+	}
+#endif
+	free(work);
 }
 
 int pack_read_callback(glc_thread_state_t *state)
 {
 	pack_t pack = (pack_t) state->ptr;
+	int compression = pack->compression;
+	unsigned int tiles;
+	size_t bound;
+	int ret;
 
 	__sync_fetch_and_add(&pack->stats.unpack_size, state->read_size);
 
+	/*
+	 * frames after a format change or in a file opened by a reload
+	 * callback can't be deltas from frames before it
+	 */
+	if (pack->keyframe_interval) {
+		if (state->header.type == GLC_CALLBACK_REQUEST)
+			pack_delta_reset(pack, 1, 0);
+		else if (state->header.type == GLC_MESSAGE_VIDEO_FORMAT &&
+			 state->read_size >= sizeof(glc_video_format_message_t))
+			pack_delta_reset(pack, 0,
+				((glc_video_format_message_t *) state->read_data)->id);
+	}
+
 	/* compress only audio and pictures */
 	if ((state->read_size > pack->compress_min) &&
 	    ((state->header.type == GLC_MESSAGE_VIDEO_FRAME) ||
 	     (state->header.type == GLC_MESSAGE_AUDIO_DATA))) {
-		if (pack->compression == PACK_QUICKLZ) {
-#ifdef __QUICKLZ
-			state->write_size = sizeof(glc_container_message_header_t)
-					    + sizeof(glc_quicklz_header_t)
-					    + __quicklz_worstcase(state->read_size);
-#else
+		if ((compression == PACK_ADAPTIVE) &&
+		    unlikely((ret = pack_adaptive_select(pack, state, &compression))))
+			return ret;
+
+		if (unlikely(!(bound = pack_bound(compression, state->read_size))))
 			goto copy;
+
+		if ((tiles = pack_tiles(pack, state->read_size)))
+			/* compressed tiles are complete container messages */
+			bound = sizeof(glc_tiles_header_t) + tiles *
+				(sizeof(glc_container_message_header_t) +
+				 pack_bound(compression, PACK_TILE_SIZE));
+
+		state->write_size = sizeof(glc_container_message_header_t) + bound;
+
+		if (pack->keyframe_interval &&
+		    state->header.type == GLC_MESSAGE_VIDEO_FRAME)
+			return pack_delta(pack, state);
+		return 0;
+	}
+copy:
+	/* next frame can't be a delta from this one */
+	if (pack->keyframe_interval &&
+	    state->header.type == GLC_MESSAGE_VIDEO_FRAME &&
+	    state->read_size >= sizeof(glc_video_frame_header_t)) {
+		struct pack_stream_s *stream = pack_get_stream(&pack->streams,
+			GLC_MESSAGE_VIDEO_FRAME,
+			((glc_video_frame_header_t *) state->read_data)->id);
+		if (stream)
+			stream->size = 0;
+	}
+	__sync_fetch_and_add(&pack->stats.pack_size, state->read_size);
+	state->flags |= GLC_THREAD_COPY;
+	return 0;
+}
+
+/* codec header and compressed data worst case size, 0 if unsupported */
+size_t pack_bound(int compression, size_t size)
+{
+	switch (compression) {
+#ifdef __QUICKLZ
+	case PACK_QUICKLZ:
+		return sizeof(glc_quicklz_header_t) + __quicklz_worstcase(size);
 #endif
-		} else if (pack->compression == PACK_LZO) {
 #ifdef __LZO
-			state->write_size = sizeof(glc_container_message_header_t)
-					    + sizeof(glc_lzo_header_t)
-			                    + __lzo_worstcase(state->read_size);
-#else
-			goto copy;
+	case PACK_LZO:
+		return sizeof(glc_lzo_header_t) + __lzo_worstcase(size);
 #endif
-		} else if (pack->compression == PACK_LZJB) {
 #ifdef __LZJB
-			state->write_size = sizeof(glc_container_message_header_t)
-					    + sizeof(glc_lzjb_header_t)
-					    + __lzjb_worstcase(state->read_size);
-#else
-			goto copy;
+	case PACK_LZJB:
+		return sizeof(glc_lzjb_header_t) + __lzjb_worstcase(size);
 #endif
-		} else
-			goto copy;
+#ifdef __LZ4
+	case PACK_LZ4:
+		if (unlikely(size > LZ4_MAX_INPUT_SIZE))
+			return 0;
+		return sizeof(glc_lz4_header_t) + LZ4_compressBound(size);
+#endif
+#ifdef __ZSTD
+	case PACK_ZSTD:
+		return sizeof(glc_zstd_header_t) + ZSTD_compressBound(size);
+#endif
+	}
+	return 0;
+}
+
+int pack_write_callback(glc_thread_state_t *state)
+{
+	pack_t pack = (pack_t) state->ptr;
+
+	return pack_compress(state, pack->compression, state->threadptr,
+			     pack->level);
+}
+
+int pack_compress(glc_thread_state_t *state, int compression,
+		  void *work, int level)
+{
+	if (pack_tiles((pack_t) state->ptr, state->read_size))
+		return pack_tiles_compress(state, compression, work, level);
+	return pack_codec_compress(state, compression, work, level);
+}
 
+/* number of tiles frame is split in, 0 if it is compressed whole */
+unsigned int pack_tiles(pack_t pack, size_t size)
+{
+	if ((!pack->bands) || (size < 2 * PACK_TILE_SIZE))
 		return 0;
+	return (size + PACK_TILE_SIZE - 1) / PACK_TILE_SIZE;
+}
+
+int pack_codec_compress(glc_thread_state_t *state, int compression,
+			void *work, int level)
+{
+	switch (compression) {
+	case PACK_QUICKLZ:
+		return pack_quicklz_compress(state, work, level);
+	case PACK_LZO:
+		return pack_lzo_compress(state, work, level);
+	case PACK_LZJB:
+		return pack_lzjb_compress(state, work, level);
+	case PACK_LZ4:
+		return pack_lz4_compress(state, work, level);
+	case PACK_ZSTD:
+		return pack_zstd_compress(state, work, level);
 	}
-copy:
-	__sync_fetch_and_add(&pack->stats.pack_size, state->read_size);
-	state->flags |= GLC_THREAD_COPY;
+	return ENOTSUP;
+}
+
+/*
+ * Tiles are compressed by band pool threads into worst case sized
+ * slots, then moved next to each other. Several pack threads can
+ * get here at once, pool is then used by only one of them.
+ */
+int pack_tiles_compress(glc_thread_state_t *state, int compression,
+			void *work, int level)
+{
+	pack_t pack = (pack_t) state->ptr;
+	glc_container_message_header_t *container =
+		(glc_container_message_header_t *) state->write_data;
+	glc_tiles_header_t *tiles_header =
+		(glc_tiles_header_t *) &state->write_data[sizeof(glc_container_message_header_t)];
+	struct pack_tiles_job_s job;
+	glc_container_message_header_t *tile;
+	char *end;
+	unsigned int t;
+
+	job.pack = pack;
+	job.state = state;
+	job.compression = compression;
+	job.work = work;
+	job.level = level;
+	job.tiles = pack_tiles(pack, state->read_size);
+	job.dst = &state->write_data[sizeof(glc_container_message_header_t) +
+				     sizeof(glc_tiles_header_t)];
+	job.slot = sizeof(glc_container_message_header_t) +
+		   pack_bound(compression, PACK_TILE_SIZE);
+	job.ret = 0;
+
+	glc_band_pool_run(pack->bands, pack_tile_band, &job, job.tiles, 0);
+	if (unlikely(job.ret))
+		return job.ret;
+
+	for (t = 0, end = job.dst; t < job.tiles; t++) {
+		tile = (glc_container_message_header_t *) &job.dst[t * job.slot];
+		if (end != (char *) tile)
+			memmove(end, tile, sizeof(glc_container_message_header_t) + tile->size);
+		end += sizeof(glc_container_message_header_t) + tile->size;
+	}
+
+	tiles_header->size = (glc_size_t) state->read_size;
+	memcpy(&tiles_header->header, &state->header, sizeof(glc_message_header_t));
+	tiles_header->tiles = job.tiles;
+	tiles_header->tile_size = PACK_TILE_SIZE;
+
+	container->size = end - (char *) tiles_header;
+	container->header.type = GLC_MESSAGE_TILES;
+
+	state->header.type = GLC_MESSAGE_CONTAINER;
+	return 0;
+}
+
+void pack_tile_band(void *arg, unsigned int first, unsigned int last)
+{
+	struct pack_tiles_job_s *job = (struct pack_tiles_job_s *) arg;
+	unsigned int worker = glc_band_pool_worker();
+	glc_thread_state_t tile;
+	void *work = job->work;
+	void **band_work;
+	size_t offset;
+	int ret;
+
+	if (worker) {
+		/* pool threads only work for one pack thread at a time */
+		band_work = &job->pack->band_work[worker - 1].work[job->compression];
+		if ((!*band_work) &&
+		    unlikely((ret = pack_work_alloc(job->compression, band_work)))) {
+			job->ret = ret;
+			return;
+		}
+		work = *band_work;
+	}
+
+	memset(&tile, 0, sizeof(tile));
+	tile.ptr = job->pack;
+	for (; first < last; first++) {
+		offset = (size_t) first * PACK_TILE_SIZE;
+		tile.header = job->state->header;
+		tile.read_data = &job->state->read_data[offset];
+		tile.read_size = job->state->read_size - offset < PACK_TILE_SIZE ?
+				 job->state->read_size - offset : PACK_TILE_SIZE;
+		tile.write_data = &job->dst[first * job->slot];
+		tile.write_size = job->slot;
+		if (unlikely((ret = pack_codec_compress(&tile, job->compression,
+							work, job->level))))
+			job->ret = ret;
+	}
+}
+
+/*
+ * Called from read callback, in packet order. Picks the codec
+ * of the packet stream and hands it to the write callback.
+ */
+int pack_adaptive_select(pack_t pack, glc_thread_state_t *state,
+			 int *compression)
+{
+	struct pack_thread_s *thread = (struct pack_thread_s *) state->threadptr;
+	/* audio data header starts with the stream id too */
+	glc_video_frame_header_t *hdr = (glc_video_frame_header_t *) state->read_data;
+	struct pack_stream_s *stream;
+	glc_utime_t now = glc_time(pack->glc);
+
+	if (unlikely(!(stream = pack_get_stream(&pack->streams, state->header.type,
+						hdr->id))))
+		return ENOMEM;
+
+	if (unlikely(!stream->window_start))
+		stream->window_start = now;
+	else if (now - stream->window_start >= PACK_ADAPTIVE_WINDOW)
+		pack_adaptive_update(pack, stream, now);
+
+	thread->stream = stream;
+	thread->codec = stream->codec;
+	*compression = pack_codecs[stream->codec].compression;
 	return 0;
 }
 
-int pack_lzo_write_callback(glc_thread_state_t *state)
+/*
+ * Time spent compressing the stream during the last window is compared
+ * to the cpu budget. Over budget, step down to a faster codec. Well
+ * under budget, or when pack had to wait for room in its target buffer,
+ * step up to a stronger one if it is expected to fit in the budget and
+ * compresses better.
+ */
+void pack_adaptive_update(pack_t pack, struct pack_stream_s *stream,
+			  glc_utime_t now)
+{
+	glc_utime_t window = now - stream->window_start;
+	unsigned int codec = stream->codec, i;
+	uint64_t ns, in, out, busy = 0;
+	unsigned int blocked;
+	double cpu, expected;
+
+	for (i = 0; pack_codecs[i].name; i++) {
+		ns = __sync_fetch_and_and(&stream->codec_ns[i], 0);
+		in = __sync_fetch_and_and(&stream->codec_in[i], 0);
+		out = __sync_fetch_and_and(&stream->codec_out[i], 0);
+		busy += ns;
+		if (!in)
+			continue;
+		if (stream->ratio[i] == 0.0) {
+			stream->ns_per_byte[i] = (double) ns / in;
+			stream->ratio[i] = (double) out / in;
+		} else {
+			stream->ns_per_byte[i] = (stream->ns_per_byte[i] + (double) ns / in) / 2;
+			stream->ratio[i] = (stream->ratio[i] + (double) out / in) / 2;
+		}
+	}
+	blocked = __sync_fetch_and_and(&stream->blocked, 0);
+	stream->window_start = now;
+
+	/* percent of the time all pack threads have */
+	cpu = (double) busy * 100 / ((double) window * pack->thread.threads);
+
+	if (cpu > pack->cpu_budget) {
+		/* fastest codec expected to fit, or the fastest one */
+		while (codec > 0) {
+			codec--;
+			if ((stream->ns_per_byte[codec] != 0.0) &&
+			    (stream->ns_per_byte[stream->codec] != 0.0) &&
+			    (cpu * stream->ns_per_byte[codec] /
+			     stream->ns_per_byte[stream->codec] <= pack->cpu_budget))
+				break;
+		}
+	} else if (pack_codecs[codec + 1].name && (stream->ratio[codec] != 0.0)) {
+		if (stream->ns_per_byte[codec + 1] != 0.0)
+			expected = cpu * stream->ns_per_byte[codec + 1] /
+				   stream->ns_per_byte[codec];
+		else
+			expected = cpu * 2; /* untried, assume twice slower */
+
+		if (((stream->ratio[codec + 1] == 0.0) ||
+		     (stream->ratio[codec + 1] < stream->ratio[codec] * 0.97)) &&
+		    (expected <= (blocked ? pack->cpu_budget : pack->cpu_budget * 3 / 4)))
+			codec++;
+	}
+
+	if (codec != stream->codec) {
+		glc_log(pack->glc, GLC_PERF, "pack",
+			"stream %d (%s): %s level %d -> %s level %d,"
+			" %.1f%% cpu, %.2f ns/byte, %.1f%% size%s",
+			stream->id, glc_util_msgtype_to_str(stream->type),
+			pack_codecs[stream->codec].name, pack_codecs[stream->codec].level,
+			pack_codecs[codec].name, pack_codecs[codec].level,
+			cpu, stream->ns_per_byte[stream->codec],
+			stream->ratio[stream->codec] * 100,
+			blocked ? ", target buffer full" : "");
+		stream->codec = codec;
+	}
+}
+
+int pack_adaptive_write_callback(glc_thread_state_t *state)
+{
+	pack_t pack = (pack_t) state->ptr;
+	struct pack_thread_s *thread = (struct pack_thread_s *) state->threadptr;
+	const struct pack_codec_s *codec = &pack_codecs[thread->codec];
+	struct pack_stream_s *stream = thread->stream;
+	glc_utime_t start;
+	int ret;
+
+	if (state->flags & GLC_THREAD_STATE_WRITE_BLOCKED)
+		__sync_fetch_and_add(&stream->blocked, 1);
+
+	start = glc_time(pack->glc);
+	if (unlikely((ret = pack_compress(state, codec->compression,
+					  thread->work[codec->compression],
+					  codec->level))))
+		return ret;
+
+	__sync_fetch_and_add(&stream->codec_ns[thread->codec],
+			     glc_time(pack->glc) - start);
+	__sync_fetch_and_add(&stream->codec_in[thread->codec], state->read_size);
+	__sync_fetch_and_add(&stream->codec_out[thread->codec],
+		((glc_container_message_header_t *) state->write_data)->size);
+	return 0;
+}
+
+/*
+ * Called from read callback, which runs in packet order. Frame is
+ * XORed in place: pack is the only reader of its source buffer.
+ */
+int pack_delta(pack_t pack, glc_thread_state_t *state)
+{
+	glc_video_frame_header_t *pic = (glc_video_frame_header_t *) state->read_data;
+	char *data = &state->read_data[sizeof(glc_video_frame_header_t)];
+	size_t size = state->read_size - sizeof(glc_video_frame_header_t);
+	struct pack_stream_s *stream;
+	uint64_t cur, prev;
+	size_t i;
+
+	if (unlikely(!(stream = pack_get_stream(&pack->streams,
+						       GLC_MESSAGE_VIDEO_FRAME, pic->id))))
+		return ENOMEM;
+
+	if ((stream->size != size) ||
+	    (++stream->frames >= pack->keyframe_interval)) {
+		if (stream->size != size) {
+			free(stream->prev);
+			stream->size = 0;
+			if (unlikely(!(stream->prev = malloc(size))))
+				return ENOMEM;
+			stream->size = size;
+		}
+		memcpy(stream->prev, data, size);
+		stream->frames = 0;
+		state->header.type = GLC_MESSAGE_VIDEO_KEYFRAME;
+		return 0;
+	}
+
+	for (i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		memcpy(&cur, &data[i], sizeof(uint64_t));
+		memcpy(&prev, &stream->prev[i], sizeof(uint64_t));
+		memcpy(&stream->prev[i], &cur, sizeof(uint64_t));
+		cur ^= prev;
+		memcpy(&data[i], &cur, sizeof(uint64_t));
+	}
+	for (; i < size; i++) {
+		char c = data[i];
+		data[i] ^= stream->prev[i];
+		stream->prev[i] = c;
+	}
+
+	state->header.type = GLC_MESSAGE_VIDEO_DELTA;
+	return 0;
+}
+
+/* size 0 makes pack_delta() start the stream over with a keyframe */
+void pack_delta_reset(pack_t pack, int all, glc_stream_id_t id)
+{
+	struct pack_stream_s *stream;
+
+	for (stream = pack->streams; stream; stream = stream->next) {
+		if ((stream->type == GLC_MESSAGE_VIDEO_FRAME) &&
+		    (all || (stream->id == id)))
+			stream->size = 0;
+	}
+}
+
+struct pack_stream_s *pack_get_stream(struct pack_stream_s **streams,
+				      glc_message_type_t type,
+				      glc_stream_id_t id)
+{
+	struct pack_stream_s *stream = *streams;
+
+	while (stream) {
+		if ((stream->id == id) && (stream->type == type))
+			return stream;
+		stream = stream->next;
+	}
+
+	if (unlikely(!(stream = calloc(1, sizeof(struct pack_stream_s)))))
+		return NULL;
+	stream->type = type;
+	stream->id = id;
+	stream->next = *streams;
+	*streams = stream;
+	return stream;
+}
+
+void pack_free_streams(struct pack_stream_s *streams)
+{
+	struct pack_stream_s *del;
+
+	while (streams) {
+		del = streams;
+		streams = streams->next;
+		free(del->prev);
+		free(del);
+	}
+}
+
+int pack_lzo_compress(glc_thread_state_t *state, void *work, int level)
 {
 #ifdef __LZO
 	glc_container_message_header_t *container = (glc_container_message_header_t *) state->write_data;
@@ -312,7 +1052,7 @@ int pack_lzo_write_callback(glc_thread_state_t *state)
 	__lzo_compress((unsigned char *) state->read_data, state->read_size,
 		       (unsigned char *) &state->write_data[sizeof(glc_lzo_header_t) +
 		       					    sizeof(glc_container_message_header_t)],
-		       &compressed_size, (lzo_voidp) state->threadptr);
+		       &compressed_size, (lzo_voidp) work);
 
 	lzo_header->size = (glc_size_t) state->read_size;
 	memcpy(&lzo_header->header, &state->header, sizeof(glc_message_header_t));
@@ -331,7 +1071,7 @@ int pack_lzo_write_callback(glc_thread_state_t *state)
 #endif
 }
 
-int pack_quicklz_write_callback(glc_thread_state_t *state)
+int pack_quicklz_compress(glc_thread_state_t *state, void *work, int level)
 {
 #ifdef __QUICKLZ
 	glc_container_message_header_t *container = (glc_container_message_header_t *) state->write_data;
@@ -342,7 +1082,7 @@ int pack_quicklz_write_callback(glc_thread_state_t *state)
 			(void *) &state->write_data[sizeof(glc_quicklz_header_t) +
 			 			    sizeof(glc_container_message_header_t)],
 			 state->read_size,
-			 (qlz_state_compress *) state->threadptr);
+			 (qlz_state_compress *) work);
 
 	quicklz_header->size = (glc_size_t) state->read_size;
 	memcpy(&quicklz_header->header, &state->header, sizeof(glc_message_header_t));
@@ -361,7 +1101,7 @@ int pack_quicklz_write_callback(glc_thread_state_t *state)
 #endif
 }
 
-int pack_lzjb_write_callback(glc_thread_state_t *state)
+int pack_lzjb_compress(glc_thread_state_t *state, void *work, int level)
 {
 #ifdef __LZJB
 	glc_container_message_header_t *container = (glc_container_message_header_t *) state->write_data;
@@ -390,6 +1130,79 @@ int pack_lzjb_write_callback(glc_thread_state_t *state)
 #endif
 }
 
+int pack_lz4_compress(glc_thread_state_t *state, void *work, int level)
+{
+#ifdef __LZ4
+	pack_t pack = (pack_t) state->ptr;
+	glc_container_message_header_t *container = (glc_container_message_header_t *) state->write_data;
+	glc_lz4_header_t *lz4_header =
+		(glc_lz4_header_t *) &state->write_data[sizeof(glc_container_message_header_t)];
+	char *dst = &state->write_data[sizeof(glc_lz4_header_t) +
+				       sizeof(glc_container_message_header_t)];
+	int dst_capacity = state->write_size - sizeof(glc_lz4_header_t) -
+			   sizeof(glc_container_message_header_t);
+
+	/* level is the acceleration factor, 1 is the default */
+	int compressed_size = LZ4_compress_fast(state->read_data, dst,
+						state->read_size, dst_capacity,
+						level ? level : 1);
+	if (unlikely(compressed_size <= 0))
+		return EINVAL;
+
+	lz4_header->size = (glc_size_t) state->read_size;
+	memcpy(&lz4_header->header, &state->header, sizeof(glc_message_header_t));
+
+	container->size = compressed_size + sizeof(glc_lz4_header_t);
+	container->header.type = GLC_MESSAGE_LZ4;
+
+	state->header.type = GLC_MESSAGE_CONTAINER;
+
+	__sync_fetch_and_add(&pack->stats.pack_size, compressed_size);
+
+	return 0;
+#else
+	return ENOTSUP;
+#endif
+}
+
+int pack_zstd_compress(glc_thread_state_t *state, void *work, int level)
+{
+#ifdef __ZSTD
+	pack_t pack = (pack_t) state->ptr;
+	glc_container_message_header_t *container = (glc_container_message_header_t *) state->write_data;
+	glc_zstd_header_t *zstd_header =
+		(glc_zstd_header_t *) &state->write_data[sizeof(glc_container_message_header_t)];
+	char *dst = &state->write_data[sizeof(glc_zstd_header_t) +
+				       sizeof(glc_container_message_header_t)];
+	size_t dst_capacity = state->write_size - sizeof(glc_zstd_header_t) -
+			      sizeof(glc_container_message_header_t);
+
+	size_t compressed_size = ZSTD_compressCCtx((ZSTD_CCtx *) work,
+						   dst, dst_capacity,
+						   state->read_data, state->read_size,
+						   level ? level : __zstd_default_level);
+	if (unlikely(ZSTD_isError(compressed_size))) {
+		glc_log(pack->glc, GLC_ERROR, "pack", "zstd: %s",
+			ZSTD_getErrorName(compressed_size));
+		return EINVAL;
+	}
+
+	zstd_header->size = (glc_size_t) state->read_size;
+	memcpy(&zstd_header->header, &state->header, sizeof(glc_message_header_t));
+
+	container->size = compressed_size + sizeof(glc_zstd_header_t);
+	container->header.type = GLC_MESSAGE_ZSTD;
+
+	state->header.type = GLC_MESSAGE_CONTAINER;
+
+	__sync_fetch_and_add(&pack->stats.pack_size, compressed_size);
+
+	return 0;
+#else
+	return ENOTSUP;
+#endif
+}
+
 int unpack_init(unpack_t *unpack, glc_t *glc)
 {
 	*unpack = (unpack_t) calloc(1, sizeof(struct unpack_s));
@@ -403,6 +1216,10 @@ int unpack_init(unpack_t *unpack, glc_t *glc)
 	(*unpack)->thread.write_callback = &unpack_write_callback;
 	(*unpack)->thread.finish_callback = &unpack_finish_callback;
 	(*unpack)->thread.threads = glc_threads_hint(glc);
+	(*unpack)->thread.name = "unpack";
+
+	pthread_mutex_init(&(*unpack)->delta_mutex, NULL);
+	pthread_cond_init(&(*unpack)->delta_cond, NULL);
 
 #ifdef __LZO
 	lzo_init();
@@ -417,8 +1234,27 @@ int unpack_process_start(unpack_t unpack, ps_buffer_t *from, ps_buffer_t *to)
 	if (unlikely(unpack->running))
 		return EAGAIN;
 
-	if (unlikely((ret = glc_thread_create(unpack->glc, &unpack->thread, from, to))))
+	if (glc_frame_threads(unpack->glc) > 1) {
+		/* tiles of a frame are also decompressed in parallel */
+		unpack->band_state_count = glc_frame_threads(unpack->glc) - 1;
+		if (unlikely(!(unpack->band_states = calloc(unpack->band_state_count,
+							    sizeof(struct unpack_thread_s)))))
+			return ENOMEM;
+		if (unlikely((ret = glc_band_pool_create(unpack->glc, &unpack->bands,
+							 glc_frame_threads(unpack->glc))))) {
+			unpack_band_states_free(unpack);
+			return ret;
+		}
+	}
+
+	if (unlikely((ret = glc_thread_create(unpack->glc, &unpack->thread, from, to)))) {
+		if (unpack->bands) {
+			glc_band_pool_destroy(unpack->bands);
+			unpack->bands = NULL;
+		}
+		unpack_band_states_free(unpack);
 		return ret;
+	}
 	unpack->running = 1;
 
 	return 0;
@@ -432,12 +1268,21 @@ int unpack_process_wait(unpack_t unpack)
 	glc_thread_wait(&unpack->thread);
 	unpack->running = 0;
 
+	if (unpack->bands) {
+		glc_band_pool_destroy(unpack->bands);
+		unpack->bands = NULL;
+	}
+	unpack_band_states_free(unpack);
+
 	return 0;
 }
 
 int unpack_destroy(unpack_t unpack)
 {
 	print_stats(unpack->glc, &unpack->stats);
+	pack_free_streams(unpack->streams);
+	pthread_cond_destroy(&unpack->delta_cond);
+	pthread_mutex_destroy(&unpack->delta_mutex);
 	free(unpack);
 	return 0;
 }
@@ -452,7 +1297,136 @@ void unpack_finish_callback(void *ptr, int err)
 
 void unpack_thread_finish_callback(void *ptr, void *threadptr, int err)
 {
-	free(threadptr);
+	unpack_t unpack = (unpack_t) ptr;
+	struct unpack_thread_s *thread_state = threadptr;
+
+	if (!thread_state)
+		return;
+
+	/* frame was never restored, later delta frames would wait forever */
+	if (thread_state->delta) {
+		pthread_mutex_lock(&unpack->delta_mutex);
+		unpack->delta_cancel = 1;
+		pthread_cond_broadcast(&unpack->delta_cond);
+		pthread_mutex_unlock(&unpack->delta_mutex);
+	}
+	if (thread_state->tile)
+		unpack_thread_free(thread_state->tile);
+	unpack_thread_free(thread_state);
+}
+
+void unpack_thread_free(struct unpack_thread_s *thread_state)
+{
+	free(thread_state->quicklz);
+#ifdef __ZSTD
+	ZSTD_freeDCtx((ZSTD_DCtx *) thread_state->zstd);
+#endif
+	free(thread_state->tiles);
+	free(thread_state);
+}
+
+void unpack_band_states_free(unpack_t unpack)
+{
+	unsigned int w;
+
+	for (w = 0; w < unpack->band_state_count; w++) {
+		free(unpack->band_states[w].quicklz);
+#ifdef __ZSTD
+		ZSTD_freeDCtx((ZSTD_DCtx *) unpack->band_states[w].zstd);
+#endif
+	}
+	free(unpack->band_states);
+	unpack->band_states = NULL;
+	unpack->band_state_count = 0;
+}
+
+struct unpack_thread_s *unpack_thread_state(glc_thread_state_t *state)
+{
+	if (unlikely(!state->threadptr))
+		state->threadptr = calloc(1, sizeof(struct unpack_thread_s));
+	return (struct unpack_thread_s *) state->threadptr;
+}
+
+/* read callback runs in packet order, tickets follow stream order */
+int unpack_delta_ticket(glc_thread_state_t *state, glc_message_header_t *header)
+{
+	unpack_t unpack = (unpack_t) state->ptr;
+	struct unpack_thread_s *thread_state;
+
+	if ((header->type != GLC_MESSAGE_VIDEO_KEYFRAME) &&
+	    (header->type != GLC_MESSAGE_VIDEO_DELTA))
+		return 0;
+
+	if (unlikely(!(thread_state = unpack_thread_state(state))))
+		return ENOMEM;
+	thread_state->delta = 1;
+	thread_state->delta_ticket = unpack->delta_next++;
+	return 0;
+}
+
+int unpack_delta_apply(unpack_t unpack, glc_thread_state_t *state)
+{
+	struct unpack_thread_s *thread_state = state->threadptr;
+	glc_video_frame_header_t *pic = (glc_video_frame_header_t *) state->write_data;
+	char *data = &state->write_data[sizeof(glc_video_frame_header_t)];
+	size_t size = state->write_size - sizeof(glc_video_frame_header_t);
+	struct pack_stream_s *stream;
+	uint64_t cur, prev;
+	size_t i;
+	int ret = 0;
+
+	pthread_mutex_lock(&unpack->delta_mutex);
+	while ((unpack->delta_turn != thread_state->delta_ticket) &&
+	       (!unpack->delta_cancel))
+		pthread_cond_wait(&unpack->delta_cond, &unpack->delta_mutex);
+	if (unlikely(unpack->delta_cancel)) {
+		ret = EINTR;
+		goto out;
+	}
+
+	if (unlikely(!(stream = pack_get_stream(&unpack->streams,
+						       GLC_MESSAGE_VIDEO_FRAME, pic->id)))) {
+		ret = ENOMEM;
+		goto out;
+	}
+
+	if (stream->size != size) {
+		free(stream->prev);
+		stream->size = 0;
+		if (unlikely(!(stream->prev = malloc(size)))) {
+			ret = ENOMEM;
+			goto out;
+		}
+		stream->size = size;
+		/* stream starts with a delta frame, picture is wrong until next keyframe */
+		if (state->header.type == GLC_MESSAGE_VIDEO_DELTA) {
+			glc_log(unpack->glc, GLC_WARN, "unpack",
+				"delta frame without keyframe in stream %d", pic->id);
+			memset(stream->prev, 0, size);
+		}
+	}
+
+	if (state->header.type == GLC_MESSAGE_VIDEO_KEYFRAME)
+		memcpy(stream->prev, data, size);
+	else {
+		for (i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+			memcpy(&cur, &data[i], sizeof(uint64_t));
+			memcpy(&prev, &stream->prev[i], sizeof(uint64_t));
+			cur ^= prev;
+			memcpy(&data[i], &cur, sizeof(uint64_t));
+			memcpy(&stream->prev[i], &cur, sizeof(uint64_t));
+		}
+		for (; i < size; i++)
+			stream->prev[i] = data[i] ^= stream->prev[i];
+	}
+	state->header.type = GLC_MESSAGE_VIDEO_FRAME;
+
+	thread_state->delta = 0;
+	unpack->delta_turn++;
+	pthread_cond_broadcast(&unpack->delta_cond);
+out:
+	pthread_mutex_unlock(&unpack->delta_mutex);
+	return ret;
 }
 
 int unpack_read_callback(glc_thread_state_t *state)
@@ -462,7 +1436,8 @@ int unpack_read_callback(glc_thread_state_t *state)
 	if (state->header.type == GLC_MESSAGE_LZO) {
 #ifdef __LZO
 		state->write_size = ((glc_lzo_header_t *) state->read_data)->size;
-		return 0;
+		return unpack_delta_ticket(state,
+			&((glc_lzo_header_t *) state->read_data)->header);
 #else
 		glc_log(unpack->glc,
 			 GLC_ERROR, "unpack", "LZO not supported");
@@ -471,7 +1446,8 @@ int unpack_read_callback(glc_thread_state_t *state)
 	} else if (state->header.type == GLC_MESSAGE_QUICKLZ) {
 #ifdef __QUICKLZ
 		state->write_size = ((glc_quicklz_header_t *) state->read_data)->size;
-		return 0;
+		return unpack_delta_ticket(state,
+			&((glc_quicklz_header_t *) state->read_data)->header);
 #else
 		glc_log(unpack->glc,
 			 GLC_ERROR, "unpack", "QuickLZ not supported");
@@ -480,11 +1456,36 @@ int unpack_read_callback(glc_thread_state_t *state)
 	} else if (state->header.type == GLC_MESSAGE_LZJB) {
 #ifdef __LZJB
 		state->write_size = ((glc_lzjb_header_t *) state->read_data)->size;
-		return 0;
+		return unpack_delta_ticket(state,
+			&((glc_lzjb_header_t *) state->read_data)->header);
 #else
 		glc_log(unpack->glc,
 			GLC_ERROR, "unpack", "LZJB not supported");
 		return ENOTSUP;
+#endif
+	} else if (state->header.type == GLC_MESSAGE_LZ4) {
+#ifdef __LZ4
+		state->write_size = ((glc_lz4_header_t *) state->read_data)->size;
+		return unpack_delta_ticket(state,
+			&((glc_lz4_header_t *) state->read_data)->header);
+#else
+		glc_log(unpack->glc,
+			GLC_ERROR, "unpack", "LZ4 not supported");
+		return ENOTSUP;
+#endif
+	} else if (state->header.type == GLC_MESSAGE_TILES) {
+		state->write_size = ((glc_tiles_header_t *) state->read_data)->size;
+		return unpack_delta_ticket(state,
+			&((glc_tiles_header_t *) state->read_data)->header);
+	} else if (state->header.type == GLC_MESSAGE_ZSTD) {
+#ifdef __ZSTD
+		state->write_size = ((glc_zstd_header_t *) state->read_data)->size;
+		return unpack_delta_ticket(state,
+			&((glc_zstd_header_t *) state->read_data)->header);
+#else
+		glc_log(unpack->glc,
+			GLC_ERROR, "unpack", "Zstandard not supported");
+		return ENOTSUP;
 #endif
 	}
 	__sync_fetch_and_add(&unpack->stats.pack_size, state->read_size);
@@ -496,6 +1497,134 @@ int unpack_read_callback(glc_thread_state_t *state)
 int unpack_write_callback(glc_thread_state_t *state)
 {
 	unpack_t unpack = (unpack_t) state->ptr;
+	int ret;
+
+	if (state->header.type == GLC_MESSAGE_TILES)
+		ret = unpack_tiles(unpack, state);
+	else
+		ret = unpack_decompress(state);
+	if (unlikely(ret))
+		return ret;
+
+	__sync_fetch_and_add(&unpack->stats.unpack_size, state->write_size);
+
+	if (state->threadptr && ((struct unpack_thread_s *) state->threadptr)->delta)
+		return unpack_delta_apply(unpack, state);
+	return 0;
+}
+
+int unpack_tiles(unpack_t unpack, glc_thread_state_t *state)
+{
+	struct unpack_tiles_job_s job;
+	struct unpack_thread_s *thread_state;
+	glc_container_message_header_t *tile;
+	char *data = &state->read_data[sizeof(glc_tiles_header_t)];
+	char *end = &state->read_data[state->read_size];
+	unsigned int t;
+
+	job.unpack = unpack;
+	job.state = state;
+	job.header = (glc_tiles_header_t *) state->read_data;
+	job.ret = 0;
+	memcpy(&state->header, &job.header->header, sizeof(glc_message_header_t));
+
+	/* tile count must be exactly what tile_size splits size into */
+	if (unlikely(!job.header->tile_size))
+		goto corrupted;
+	if (unlikely(!job.header->tiles ||
+		     job.header->tiles != state->write_size / job.header->tile_size +
+					  (state->write_size % job.header->tile_size != 0)))
+		goto corrupted;
+
+	/* tiles this thread works on have state of their own */
+	if (unlikely(!(thread_state = unpack_thread_state(state))))
+		return ENOMEM;
+	if (!thread_state->tile &&
+	    unlikely(!(thread_state->tile = calloc(1, sizeof(struct unpack_thread_s)))))
+		return ENOMEM;
+
+	if (thread_state->tile_count < job.header->tiles) {
+		glc_container_message_header_t **tiles =
+			realloc(thread_state->tiles, sizeof(glc_container_message_header_t *) *
+						     job.header->tiles);
+		if (unlikely(!tiles))
+			return ENOMEM;
+		thread_state->tiles = tiles;
+		thread_state->tile_count = job.header->tiles;
+	}
+
+	for (t = 0; t < job.header->tiles; t++) {
+		tile = (glc_container_message_header_t *) data;
+		if (unlikely(data + sizeof(glc_container_message_header_t) > end ||
+			     data + sizeof(glc_container_message_header_t) + tile->size > end))
+			goto corrupted;
+		thread_state->tiles[t] = tile;
+		data += sizeof(glc_container_message_header_t) + tile->size;
+	}
+
+	job.tiles = thread_state->tiles;
+	job.thread_state = thread_state->tile;
+	if (unpack->bands)
+		glc_band_pool_run(unpack->bands, unpack_tile_band, &job,
+				  job.header->tiles, 0);
+	else
+		unpack_tile_band(&job, 0, job.header->tiles);
+	return job.ret;
+
+corrupted:
+	glc_log(unpack->glc, GLC_ERROR, "unpack", "corrupted tiled packet");
+	return EINVAL;
+}
+
+void unpack_tile_band(void *arg, unsigned int first, unsigned int last)
+{
+	struct unpack_tiles_job_s *job = (struct unpack_tiles_job_s *) arg;
+	unsigned int worker = glc_band_pool_worker();
+	struct unpack_thread_s *thread_state = job->thread_state;
+	int ret;
+
+	/* pool threads only work for one unpack thread at a time */
+	if (worker)
+		thread_state = &job->unpack->band_states[worker - 1];
+
+	for (; first < last; first++) {
+		if (unlikely((ret = unpack_tile(job, job->tiles[first], first,
+						thread_state))))
+			job->ret = ret;
+	}
+}
+
+int unpack_tile(struct unpack_tiles_job_s *job, glc_container_message_header_t *tile,
+		unsigned int t, struct unpack_thread_s *thread_state)
+{
+	glc_thread_state_t tile_state;
+	size_t offset = (size_t) t * job->header->tile_size;
+	size_t size = job->state->write_size - offset < job->header->tile_size ?
+		      job->state->write_size - offset : job->header->tile_size;
+	int ret;
+
+	memset(&tile_state, 0, sizeof(tile_state));
+	tile_state.ptr = job->unpack;
+	tile_state.threadptr = thread_state;
+	tile_state.header = tile->header;
+	tile_state.read_data = (char *) tile + sizeof(glc_container_message_header_t);
+	tile_state.read_size = tile->size;
+	tile_state.write_data = &job->state->write_data[offset];
+	tile_state.write_size = size;
+
+	if (unlikely((ret = unpack_decompress(&tile_state))))
+		return ret;
+	if (unlikely(tile_state.write_size != size)) {
+		glc_log(job->unpack->glc, GLC_ERROR, "unpack", "corrupted tile");
+		return EINVAL;
+	}
+	return 0;
+}
+
+int unpack_decompress(glc_thread_state_t *state)
+{
+	unpack_t unpack = (unpack_t) state->ptr;
+	struct unpack_thread_s *thread_state;
 
 	if (state->header.type == GLC_MESSAGE_LZO) {
 #ifdef __LZO
@@ -516,11 +1645,15 @@ int unpack_write_callback(glc_thread_state_t *state)
 					state->read_size - sizeof(glc_quicklz_header_t));
 		memcpy(&state->header, &((glc_quicklz_header_t *) state->read_data)->header,
 		       sizeof(glc_message_header_t));
-		if (!state->threadptr)
-			state->threadptr = malloc(sizeof(qlz_state_decompress));
+		thread_state = unpack_thread_state(state);
+		if (unlikely(!thread_state))
+			return ENOMEM;
+		if (!thread_state->quicklz &&
+		    unlikely(!(thread_state->quicklz = malloc(sizeof(qlz_state_decompress)))))
+			return ENOMEM;
 		qlz_decompress((const void *) &state->read_data[sizeof(glc_quicklz_header_t)],
 				(void *) state->write_data,
-				(qlz_state_decompress *) state->threadptr);
+				(qlz_state_decompress *) thread_state->quicklz);
 #else
 		return ENOTSUP;
 #endif
@@ -535,10 +1668,48 @@ int unpack_write_callback(glc_thread_state_t *state)
 				state->write_size);
 #else
 		return ENOTSUP;
+#endif
+	} else if (state->header.type == GLC_MESSAGE_LZ4) {
+#ifdef __LZ4
+		__sync_fetch_and_add(&unpack->stats.pack_size, state->read_size - sizeof(glc_lz4_header_t));
+		memcpy(&state->header, &((glc_lz4_header_t *) state->read_data)->header,
+		       sizeof(glc_message_header_t));
+		if (unlikely(LZ4_decompress_safe(&state->read_data[sizeof(glc_lz4_header_t)],
+						 state->write_data,
+						 state->read_size - sizeof(glc_lz4_header_t),
+						 state->write_size) != state->write_size)) {
+			glc_log(unpack->glc, GLC_ERROR, "unpack", "corrupted LZ4 packet");
+			return EINVAL;
+		}
+#else
+		return ENOTSUP;
+#endif
+	} else if (state->header.type == GLC_MESSAGE_ZSTD) {
+#ifdef __ZSTD
+		size_t size;
+
+		__sync_fetch_and_add(&unpack->stats.pack_size, state->read_size - sizeof(glc_zstd_header_t));
+		memcpy(&state->header, &((glc_zstd_header_t *) state->read_data)->header,
+		       sizeof(glc_message_header_t));
+		thread_state = unpack_thread_state(state);
+		if (unlikely(!thread_state))
+			return ENOMEM;
+		if (!thread_state->zstd &&
+		    unlikely(!(thread_state->zstd = ZSTD_createDCtx())))
+			return ENOMEM;
+		size = ZSTD_decompressDCtx((ZSTD_DCtx *) thread_state->zstd,
+					   state->write_data, state->write_size,
+					   &state->read_data[sizeof(glc_zstd_header_t)],
+					   state->read_size - sizeof(glc_zstd_header_t));
+		if (unlikely(ZSTD_isError(size) || size != state->write_size)) {
+			glc_log(unpack->glc, GLC_ERROR, "unpack", "corrupted Zstandard packet");
+			return EINVAL;
+		}
+#else
+		return ENOTSUP;
 #endif
 	} else
 		return ENOTSUP;
-	__sync_fetch_and_add(&unpack->stats.unpack_size, state->write_size);
 	return 0;
 }
 
@@ -34,6 +34,12 @@ typedef struct pack_s* pack_t;
 #define PACK_LZO           0x2
 /** LZJB compression */
 #define PACK_LZJB          0x3
+/** LZ4 compression */
+#define PACK_LZ4           0x4
+/** Zstandard compression */
+#define PACK_ZSTD          0x5
+/** pick one of the above per stream, see pack_set_cpu_budget() */
+#define PACK_ADAPTIVE      0x6
 
 /**
  * \brief unpack object
@@ -60,6 +66,49 @@ __PUBLIC int pack_init(pack_t *pack, glc_t *glc);
  */
 __PUBLIC int pack_set_compression(pack_t pack, int compression);
 
+/**
+ * \brief set compression level
+ *
+ * Only used by LZ4, where it is the acceleration factor (higher is
+ * faster), and Zstandard, where it is the compression level (higher
+ * compresses better). 0 selects the algorithm default.
+ * \param pack pack object
+ * \param level compression level
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_compression_level(pack_t pack, int level);
+
+/**
+ * \brief set cpu budget of adaptive compression
+ *
+ * With PACK_ADAPTIVE, time spent compressing each stream and
+ * the compression ratio of each algorithm are measured on live
+ * data. Streams move to a faster algorithm when compression
+ * takes more than percent of the pack threads time, and to a
+ * stronger one when there is room left or when the target
+ * buffer fills up. Changes are logged at GLC_PERF level.
+ * Default budget is 50%.
+ * \param pack pack object
+ * \param percent cpu budget, 1 to 100
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_cpu_budget(pack_t pack, unsigned int percent);
+
+/**
+ * \brief set keyframe interval
+ *
+ * When non zero, video frames are XORed with the previous frame
+ * of the same stream before compression, which turns static
+ * parts of the picture into long runs of zeros. Every interval
+ * frames, or when the frame size changes, a keyframe is sent
+ * as is. unpack restores the original frames. 0 disables delta
+ * coding and is the default.
+ * \param pack pack object
+ * \param interval frames between keyframes
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int pack_set_keyframe_interval(pack_t pack, unsigned int interval);
+
 /**
  * \brief set compression threshold
  *
@@ -76,7 +125,8 @@ __PUBLIC int pack_set_minimum_size(pack_t pack, size_t min_size);
  *
  * pack compresses all data that is practical to compress (currently
  * pictures and audio data) and wraps compressed data into container
- * packets.
+ * packets. When glc_frame_threads() is more than 1, frames larger
+ * than a few MiB are split in tiles compressed in parallel.
  * \param pack pack object
  * \param from source buffer
  * \param to target buffer
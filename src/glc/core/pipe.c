@@ -36,6 +36,7 @@
 #include <glc/common/state.h>
 #include <glc/common/log.h>
 #include <glc/common/thread.h>
+#include <glc/common/metrics.h>
 #include <glc/common/util.h>
 #include <glc/common/signal.h>
 #include <glc/common/optimization.h>
@@ -44,6 +45,7 @@
 
 #include "pipe.h"
 #include "frame_writers.h"
+#include "shm_ring.h"
 
 #define PIPE_WRITING      0x01
 #define PIPE_RUNNING      0x02
@@ -78,6 +80,14 @@ struct pipe_runtime_s
 	glc_stream_id_t id;
 	struct timespec wait_time;
 	int write_frame_ret;
+	int splice;
+	int invert;
+	/*
+	 * frames go through a shared memory ring instead of the pipe when
+	 * shm_frames is set. The reader gets the ring memfd as stdin.
+	 */
+	unsigned shm_frames;
+	shm_ring_t ring;
 };
 
 typedef struct {
@@ -126,8 +136,8 @@ static sink_ops_t pipe_sink_ops = {
 };
 
 int pipe_sink_init(sink_t *sink, glc_t *glc, const char *exec_file,
-		   int invert, unsigned delay_ms,
-		   int (*stop_capture_cb)())
+		   int invert, int splice, unsigned shm_frames,
+		   unsigned delay_ms, int (*stop_capture_cb)())
 {
 	int ret;
 	pipe_sink_t *pipe_sink = (pipe_sink_t*)calloc(1,sizeof(pipe_sink_t));
@@ -141,7 +151,9 @@ int pipe_sink_init(sink_t *sink, glc_t *glc, const char *exec_file,
 		return errno;
 	}
 
-	if (invert)
+	if (splice)
+		ret = glcs_splice_create(&pipe_sink->runtime.writer, invert);
+	else if (invert)
 		ret = glcs_invert_create(&pipe_sink->runtime.writer);
 	else
 		ret = glcs_std_create(&pipe_sink->runtime.writer);
@@ -162,6 +174,7 @@ int pipe_sink_init(sink_t *sink, glc_t *glc, const char *exec_file,
 	pipe_sink->thread.close_callback  = &pipe_close_callback;
 	pipe_sink->thread.finish_callback = &pipe_finish_callback;
 	pipe_sink->thread.threads = 1;
+	pipe_sink->thread.name     = "pipe";
 
 	tracker_init(&pipe_sink->state_tracker, pipe_sink->glc);
 
@@ -169,6 +182,9 @@ int pipe_sink_init(sink_t *sink, glc_t *glc, const char *exec_file,
 	pipe_sink->params.fps       = 0.0;
 	pipe_sink->params.delay_ns  = delay_ms*1000000;
 	pipe_sink->runtime.w_pipefd = -1;
+	pipe_sink->runtime.splice   = splice;
+	pipe_sink->runtime.invert   = invert;
+	pipe_sink->runtime.shm_frames = shm_frames;
 
 	return 0;
 }
@@ -336,6 +352,17 @@ static int open_pipe(pipe_sink_t *pipe_sink, glc_video_format_message_t *format,
 		return EINVAL;
 	}
 
+	if (pipe_sink->runtime.shm_frames) {
+		if (unlikely((ret = shm_ring_create(&pipe_sink->runtime.ring,
+						    pipe_sink->glc, r, format->height,
+						    pipe_sink->runtime.shm_frames,
+						    pipe_sink->runtime.invert,
+						    &stream_pipe[0]))))
+			return ret;
+		stream_pipe[1] = -1;
+		goto fork_reader;
+	}
+
 	if (unlikely((ret = pipe(stream_pipe)) < 0)) {
 		glc_log(pipe_sink->glc, GLC_ERROR, "pipe", "error creating pipe: %s (%d)",
 			strerror(errno), errno);
@@ -360,8 +387,16 @@ static int open_pipe(pipe_sink_t *pipe_sink, glc_video_format_message_t *format,
 	}
 
 	frame_size = r * format->height;
-	glc_util_set_pipe_size(pipe_sink->glc,stream_pipe[1], 15*frame_size);
+	/*
+	 * Splice writer copies as much as the pipe holds at the end of each
+	 * frame, keep the pipe small enough for most of the frame to be spliced.
+	 */
+	if (pipe_sink->runtime.splice)
+		glc_util_set_pipe_size(pipe_sink->glc,stream_pipe[1], frame_size/4);
+	else
+		glc_util_set_pipe_size(pipe_sink->glc,stream_pipe[1], 15*frame_size);
 
+fork_reader:
 	/*
 	 * Check SIGCHLD disposition and issue warning if there is a risk to interfere
 	 * with the host application.
@@ -453,8 +488,12 @@ static int open_pipe(pipe_sink_t *pipe_sink, glc_video_format_message_t *format,
 	pthread_sigmask(SIG_SETMASK, &oset, NULL);
 	return ret;
 err:
+	if (pipe_sink->runtime.ring) {
+		shm_ring_destroy(pipe_sink->runtime.ring);
+		pipe_sink->runtime.ring = NULL;
+	} else
+		close(stream_pipe[1]);
 	close(stream_pipe[0]);
-	close(stream_pipe[1]);
 	return ret;
 }
 
@@ -498,6 +537,16 @@ static int write_video_frame(pipe_sink_t *pipe_sink,
 	int ret;
 	int timeout_ms = pipe_sink->runtime.wait_time.tv_sec*1000 +
 			 pipe_sink->runtime.wait_time.tv_nsec/1000000L;
+	if (pipe_sink->runtime.ring) {
+		ret = shm_ring_write(pipe_sink->runtime.ring, frame_data,
+				     &pipe_sink->runtime.wait_time);
+		if (unlikely(ret))
+			glc_log(pipe_sink->glc, GLC_ERROR, "pipe",
+				"frame ring still full after %d ms. Child process too slow",
+				timeout_ms);
+		return ret;
+	}
+
 	pipe_sink->runtime.writer->ops->write_init(pipe_sink->runtime.writer, frame_data);
 	do {
 		if (unlikely(!pipe_sink->runtime.pipe_ready)) {
@@ -560,7 +609,8 @@ int pipe_read_callback(glc_thread_state_t *state)
 			glc_video_frame_header_t *pic_hdr =
 				(glc_video_frame_header_t *)state->read_data;
 
-			if (likely(pipe_sink->runtime.w_pipefd < 0)) {
+			if (likely(pipe_sink->runtime.w_pipefd < 0 &&
+				   !pipe_sink->runtime.ring)) {
 				glc_video_format_message_t *format;
 				if (unlikely(!(format = get_video_format(pipe_sink, pic_hdr->id)))) {
 					return 1;
@@ -573,13 +623,21 @@ int pipe_read_callback(glc_thread_state_t *state)
 				// if successful, record the stream id played
 				pipe_sink->runtime.id = pic_hdr->id;
 			} else {
-				if (unlikely(pic_hdr->id != pipe_sink->runtime.id))
+				if (unlikely(pic_hdr->id != pipe_sink->runtime.id)) {
+					glc_metrics_frame_written(pipe_sink->glc, &state->header,
+								  state->read_data);
 					return 0;
+				}
 			}
-			if (likely(pic_hdr->time >= pipe_sink->runtime.first_frame_ts))
+			if (likely(pic_hdr->time >= pipe_sink->runtime.first_frame_ts)) {
 				pipe_sink->runtime.write_frame_ret = write_video_frame(pipe_sink,
 					&state->read_data[sizeof(glc_video_frame_header_t)]
 				);
+				if (unlikely(pipe_sink->runtime.write_frame_ret))
+					glc_metrics_drop(pipe_sink->glc, GLC_METRICS_DROP_PIPE);
+			}
+			glc_metrics_frame_written(pipe_sink->glc, &state->header,
+						  state->read_data);
 			break;
 		}
 		case GLC_MESSAGE_CLOSE: // noop
@@ -623,14 +681,20 @@ int pipe_open_target(sink_t sink, const char *filename)
  */
 void close_pipe(glc_t *glc, struct pipe_runtime_s *rt)
 {
-	if (rt->w_pipefd >= 0) {
+	if (rt->w_pipefd >= 0 || rt->ring) {
 		int ret, status, i;
 		struct timespec kill_wait_time;
 
 		/* closing the pipe should terminate the child */
-		epoll_ctl(rt->epollfd, EPOLL_CTL_DEL, rt->w_pipefd, NULL);
-		close(rt->w_pipefd);
-		rt->w_pipefd = -1;
+		if (rt->ring) {
+			shm_ring_close(rt->ring);
+			shm_ring_destroy(rt->ring);
+			rt->ring = NULL;
+		} else {
+			epoll_ctl(rt->epollfd, EPOLL_CTL_DEL, rt->w_pipefd, NULL);
+			close(rt->w_pipefd);
+			rt->w_pipefd = -1;
+		}
 
 		ret = glcs_signal_timed_waitpid(glc, rt->consumer_proc, &status, &rt->wait_time);
 		if (!ret || errno == ECHILD)
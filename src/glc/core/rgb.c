@@ -44,6 +44,12 @@
 #include <glc/common/optimization.h>
 
 #include "rgb.h"
+#include "colorspace.h"
+
+#ifdef __x86_64__
+# include <immintrin.h>
+# define RGB_SIMD
+#endif
 
 /*
 R'd = Y' + (Cr - 128) * (2 - 2 * Kr)
@@ -69,33 +75,23 @@ B'd = Y' + (Cb - 128) * (2 - 2 * Kb)
 #define YCbCrJPEG_TO_RGB_Bd(Y, Cb, Cr) \
 	((Y) + ((1814 * (Cb)) >> 10) - 227)*/
 
-#define LOOKUP_BITS 7
-#define LOOKUP_POS(Rd, Gd, Bd) \
-	(((((Rd) >> (8 - LOOKUP_BITS)) << (LOOKUP_BITS * 2)) + \
-	  (((Gd) >> (8 - LOOKUP_BITS)) << LOOKUP_BITS) + \
-	  ( (Bd) >> (8 - LOOKUP_BITS))) * 3)
-
-/** \note unfortunately overflows will occur */
-#define CLAMP_256(val) \
-	(val) < 0 ? 0 : ((val) > 255 ? 255 : (val))
-
-static unsigned char YCbCrJPEG_TO_RGB_Rd(unsigned char Y, unsigned char Cb, unsigned char Cr)
-{
-	int R = Y + 1.402 * (Cr - 128);
-	return CLAMP_256(R);
-}
-
-static unsigned char YCbCrJPEG_TO_RGB_Gd(unsigned char Y, unsigned char Cb, unsigned char Cr)
-{
-	int G = Y - 0.344136 * (Cb - 128) - 0.714136 * (Cr - 128);
-	return CLAMP_256(G);
-}
+struct rgb_video_stream_s;
 
-static unsigned char YCbCrJPEG_TO_RGB_Bd(unsigned char Y, unsigned char Cb, unsigned char Cr)
-{
-	int B = Y + 1.772 * (Cb - 128);
-	return CLAMP_256(B);
-}
+/**
+ * \brief SIMD kernel set
+ *
+ * Row kernels convert a pair of Y' rows sharing a chroma row, the
+ * caller passes destination rows already flipped.
+ */
+struct rgb_kernels_s {
+	/* same first members as glc_simd_kernels_t */
+	const char *name;
+	glc_flags_t simd;
+	/** convert n 2x2 blocks into BGR */
+	void (*row)(const unsigned char *Ytop, const unsigned char *Ybottom,
+		    const unsigned char *Cb, const unsigned char *Cr, unsigned int n,
+		    unsigned char *top, unsigned char *bottom);
+};
 
 struct rgb_video_stream_s {
 	glc_stream_id_t id;
@@ -112,23 +108,37 @@ struct rgb_s {
 	glc_thread_t thread;
 	int running;
 
-	unsigned char *lookup_table;
+	const struct rgb_kernels_s *kernels;
+	glc_band_pool_t bands;
+
+	struct rgb_video_stream_s *ctx;
+};
 
+struct rgb_band_job_s {
+	rgb_t rgb;
 	struct rgb_video_stream_s *ctx;
+	unsigned char *from, *to;
 };
 
 static int rgb_read_callback(glc_thread_state_t *state);
 static int rgb_write_callback(glc_thread_state_t *state);
 static void rgb_finish_callback(void *ptr, int err);
+static void rgb_band(void *arg, unsigned int first, unsigned int last);
 
 static void rgbget_video_stream(rgb_t rgb, glc_stream_id_t id,
 		struct rgb_video_stream_s **ctx);
 
 static int rgb_video_format_message(rgb_t rgb, glc_video_format_message_t *video_format_message);
 
-static int rgb_init_lookup(rgb_t rgb);
-static int rgb_convert_lookup(rgb_t rgb, struct rgb_video_stream_s *ctx,
-		       unsigned char *from, unsigned char *to);
+static int rgb_convert(rgb_t rgb, struct rgb_video_stream_s *ctx,
+		       unsigned char *from, unsigned char *to,
+		       unsigned int first, unsigned int last);
+static void rgb_row_c(const unsigned char *Ytop, const unsigned char *Ybottom,
+		      const unsigned char *Cb, const unsigned char *Cr, unsigned int n,
+		      unsigned char *top, unsigned char *bottom);
+
+static void rgb_select_kernels(rgb_t rgb);
+static int rgb_test_kernels(void *ptr, const void *kernels, glc_simd_test_t *test);
 
 int rgb_init(rgb_t *rgb, glc_t *glc)
 {
@@ -136,7 +146,7 @@ int rgb_init(rgb_t *rgb, glc_t *glc)
 
 	(*rgb)->glc = glc;
 
-	rgb_init_lookup(*rgb);
+	rgb_select_kernels(*rgb);
 
 	(*rgb)->thread.flags = GLC_THREAD_READ | GLC_THREAD_WRITE;
 	(*rgb)->thread.read_callback = &rgb_read_callback;
@@ -144,13 +154,13 @@ int rgb_init(rgb_t *rgb, glc_t *glc)
 	(*rgb)->thread.finish_callback = &rgb_finish_callback;
 	(*rgb)->thread.ptr = *rgb;
 	(*rgb)->thread.threads = glc_threads_hint(glc);
+	(*rgb)->thread.name = "rgb";
 
 	return 0;
 }
 
 int rgb_destroy(rgb_t rgb)
 {
-	free(rgb->lookup_table);
 	free(rgb);
 	return 0;
 }
@@ -161,8 +171,20 @@ int rgb_process_start(rgb_t rgb, ps_buffer_t *from, ps_buffer_t *to)
 	if (unlikely(rgb->running))
 		return EAGAIN;
 
+	if (glc_frame_threads(rgb->glc) > 1) {
+		if (unlikely((ret = glc_band_pool_create(rgb->glc, &rgb->bands,
+							 glc_frame_threads(rgb->glc)))))
+			return ret;
+		rgb->thread.threads = 1;
+	} else
+		rgb->thread.threads = glc_threads_hint(rgb->glc);
+
 	if (likely(!(ret = glc_thread_create(rgb->glc, &rgb->thread, from, to))))
 		rgb->running = 1;
+	else if (rgb->bands) {
+		glc_band_pool_destroy(rgb->bands);
+		rgb->bands = NULL;
+	}
 
 	return ret;
 }
@@ -175,6 +197,11 @@ int rgb_process_wait(rgb_t rgb)
 	glc_thread_wait(&rgb->thread);
 	rgb->running = 0;
 
+	if (rgb->bands) {
+		glc_band_pool_destroy(rgb->bands);
+		rgb->bands = NULL;
+	}
+
 	return 0;
 }
 
@@ -227,16 +254,31 @@ int rgb_write_callback(glc_thread_state_t *state)
 {
 	rgb_t rgb = (rgb_t) state->ptr;
 	struct rgb_video_stream_s *ctx = state->threadptr;
+	struct rgb_band_job_s job;
 
 	memcpy(state->write_data, state->read_data, sizeof(glc_video_frame_header_t));
-	rgb_convert_lookup(rgb, ctx,
-		    (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)],
-		    (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)]);
+
+	job.rgb = rgb;
+	job.ctx = ctx;
+	job.from = (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)];
+	job.to = (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)];
+
+	/* bands are pairs of rows sharing a chroma row */
+	if (rgb->bands)
+		glc_band_pool_run(rgb->bands, rgb_band, &job, ctx->h / 2, 3 * ctx->w);
+	else
+		rgb_convert(rgb, ctx, job.from, job.to, 0, ctx->h / 2);
 	pthread_rwlock_unlock(&ctx->update);
 
 	return 0;
 }
 
+void rgb_band(void *arg, unsigned int first, unsigned int last)
+{
+	struct rgb_band_job_s *job = arg;
+	rgb_convert(job->rgb, job->ctx, job->from, job->to, first, last);
+}
+
 void rgbget_video_stream(rgb_t rgb, glc_stream_id_t id,
 		struct rgb_video_stream_s **ctx)
 {
@@ -280,64 +322,326 @@ int rgb_video_format_message(rgb_t rgb, glc_video_format_message_t *video_format
 	return 0;
 }
 
-int rgb_init_lookup(rgb_t rgb)
+int rgb_convert(rgb_t rgb, struct rgb_video_stream_s *video,
+		unsigned char *from, unsigned char *to,
+		unsigned int first, unsigned int last)
 {
-	unsigned int Y, Cb, Cr, color;
-	size_t lookup_size = (1 << LOOKUP_BITS) * (1 << LOOKUP_BITS) * (1 << LOOKUP_BITS) * 3;
-
-	glc_log(rgb->glc, GLC_INFO, "rgb",
-		 "using %d bit lookup table (%zd bytes)", LOOKUP_BITS, lookup_size);
-	rgb->lookup_table = malloc(lookup_size);
-
-	color = 0;
-	for (Y = 0; Y < 256; Y += (1 << (8 - LOOKUP_BITS))) {
-		for (Cb = 0; Cb < 256; Cb += (1 << (8 - LOOKUP_BITS))) {
-			for (Cr = 0; Cr < 256; Cr += (1 << (8 - LOOKUP_BITS))) {
-				rgb->lookup_table[color + 0] = YCbCrJPEG_TO_RGB_Rd(Y, Cb, Cr);
-				rgb->lookup_table[color + 1] = YCbCrJPEG_TO_RGB_Gd(Y, Cb, Cr);
-				rgb->lookup_table[color + 2] = YCbCrJPEG_TO_RGB_Bd(Y, Cb, Cr);
-				color += 3;
-			}
-		}
-	}
+	unsigned char *Y, *Cb, *Cr;
+	unsigned int y, cw = video->w / 2;
+
+	Y = from;
+	Cb = &from[video->h * video->w];
+	Cr = &from[video->h * video->w + (video->h / 2) * cw];
+
+	/* YCBCR_420JPEG frame dimensions are always divisible by two,
+	   Y' row y goes to BGR row h - 1 - y */
+	for (y = first * 2; y < last * 2; y += 2)
+		rgb->kernels->row(&Y[y * video->w], &Y[(y + 1) * video->w],
+				  &Cb[(y / 2) * cw], &Cr[(y / 2) * cw], cw,
+				  &to[(video->h - 1 - y) * video->w * 3],
+				  &to[(video->h - 2 - y) * video->w * 3]);
 	return 0;
 }
 
-int rgb_convert_lookup(rgb_t rgb, struct rgb_video_stream_s *video,
-		       unsigned char *from, unsigned char *to)
+static inline unsigned char rgb_clamp(int val)
 {
-	unsigned int x, y, Cpix;
-	unsigned int color;
-	unsigned char *Y, *Cb, *Cr;
+	return val < 0 ? 0 : (val > 255 ? 255 : val);
+}
 
-	Y = from;
-	Cb = &from[video->h * video->w];
-	Cr = &from[video->h * video->w + (video->h / 2) * (video->w / 2)];
-	Cpix = 0;
-
-#define CONVERT(xadd, yrgbadd, yadd) 						\
-	color = LOOKUP_POS(Y[(x + (xadd)) + (y + (yadd)) * video->w],		\
-			   Cb[Cpix], Cr[Cpix]);					\
-	to[((x + (xadd)) + ((video->h - y) + (yrgbadd)) * video->w) * 3 + 2] =	\
-		rgb->lookup_table[color + 0];					\
-	to[((x + (xadd)) + ((video->h - y) + (yrgbadd)) * video->w) * 3 + 1] =	\
-		rgb->lookup_table[color + 1];					\
-	to[((x + (xadd)) + ((video->h - y) + (yrgbadd)) * video->w) * 3 + 0] =	\
-		rgb->lookup_table[color + 2];
-
-	/* YCBCR_420JPEG frame dimensions are always divisible by two */
-	for (y = 0; y < video->h; y += 2) {
-		for (x = 0; x < video->w; x += 2) {
-			CONVERT(0, -1, 0)
-			CONVERT(1, -1, 0)
-			CONVERT(0, -2, 1)
-			CONVERT(1, -2, 1)
-			
-			Cpix++;
+void rgb_row_c(const unsigned char *Ytop, const unsigned char *Ybottom,
+	       const unsigned char *Cb, const unsigned char *Cr, unsigned int n,
+	       unsigned char *top, unsigned char *bottom)
+{
+	int dR, dG, dB;
+	unsigned int i, x;
+
+	for (i = 0; i < n; i++) {
+		dR = YCbCrJPEG_Cr_R(Cr[i] - 128);
+		dG = YCbCrJPEG_CbCr_G(Cb[i] - 128, Cr[i] - 128);
+		dB = YCbCrJPEG_Cb_B(Cb[i] - 128);
+
+		for (x = i * 2; x < i * 2 + 2; x++) {
+			top[x * 3 + 0] = rgb_clamp(Ytop[x] + dB);
+			top[x * 3 + 1] = rgb_clamp(Ytop[x] + dG);
+			top[x * 3 + 2] = rgb_clamp(Ytop[x] + dR);
+			bottom[x * 3 + 0] = rgb_clamp(Ybottom[x] + dB);
+			bottom[x * 3 + 1] = rgb_clamp(Ybottom[x] + dG);
+			bottom[x * 3 + 2] = rgb_clamp(Ybottom[x] + dR);
 		}
 	}
-#undef CONVERT
-	return 0;
+}
+
+#ifdef RGB_SIMD
+
+/*
+ * Chroma terms are computed once per 2x2 block with pmaddwd: the
+ * (C - 128, 1) pairs against (coefficient, rounding) give exactly the
+ * YCbCrJPEG_C*_* macros. Adding Y' and packing with unsigned saturation then
+ * does the clamp.
+ */
+
+/* SSE2 */
+
+/* 8 chroma samples into 8 16 bit (dR, dG, dB) offsets */
+static inline void rgb_sse2_chroma(const unsigned char *Cb, const unsigned char *Cr,
+				   __m128i *dR, __m128i *dG, __m128i *dB)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c128 = _mm_set1_epi16(128);
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i kR = _mm_unpacklo_epi16(_mm_set1_epi16(YCbCrJPEG_K_Cr_R), _mm_set1_epi16(YCbCrJPEG_ROUND));
+	const __m128i kB = _mm_unpacklo_epi16(_mm_set1_epi16(YCbCrJPEG_K_Cb_B), _mm_set1_epi16(YCbCrJPEG_ROUND));
+	const __m128i kG = _mm_unpacklo_epi16(_mm_set1_epi16(-YCbCrJPEG_K_Cb_G), _mm_set1_epi16(-YCbCrJPEG_K_Cr_G));
+	const __m128i round = _mm_set1_epi32(YCbCrJPEG_ROUND);
+	__m128i cb, cr;
+
+	cb = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) Cb), zero), c128);
+	cr = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) Cr), zero), c128);
+
+	*dR = _mm_packs_epi32(
+		_mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(cr, one), kR), YCbCrJPEG_FIX_BITS),
+		_mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(cr, one), kR), YCbCrJPEG_FIX_BITS));
+	*dB = _mm_packs_epi32(
+		_mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(cb, one), kB), YCbCrJPEG_FIX_BITS),
+		_mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(cb, one), kB), YCbCrJPEG_FIX_BITS));
+	*dG = _mm_packs_epi32(
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(cb, cr), kG),
+					     round), YCbCrJPEG_FIX_BITS),
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(cb, cr), kG),
+					     round), YCbCrJPEG_FIX_BITS));
+}
+
+/* 16 Y' with the offsets of their 8 blocks into 16 clamped values */
+static inline __m128i rgb_sse2_add(__m128i Yl, __m128i Yh, __m128i d)
+{
+	return _mm_packus_epi16(_mm_add_epi16(Yl, _mm_unpacklo_epi16(d, d)),
+				_mm_add_epi16(Yh, _mm_unpackhi_epi16(d, d)));
+}
+
+static inline void rgb_sse2_pixels(const unsigned char *Y, __m128i dR, __m128i dG, __m128i dB,
+				   __m128i *B, __m128i *G, __m128i *R)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i y = _mm_loadu_si128((const __m128i *) Y);
+	__m128i Yl = _mm_unpacklo_epi8(y, zero), Yh = _mm_unpackhi_epi8(y, zero);
+
+	*B = rgb_sse2_add(Yl, Yh, dB);
+	*G = rgb_sse2_add(Yl, Yh, dG);
+	*R = rgb_sse2_add(Yl, Yh, dR);
+}
+
+static inline void rgb_sse2_store(unsigned char *to, __m128i B, __m128i G, __m128i R)
+{
+	unsigned char b[16], g[16], r[16];
+	unsigned int x;
+
+	_mm_storeu_si128((__m128i *) b, B);
+	_mm_storeu_si128((__m128i *) g, G);
+	_mm_storeu_si128((__m128i *) r, R);
+	for (x = 0; x < 16; x++) {
+		to[x * 3 + 0] = b[x];
+		to[x * 3 + 1] = g[x];
+		to[x * 3 + 2] = r[x];
+	}
+}
+
+static void rgb_row_sse2(const unsigned char *Ytop, const unsigned char *Ybottom,
+			 const unsigned char *Cb, const unsigned char *Cr, unsigned int n,
+			 unsigned char *top, unsigned char *bottom)
+{
+	__m128i dR, dG, dB, B, G, R;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		rgb_sse2_chroma(&Cb[i], &Cr[i], &dR, &dG, &dB);
+		rgb_sse2_pixels(&Ytop[i * 2], dR, dG, dB, &B, &G, &R);
+		rgb_sse2_store(&top[i * 6], B, G, R);
+		rgb_sse2_pixels(&Ybottom[i * 2], dR, dG, dB, &B, &G, &R);
+		rgb_sse2_store(&bottom[i * 6], B, G, R);
+	}
+
+	rgb_row_c(&Ytop[i * 2], &Ybottom[i * 2], &Cb[i], &Cr[i], n - i,
+		  &top[i * 6], &bottom[i * 6]);
+}
+
+/* SSSE3 */
+
+/* interleave 16 B, G and R bytes into 48 bytes of BGR */
+__attribute__((target("ssse3")))
+static inline void rgb_ssse3_store(unsigned char *to, __m128i B, __m128i G, __m128i R)
+{
+	const __m128i b0 = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+	const __m128i g0 = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+	const __m128i r0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+	const __m128i b1 = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+	const __m128i g1 = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+	const __m128i r1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+	const __m128i b2 = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+	const __m128i g2 = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+	const __m128i r2 = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+
+	_mm_storeu_si128((__m128i *) &to[0],
+			 _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(B, b0), _mm_shuffle_epi8(G, g0)),
+				      _mm_shuffle_epi8(R, r0)));
+	_mm_storeu_si128((__m128i *) &to[16],
+			 _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(B, b1), _mm_shuffle_epi8(G, g1)),
+				      _mm_shuffle_epi8(R, r1)));
+	_mm_storeu_si128((__m128i *) &to[32],
+			 _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(B, b2), _mm_shuffle_epi8(G, g2)),
+				      _mm_shuffle_epi8(R, r2)));
+}
+
+__attribute__((target("ssse3")))
+static void rgb_row_ssse3(const unsigned char *Ytop, const unsigned char *Ybottom,
+			  const unsigned char *Cb, const unsigned char *Cr, unsigned int n,
+			  unsigned char *top, unsigned char *bottom)
+{
+	__m128i dR, dG, dB, B, G, R;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		rgb_sse2_chroma(&Cb[i], &Cr[i], &dR, &dG, &dB);
+		rgb_sse2_pixels(&Ytop[i * 2], dR, dG, dB, &B, &G, &R);
+		rgb_ssse3_store(&top[i * 6], B, G, R);
+		rgb_sse2_pixels(&Ybottom[i * 2], dR, dG, dB, &B, &G, &R);
+		rgb_ssse3_store(&bottom[i * 6], B, G, R);
+	}
+
+	rgb_row_c(&Ytop[i * 2], &Ybottom[i * 2], &Cb[i], &Cr[i], n - i,
+		  &top[i * 6], &bottom[i * 6]);
+}
+
+/* AVX2 */
+
+/*
+ * In-lane unpacks keep everything in order: the low lane holds blocks
+ * 0-3 and 8-11 (pixels 0-7 and 16-23 after duplication), exactly the
+ * pixels unpacklo_epi8() of 32 Y' bytes gives.
+ */
+
+__attribute__((target("avx2")))
+static inline __m256i rgb_avx2_offset(__m256i c, __m256i k)
+{
+	const __m256i one = _mm256_set1_epi16(1);
+	return _mm256_packs_epi32(
+		_mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(c, one), k), YCbCrJPEG_FIX_BITS),
+		_mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(c, one), k), YCbCrJPEG_FIX_BITS));
+}
+
+__attribute__((target("avx2")))
+static inline void rgb_avx2_chroma(const unsigned char *Cb, const unsigned char *Cr,
+				   __m256i *dR, __m256i *dG, __m256i *dB)
+{
+	const __m256i c128 = _mm256_set1_epi16(128);
+	const __m256i kR = _mm256_unpacklo_epi16(_mm256_set1_epi16(YCbCrJPEG_K_Cr_R),
+						 _mm256_set1_epi16(YCbCrJPEG_ROUND));
+	const __m256i kB = _mm256_unpacklo_epi16(_mm256_set1_epi16(YCbCrJPEG_K_Cb_B),
+						 _mm256_set1_epi16(YCbCrJPEG_ROUND));
+	const __m256i kG = _mm256_unpacklo_epi16(_mm256_set1_epi16(-YCbCrJPEG_K_Cb_G),
+						 _mm256_set1_epi16(-YCbCrJPEG_K_Cr_G));
+	const __m256i round = _mm256_set1_epi32(YCbCrJPEG_ROUND);
+	__m256i cb, cr;
+
+	cb = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) Cb)), c128);
+	cr = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) Cr)), c128);
+
+	*dR = rgb_avx2_offset(cr, kR);
+	*dB = rgb_avx2_offset(cb, kB);
+	*dG = _mm256_packs_epi32(
+		_mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(cb, cr), kG),
+						   round), YCbCrJPEG_FIX_BITS),
+		_mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(cb, cr), kG),
+						   round), YCbCrJPEG_FIX_BITS));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i rgb_avx2_add(__m256i Yl, __m256i Yh, __m256i d)
+{
+	return _mm256_packus_epi16(_mm256_add_epi16(Yl, _mm256_unpacklo_epi16(d, d)),
+				   _mm256_add_epi16(Yh, _mm256_unpackhi_epi16(d, d)));
+}
+
+__attribute__((target("avx2")))
+static inline void rgb_avx2_store(unsigned char *to, const unsigned char *Y,
+				  __m256i dR, __m256i dG, __m256i dB)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i y = _mm256_loadu_si256((const __m256i *) Y);
+	__m256i Yl = _mm256_unpacklo_epi8(y, zero), Yh = _mm256_unpackhi_epi8(y, zero);
+	__m256i B = rgb_avx2_add(Yl, Yh, dB);
+	__m256i G = rgb_avx2_add(Yl, Yh, dG);
+	__m256i R = rgb_avx2_add(Yl, Yh, dR);
+
+	rgb_ssse3_store(&to[0], _mm256_castsi256_si128(B), _mm256_castsi256_si128(G),
+			_mm256_castsi256_si128(R));
+	rgb_ssse3_store(&to[48], _mm256_extracti128_si256(B, 1), _mm256_extracti128_si256(G, 1),
+			_mm256_extracti128_si256(R, 1));
+}
+
+__attribute__((target("avx2")))
+static void rgb_row_avx2(const unsigned char *Ytop, const unsigned char *Ybottom,
+			 const unsigned char *Cb, const unsigned char *Cr, unsigned int n,
+			 unsigned char *top, unsigned char *bottom)
+{
+	__m256i dR, dG, dB;
+	unsigned int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		rgb_avx2_chroma(&Cb[i], &Cr[i], &dR, &dG, &dB);
+		rgb_avx2_store(&top[i * 6], &Ytop[i * 2], dR, dG, dB);
+		rgb_avx2_store(&bottom[i * 6], &Ybottom[i * 2], dR, dG, dB);
+	}
+
+	rgb_row_ssse3(&Ytop[i * 2], &Ybottom[i * 2], &Cb[i], &Cr[i], n - i,
+		      &top[i * 6], &bottom[i * 6]);
+}
+
+static const struct rgb_kernels_s rgb_kernels[] = {
+	{"avx2", GLC_SIMD_AVX2, &rgb_row_avx2},
+	{"ssse3", GLC_SIMD_SSSE3, &rgb_row_ssse3},
+	{"sse2", GLC_SIMD_SSE2, &rgb_row_sse2},
+	{NULL, 0, NULL}
+};
+
+#else
+
+static const struct rgb_kernels_s rgb_kernels[] = {
+	{NULL, 0, NULL}
+};
+
+#endif
+
+static const struct rgb_kernels_s rgb_kernels_c = {"c", 0, &rgb_row_c};
+
+/* row pairs of the self-test, leave every tail */
+#define RGB_TEST_PIXELS (16 + 8 + 7)
+
+void rgb_select_kernels(rgb_t rgb)
+{
+	rgb->kernels = glc_simd_select(rgb->glc, "rgb", rgb_kernels,
+				       sizeof(struct rgb_kernels_s), &rgb_kernels_c,
+				       &rgb_test_kernels, rgb,
+				       RGB_TEST_PIXELS * 6, RGB_TEST_PIXELS * 12);
+}
+
+/**
+ * Self-test: convert a synthetic row pair with both the scalar and the
+ * given kernels. The width exercises every tail and the extreme
+ * values the clamping.
+ */
+int rgb_test_kernels(void *ptr, const void *kernels, glc_simd_test_t *test)
+{
+	const struct rgb_kernels_s *k = kernels;
+	unsigned int n = RGB_TEST_PIXELS;
+	unsigned char *from = test->from;
+
+	memset(test->out, 0xaa, n * 12);
+	rgb_row_c(from, &from[n * 2], &from[n * 4], &from[n * 5], n,
+		  test->ref, &test->ref[n * 6]);
+	k->row(from, &from[n * 2], &from[n * 4], &from[n * 5], n,
+	       test->out, &test->out[n * 6]);
+
+	return glc_simd_test_compare(test, test->ref, test->out, n * 12);
 }
 
 /**  \} */
@@ -35,6 +35,7 @@
 #include <packetstream.h>
 #include <pthread.h>
 #include <errno.h>
+#include <math.h>
 
 #include <glc/common/glc.h>
 #include <glc/common/core.h>
@@ -45,15 +46,70 @@
 
 #include "scale.h"
 
+#ifdef __x86_64__
+# include <immintrin.h>
+# define SCALE_SIMD
+#endif
+
 #define SCALE_RUNNING      0x1
 #define SCALE_SIZE         0x2
 
+/*
+ * Filter weights have SCALE_COEF_BITS fractional bits and add up to
+ * exactly SCALE_COEF_ONE. Rows filtered by the vertical pass keep
+ * SCALE_TMP_BITS fractional bits for the horizontal one.
+ */
+#define SCALE_COEF_BITS    14
+#define SCALE_COEF_ONE     (1 << SCALE_COEF_BITS)
+#define SCALE_TMP_BITS     6
+#define SCALE_COEF_ALIGN   8
+/* filtered rows are over-allocated so padded taps never read past them */
+#define SCALE_TMP_PAD      SCALE_COEF_ALIGN
+
+#define SCALE_HORIZONTAL_ROUND (1 << (SCALE_COEF_BITS + SCALE_TMP_BITS - 1))
+#define SCALE_HORIZONTAL_CLAMP(acc) \
+	(((acc) < 0) ? 0 : (((acc) >> (SCALE_COEF_BITS + SCALE_TMP_BITS) > 255) ? \
+			    255 : ((acc) >> (SCALE_COEF_BITS + SCALE_TMP_BITS))))
+
+/**
+ * \brief separable filter for one axis
+ *
+ * Output sample i is the weighted sum of taps source samples
+ * starting at start[i], weights are coef[i * pitch ... + taps - 1].
+ * Weight rows are zero padded up to pitch, a multiple of
+ * SCALE_COEF_ALIGN, so kernels can always work on full vectors.
+ */
+struct scale_axis_s {
+	unsigned int taps, pitch;
+	unsigned int *start;
+	short *coef;
+};
+
+/**
+ * \brief SIMD kernel set
+ */
+struct scale_kernels_s {
+	/* same first members as glc_simd_kernels_t */
+	const char *name;
+	glc_flags_t simd;
+	/** filter n bytes from taps rows stride bytes apart */
+	void (*vertical)(const unsigned char *from, size_t stride, const short *coef,
+			 unsigned int taps, unsigned int n, short *to);
+	/** filter a row into n samples, stride 1 is a plane, 3 or 4 is BGR(A) */
+	void (*horizontal)(const struct scale_axis_s *ax, const short *from,
+			   unsigned int stride, unsigned int n, unsigned char *to);
+};
+
 struct scale_video_stream_s;
 
+/* processes band rows [first, last), see scale_video_stream_s.rows */
 typedef void (*scale_proc)(scale_t scale,
 			   struct scale_video_stream_s *video,
 			   unsigned char *from,
-			   unsigned char *to);
+			   unsigned char *to,
+			   short *tmp,
+			   unsigned int first,
+			   unsigned int last);
 
 struct scale_video_stream_s {
 	glc_stream_id_t id;
@@ -67,47 +123,100 @@ struct scale_video_stream_s {
 
 	unsigned int rw, rh, rx, ry;
 
-	unsigned int *pos;
-	float *factor;
+	/* x and y, followed by chroma x and y for Y'CbCr */
+	struct scale_axis_s axis[4];
 
 	scale_proc proc;
+	/* band rows proc works on and source bytes read per band row */
+	unsigned int rows;
+	size_t row_size;
+	/* shorts of filtered row buffer proc needs, 0 if none */
+	size_t tmp_size;
 
 	pthread_rwlock_t update;
 	struct scale_video_stream_s *next;
 };
 
+/* row buffer between vertical and horizontal passes */
+struct scale_tmp_s {
+	short *buf;
+	size_t size;
+};
+
+struct scale_thread_s {
+	struct scale_video_stream_s *video;
+	struct scale_tmp_s tmp;
+};
+
+struct scale_band_job_s {
+	scale_t scale;
+	struct scale_video_stream_s *video;
+	unsigned char *from, *to;
+	/* calling thread buffer, band workers use scale->band_tmp */
+	short *tmp;
+};
+
 struct scale_s {
 	glc_t *glc;
 	glc_flags_t flags;
 	struct scale_video_stream_s *video;
 	glc_thread_t thread;
+	glc_band_pool_t bands;
+	/* one per band worker, workers are numbered from 1 */
+	struct scale_tmp_s *band_tmp;
+	unsigned int band_tmp_count;
+	const struct scale_kernels_s *kernels;
 
 	double scale;
 	unsigned int width, height;
+	int filter;
 };
 
 static int scale_read_callback(glc_thread_state_t *state);
 static int scale_write_callback(glc_thread_state_t *state);
 static void scale_finish_callback(void *ptr, int err);
+static int scale_thread_create_callback(void *ptr, void **threadptr);
+static void scale_thread_finish_callback(void *ptr, void *threadptr, int err);
+static void scale_band(void *arg, unsigned int first, unsigned int last);
+static int scale_tmp_reserve(struct scale_tmp_s *tmp, size_t size);
+static void scale_band_tmp_free(scale_t scale);
 
 static int scale_video_format_message(scale_t scale, glc_video_format_message_t *format_message,
 				glc_thread_state_t *state);
 static int scale_get_video_stream(scale_t scale, glc_stream_id_t id, struct scale_video_stream_s **video);
 
-static int scale_generate_rgb_map(scale_t scale, struct scale_video_stream_s *video);
-static int scale_generate_ycbcr_map(scale_t scale, struct scale_video_stream_s *video);
+static int scale_generate_filter(scale_t scale, struct scale_video_stream_s *video);
+static int scale_generate_axis(scale_t scale, struct scale_axis_s *axis,
+			       unsigned int n, unsigned int sn);
+static double scale_filter_lanczos3(double x);
+
+static void scale_clear_rows(unsigned char *to, unsigned int row,
+			     unsigned int first, unsigned int last, int c);
 
 static void scale_rgb_convert(scale_t scale, struct scale_video_stream_s *video,
-		       unsigned char *from, unsigned char *to);
+		       unsigned char *from, unsigned char *to, short *tmp,
+		       unsigned int first, unsigned int last);
 static void scale_rgb_half(scale_t scale, struct scale_video_stream_s *video,
-		    unsigned char *from, unsigned char *to);
+		    unsigned char *from, unsigned char *to, short *tmp,
+		    unsigned int first, unsigned int last);
 static void scale_rgb_scale(scale_t scale, struct scale_video_stream_s *video,
-		     unsigned char *from, unsigned char *to);
+		     unsigned char *from, unsigned char *to, short *tmp,
+		     unsigned int first, unsigned int last);
 
 static void scale_ycbcr_half(scale_t scale, struct scale_video_stream_s *video,
-		      unsigned char *from, unsigned char *to);
+		      unsigned char *from, unsigned char *to, short *tmp,
+		      unsigned int first, unsigned int last);
 static void scale_ycbcr_scale(scale_t scale, struct scale_video_stream_s *video,
-		       unsigned char *from, unsigned char *to);
+		       unsigned char *from, unsigned char *to, short *tmp,
+		       unsigned int first, unsigned int last);
+
+static void scale_horizontal_c(const struct scale_axis_s *ax, const short *from,
+			       unsigned int stride, unsigned int n, unsigned char *to);
+static void scale_vertical_c(const unsigned char *from, size_t stride, const short *coef,
+			     unsigned int taps, unsigned int n, short *to);
+
+static void scale_select_kernels(scale_t scale);
+static int scale_test_kernels(void *ptr, const void *kernels, glc_simd_test_t *test);
 
 int scale_init(scale_t *scale, glc_t *glc)
 {
@@ -119,10 +228,15 @@ int scale_init(scale_t *scale, glc_t *glc)
 	(*scale)->thread.read_callback = &scale_read_callback;
 	(*scale)->thread.write_callback = &scale_write_callback;
 	(*scale)->thread.finish_callback = &scale_finish_callback;
+	(*scale)->thread.thread_create_callback = &scale_thread_create_callback;
+	(*scale)->thread.thread_finish_callback = &scale_thread_finish_callback;
 	(*scale)->thread.ptr = *scale;
 	(*scale)->thread.threads = glc_threads_hint(glc);
+	(*scale)->thread.name = "scale";
 	(*scale)->scale = 1.0;
+	(*scale)->filter = SCALE_FILTER_BILINEAR;
 
+	scale_select_kernels(*scale);
 	return 0;
 }
 
@@ -153,14 +267,47 @@ int scale_set_size(scale_t scale, unsigned int width, unsigned int height)
 	return 0;
 }
 
+int scale_set_filter(scale_t scale, int filter)
+{
+	if (unlikely((filter != SCALE_FILTER_BILINEAR) &&
+		     (filter != SCALE_FILTER_AREA) &&
+		     (filter != SCALE_FILTER_LANCZOS3)))
+		return EINVAL;
+
+	scale->filter = filter;
+	return 0;
+}
+
 int scale_process_start(scale_t scale, ps_buffer_t *from, ps_buffer_t *to)
 {
 	int ret;
 	if (unlikely(scale->flags & SCALE_RUNNING))
 		return EAGAIN;
 
-	if (unlikely((ret = glc_thread_create(scale->glc, &scale->thread, from, to))))
+	if (glc_frame_threads(scale->glc) > 1) {
+		scale->band_tmp_count = glc_frame_threads(scale->glc) - 1;
+		if (unlikely(!(scale->band_tmp = calloc(scale->band_tmp_count,
+							sizeof(struct scale_tmp_s))))) {
+			scale->band_tmp_count = 0;
+			return ENOMEM;
+		}
+		if (unlikely((ret = glc_band_pool_create(scale->glc, &scale->bands,
+							 glc_frame_threads(scale->glc))))) {
+			scale_band_tmp_free(scale);
+			return ret;
+		}
+		scale->thread.threads = 1;
+	} else
+		scale->thread.threads = glc_threads_hint(scale->glc);
+
+	if (unlikely((ret = glc_thread_create(scale->glc, &scale->thread, from, to)))) {
+		if (scale->bands) {
+			glc_band_pool_destroy(scale->bands);
+			scale->bands = NULL;
+		}
+		scale_band_tmp_free(scale);
 		return ret;
+	}
 	scale->flags |= SCALE_RUNNING;
 
 	return 0;
@@ -175,6 +322,54 @@ int scale_process_wait(scale_t scale)
 	glc_thread_wait(&scale->thread);
 	scale->flags &= ~SCALE_RUNNING;
 
+	if (scale->bands) {
+		glc_band_pool_destroy(scale->bands);
+		scale->bands = NULL;
+	}
+	scale_band_tmp_free(scale);
+
+	return 0;
+}
+
+void scale_band_tmp_free(scale_t scale)
+{
+	unsigned int w;
+
+	for (w = 0; w < scale->band_tmp_count; w++)
+		free(scale->band_tmp[w].buf);
+	free(scale->band_tmp);
+	scale->band_tmp = NULL;
+	scale->band_tmp_count = 0;
+}
+
+int scale_thread_create_callback(void *ptr, void **threadptr)
+{
+	if (unlikely(!(*threadptr = calloc(1, sizeof(struct scale_thread_s)))))
+		return ENOMEM;
+	return 0;
+}
+
+void scale_thread_finish_callback(void *ptr, void *threadptr, int err)
+{
+	struct scale_thread_s *thread = threadptr;
+
+	if (!thread)
+		return;
+	free(thread->tmp.buf);
+	free(thread);
+}
+
+int scale_tmp_reserve(struct scale_tmp_s *tmp, size_t size)
+{
+	short *buf;
+
+	if (tmp->size >= size)
+		return 0;
+	if (unlikely(!(buf = calloc(size, sizeof(short)))))
+		return ENOMEM;
+	free(tmp->buf);
+	tmp->buf = buf;
+	tmp->size = size;
 	return 0;
 }
 
@@ -182,6 +377,7 @@ void scale_finish_callback(void *ptr, int err)
 {
 	scale_t scale = ptr;
 	struct scale_video_stream_s *del;
+	unsigned int i;
 
 	if (unlikely(err))
 		glc_log(scale->glc, GLC_ERROR, "scale", "%s (%d)", strerror(err), err);
@@ -190,8 +386,10 @@ void scale_finish_callback(void *ptr, int err)
 		del = scale->video;
 		scale->video = scale->video->next;
 
-		free(del->pos);
-		free(del->factor);
+		for (i = 0; i < sizeof(del->axis) / sizeof(del->axis[0]); i++) {
+			free(del->axis[i].start);
+			free(del->axis[i].coef);
+		}
 
 		pthread_rwlock_destroy(&del->update);
 		free(del);
@@ -200,8 +398,11 @@ void scale_finish_callback(void *ptr, int err)
 
 int scale_read_callback(glc_thread_state_t *state) {
 	scale_t scale = (scale_t) state->ptr;
+	struct scale_thread_s *thread = state->threadptr;
 	struct scale_video_stream_s *video;
 	glc_video_frame_header_t *video_frame_header;
+	unsigned int w;
+	int ret;
 
 	if (state->header.type == GLC_MESSAGE_VIDEO_FORMAT)
 		return scale_video_format_message(scale,
@@ -211,13 +412,24 @@ int scale_read_callback(glc_thread_state_t *state) {
 	if (state->header.type == GLC_MESSAGE_VIDEO_FRAME) {
 		video_frame_header = (glc_video_frame_header_t *) state->read_data;
 		scale_get_video_stream(scale, video_frame_header->id, &video);
-		state->threadptr = video;
+		thread->video = video;
 
 		pthread_rwlock_rdlock(&video->update);
 
-		if (video->proc)
+		if (video->proc) {
+			/*
+			 * band workers only run for the single scale thread,
+			 * their buffers are grown here between frames
+			 */
+			ret = scale_tmp_reserve(&thread->tmp, video->tmp_size);
+			for (w = 0; (!ret) && (w < scale->band_tmp_count); w++)
+				ret = scale_tmp_reserve(&scale->band_tmp[w], video->tmp_size);
+			if (unlikely(ret)) {
+				pthread_rwlock_unlock(&video->update);
+				return ret;
+			}
 			state->write_size = video->size + sizeof(glc_video_frame_header_t);
-		else {
+		} else {
 			state->flags |= GLC_THREAD_COPY;
 			pthread_rwlock_unlock(&video->update);
 		}
@@ -229,17 +441,39 @@ int scale_read_callback(glc_thread_state_t *state) {
 
 int scale_write_callback(glc_thread_state_t *state) {
 	scale_t scale = (scale_t) state->ptr;
-	struct scale_video_stream_s *video = state->threadptr;
+	struct scale_thread_s *thread = state->threadptr;
+	struct scale_video_stream_s *video = thread->video;
+	struct scale_band_job_s job;
 
 	memcpy(state->write_data, state->read_data, sizeof(glc_video_frame_header_t));
-	video->proc(scale, video,
-		  (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)],
-		  (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)]);
+
+	job.scale = scale;
+	job.video = video;
+	job.from = (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)];
+	job.to = (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)];
+	job.tmp = thread->tmp.buf;
+
+	if (scale->bands)
+		glc_band_pool_run(scale->bands, scale_band, &job,
+				  video->rows, video->row_size);
+	else
+		video->proc(scale, video, job.from, job.to, job.tmp, 0, video->rows);
 	pthread_rwlock_unlock(&video->update);
 
 	return 0;
 }
 
+void scale_band(void *arg, unsigned int first, unsigned int last)
+{
+	struct scale_band_job_s *job = arg;
+	unsigned int worker = glc_band_pool_worker();
+	short *tmp = job->tmp;
+
+	if (worker && (worker <= job->scale->band_tmp_count))
+		tmp = job->scale->band_tmp[worker - 1].buf;
+	job->video->proc(job->scale, job->video, job->from, job->to, tmp, first, last);
+}
+
 int scale_get_video_stream(scale_t scale, glc_stream_id_t id, struct scale_video_stream_s **video)
 {
 	struct scale_video_stream_s *list = scale->video;
@@ -265,15 +499,17 @@ int scale_get_video_stream(scale_t scale, glc_stream_id_t id, struct scale_video
 }
 
 void scale_rgb_convert(scale_t scale, struct scale_video_stream_s *video,
-		       unsigned char *from, unsigned char *to)
+		       unsigned char *from, unsigned char *to, short *tmp,
+		       unsigned int first, unsigned int last)
 {
 	unsigned int x, y, ox, oy, op, tp;
 	unsigned int swi = video->sw * 3;
-	unsigned int shi = video->sh * 3;
-	ox = oy = 0;
+	unsigned int shi = last * 3;
+	ox = 0;
+	oy = first;
 
 	/* just convert from different bpp to 3 */
-	for (y = 0; y < shi; y += 3) {
+	for (y = first * 3; y < shi; y += 3) {
 		for (x = 0; x < swi; x += 3) {
 			tp = x + y * video->sw;
 			op = ox + oy * video->row;
@@ -290,11 +526,14 @@ void scale_rgb_convert(scale_t scale, struct scale_video_stream_s *video,
 }
 
 void scale_rgb_half(scale_t scale, struct scale_video_stream_s *video,
-		    unsigned char *from, unsigned char *to)
+		    unsigned char *from, unsigned char *to, short *tmp,
+		    unsigned int first, unsigned int last)
 {
 	unsigned int ox, oy, op1, op2, op3, op4;
+	unsigned int oh = (last * 2 < video->h) ? last * 2 : video->h;
 
-	for (oy = 0; oy < video->h; oy += 2) {
+	to += first * ((video->w + 1) / 2) * 3;
+	for (oy = first * 2; oy < oh; oy += 2) {
 		for (ox = 0; ox < video->w; ox += 2) {
 			op1 = ox * video->bpp + oy * video->row;
 			op2 = op1 + video->bpp;
@@ -319,36 +558,28 @@ void scale_rgb_half(scale_t scale, struct scale_video_stream_s *video,
 }
 
 void scale_rgb_scale(scale_t scale, struct scale_video_stream_s *video,
-		     unsigned char *from, unsigned char *to)
+		     unsigned char *from, unsigned char *to, short *tmp,
+		     unsigned int first, unsigned int last)
 {
-	unsigned int x, y, tp, sp;
+	const struct scale_kernels_s *k = scale->kernels;
+	struct scale_axis_s *ax = &video->axis[0], *ay = &video->axis[1];
+	unsigned int y;
 
 	if (scale->flags & SCALE_SIZE)
-		memset(to, 0, video->size);
-
-	for (y = 0; y < video->sh; y++) {
-		for (x = 0; x < video->sw; x++) {
-			sp = (x + y * video->sw) * 4;
-			tp = ((x + video->rx) + (y + video->ry) * video->rw) * 3;
-
-			to[tp + 0] = from[video->pos[sp + 0] + 0] * video->factor[sp + 0] +
-				     from[video->pos[sp + 1] + 0] * video->factor[sp + 1] +
-				     from[video->pos[sp + 2] + 0] * video->factor[sp + 2] +
-				     from[video->pos[sp + 3] + 0] * video->factor[sp + 3];
-			to[tp + 1] = from[video->pos[sp + 0] + 1] * video->factor[sp + 0] +
-				     from[video->pos[sp + 1] + 1] * video->factor[sp + 1] +
-				     from[video->pos[sp + 2] + 1] * video->factor[sp + 2] +
-				     from[video->pos[sp + 3] + 1] * video->factor[sp + 3];
-			to[tp + 2] = from[video->pos[sp + 0] + 2] * video->factor[sp + 0] +
-				     from[video->pos[sp + 1] + 2] * video->factor[sp + 1] +
-				     from[video->pos[sp + 2] + 2] * video->factor[sp + 2] +
-				     from[video->pos[sp + 3] + 2] * video->factor[sp + 3];
-		}
+		scale_clear_rows(to, video->rw * 3, first ? first + video->ry : 0,
+				 (last == video->sh) ? video->rh : last + video->ry, 0);
+
+	for (y = first; y < last; y++) {
+		k->vertical(&from[ay->start[y] * video->row], video->row,
+			    &ay->coef[y * ay->pitch], ay->taps, video->w * video->bpp, tmp);
+		k->horizontal(ax, tmp, video->bpp, video->sw,
+			      &to[(video->rx + (y + video->ry) * video->rw) * 3]);
 	}
 }
 
 void scale_ycbcr_half(scale_t scale, struct scale_video_stream_s *video,
-		      unsigned char *from, unsigned char *to)
+		      unsigned char *from, unsigned char *to, short *tmp,
+		      unsigned int first, unsigned int last)
 {
 	unsigned int x, y, ox, oy, cw_from, ch_from, cw_to, ch_to, op1, op2, op3, op4;
 	unsigned char *Cb_to, *Cr_to;
@@ -364,8 +595,12 @@ void scale_ycbcr_half(scale_t scale, struct scale_video_stream_s *video,
 	Cb_to = &to[video->sw * video->sh];
 	Cr_to = &Cb_to[cw_to * ch_to];
 
-	ox = oy = 0;
-	for (y = 0; y < ch_to; y++) {
+	Cb_to += first * cw_to;
+	Cr_to += first * cw_to;
+
+	ox = 0;
+	oy = first * 2;
+	for (y = first; y < last; y++) {
 		for (x = 0; x < cw_to; x++) {
 			op1 = oy * cw_from + ox;
 			op2 = op1 + 1;
@@ -387,8 +622,11 @@ void scale_ycbcr_half(scale_t scale, struct scale_video_stream_s *video,
 		oy += 2;
 	}
 
-	ox = oy = 0;
-	for (y = 0; y < video->sh; y++) {
+	to += first * 2 * video->sw;
+
+	ox = 0;
+	oy = first * 4;
+	for (y = first * 2; y < last * 2; y++) {
 		for (x = 0; x < video->sw; x++) {
 			op1 = oy * video->w + ox;
 			op2 = op1 + 1;
@@ -408,9 +646,12 @@ void scale_ycbcr_half(scale_t scale, struct scale_video_stream_s *video,
 }
 
 void scale_ycbcr_scale(scale_t scale, struct scale_video_stream_s *video,
-		       unsigned char *from, unsigned char *to)
+		       unsigned char *from, unsigned char *to, short *tmp,
+		       unsigned int first, unsigned int last)
 {
-	unsigned int x, y, sp, cw, ch;
+	const struct scale_kernels_s *k = scale->kernels;
+	struct scale_axis_s *ax, *ay;
+	unsigned int y, cw, ch, crw;
 	unsigned char *Y_to, *Cb_to, *Cr_to;
 	unsigned char *Y_from, *Cb_from, *Cr_from;
 
@@ -418,49 +659,301 @@ void scale_ycbcr_scale(scale_t scale, struct scale_video_stream_s *video,
 	Cb_from = &from[video->w * video->h];
 	Cr_from = &Cb_from[(video->w / 2) * (video->h / 2)];
 
-	cw = video->sw / 2;
+	cw = video->w / 2;
 	ch = video->sh / 2;
+	crw = video->rw / 2;
 	Y_to = to;
 	Cb_to = &to[video->rw * video->rh];
-	Cr_to = &Cb_to[(video->rw / 2) * (video->rh / 2)];
+	Cr_to = &Cb_to[crw * (video->rh / 2)];
 
 	if (scale->flags & SCALE_SIZE) {
-		memset(Y_to, 0, video->rw * video->rh);
-		memset(Cb_to, 128, (video->rw / 2) * (video->rh / 2));
-		memset(Cr_to, 128, (video->rw / 2) * (video->rh / 2));
+		scale_clear_rows(Y_to, video->rw, first ? first * 2 + video->ry : 0,
+				 (last == ch) ? video->rh : last * 2 + video->ry, 0);
+		scale_clear_rows(Cb_to, crw, first ? first + video->ry / 2 : 0,
+				 (last == ch) ? video->rh / 2 : last + video->ry / 2, 128);
+		scale_clear_rows(Cr_to, crw, first ? first + video->ry / 2 : 0,
+				 (last == ch) ? video->rh / 2 : last + video->ry / 2, 128);
 	}
 
-	for (y = 0; y < video->sh; y++) {
-		for (x = 0; x < video->sw; x++) {
-			sp = (x + y * video->sw) * 4;
+	ax = &video->axis[0];
+	ay = &video->axis[1];
+	for (y = first * 2; y < last * 2; y++) {
+		k->vertical(&Y_from[ay->start[y] * video->w], video->w,
+			    &ay->coef[y * ay->pitch], ay->taps, video->w, tmp);
+		k->horizontal(ax, tmp, 1, video->sw,
+			      &Y_to[video->rx + (y + video->ry) * video->rw]);
+	}
 
-			Y_to[(x + video->rx) + (y + video->ry) * video->rw] =
-				Y_from[video->pos[sp + 0]] * video->factor[sp + 0] +
-				Y_from[video->pos[sp + 1]] * video->factor[sp + 1] +
-				Y_from[video->pos[sp + 2]] * video->factor[sp + 2] +
-				Y_from[video->pos[sp + 3]] * video->factor[sp + 3];
+	ax = &video->axis[2];
+	ay = &video->axis[3];
+	for (y = first; y < last; y++) {
+		k->vertical(&Cb_from[ay->start[y] * cw], cw,
+			    &ay->coef[y * ay->pitch], ay->taps, cw, tmp);
+		k->horizontal(ax, tmp, 1, video->sw / 2,
+			      &Cb_to[video->rx / 2 + (y + video->ry / 2) * crw]);
+		k->vertical(&Cr_from[ay->start[y] * cw], cw,
+			    &ay->coef[y * ay->pitch], ay->taps, cw, tmp);
+		k->horizontal(ax, tmp, 1, video->sw / 2,
+			      &Cr_to[video->rx / 2 + (y + video->ry / 2) * crw]);
+	}
+}
+
+/**
+ * Filtered values are kept with SCALE_TMP_BITS fractional bits between
+ * passes, coefficients have SCALE_COEF_BITS.
+ */
+void scale_horizontal_c(const struct scale_axis_s *ax, const short *from,
+			unsigned int stride, unsigned int n, unsigned char *to)
+{
+	const short *coef = ax->coef, *src;
+	unsigned int x, t;
+	int b, g, r;
+
+	if (stride == 1) {
+		for (x = 0; x < n; x++, coef += ax->pitch) {
+			src = &from[ax->start[x]];
+			b = SCALE_HORIZONTAL_ROUND;
+			for (t = 0; t < ax->taps; t++)
+				b += coef[t] * src[t];
+			*to++ = SCALE_HORIZONTAL_CLAMP(b);
 		}
+		return;
 	}
 
-	for (y = 0; y < ch; y++) {
-		for (x = 0; x < cw; x++) {
-			sp = video->sw * video->sh * 4 + (x + y * cw) * 4;
-
-			Cb_to[(x + video->rx / 2) + (y + video->ry / 2) * (video->rw / 2)] =
-				Cb_from[video->pos[sp + 0]] * video->factor[sp + 0] +
-				Cb_from[video->pos[sp + 1]] * video->factor[sp + 1] +
-				Cb_from[video->pos[sp + 2]] * video->factor[sp + 2] +
-				Cb_from[video->pos[sp + 3]] * video->factor[sp + 3];
-
-			Cr_to[(x + video->rx / 2) + (y + video->ry / 2) * (video->rw / 2)] =
-				Cr_from[video->pos[sp + 0]] * video->factor[sp + 0] +
-				Cr_from[video->pos[sp + 1]] * video->factor[sp + 1] +
-				Cr_from[video->pos[sp + 2]] * video->factor[sp + 2] +
-				Cr_from[video->pos[sp + 3]] * video->factor[sp + 3];
+	for (x = 0; x < n; x++, coef += ax->pitch) {
+		src = &from[ax->start[x] * stride];
+		b = g = r = SCALE_HORIZONTAL_ROUND;
+		for (t = 0; t < ax->taps; t++, src += stride) {
+			b += coef[t] * src[0];
+			g += coef[t] * src[1];
+			r += coef[t] * src[2];
 		}
+		*to++ = SCALE_HORIZONTAL_CLAMP(b);
+		*to++ = SCALE_HORIZONTAL_CLAMP(g);
+		*to++ = SCALE_HORIZONTAL_CLAMP(r);
 	}
 }
 
+void scale_vertical_c(const unsigned char *from, size_t stride, const short *coef,
+		      unsigned int taps, unsigned int n, short *to)
+{
+	unsigned int i, t;
+	int acc;
+
+	for (i = 0; i < n; i++) {
+		acc = 1 << (SCALE_COEF_BITS - SCALE_TMP_BITS - 1);
+		for (t = 0; t < taps; t++)
+			acc += coef[t] * from[t * stride + i];
+		to[i] = acc >> (SCALE_COEF_BITS - SCALE_TMP_BITS);
+	}
+}
+
+#ifdef SCALE_SIMD
+
+/*
+ * Vertical kernels take source rows in pairs so that pmaddwd does two
+ * taps at once, an odd last tap is paired with zeros.
+ */
+
+static void scale_vertical_sse2(const unsigned char *from, size_t stride, const short *coef,
+				unsigned int taps, unsigned int n, short *to)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(1 << (SCALE_COEF_BITS - SCALE_TMP_BITS - 1));
+	__m128i a, b, c, lo, hi;
+	unsigned int i, t;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		lo = hi = round;
+		for (t = 0; t < taps; t += 2) {
+			a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) &from[t * stride + i]),
+					      zero);
+			if (t + 1 < taps) {
+				b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)
+								      &from[(t + 1) * stride + i]), zero);
+				c = _mm_unpacklo_epi16(_mm_set1_epi16(coef[t]),
+						       _mm_set1_epi16(coef[t + 1]));
+			} else {
+				b = zero;
+				c = _mm_unpacklo_epi16(_mm_set1_epi16(coef[t]), zero);
+			}
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), c));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), c));
+		}
+		_mm_storeu_si128((__m128i *) &to[i],
+				 _mm_packs_epi32(_mm_srai_epi32(lo, SCALE_COEF_BITS - SCALE_TMP_BITS),
+						 _mm_srai_epi32(hi, SCALE_COEF_BITS - SCALE_TMP_BITS)));
+	}
+
+	scale_vertical_c(&from[i], stride, coef, taps, n - i, &to[i]);
+}
+
+/*
+ * Planes are filtered SCALE_COEF_ALIGN taps at a time, BGR(A) pixels
+ * two taps at a time with channels in separate lanes. Zero padded
+ * weights cover the taps read past the filter window.
+ */
+static void scale_horizontal_sse2(const struct scale_axis_s *ax, const short *from,
+				  unsigned int stride, unsigned int n, unsigned char *to)
+{
+	const __m128i round = _mm_set1_epi32(SCALE_HORIZONTAL_ROUND);
+	const short *coef = ax->coef, *src;
+	__m128i acc;
+	unsigned int x, t;
+	int px;
+
+	for (x = 0; x < n; x++, coef += ax->pitch) {
+		acc = _mm_setzero_si128();
+		if (stride == 1) {
+			src = &from[ax->start[x]];
+			for (t = 0; t < ax->taps; t += SCALE_COEF_ALIGN)
+				acc = _mm_add_epi32(acc, _mm_madd_epi16(
+					_mm_loadu_si128((const __m128i *) &src[t]),
+					_mm_loadu_si128((const __m128i *) &coef[t])));
+			acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+			acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+		} else {
+			src = &from[ax->start[x] * stride];
+			for (t = 0; t < ax->taps; t += 2, src += 2 * stride)
+				acc = _mm_add_epi32(acc, _mm_madd_epi16(
+					_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *) src),
+							   _mm_loadl_epi64((const __m128i *) &src[stride])),
+					_mm_unpacklo_epi16(_mm_set1_epi16(coef[t]),
+							   _mm_set1_epi16(coef[t + 1]))));
+		}
+		acc = _mm_srai_epi32(_mm_add_epi32(acc, round),
+				     SCALE_COEF_BITS + SCALE_TMP_BITS);
+		acc = _mm_packs_epi32(acc, acc);
+		px = _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+		if (stride == 1)
+			*to++ = px;
+		else {
+			memcpy(to, &px, 3);
+			to += 3;
+		}
+	}
+}
+
+/* in-lane unpacks and packs cancel out, results stay in order */
+__attribute__((target("avx2")))
+static void scale_vertical_avx2(const unsigned char *from, size_t stride, const short *coef,
+				unsigned int taps, unsigned int n, short *to)
+{
+	const __m256i round = _mm256_set1_epi32(1 << (SCALE_COEF_BITS - SCALE_TMP_BITS - 1));
+	__m256i a, b, c, lo, hi;
+	unsigned int i, t;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		lo = hi = round;
+		for (t = 0; t < taps; t += 2) {
+			a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)
+								 &from[t * stride + i]));
+			if (t + 1 < taps) {
+				b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)
+									 &from[(t + 1) * stride + i]));
+				c = _mm256_unpacklo_epi16(_mm256_set1_epi16(coef[t]),
+							  _mm256_set1_epi16(coef[t + 1]));
+			} else {
+				b = _mm256_setzero_si256();
+				c = _mm256_unpacklo_epi16(_mm256_set1_epi16(coef[t]), b);
+			}
+			lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), c));
+			hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), c));
+		}
+		_mm256_storeu_si256((__m256i *) &to[i],
+				    _mm256_packs_epi32(_mm256_srai_epi32(lo, SCALE_COEF_BITS - SCALE_TMP_BITS),
+						       _mm256_srai_epi32(hi, SCALE_COEF_BITS - SCALE_TMP_BITS)));
+	}
+
+	scale_vertical_sse2(&from[i], stride, coef, taps, n - i, &to[i]);
+}
+
+static const struct scale_kernels_s scale_kernels[] = {
+	{"avx2", GLC_SIMD_AVX2, &scale_vertical_avx2, &scale_horizontal_sse2},
+	{"sse2", GLC_SIMD_SSE2, &scale_vertical_sse2, &scale_horizontal_sse2},
+	{NULL, 0, NULL, NULL}
+};
+
+#else
+
+static const struct scale_kernels_s scale_kernels[] = {
+	{NULL, 0, NULL, NULL}
+};
+
+#endif
+
+static const struct scale_kernels_s scale_kernels_c = {"c", 0, &scale_vertical_c,
+							      &scale_horizontal_c};
+
+/* vertical self-test width leaves a scalar tail for every kernel */
+#define SCALE_TEST_N       (16 + 8 + 5)
+#define SCALE_TEST_TAPS    5
+/* horizontal self-test reads 9 overlapping windows over 23 pixels */
+#define SCALE_TEST_SAMPLES 9
+#define SCALE_TEST_ROW     (23 * 4 + SCALE_TMP_PAD)
+
+void scale_select_kernels(scale_t scale)
+{
+	scale->kernels = glc_simd_select(scale->glc, "scale", scale_kernels,
+					 sizeof(struct scale_kernels_s), &scale_kernels_c,
+					 &scale_test_kernels, scale,
+					 SCALE_TEST_N * SCALE_TEST_TAPS,
+					 sizeof(short) * SCALE_TEST_ROW);
+}
+
+/**
+ * Self-test: filter synthetic rows with both the scalar and the given
+ * kernels. Lanczos-like negative weights and an odd tap count are
+ * used.
+ */
+int scale_test_kernels(void *ptr, const void *kernels, glc_simd_test_t *test)
+{
+	static const short coef[SCALE_TEST_TAPS] = {-1200, 6000, 13000, -2416, 1000};
+	const struct scale_kernels_s *k = kernels;
+	unsigned int n = SCALE_TEST_N, i, stride, start[SCALE_TEST_SAMPLES];
+	short *ref = (short *) test->ref, *out = (short *) test->out;
+	short hcoef[SCALE_TEST_SAMPLES * SCALE_COEF_ALIGN];
+	unsigned char href[SCALE_TEST_SAMPLES * 3], hout[SCALE_TEST_SAMPLES * 3];
+	struct scale_axis_s ax;
+	int ret;
+
+	scale_vertical_c(test->from, n, coef, SCALE_TEST_TAPS, n, ref);
+	k->vertical(test->from, n, coef, SCALE_TEST_TAPS, n, out);
+	if (unlikely((ret = glc_simd_test_compare(test, ref, out, sizeof(short) * n))))
+		return ret;
+
+	ax.taps = SCALE_TEST_TAPS;
+	ax.pitch = SCALE_COEF_ALIGN;
+	ax.start = start;
+	ax.coef = hcoef;
+	memset(hcoef, 0, sizeof(hcoef));
+	for (i = 0; i < SCALE_TEST_SAMPLES; i++) {
+		start[i] = i * 2;
+		memcpy(&hcoef[i * SCALE_COEF_ALIGN], coef, sizeof(coef));
+	}
+
+	/* filtered vertical output, out is reused as horizontal input */
+	memset(out, 0, sizeof(short) * SCALE_TEST_ROW);
+	for (i = 0; i < 23 * 4; i++)
+		out[i] = ref[i % n] * ((i % 5) ? 1 : -1);
+
+	for (stride = 1; stride <= 4 && !ret; stride += (stride == 1) ? 2 : 1) {
+		scale_horizontal_c(&ax, out, stride, SCALE_TEST_SAMPLES, href);
+		k->horizontal(&ax, out, stride, SCALE_TEST_SAMPLES, hout);
+		ret = glc_simd_test_compare(test, href, hout, (stride == 1) ?
+					    SCALE_TEST_SAMPLES : SCALE_TEST_SAMPLES * 3);
+	}
+
+	return ret;
+}
+
+void scale_clear_rows(unsigned char *to, unsigned int row,
+		      unsigned int first, unsigned int last, int c)
+{
+	if (last > first)
+		memset(&to[first * row], c, (last - first) * row);
+}
+
 int scale_video_format_message(scale_t scale,
 			       glc_video_format_message_t *format_message,
 			       glc_thread_state_t *state)
@@ -519,25 +1012,35 @@ int scale_video_format_message(scale_t scale,
 	}
 
 	video->proc = NULL; /* do not try anything stupid... */
+	video->tmp_size = 0;
 
 	if ((video->format == GLC_VIDEO_BGR) ||
 	    (video->format == GLC_VIDEO_BGRA)) {
-		if ((video->scale == 0.5) && !(scale->flags & SCALE_SIZE)) {
+		if ((video->scale == 0.5) && !(scale->flags & SCALE_SIZE) &&
+		    (scale->filter != SCALE_FILTER_LANCZOS3)) {
 			glc_log(scale->glc, GLC_DEBUG, "scale",
 				 "scaling RGB data to half-size (from %ux%u to %ux%u)",
 				 video->w, video->h, video->sw, video->sh);
 			video->proc = scale_rgb_half;
+			video->rows = (video->h + 1) / 2;
+			video->row_size = 2 * video->row;
 		} else if ((video->rw == video->w) &&
 			   (video->rh == video->h) &&
 			   (video->format == GLC_VIDEO_BGRA)) {
 			glc_log(scale->glc, GLC_DEBUG, "scale", "converting BGRA to BGR");
 			video->proc = scale_rgb_convert;
+			video->rows = video->sh;
+			video->row_size = video->row;
 		} else if ((video->rw != video->w) | (video->rh != video->h)) {
 			glc_log(scale->glc, GLC_DEBUG, "scale",
 				 "scaling RGB data with factor %f (from %ux%u to %ux%u)",
 				 video->scale, video->w, video->h, video->sw, video->sh);
 			video->proc = scale_rgb_scale;
-			scale_generate_rgb_map(scale, video);
+			video->rows = video->sh;
+			video->row_size = video->row * video->h / (video->sh ? video->sh : 1);
+			video->tmp_size = video->w * video->bpp + SCALE_TMP_PAD;
+			if (unlikely(scale_generate_filter(scale, video)))
+				video->proc = NULL;
 		}
 
 		format_message->format = GLC_VIDEO_BGR; /* after scaling data is in BGR */
@@ -562,17 +1065,24 @@ int scale_video_format_message(scale_t scale,
 		format_message->height = video->rh;
 		video->size = video->rw * video->rh + 2 * ((video->rw / 2) * (video->rh / 2));
 
-		if ((video->scale == 0.5) && !(scale->flags & SCALE_SIZE)) {
+		if ((video->scale == 0.5) && !(scale->flags & SCALE_SIZE) &&
+		    (scale->filter != SCALE_FILTER_LANCZOS3)) {
 			glc_log(scale->glc, GLC_DEBUG, "scale",
 				 "scaling Y'CbCr data to half-size (from %ux%u to %ux%u)",
 				 video->w, video->h, video->sw, video->sh);
 			video->proc = scale_ycbcr_half;
+			video->rows = video->sh / 2;
+			video->row_size = 6 * video->w;
 		} else if ((video->rw != video->w) || (video->rh != video->h)) {
 			glc_log(scale->glc, GLC_DEBUG, "scale",
 				 "scaling Y'CbCr data with factor %f (from %ux%u to %ux%u)",
 				 video->scale, video->w, video->h, video->sw, video->sh);
 			video->proc = scale_ycbcr_scale;
-			scale_generate_ycbcr_map(scale, video);
+			video->rows = video->sh / 2;
+			video->row_size = 3 * video->w * video->h / (video->sh ? video->sh : 1);
+			video->tmp_size = video->w + SCALE_TMP_PAD;
+			if (unlikely(scale_generate_filter(scale, video)))
+				video->proc = NULL;
 		}
 
 		if ((scale->flags & SCALE_SIZE) && (video->created) &&
@@ -587,160 +1097,136 @@ int scale_video_format_message(scale_t scale,
 	return 0;
 }
 
-int scale_generate_rgb_map(scale_t scale, struct scale_video_stream_s *video)
+double scale_filter_lanczos3(double x)
 {
-	float ofx, ofy, fx0, fx1, fy0, fy1;
-	unsigned int tp, x, y, r;
-	float d;
-	size_t smap_size = video->sw * video->sh * 3 * 4;
+	if (x == 0.0)
+		return 1.0;
+	if (fabs(x) >= 3.0)
+		return 0.0;
+	x *= M_PI;
+	return 3.0 * sin(x) * sin(x / 3.0) / (x * x);
+}
 
-	glc_log(scale->glc, GLC_DEBUG, "scale", "generating %zd + %zd byte scale map for video stream %d",
-		 smap_size * sizeof(unsigned int), smap_size * sizeof(float), video->id);
+/**
+ * Builds coefficients for resampling n source samples to sn. Sample
+ * centers are aligned and the filter is stretched when downscaling so
+ * that every source sample contributes. Windows are kept inside the
+ * source, which renormalizes weights at the edges.
+ */
+int scale_generate_axis(scale_t scale, struct scale_axis_s *axis,
+			unsigned int n, unsigned int sn)
+{
+	double ratio = (double) n / (double) sn;
+	double stretch = (ratio > 1.0) ? ratio : 1.0;
+	double support, center, x, sum;
+	double *w;
+	unsigned int *start;
+	short *coef;
+	unsigned int i, t, taps, max;
+	int left, total;
+
+	if (unlikely((!n) || (!sn)))
+		return EINVAL;
 
-	if (video->pos)
-		video->pos = (unsigned int *) realloc(video->pos, sizeof(unsigned int) * smap_size);
+	if (scale->filter == SCALE_FILTER_LANCZOS3)
+		support = 3.0 * stretch;
+	else if (scale->filter == SCALE_FILTER_AREA)
+		support = 0.5 + stretch / 2.0;
 	else
-		video->pos = (unsigned int *) malloc(sizeof(unsigned int) * smap_size);
-	if (video->factor)
-		video->factor = (float *) realloc(video->factor, sizeof(float) * smap_size);
-	else
-		video->factor = (float *) malloc(sizeof(float) * smap_size);
-
-	r = 0;
-	do {
-		d = (float) (video->w - r++) / (float) video->sw;
-		glc_log(scale->glc, GLC_DEBUG, "scale", "d = %f", d);
-	} while ((d * (float) (video->sh - 1) + 1.0 > video->h) |
-		 (d * (float) (video->sw - 1) + 1.0 > video->w));
+		support = stretch;
+
+	/* at most this many samples are strictly inside the support */
+	taps = ceil(support * 2.0);
+	if (taps > n)
+		taps = n;
+
+	axis->taps = taps;
+	axis->pitch = (taps + SCALE_COEF_ALIGN - 1) & ~(SCALE_COEF_ALIGN - 1);
+	if (unlikely(!(start = (unsigned int *) realloc(axis->start,
+						sizeof(unsigned int) * sn))))
+		return ENOMEM;
+	axis->start = start;
+	if (unlikely(!(coef = (short *) realloc(axis->coef,
+						sizeof(short) * axis->pitch * sn))))
+		return ENOMEM;
+	axis->coef = coef;
+	if (unlikely(!(w = (double *) malloc(sizeof(double) * taps))))
+		return ENOMEM;
+
+	for (i = 0; i < sn; i++) {
+		center = ((double) i + 0.5) * ratio - 0.5;
+		left = floor(center - support) + 1;
+		if (left + taps > n)
+			left = n - taps;
+		if (left < 0)
+			left = 0;
+		axis->start[i] = left;
+		memset(&axis->coef[i * axis->pitch], 0, sizeof(short) * axis->pitch);
+
+		sum = 0;
+		for (t = 0; t < taps; t++) {
+			x = (double) (left + t) - center;
+			if (scale->filter == SCALE_FILTER_LANCZOS3)
+				w[t] = scale_filter_lanczos3(x / stretch);
+			else if (scale->filter == SCALE_FILTER_AREA) /* source pixel coverage */
+				w[t] = fmax(0.0, fmin(x + 0.5, stretch / 2.0) -
+						 fmax(x - 0.5, -stretch / 2.0));
+			else
+				w[t] = fmax(0.0, 1.0 - fabs(x) / stretch);
+			sum += w[t];
+		}
 
-	ofx = ofy = 0;
-	for (y = 0; y < video->sh; y++) {
-		for (x = 0; x < video->sw; x++) {
-			tp = (x + y * video->sw) * 4;
-
-			video->pos[tp + 0] = ((unsigned int) ofx + 0) * video->bpp +
-					   ((unsigned int) ofy + 0) * video->row;
-			video->pos[tp + 1] = ((unsigned int) ofx + 1) * video->bpp +
-					   ((unsigned int) ofy + 0) * video->row;
-			video->pos[tp + 2] = ((unsigned int) ofx + 0) * video->bpp +
-					   ((unsigned int) ofy + 1) * video->row;
-			video->pos[tp + 3] = ((unsigned int) ofx + 1) * video->bpp +
-					   ((unsigned int) ofy + 1) * video->row;
-
-			fx1 = (float) x * d - (float) ((unsigned int) ofx);
-			fx0 = 1.0 - fx1;
-			fy1 = (float) y * d - (float) ((unsigned int) ofy);
-			fy0 = 1.0 - fy1;
-
-			video->factor[tp + 0] = fx0 * fy0;
-			video->factor[tp + 1] = fx1 * fy0;
-			video->factor[tp + 2] = fx0 * fy1;
-			video->factor[tp + 3] = fx1 * fy1;
-
-			ofx += d;
+		/* rounding error goes to the largest weight, sum must be exact */
+		total = 0;
+		max = 0;
+		for (t = 0; t < taps; t++) {
+			axis->coef[i * axis->pitch + t] = lround(w[t] / sum * SCALE_COEF_ONE);
+			total += axis->coef[i * axis->pitch + t];
+			if (w[t] > w[max])
+				max = t;
 		}
-		ofy += d;
-		ofx = 0;
+		axis->coef[i * axis->pitch + max] += SCALE_COEF_ONE - total;
 	}
 
+	free(w);
 	return 0;
 }
 
-int scale_generate_ycbcr_map(scale_t scale, struct scale_video_stream_s *video)
+int scale_generate_filter(scale_t scale, struct scale_video_stream_s *video)
 {
-	float ofx, ofy, fx0, fx1, fy0, fy1;
-	unsigned int tp, x, y, r, cw, ch;
-	float d;
-	size_t smap_size = video->sw * video->sh * 5; /* yw*yh*4 + (ch*cw)*4, ch = yh/2, cw = yw/2 */
-
-	glc_log(scale->glc, GLC_DEBUG, "scale", "generating %zd B + %zd B scale map for video stream %d",
-		 smap_size * sizeof(unsigned int), smap_size * sizeof(float), video->id);
-
-	if (video->pos)
-		video->pos = (unsigned int *) realloc(video->pos, sizeof(unsigned int) * smap_size);
-	else
-		video->pos = (unsigned int *) malloc(sizeof(unsigned int) * smap_size);
-	if (video->factor)
-		video->factor = (float *) realloc(video->factor, sizeof(float) * smap_size);
-	else
-		video->factor = (float *) malloc(sizeof(float) * smap_size);
+	static const char *filters[] = {NULL, "bilinear", "area", "lanczos3"};
+	unsigned int axes;
+	size_t size;
+	int ret;
 
-	r = 0;
-	do {
-		d = (float) (video->w - r++) / (float) video->sw;
-		glc_log(scale->glc, GLC_DEBUG, "scale", "Y: d = %f", d);
-	} while ((d * (float) (video->sh - 1) + 1.0 > video->h) |
-		 (d * (float) (video->sw - 1) + 1.0 > video->w));
+	if (video->format == GLC_VIDEO_YCBCR_420JPEG) {
+		axes = 4;
+		if (unlikely((ret = scale_generate_axis(scale, &video->axis[2],
+							video->w / 2, video->sw / 2))))
+			return ret;
+		if (unlikely((ret = scale_generate_axis(scale, &video->axis[3],
+							video->h / 2, video->sh / 2))))
+			return ret;
+	} else
+		axes = 2;
 
-	ofx = ofy = 0;
-	for (y = 0; y < video->sh; y++) {
-		for (x = 0; x < video->sw; x++) {
-			tp = (x + y * video->sw) * 4;
-
-			video->pos[tp + 0] = ((unsigned int) ofx + 0) +
-					   ((unsigned int) ofy + 0) * video->w;
-			video->pos[tp + 1] = ((unsigned int) ofx + 1) +
-					   ((unsigned int) ofy + 0) * video->w;
-			video->pos[tp + 2] = ((unsigned int) ofx + 0) +
-					   ((unsigned int) ofy + 1) * video->w;
-			video->pos[tp + 3] = ((unsigned int) ofx + 1) +
-					   ((unsigned int) ofy + 1) * video->w;
-
-			fx1 = (float) x * d - (float) ((unsigned int) ofx);
-			fx0 = 1.0 - fx1;
-			fy1 = (float) y * d - (float) ((unsigned int) ofy);
-			fy0 = 1.0 - fy1;
-
-			video->factor[tp + 0] = fx0 * fy0;
-			video->factor[tp + 1] = fx1 * fy0;
-			video->factor[tp + 2] = fx0 * fy1;
-			video->factor[tp + 3] = fx1 * fy1;
-
-			ofx += d;
-		}
-		ofy += d;
-		ofx = 0;
-	}
+	if (unlikely((ret = scale_generate_axis(scale, &video->axis[0],
+						video->w, video->sw))))
+		return ret;
+	if (unlikely((ret = scale_generate_axis(scale, &video->axis[1],
+						video->h, video->sh))))
+		return ret;
 
-	cw = video->sw / 2;
-	ch = video->sh / 2;
-	r = (r < 2) ? (0) : (r - 2);
-	do {
-		d = (float) ((video->w / 2) - r++) / (float) cw;
-		glc_log(scale->glc, GLC_DEBUG, "scale", "C: d = %f", d);
-	} while ((d * (float) (ch - 1) + 1.0 > (video->h / 2)) |
-		 (d * (float) (cw - 1) + 1.0 > (video->w / 2)));
-
-	ofx = ofy = 0;
-	for (y = 0; y < ch; y++) {
-		for (x = 0; x < cw; x++) {
-			tp = video->sw * video->sh * 4 + (x + y * cw) * 4;
-
-			video->pos[tp + 0] = ((unsigned int) ofx + 0) +
-					   ((unsigned int) ofy + 0) * (video->w / 2);
-			video->pos[tp + 1] = ((unsigned int) ofx + 1) +
-					   ((unsigned int) ofy + 0) * (video->w / 2);
-			video->pos[tp + 2] = ((unsigned int) ofx + 0) +
-					   ((unsigned int) ofy + 1) * (video->w / 2);
-			video->pos[tp + 3] = ((unsigned int) ofx + 1) +
-					   ((unsigned int) ofy + 1) * (video->w / 2);
-
-			fx1 = (float) x * d - (float) ((unsigned int) ofx);
-			fx0 = 1.0 - fx1;
-			fy1 = (float) y * d - (float) ((unsigned int) ofy);
-			fy0 = 1.0 - fy1;
-
-			video->factor[tp + 0] = fx0 * fy0;
-			video->factor[tp + 1] = fx1 * fy0;
-			video->factor[tp + 2] = fx0 * fy1;
-			video->factor[tp + 3] = fx1 * fy1;
-
-			ofx += d;
-		}
-		ofy += d;
-		ofx = 0;
-	}
+	size = (video->sw + video->sh) * sizeof(unsigned int) +
+		(video->sw * video->axis[0].pitch + video->sh * video->axis[1].pitch) * sizeof(short);
+	if (axes == 4)
+		size += (video->sw / 2 + video->sh / 2) * sizeof(unsigned int) +
+			((video->sw / 2) * video->axis[2].pitch +
+			 (video->sh / 2) * video->axis[3].pitch) * sizeof(short);
 
+	glc_log(scale->glc, GLC_DEBUG, "scale",
+		"generated %zd B %s filter tables for video stream %d",
+		size, filters[scale->filter], video->id);
 	return 0;
 }
 
@@ -60,6 +60,26 @@ __PUBLIC int scale_set_scale(scale_t scale, double factor);
 __PUBLIC int scale_set_size(scale_t scale, unsigned int width,
 			    unsigned int height);
 
+/** bilinear interpolation, default */
+#define SCALE_FILTER_BILINEAR 0x1
+/** area averaging, best for downscaling */
+#define SCALE_FILTER_AREA     0x2
+/** 3-lobed Lanczos, sharpest but slowest */
+#define SCALE_FILTER_LANCZOS3 0x3
+
+/**
+ * \brief set resampling filter
+ *
+ * Filter is stretched when downscaling so all source pixels
+ * contribute to the result. Takes effect on next video format
+ * message.
+ * \param scale scale object
+ * \param filter SCALE_FILTER_BILINEAR, SCALE_FILTER_AREA or
+ *               SCALE_FILTER_LANCZOS3
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int scale_set_filter(scale_t scale, int filter);
+
 /**
  * \brief process data
  *
@@ -0,0 +1,338 @@
+/**
+ * \file glc/core/shm_ring.c
+ * \brief Shared memory frame ring between the pipe sink and its reader process.
+ * \author agent <agent@local>
+ * \date 2026
+
+    Copyright 2026 agent
+
+    This file is part of glcs.
+
+    glcs is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    glcs is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with glcs.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/memfd.h>
+
+#include <glc/common/log.h>
+#include <glc/common/optimization.h>
+
+#include "shm_ring.h"
+
+#define SHM_RING_PAGE_SIZE 4096
+#define SHM_RING_ALIGN(x) (((x) + SHM_RING_PAGE_SIZE - 1) & ~((size_t) SHM_RING_PAGE_SIZE - 1))
+
+struct shm_ring_s {
+	glc_t *glc;
+	glc_shm_ring_header_t *hdr;
+	char *data;
+	size_t map_size;
+	size_t row_sz;
+	unsigned int height;
+	int invert;
+	/* private copy of the geometry, the shared header can change */
+	unsigned int frames;
+	size_t frame_size, slot_size;
+	/* writer owns head, only tail is taken from the other side */
+	u_int32_t head;
+};
+
+static int shm_ring_map(struct shm_ring_s *ring, int fd, size_t size, int flags);
+static u_int32_t shm_ring_used(struct shm_ring_s *ring, u_int32_t tail);
+static void shm_ring_futex_wake(volatile u_int32_t *addr);
+static int shm_ring_futex_wait(volatile u_int32_t *addr, u_int32_t val,
+			       const struct timespec *deadline);
+
+int shm_ring_create(shm_ring_t *ring, glc_t *glc, size_t row_sz,
+		    unsigned int height, unsigned int frames,
+		    int invert, int *fd)
+{
+	glc_shm_ring_header_t *hdr;
+	size_t data_offset, slot_size, size;
+	int ret;
+
+	if (unlikely(!frames || !row_sz || !height))
+		return EINVAL;
+
+	data_offset = SHM_RING_ALIGN(sizeof(glc_shm_ring_header_t));
+	slot_size = SHM_RING_ALIGN(row_sz * height);
+	size = data_offset + slot_size * frames;
+
+	*ring = (shm_ring_t) calloc(1, sizeof(struct shm_ring_s));
+	if (unlikely(!*ring))
+		return ENOMEM;
+	(*ring)->glc = glc;
+	(*ring)->row_sz = row_sz;
+	(*ring)->height = height;
+	(*ring)->invert = invert;
+
+	/* reader gets it through dup2() which clears close-on-exec */
+	*fd = syscall(SYS_memfd_create, "glcs-frames", MFD_CLOEXEC);
+	if (unlikely(*fd < 0)) {
+		ret = errno;
+		glc_log(glc, GLC_ERROR, "shm_ring", "memfd_create() failed: %s (%d)",
+			strerror(ret), ret);
+		goto err;
+	}
+
+	if (unlikely(ftruncate(*fd, size) < 0)) {
+		ret = errno;
+		glc_log(glc, GLC_ERROR, "shm_ring", "can't size ring to %zu bytes: %s (%d)",
+			size, strerror(ret), ret);
+		goto err_close;
+	}
+
+	/* populate now rather than fault pages in while writing frames */
+	if (unlikely((ret = shm_ring_map(*ring, *fd, size, MAP_POPULATE)))) {
+		glc_log(glc, GLC_ERROR, "shm_ring", "mmap() failed: %s (%d)",
+			strerror(ret), ret);
+		goto err_close;
+	}
+
+	hdr = (*ring)->hdr;
+	hdr->frames      = frames;
+	hdr->height      = height;
+	hdr->frame_size  = row_sz * height;
+	hdr->slot_size   = slot_size;
+	hdr->data_offset = data_offset;
+	hdr->version     = GLC_SHM_RING_VERSION;
+	__sync_synchronize();
+	hdr->magic       = GLC_SHM_RING_MAGIC;
+	(*ring)->data    = (char *) hdr + data_offset;
+	(*ring)->frames     = frames;
+	(*ring)->frame_size = row_sz * height;
+	(*ring)->slot_size  = slot_size;
+
+	glc_log(glc, GLC_INFO, "shm_ring", "%u frames of %zu bytes ring created",
+		frames, row_sz * height);
+	return 0;
+
+err_close:
+	close(*fd);
+	*fd = -1;
+err:
+	free(*ring);
+	*ring = NULL;
+	return ret;
+}
+
+int shm_ring_open(shm_ring_t *ring, int fd)
+{
+	glc_shm_ring_header_t *hdr;
+	u_int64_t frames, frame_size, slot_size, data_offset;
+	struct stat st;
+	int ret;
+
+	if (unlikely(fstat(fd, &st) < 0))
+		return errno;
+	if (unlikely(st.st_size < sizeof(glc_shm_ring_header_t)))
+		return EINVAL;
+
+	*ring = (shm_ring_t) calloc(1, sizeof(struct shm_ring_s));
+	if (unlikely(!*ring))
+		return ENOMEM;
+
+	if (unlikely((ret = shm_ring_map(*ring, fd, st.st_size, 0))))
+		goto err;
+
+	hdr = (*ring)->hdr;
+	frames = hdr->frames;
+	frame_size = hdr->frame_size;
+	slot_size = hdr->slot_size;
+	data_offset = hdr->data_offset;
+
+	/*
+	 * header comes from another process, every slot must lie in the
+	 * file and hold a frame; division keeps the check from overflowing
+	 */
+	if (unlikely(hdr->magic != GLC_SHM_RING_MAGIC ||
+		     hdr->version != GLC_SHM_RING_VERSION ||
+		     !frames || frame_size > slot_size ||
+		     data_offset < sizeof(glc_shm_ring_header_t) ||
+		     data_offset > st.st_size ||
+		     slot_size > (st.st_size - data_offset) / frames)) {
+		munmap(hdr, (*ring)->map_size);
+		ret = EINVAL;
+		goto err;
+	}
+	(*ring)->data = (char *) hdr + data_offset;
+	(*ring)->frames = frames;
+	(*ring)->frame_size = frame_size;
+	(*ring)->slot_size = slot_size;
+	return 0;
+err:
+	free(*ring);
+	*ring = NULL;
+	return ret;
+}
+
+/*
+ * A tail that is ahead of head or more than a ring behind it can only
+ * come from a broken reader, clamp it to a full ring so that no slot
+ * still owned by the reader gets overwritten.
+ */
+u_int32_t shm_ring_used(struct shm_ring_s *ring, u_int32_t tail)
+{
+	u_int32_t used = ring->head - tail;
+
+	return unlikely(used > ring->frames) ? ring->frames : used;
+}
+
+int shm_ring_map(struct shm_ring_s *ring, int fd, size_t size, int flags)
+{
+	void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | flags, fd, 0);
+	if (unlikely(addr == MAP_FAILED))
+		return errno;
+	ring->hdr = (glc_shm_ring_header_t *) addr;
+	ring->map_size = size;
+	return 0;
+}
+
+int shm_ring_write(shm_ring_t ring, const char *frame,
+		   const struct timespec *timeout)
+{
+	glc_shm_ring_header_t *hdr = ring->hdr;
+	u_int32_t head = ring->head;
+	u_int32_t tail;
+	struct timespec deadline, *until = NULL;
+	char *slot;
+	unsigned int i;
+
+	while (unlikely(shm_ring_used(ring, hdr->tail) >= ring->frames)) {
+		/*
+		 * the deadline is absolute so that spurious wake ups and
+		 * EINTR do not restart the whole timeout
+		 */
+		if (timeout && !until) {
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+			deadline.tv_sec += timeout->tv_sec;
+			deadline.tv_nsec += timeout->tv_nsec;
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+			until = &deadline;
+		}
+		hdr->writer_waiting = 1;
+		__sync_synchronize();
+		tail = hdr->tail;
+		if (shm_ring_used(ring, tail) < ring->frames)
+			break;
+		if (unlikely(shm_ring_futex_wait(&hdr->tail, tail, until) == ETIMEDOUT)) {
+			hdr->writer_waiting = 0;
+			return ETIMEDOUT;
+		}
+	}
+
+	slot = &ring->data[(head % ring->frames) * ring->slot_size];
+	if (ring->invert) {
+		for (i = 0; i < ring->height; i++)
+			memcpy(&slot[i * ring->row_sz],
+			       &frame[(ring->height - 1 - i) * ring->row_sz],
+			       ring->row_sz);
+	} else
+		memcpy(slot, frame, ring->frame_size);
+
+	__sync_synchronize();
+	ring->head = head + 1;
+	hdr->head = ring->head;
+	/* full barrier, orders head before reading reader_waiting */
+	__sync_fetch_and_add(&hdr->seq, 1);
+	if (hdr->reader_waiting) {
+		hdr->reader_waiting = 0;
+		shm_ring_futex_wake(&hdr->seq);
+	}
+	return 0;
+}
+
+int shm_ring_close(shm_ring_t ring)
+{
+	glc_shm_ring_header_t *hdr = ring->hdr;
+
+	hdr->closed = 1;
+	__sync_fetch_and_add(&hdr->seq, 1);
+	hdr->reader_waiting = 0;
+	shm_ring_futex_wake(&hdr->seq);
+	return 0;
+}
+
+int shm_ring_read(shm_ring_t ring, const char **frame, size_t *size)
+{
+	glc_shm_ring_header_t *hdr = ring->hdr;
+	u_int32_t tail = hdr->tail;
+	u_int32_t seq;
+
+	while (hdr->head == tail) {
+		if (hdr->closed)
+			return EPIPE;
+		hdr->reader_waiting = 1;
+		__sync_synchronize();
+		seq = hdr->seq;
+		if (hdr->head != tail || hdr->closed)
+			continue;
+		shm_ring_futex_wait(&hdr->seq, seq, NULL);
+	}
+	__sync_synchronize();
+
+	*frame = &ring->data[(tail % ring->frames) * ring->slot_size];
+	*size = ring->frame_size;
+	return 0;
+}
+
+int shm_ring_read_done(shm_ring_t ring)
+{
+	glc_shm_ring_header_t *hdr = ring->hdr;
+
+	/* full barrier, frame is read before slot is given back */
+	__sync_fetch_and_add(&hdr->tail, 1);
+	if (hdr->writer_waiting) {
+		hdr->writer_waiting = 0;
+		shm_ring_futex_wake(&hdr->tail);
+	}
+	return 0;
+}
+
+int shm_ring_destroy(shm_ring_t ring)
+{
+	munmap(ring->hdr, ring->map_size);
+	free(ring);
+	return 0;
+}
+
+/* ring is shared between processes, private futex ops can't be used */
+void shm_ring_futex_wake(volatile u_int32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC deadline */
+int shm_ring_futex_wait(volatile u_int32_t *addr, u_int32_t val,
+			const struct timespec *deadline)
+{
+	if (syscall(SYS_futex, addr, FUTEX_WAIT_BITSET, val, deadline, NULL,
+		    FUTEX_BITSET_MATCH_ANY) < 0)
+		return errno;
+	return 0;
+}
@@ -0,0 +1,149 @@
+/**
+ * \file glc/core/shm_ring.h
+ * \brief Shared memory frame ring between the pipe sink and its reader process.
+ * \author agent <agent@local>
+ * \date 2026
+
+    Copyright 2026 agent
+
+    This file is part of glcs.
+
+    glcs is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    glcs is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with glcs.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef _SHM_RING_H
+#define _SHM_RING_H
+
+#include <time.h>
+#include <glc/common/glc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** ring signature = "GLCR" */
+#define GLC_SHM_RING_MAGIC   0x52434c47
+#define GLC_SHM_RING_VERSION 0x1
+
+/**
+ * \brief ring header, at offset 0 of the shared memory file
+ *
+ * Frame n is at data_offset + (n % frames) * slot_size. The writer
+ * publishes frames by incrementing head, the reader releases them by
+ * incrementing tail. Both counters wrap around. seq changes each time
+ * head or closed does and is the futex word the reader sleeps on, tail
+ * is the one the writer sleeps on. Futexes are shared (not private).
+ */
+typedef struct {
+	u_int32_t magic;
+	u_int32_t version;
+	/** number of frame slots */
+	u_int32_t frames;
+	/** frame height */
+	u_int32_t height;
+	/** frame size in bytes */
+	u_int64_t frame_size;
+	/** distance between slots */
+	u_int64_t slot_size;
+	/** first slot offset */
+	u_int64_t data_offset;
+
+	/* written by the writer */
+	volatile u_int32_t head __attribute__ ((aligned (64)));
+	volatile u_int32_t seq;
+	volatile u_int32_t closed;
+	volatile u_int32_t writer_waiting;
+
+	/* written by the reader */
+	volatile u_int32_t tail __attribute__ ((aligned (64)));
+	volatile u_int32_t reader_waiting;
+} glc_shm_ring_header_t;
+
+typedef struct shm_ring_s* shm_ring_t;
+
+/**
+ * \brief create a ring in a new memfd
+ * \param ring returned ring
+ * \param glc glc
+ * \param row_sz frame row size in bytes
+ * \param height frame height
+ * \param frames number of frame slots
+ * \param invert write rows in reverse order
+ * \param fd returned memfd to hand to the reader, owned by caller
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int shm_ring_create(shm_ring_t *ring, glc_t *glc, size_t row_sz,
+			     unsigned int height, unsigned int frames,
+			     int invert, int *fd);
+
+/**
+ * \brief copy a frame into the next free slot
+ *
+ * This is the only copy of the frame, the reader accesses the slot
+ * in place.
+ * \param ring ring
+ * \param frame frame data
+ * \param timeout how long to wait in total for a free slot, NULL waits
+ *                forever
+ * \return 0 on success, ETIMEDOUT if the reader is too slow
+ */
+__PUBLIC int shm_ring_write(shm_ring_t ring, const char *frame,
+			    const struct timespec *timeout);
+
+/**
+ * \brief signal end of stream to the reader
+ * \param ring ring
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int shm_ring_close(shm_ring_t ring);
+
+/**
+ * \brief map a ring created by shm_ring_create()
+ * \param ring returned ring
+ * \param fd memfd received from the writer
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int shm_ring_open(shm_ring_t *ring, int fd);
+
+/**
+ * \brief wait for the next frame
+ *
+ * The frame stays valid until shm_ring_read_done().
+ * \param ring ring opened with shm_ring_open()
+ * \param frame returned frame data
+ * \param size returned frame size
+ * \return 0 on success, EPIPE at end of stream
+ */
+__PUBLIC int shm_ring_read(shm_ring_t ring, const char **frame, size_t *size);
+
+/**
+ * \brief release the frame returned by shm_ring_read()
+ * \param ring ring
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int shm_ring_read_done(shm_ring_t ring);
+
+/**
+ * \brief unmap and free ring
+ * \param ring ring
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int shm_ring_destroy(shm_ring_t ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -44,6 +44,12 @@
 #include <glc/common/optimization.h>
 
 #include "ycbcr.h"
+#include "colorspace.h"
+
+#ifdef __x86_64__
+# include <immintrin.h>
+# define YCBCR_SIMD
+#endif
 
 /*
 http://en.wikipedia.org/wiki/YCbCr:
@@ -65,20 +71,65 @@ Y', Cb, Cr      in {0, 1, 2, ..., 255}
 	(128 + 0.5      * (Rd) - 0.418688 * (Gd) - 0.081312 * (Bd))
 */
 
-#define RGB_TO_YCbCrJPEG_Y(Rd, Gd, Bd) \
-	(    + ((306 * (Rd) + 601 * (Gd) + 117 * (Bd)) >> 10))
-#define RGB_TO_YCbCrJPEG_Cb(Rd, Gd, Bd) \
-	(128 - ((173 * (Rd) + 339 * (Gd) - 512 * (Bd)) >> 10))
-#define RGB_TO_YCbCrJPEG_Cr(Rd, Gd, Bd) \
-	(128 + ((512 * (Rd) - 429 * (Gd) -  83 * (Bd)) >> 10))
+/* integer RGB_TO_YCbCrJPEG_* are in colorspace.h */
+
+/* source pixels converted per SIMD kernel call */
+#define YCBCR_SIMD_CHUNK 256
+
+/* bilinear weights of the arbitrary scale path, products fit in 16 bits */
+#define YCBCR_SCALE_BITS  7
+#define YCBCR_SCALE_ONE   (1 << YCBCR_SCALE_BITS)
+#define YCBCR_SCALE_ROUND (1 << (2 * YCBCR_SCALE_BITS - 1))
+/* blended rows are over-allocated for 4 channel loads of 3 bpp pixels */
+#define YCBCR_SCALE_PAD   8
 
 struct ycbcr_video_stream_s;
 struct ycbcr_private_s;
 
+/**
+ * \brief SIMD kernel set
+ *
+ * Row kernels work on 32 bit BGRX pixels, BGR rows are expanded
+ * first in YCBCR_SIMD_CHUNK sized pieces. Results are bit-exact with
+ * the scalar conversion.
+ */
+struct ycbcr_kernels_s {
+	/* same first members as glc_simd_kernels_t */
+	const char *name;
+	glc_flags_t simd;
+	/** expand n BGR pixels into BGRX */
+	void (*expand)(const unsigned char *from, unsigned char *to, unsigned int n);
+	/** convert n 2x2 blocks, top row becomes the upper Y' row */
+	void (*row)(const unsigned char *top, const unsigned char *bottom, unsigned int n,
+		    unsigned char *Ytop, unsigned char *Ybottom,
+		    unsigned char *Cb, unsigned char *Cr);
+	/** convert n 4x4 blocks, src[3] becomes the upper Y' row */
+	void (*half_row)(const unsigned char *src[4], unsigned int n,
+			 unsigned char *Ytop, unsigned char *Ybottom,
+			 unsigned char *Cb, unsigned char *Cr);
+	/** blend n bytes of two source rows, b weighted by f / YCBCR_SCALE_ONE */
+	void (*vertical)(const unsigned char *a, const unsigned char *b,
+			 unsigned int f, unsigned int n, short *to);
+	/** interpolate n BGRX pixels from a blended row, 2 taps per pixel */
+	void (*horizontal)(const short *from, unsigned int bpp,
+			   const unsigned int *pos, const unsigned char *factor,
+			   unsigned int n, unsigned char *to);
+};
+
+/* converts output rows [2 * first, 2 * last) */
 typedef void (*ycbcr_convert_proc)(ycbcr_t ycbcr,
 				   struct ycbcr_video_stream_s *video,
 				   unsigned char *from,
-				   unsigned char *to);
+				   unsigned char *to,
+				   short *blend,
+				   unsigned int first,
+				   unsigned int last);
+
+/* row buffer of the arbitrary scale path */
+struct ycbcr_blend_s {
+	short *buf;
+	size_t size;
+};
 
 struct ycbcr_video_stream_s {
 	glc_stream_id_t id;
@@ -89,8 +140,16 @@ struct ycbcr_video_stream_s {
 	double scale;
 	size_t size;
 
-	unsigned int *pos;
-	float *factor;
+	/* bilinear taps for other scales, see ycbcr_generate_map() */
+	unsigned int *xpos, *ypos;
+	unsigned char *xfactor, *yfactor;
+	/*
+	 * blended rows between vertical and horizontal taps, [0] for
+	 * ycbcr_convert_frame() callers, [w] for band worker w
+	 */
+	struct ycbcr_blend_s *blend;
+	unsigned int blend_count;
+	size_t blend_size;
 
 	ycbcr_convert_proc convert;
 
@@ -104,24 +163,72 @@ struct ycbcr_s {
 	int running;
 	double scale;
 
+	const struct ycbcr_kernels_s *kernels;
+	glc_band_pool_t bands;
+
+	/* protects stream list when converting outside of thread */
+	pthread_mutex_t streams;
+	struct ycbcr_video_stream_s *video;
+};
+
+struct ycbcr_thread_s {
+	struct ycbcr_video_stream_s *video;
+	struct ycbcr_blend_s blend;
+};
+
+struct ycbcr_band_job_s {
+	ycbcr_t ycbcr;
 	struct ycbcr_video_stream_s *video;
+	unsigned char *from, *to;
+	/* calling thread buffer, band workers use video->blend */
+	short *blend;
+	int ret;
 };
 
 static int ycbcr_read_callback(glc_thread_state_t *state);
 static int ycbcr_write_callback(glc_thread_state_t *state);
 static void ycbcr_finish_callback(void *ptr, int err);
+static int ycbcr_thread_create_callback(void *ptr, void **threadptr);
+static void ycbcr_thread_finish_callback(void *ptr, void *threadptr, int err);
+static void ycbcr_band(void *arg, unsigned int first, unsigned int last);
 
 static int ycbcr_video_format_message(ycbcr_t ycbcr, glc_video_format_message_t *video_format);
+static int ycbcr_convert(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+			 unsigned char *from, unsigned char *to, short *blend);
 static void ycbcr_get_video_stream(ycbcr_t ycbcr, glc_stream_id_t id, struct ycbcr_video_stream_s **video);
 
 static int ycbcr_generate_map(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video);
+static void ycbcr_generate_axis(unsigned int n, unsigned int sn,
+				unsigned int *pos, unsigned char *factor);
+static int ycbcr_blend_reserve(struct ycbcr_blend_s *blend, size_t size);
+static void ycbcr_blend_free(struct ycbcr_video_stream_s *video);
 
 static void ycbcr_bgr_to_jpeg420(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
-			  unsigned char *from, unsigned char *to);
+			  unsigned char *from, unsigned char *to, short *blend,
+			  unsigned int first, unsigned int last);
 static void ycbcr_bgr_to_jpeg420_half(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
-			       unsigned char *from, unsigned char *to);
+			       unsigned char *from, unsigned char *to, short *blend,
+			       unsigned int first, unsigned int last);
 static void ycbcr_bgr_to_jpeg420_scale(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
-				unsigned char *from, unsigned char *to);
+				unsigned char *from, unsigned char *to, short *blend,
+				unsigned int first, unsigned int last);
+
+static void ycbcr_scale_rows(const struct ycbcr_kernels_s *k,
+			     struct ycbcr_video_stream_s *video,
+			     unsigned char *from, unsigned char *to, short *blend,
+			     unsigned int first, unsigned int last);
+static void ycbcr_bgr_to_jpeg420_simd(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				      unsigned char *from, unsigned char *to, short *blend,
+				      unsigned int first, unsigned int last);
+static void ycbcr_bgr_to_jpeg420_half_simd(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+					   unsigned char *from, unsigned char *to, short *blend,
+					   unsigned int first, unsigned int last);
+static void ycbcr_bgr_to_jpeg420_scale_simd(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+					    unsigned char *from, unsigned char *to, short *blend,
+					    unsigned int first, unsigned int last);
+
+static void ycbcr_select_kernels(ycbcr_t ycbcr);
+static int ycbcr_test_kernels(void *ptr, const void *kernels, glc_simd_test_t *test);
 
 int ycbcr_init(ycbcr_t *ycbcr, glc_t *glc)
 {
@@ -133,15 +240,27 @@ int ycbcr_init(ycbcr_t *ycbcr, glc_t *glc)
 	(*ycbcr)->thread.read_callback = &ycbcr_read_callback;
 	(*ycbcr)->thread.write_callback = &ycbcr_write_callback;
 	(*ycbcr)->thread.finish_callback = &ycbcr_finish_callback;
+	(*ycbcr)->thread.thread_create_callback = &ycbcr_thread_create_callback;
+	(*ycbcr)->thread.thread_finish_callback = &ycbcr_thread_finish_callback;
 	(*ycbcr)->thread.ptr = *ycbcr;
 	(*ycbcr)->thread.threads = glc_threads_hint(glc);
+	(*ycbcr)->thread.name = "ycbcr";
 	(*ycbcr)->scale = 1.0;
+	pthread_mutex_init(&(*ycbcr)->streams, NULL);
+
+	ycbcr_select_kernels(*ycbcr);
 
 	return 0;
 }
 
 int ycbcr_destroy(ycbcr_t ycbcr)
 {
+	/* streams left by ycbcr_convert_format() */
+	ycbcr_finish_callback(ycbcr, 0);
+	if (ycbcr->bands)
+		glc_band_pool_destroy(ycbcr->bands);
+
+	pthread_mutex_destroy(&ycbcr->streams);
 	free(ycbcr);
 	return 0;
 }
@@ -162,8 +281,21 @@ int ycbcr_process_start(ycbcr_t ycbcr, ps_buffer_t *from, ps_buffer_t *to)
 	if (unlikely(ycbcr->running))
 		return EAGAIN;
 
-	if (unlikely((ret = glc_thread_create(ycbcr->glc, &ycbcr->thread, from, to))))
+	if (glc_frame_threads(ycbcr->glc) > 1) {
+		if (unlikely((ret = glc_band_pool_create(ycbcr->glc, &ycbcr->bands,
+							 glc_frame_threads(ycbcr->glc)))))
+			return ret;
+		ycbcr->thread.threads = 1;
+	} else
+		ycbcr->thread.threads = glc_threads_hint(ycbcr->glc);
+
+	if (unlikely((ret = glc_thread_create(ycbcr->glc, &ycbcr->thread, from, to)))) {
+		if (ycbcr->bands) {
+			glc_band_pool_destroy(ycbcr->bands);
+			ycbcr->bands = NULL;
+		}
 		return ret;
+	}
 	ycbcr->running = 1;
 
 	return 0;
@@ -179,6 +311,11 @@ int ycbcr_process_wait(ycbcr_t ycbcr)
 	glc_thread_wait(&ycbcr->thread);
 	ycbcr->running = 0;
 
+	if (ycbcr->bands) {
+		glc_band_pool_destroy(ycbcr->bands);
+		ycbcr->bands = NULL;
+	}
+
 	return 0;
 }
 
@@ -194,19 +331,41 @@ void ycbcr_finish_callback(void *ptr, int err)
 		del = ycbcr->video;
 		ycbcr->video = ycbcr->video->next;
 
-		free(del->pos);
-		free(del->factor);
+		free(del->xpos);
+		free(del->ypos);
+		free(del->xfactor);
+		free(del->yfactor);
+		ycbcr_blend_free(del);
 
 		pthread_rwlock_destroy(&del->update);
 		free(del);
 	}
 }
 
+int ycbcr_thread_create_callback(void *ptr, void **threadptr)
+{
+	if (unlikely(!(*threadptr = calloc(1, sizeof(struct ycbcr_thread_s)))))
+		return ENOMEM;
+	return 0;
+}
+
+void ycbcr_thread_finish_callback(void *ptr, void *threadptr, int err)
+{
+	struct ycbcr_thread_s *thread = threadptr;
+
+	if (!thread)
+		return;
+	free(thread->blend.buf);
+	free(thread);
+}
+
 int ycbcr_read_callback(glc_thread_state_t *state)
 {
 	ycbcr_t ycbcr = state->ptr;
+	struct ycbcr_thread_s *thread = state->threadptr;
 	struct ycbcr_video_stream_s *video;
 	glc_video_frame_header_t *pic_hdr;
+	int ret;
 
 	if (state->header.type == GLC_MESSAGE_VIDEO_FORMAT)
 		ycbcr_video_format_message(ycbcr, (glc_video_format_message_t *) state->read_data);
@@ -214,13 +373,19 @@ int ycbcr_read_callback(glc_thread_state_t *state)
 	if (state->header.type == GLC_MESSAGE_VIDEO_FRAME) {
 		pic_hdr = (glc_video_frame_header_t *) state->read_data;
 		ycbcr_get_video_stream(ycbcr, pic_hdr->id, &video);
-		state->threadptr = video;
+		thread->video = video;
 
 		pthread_rwlock_rdlock(&video->update);
 
-		if (video->convert != NULL)
+		if (video->convert != NULL) {
+			/* stream rows can be shared by ycbcr threads, this one is not */
+			if (unlikely((ret = ycbcr_blend_reserve(&thread->blend,
+								video->blend_size)))) {
+				pthread_rwlock_unlock(&video->update);
+				return ret;
+			}
 			state->write_size = sizeof(glc_video_frame_header_t) + video->size;
-		else {
+		} else {
 			state->flags |= GLC_THREAD_COPY;
 			pthread_rwlock_unlock(&video->update);
 		}
@@ -233,15 +398,112 @@ int ycbcr_read_callback(glc_thread_state_t *state)
 int ycbcr_write_callback(glc_thread_state_t *state)
 {
 	ycbcr_t ycbcr = state->ptr;
-	struct ycbcr_video_stream_s *video = state->threadptr;
+	struct ycbcr_thread_s *thread = state->threadptr;
+	struct ycbcr_video_stream_s *video = thread->video;
+	int ret;
 
 	memcpy(state->write_data, state->read_data, sizeof(glc_video_frame_header_t));
-	video->convert(ycbcr, video,
-		     (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)],
-		     (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)]);
+	ret = ycbcr_convert(ycbcr, video,
+			    (unsigned char *) &state->read_data[sizeof(glc_video_frame_header_t)],
+			    (unsigned char *) &state->write_data[sizeof(glc_video_frame_header_t)],
+			    thread->blend.buf);
 	pthread_rwlock_unlock(&video->update);
 
-	return 0;
+	return ret;
+}
+
+int ycbcr_convert(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+		  unsigned char *from, unsigned char *to, short *blend)
+{
+	struct ycbcr_band_job_s job;
+
+	job.ycbcr = ycbcr;
+	job.video = video;
+	job.from = from;
+	job.to = to;
+	job.blend = blend;
+	job.ret = 0;
+
+	/* bands are pairs of output rows, each reads h / (yh / 2) source rows */
+	if ((ycbcr->bands) && (video->yh >= 2))
+		glc_band_pool_run(ycbcr->bands, ycbcr_band, &job, video->yh / 2,
+				  (size_t) video->row * video->h / (video->yh / 2));
+	else
+		ycbcr_band(&job, 0, video->yh / 2);
+
+	return job.ret;
+}
+
+void ycbcr_band(void *arg, unsigned int first, unsigned int last)
+{
+	struct ycbcr_band_job_s *job = arg;
+	unsigned int worker = glc_band_pool_worker();
+	short *blend = job->blend;
+
+	if (worker)
+		blend = (worker < job->video->blend_count) ?
+			job->video->blend[worker].buf : NULL;
+
+	/* rows are preallocated, missing one means the stream has no map */
+	if (unlikely(job->video->blend_size && !blend)) {
+		job->ret = ENOMEM;
+		return;
+	}
+	job->video->convert(job->ycbcr, job->video, job->from, job->to, blend, first, last);
+}
+
+int ycbcr_convert_format(ycbcr_t ycbcr, glc_video_format_message_t *video_format,
+			 size_t *size)
+{
+	struct ycbcr_video_stream_s *video;
+	int ret;
+
+	*size = 0;
+	if (unlikely(ycbcr->running))
+		return EBUSY;
+
+	pthread_mutex_lock(&ycbcr->streams);
+	if ((!ycbcr->bands) && (glc_frame_threads(ycbcr->glc) > 1)) {
+		/* not fatal, frames are converted by calling thread alone */
+		if (unlikely((ret = glc_band_pool_create(ycbcr->glc, &ycbcr->bands,
+							 glc_frame_threads(ycbcr->glc)))))
+			glc_log(ycbcr->glc, GLC_WARN, "ycbcr",
+				"can't create band pool: %s (%d)", strerror(ret), ret);
+	}
+	ret = ycbcr_video_format_message(ycbcr, video_format);
+	ycbcr_get_video_stream(ycbcr, video_format->id, &video);
+	pthread_mutex_unlock(&ycbcr->streams);
+
+	pthread_rwlock_rdlock(&video->update);
+	if (video->convert)
+		*size = video->size;
+	pthread_rwlock_unlock(&video->update);
+
+	return ret;
+}
+
+int ycbcr_convert_frame(ycbcr_t ycbcr, glc_stream_id_t id,
+			const unsigned char *from, unsigned char *to)
+{
+	struct ycbcr_video_stream_s *video;
+	int ret;
+
+	pthread_mutex_lock(&ycbcr->streams);
+	ycbcr_get_video_stream(ycbcr, id, &video);
+	pthread_mutex_unlock(&ycbcr->streams);
+
+	pthread_rwlock_rdlock(&video->update);
+	if (unlikely(!video->convert)) {
+		pthread_rwlock_unlock(&video->update);
+		return EINVAL;
+	}
+
+	/* converters never write to source */
+	ret = ycbcr_convert(ycbcr, video, (unsigned char *) from, to,
+			    video->blend_count ? video->blend[0].buf : NULL);
+	pthread_rwlock_unlock(&video->update);
+
+	return ret;
 }
 
 void ycbcr_get_video_stream(ycbcr_t ycbcr, glc_stream_id_t id, struct ycbcr_video_stream_s **video)
@@ -266,7 +528,8 @@ void ycbcr_get_video_stream(ycbcr_t ycbcr, glc_stream_id_t id, struct ycbcr_vide
 }
 
 void ycbcr_bgr_to_jpeg420(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
-			  unsigned char *from, unsigned char *to)
+			  unsigned char *from, unsigned char *to, short *blend,
+			  unsigned int first, unsigned int last)
 {
 	unsigned int Ypix;
 	unsigned int op1, op2, op3, op4;
@@ -275,13 +538,13 @@ void ycbcr_bgr_to_jpeg420(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
 	unsigned char *Y, *Cb, *Cr;
 
 	Y = to;
-	Cb = &to[video->yw * video->yh];
-	Cr = &to[video->yw * video->yh + video->cw * video->ch];
+	Cb = &to[video->yw * video->yh + first * video->cw];
+	Cr = &to[video->yw * video->yh + video->cw * video->ch + first * video->cw];
 
-	oy = (video->h - 2) * video->row;
+	oy = (video->h - 2 - first * 2) * video->row;
 	ox = 0;
 
-	for (Yy = 0; Yy < video->yh; Yy += 2) {
+	for (Yy = first * 2; Yy < last * 2; Yy += 2) {
 		for (Yx = 0; Yx < video->yw; Yx += 2) {
 			op1 = ox + oy;
 			op2 = op1 + video->bpp;
@@ -326,7 +589,8 @@ void ycbcr_bgr_to_jpeg420(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
 	Bd = (from[op1 + 0] + from[op2 + 0] + from[op3 + 0] + from[op4 + 0]) >> 2;
 
 void ycbcr_bgr_to_jpeg420_half(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
-			       unsigned char *from, unsigned char *to)
+			       unsigned char *from, unsigned char *to, short *blend,
+			       unsigned int first, unsigned int last)
 {
 	unsigned int Ypix;
 	unsigned int op1, op2, op3, op4;
@@ -334,13 +598,13 @@ void ycbcr_bgr_to_jpeg420_half(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video
 	unsigned int ox, oy, Yy, Yx;
 	unsigned char *Cb, *Cr;
 
-	Cb = &to[video->yw * video->yh];
-	Cr = &to[video->yw * video->yh + video->cw * video->ch];
+	Cb = &to[video->yw * video->yh + first * video->cw];
+	Cr = &to[video->yw * video->yh + video->cw * video->ch + first * video->cw];
 
-	oy = (video->h - 4);
+	oy = (video->h - 4 - first * 4);
 	ox = 0;
 
-	for (Yy = 0; Yy < video->yh; Yy += 2) {
+	for (Yy = first * 2; Yy < last * 2; Yy += 2) {
 		for (Yx = 0; Yx < video->yw; Yx += 2) {
 			/* CbCr */
 			CALC_BILINEAR_RGB(video->bpp, video->bpp * 2, 1, 2)
@@ -371,68 +635,824 @@ void ycbcr_bgr_to_jpeg420_half(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video
 
 #undef CALC_BILINEAR_RGB
 
+/* scalar kernels, also used as reference by the self-test */
+
+static inline void ycbcr_block_bgrx(const unsigned char *t, const unsigned char *b,
+				    unsigned char *Ytop, unsigned char *Ybottom,
+				    unsigned char *Cb, unsigned char *Cr)
+{
+	unsigned char Rd, Gd, Bd;
+
+	Rd = (t[2] + t[6] + b[2] + b[6]) >> 2;
+	Gd = (t[1] + t[5] + b[1] + b[5]) >> 2;
+	Bd = (t[0] + t[4] + b[0] + b[4]) >> 2;
+
+	*Cb = RGB_TO_YCbCrJPEG_Cb(Rd, Gd, Bd);
+	*Cr = RGB_TO_YCbCrJPEG_Cr(Rd, Gd, Bd);
+
+	Ytop[0] = RGB_TO_YCbCrJPEG_Y(t[2], t[1], t[0]);
+	Ytop[1] = RGB_TO_YCbCrJPEG_Y(t[6], t[5], t[4]);
+	Ybottom[0] = RGB_TO_YCbCrJPEG_Y(b[2], b[1], b[0]);
+	Ybottom[1] = RGB_TO_YCbCrJPEG_Y(b[6], b[5], b[4]);
+}
+
+static void ycbcr_expand_c(const unsigned char *from, unsigned char *to, unsigned int n)
+{
+	while (n--) {
+		to[0] = from[0];
+		to[1] = from[1];
+		to[2] = from[2];
+		to[3] = 0;
+		from += 3;
+		to += 4;
+	}
+}
+
+static void ycbcr_row_c(const unsigned char *top, const unsigned char *bottom,
+			unsigned int n, unsigned char *Ytop, unsigned char *Ybottom,
+			unsigned char *Cb, unsigned char *Cr)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		ycbcr_block_bgrx(&top[i * 8], &bottom[i * 8], &Ytop[i * 2], &Ybottom[i * 2],
+				 &Cb[i], &Cr[i]);
+}
+
+static void ycbcr_vertical_c(const unsigned char *a, const unsigned char *b,
+			     unsigned int f, unsigned int n, short *to)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		to[i] = a[i] * (YCBCR_SCALE_ONE - f) + b[i] * f;
+}
+
+static void ycbcr_horizontal_c(const short *from, unsigned int bpp,
+			       const unsigned int *pos, const unsigned char *factor,
+			       unsigned int n, unsigned char *to)
+{
+	const short *p;
+	unsigned int i, c;
+
+	for (i = 0; i < n; i++, to += 4) {
+		p = &from[pos[i] * bpp];
+		for (c = 0; c < 3; c++)
+			to[c] = (p[c] * (YCBCR_SCALE_ONE - factor[i]) + p[bpp + c] * factor[i] +
+				 YCBCR_SCALE_ROUND) >> (2 * YCBCR_SCALE_BITS);
+		to[3] = 0;
+	}
+}
+
+static const struct ycbcr_kernels_s ycbcr_kernels_c = {
+	"c", 0, &ycbcr_expand_c, &ycbcr_row_c, NULL,
+	&ycbcr_vertical_c, &ycbcr_horizontal_c
+};
+
 void ycbcr_bgr_to_jpeg420_scale(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
-				unsigned char *from, unsigned char *to)
+				unsigned char *from, unsigned char *to, short *blend,
+				unsigned int first, unsigned int last)
+{
+	ycbcr_scale_rows(&ycbcr_kernels_c, video, from, to, blend, first, last);
+}
+
+/*
+ * Output is produced YCBCR_SIMD_CHUNK pixels at a time: both source
+ * rows of each output row are blended over just the columns the chunk
+ * reads, interpolated into BGRX and converted as 2x2 blocks, so the
+ * working set stays in L1 whatever the frame width.
+ */
+void ycbcr_scale_rows(const struct ycbcr_kernels_s *k, struct ycbcr_video_stream_s *video,
+		      unsigned char *from, unsigned char *to, short *blend,
+		      unsigned int first, unsigned int last)
 {
-	unsigned int Cpix;
+	unsigned char tmp[2][YCBCR_SIMD_CHUNK * 4] __attribute__((aligned(32)));
+	const unsigned char *a;
 	unsigned char *Y, *Cb, *Cr;
-	unsigned int Cmap, Yy, Yx;
-	unsigned char Rd, Gd, Bd;
+	unsigned int Yy, Yx, n, r, x0, x1;
 
 	Y = to;
-	Cb = &to[video->yw * video->yh];
-	Cr = &to[video->yw * video->yh + video->cw * video->ch];
-
-	Cpix = 0;
-	Cmap = video->yw * video->yh;
-
-#define CALC_Rd(m) (from[video->pos[m + 0] + 2] * video->factor[m + 0] \
-		  + from[video->pos[m + 1] + 2] * video->factor[m + 1] \
-		  + from[video->pos[m + 2] + 2] * video->factor[m + 2] \
-		  + from[video->pos[m + 3] + 2] * video->factor[m + 3])
-#define CALC_Bd(m) (from[video->pos[m + 0] + 1] * video->factor[m + 0] \
-		  + from[video->pos[m + 1] + 1] * video->factor[m + 1] \
-		  + from[video->pos[m + 2] + 1] * video->factor[m + 2] \
-		  + from[video->pos[m + 3] + 1] * video->factor[m + 3])
-#define CALC_Gd(m) (from[video->pos[m + 0] + 0] * video->factor[m + 0] \
-		  + from[video->pos[m + 1] + 0] * video->factor[m + 1] \
-		  + from[video->pos[m + 2] + 0] * video->factor[m + 2] \
-		  + from[video->pos[m + 3] + 0] * video->factor[m + 3])
-
-#define CALC_RdBdGd(m) \
-	Rd = CALC_Rd((m) * 4); \
-	Gd = CALC_Bd((m) * 4); \
-	Bd = CALC_Gd((m) * 4);
-
-	for (Yy = 0; Yy < video->yh; Yy += 2) {
-		for (Yx = 0; Yx < video->yw; Yx += 2) {
-			/* CbCr */
-			CALC_RdBdGd(Cmap + Cpix)
-			Cb[Cpix  ] = RGB_TO_YCbCrJPEG_Cb(Rd, Gd, Bd);
-			Cr[Cpix++] = RGB_TO_YCbCrJPEG_Cr(Rd, Gd, Bd);
+	Cb = &to[video->yw * video->yh + first * video->cw];
+	Cr = &to[video->yw * video->yh + video->cw * video->ch + first * video->cw];
+
+	for (Yy = first * 2; Yy < last * 2; Yy += 2) {
+		for (Yx = 0; Yx < video->yw; Yx += n) {
+			n = video->yw - Yx;
+			if (n > YCBCR_SIMD_CHUNK)
+				n = YCBCR_SIMD_CHUNK;
+
+			x0 = video->xpos[Yx] * video->bpp;
+			x1 = (video->xpos[Yx + n - 1] + 2) * video->bpp;
+			if (x1 > video->w * video->bpp)
+				x1 = video->w * video->bpp;
+
+			for (r = 0; r < 2; r++) {
+				/* frame is bottom-up, next source row is below in memory */
+				a = &from[video->ypos[Yy + r] * video->row + x0];
+				k->vertical(a, video->ypos[Yy + r] ? a - video->row : a,
+					    video->yfactor[Yy + r], x1 - x0, &blend[x0]);
+				k->horizontal(blend, video->bpp, &video->xpos[Yx],
+					      &video->xfactor[Yx], n, tmp[r]);
+			}
+
+			k->row(tmp[0], tmp[1], n / 2,
+			       &Y[Yx + Yy * video->yw], &Y[Yx + (Yy + 1) * video->yw],
+			       &Cb[Yx / 2], &Cr[Yx / 2]);
+		}
 
-			/* Y' */
-			CALC_RdBdGd((Yx + 0) + (Yy + 0) * video->yw)
-			Y[(Yx + 0) + (Yy + 0) * video->yw] = RGB_TO_YCbCrJPEG_Y(Rd, Gd, Bd);
+		Cb += video->cw;
+		Cr += video->cw;
+	}
+}
+
+void ycbcr_bgr_to_jpeg420_simd(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+			       unsigned char *from, unsigned char *to, short *blend,
+			       unsigned int first, unsigned int last)
+{
+	const struct ycbcr_kernels_s *k = ycbcr->kernels;
+	unsigned char tmp[2][YCBCR_SIMD_CHUNK * 4] __attribute__((aligned(32)));
+	const unsigned char *top, *bottom;
+	unsigned char *Y, *Cb, *Cr;
+	unsigned int Yy, Yx, n, chunk;
+
+	Y = to;
+	Cb = &to[video->yw * video->yh + first * video->cw];
+	Cr = &to[video->yw * video->yh + video->cw * video->ch + first * video->cw];
+
+	chunk = (video->bpp == 4) ? video->yw : YCBCR_SIMD_CHUNK;
+
+	for (Yy = first * 2; Yy < last * 2; Yy += 2) {
+		top = &from[(video->h - 1 - Yy) * video->row];
+		bottom = top - video->row;
+
+		for (Yx = 0; Yx < video->yw; Yx += n) {
+			n = video->yw - Yx;
+			if (n > chunk)
+				n = chunk;
+
+			if (video->bpp == 4)
+				k->row(&top[Yx * 4], &bottom[Yx * 4], n / 2,
+				       &Y[Yx + Yy * video->yw], &Y[Yx + (Yy + 1) * video->yw],
+				       &Cb[Yx / 2], &Cr[Yx / 2]);
+			else {
+				k->expand(&top[Yx * 3], tmp[0], n);
+				k->expand(&bottom[Yx * 3], tmp[1], n);
+				k->row(tmp[0], tmp[1], n / 2,
+				       &Y[Yx + Yy * video->yw], &Y[Yx + (Yy + 1) * video->yw],
+				       &Cb[Yx / 2], &Cr[Yx / 2]);
+			}
+		}
 
-			CALC_RdBdGd((Yx + 1) + (Yy + 0) * video->yw)
-			Y[(Yx + 1) + (Yy + 0) * video->yw] = RGB_TO_YCbCrJPEG_Y(Rd, Gd, Bd);
+		Cb += video->cw;
+		Cr += video->cw;
+	}
+}
 
-			CALC_RdBdGd((Yx + 0) + (Yy + 1) * video->yw)
-			Y[(Yx + 0) + (Yy + 1) * video->yw] = RGB_TO_YCbCrJPEG_Y(Rd, Gd, Bd);
+void ycbcr_bgr_to_jpeg420_half_simd(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				    unsigned char *from, unsigned char *to, short *blend,
+				    unsigned int first, unsigned int last)
+{
+	const struct ycbcr_kernels_s *k = ycbcr->kernels;
+	unsigned char tmp[4][YCBCR_SIMD_CHUNK * 4] __attribute__((aligned(32)));
+	const unsigned char *row[4], *src[4];
+	unsigned char *Y, *Cb, *Cr;
+	unsigned int Yy, Yx, n, chunk, i;
 
-			CALC_RdBdGd((Yx + 1) + (Yy + 1) * video->yw)
-			Y[(Yx + 1) + (Yy + 1) * video->yw] = RGB_TO_YCbCrJPEG_Y(Rd, Gd, Bd);
+	Y = to;
+	Cb = &to[video->yw * video->yh + first * video->cw];
+	Cr = &to[video->yw * video->yh + video->cw * video->ch + first * video->cw];
+
+	/* in output pixels, each one takes 2 source pixels */
+	chunk = (video->bpp == 4) ? video->yw : YCBCR_SIMD_CHUNK / 2;
+
+	for (Yy = first * 2; Yy < last * 2; Yy += 2) {
+		row[0] = &from[(video->h - 4 - Yy * 2) * video->row];
+		for (i = 1; i < 4; i++)
+			row[i] = row[i - 1] + video->row;
+
+		for (Yx = 0; Yx < video->yw; Yx += n) {
+			n = video->yw - Yx;
+			if (n > chunk)
+				n = chunk;
+
+			for (i = 0; i < 4; i++) {
+				if (video->bpp == 4)
+					src[i] = &row[i][Yx * 2 * 4];
+				else {
+					k->expand(&row[i][Yx * 2 * 3], tmp[i], n * 2);
+					src[i] = tmp[i];
+				}
+			}
+
+			k->half_row(src, n / 2,
+				    &Y[Yx + Yy * video->yw], &Y[Yx + (Yy + 1) * video->yw],
+				    &Cb[Yx / 2], &Cr[Yx / 2]);
 		}
+
+		Cb += video->cw;
+		Cr += video->cw;
 	}
-#undef Rd
-#undef Gd
-#undef Bd
+}
+
+void ycbcr_bgr_to_jpeg420_scale_simd(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video,
+				     unsigned char *from, unsigned char *to, short *blend,
+				     unsigned int first, unsigned int last)
+{
+	ycbcr_scale_rows(ycbcr->kernels, video, from, to, blend, first, last);
+}
+
+#ifdef YCBCR_SIMD
+
+/*
+ * All kernels use the same integer arithmetic as the RGB_TO_YCbCrJPEG_*
+ * macros: pmaddwd with the 10 bit coefficients, >> 10 and finally the
+ * same truncation to unsigned char (Cb is 256 for pure blue and wraps
+ * to 0 exactly like the scalar code does).
+ */
+
+#define BGRX_AVG(p, q, c) ((p[c] + p[(c) + 4] + q[c] + q[(c) + 4]) >> 2)
+
+static inline void ycbcr_half_block_bgrx(const unsigned char *src[4], unsigned int x,
+					 unsigned char *Ytop, unsigned char *Ybottom,
+					 unsigned char *Cb, unsigned char *Cr)
+{
+	const unsigned char *s0 = &src[0][x], *s1 = &src[1][x];
+	const unsigned char *s2 = &src[2][x], *s3 = &src[3][x];
+	unsigned char Rd, Gd, Bd;
+
+	Rd = BGRX_AVG((s1 + 4), (s2 + 4), 2);
+	Gd = BGRX_AVG((s1 + 4), (s2 + 4), 1);
+	Bd = BGRX_AVG((s1 + 4), (s2 + 4), 0);
+	*Cb = RGB_TO_YCbCrJPEG_Cb(Rd, Gd, Bd);
+	*Cr = RGB_TO_YCbCrJPEG_Cr(Rd, Gd, Bd);
+
+	Ytop[0] = RGB_TO_YCbCrJPEG_Y(BGRX_AVG(s2, s3, 2), BGRX_AVG(s2, s3, 1),
+				     BGRX_AVG(s2, s3, 0));
+	Ytop[1] = RGB_TO_YCbCrJPEG_Y(BGRX_AVG((s2 + 8), (s3 + 8), 2),
+				     BGRX_AVG((s2 + 8), (s3 + 8), 1),
+				     BGRX_AVG((s2 + 8), (s3 + 8), 0));
+	Ybottom[0] = RGB_TO_YCbCrJPEG_Y(BGRX_AVG(s0, s1, 2), BGRX_AVG(s0, s1, 1),
+					BGRX_AVG(s0, s1, 0));
+	Ybottom[1] = RGB_TO_YCbCrJPEG_Y(BGRX_AVG((s0 + 8), (s1 + 8), 2),
+					BGRX_AVG((s0 + 8), (s1 + 8), 1),
+					BGRX_AVG((s0 + 8), (s1 + 8), 0));
+}
+
+#undef BGRX_AVG
+
+/* SSE2 */
+
+static inline __m128i ycbcr_sse2_hadd(__m128i a, __m128i b)
+{
+	__m128 fa = _mm_castsi128_ps(a), fb = _mm_castsi128_ps(b);
+	return _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0))),
+			     _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1))));
+}
+
+/* two pixels per argument as 16 bit BGRX, returns 4 Y' as 32 bit */
+static inline __m128i ycbcr_sse2_y(__m128i a, __m128i b)
+{
+	const __m128i k = _mm_setr_epi16(117, 601, 306, 0, 117, 601, 306, 0);
+	return _mm_srli_epi32(ycbcr_sse2_hadd(_mm_madd_epi16(a, k),
+					      _mm_madd_epi16(b, k)), 10);
+}
+
+/* two pixels per argument as 16 bit BGRX, returns 4 Cb and 4 Cr */
+static inline void ycbcr_sse2_cbcr(__m128i a, __m128i b, __m128i *Cb, __m128i *Cr)
+{
+	const __m128i kb = _mm_setr_epi16(-512, 339, 173, 0, -512, 339, 173, 0);
+	const __m128i kr = _mm_setr_epi16(-83, -429, 512, 0, -83, -429, 512, 0);
+	const __m128i c128 = _mm_set1_epi32(128);
+
+	*Cb = _mm_sub_epi32(c128, _mm_srai_epi32(ycbcr_sse2_hadd(_mm_madd_epi16(a, kb),
+								 _mm_madd_epi16(b, kb)), 10));
+	*Cr = _mm_add_epi32(c128, _mm_srai_epi32(ycbcr_sse2_hadd(_mm_madd_epi16(a, kr),
+								 _mm_madd_epi16(b, kr)), 10));
+}
+
+/* [p0, p1] + [p2, p3] 16 bit BGRX pixel pairs into [p0 + p1, p2 + p3] */
+static inline __m128i ycbcr_sse2_pairs(__m128i a, __m128i b)
+{
+	return _mm_add_epi16(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b));
+}
+
+/* 8 32 bit values into 8 bytes with unsigned char truncation */
+static inline __m128i ycbcr_sse2_bytes(__m128i a, __m128i b)
+{
+	__m128i v = _mm_and_si128(_mm_packs_epi32(a, b), _mm_set1_epi16(0xff));
+	return _mm_packus_epi16(v, v);
+}
+
+static inline void ycbcr_store32(unsigned char *to, __m128i v)
+{
+	int i = _mm_cvtsi128_si32(v);
+	memcpy(to, &i, sizeof(i));
+}
+
+static void ycbcr_row_sse2(const unsigned char *top, const unsigned char *bottom,
+			   unsigned int n, unsigned char *Ytop, unsigned char *Ybottom,
+			   unsigned char *Cb, unsigned char *Cr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i t0, t1, b0, b1, tl0, th0, tl1, th1, bl0, bh0, bl1, bh1;
+	__m128i c0, c1, vCb, vCr;
+	unsigned int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		t0 = _mm_loadu_si128((const __m128i *) &top[i * 8]);
+		t1 = _mm_loadu_si128((const __m128i *) &top[i * 8 + 16]);
+		b0 = _mm_loadu_si128((const __m128i *) &bottom[i * 8]);
+		b1 = _mm_loadu_si128((const __m128i *) &bottom[i * 8 + 16]);
+
+		tl0 = _mm_unpacklo_epi8(t0, zero);
+		th0 = _mm_unpackhi_epi8(t0, zero);
+		tl1 = _mm_unpacklo_epi8(t1, zero);
+		th1 = _mm_unpackhi_epi8(t1, zero);
+		bl0 = _mm_unpacklo_epi8(b0, zero);
+		bh0 = _mm_unpackhi_epi8(b0, zero);
+		bl1 = _mm_unpacklo_epi8(b1, zero);
+		bh1 = _mm_unpackhi_epi8(b1, zero);
+
+		_mm_storel_epi64((__m128i *) &Ytop[i * 2],
+				 ycbcr_sse2_bytes(ycbcr_sse2_y(tl0, th0), ycbcr_sse2_y(tl1, th1)));
+		_mm_storel_epi64((__m128i *) &Ybottom[i * 2],
+				 ycbcr_sse2_bytes(ycbcr_sse2_y(bl0, bh0), ycbcr_sse2_y(bl1, bh1)));
+
+		c0 = _mm_srli_epi16(ycbcr_sse2_pairs(_mm_add_epi16(tl0, bl0),
+						     _mm_add_epi16(th0, bh0)), 2);
+		c1 = _mm_srli_epi16(ycbcr_sse2_pairs(_mm_add_epi16(tl1, bl1),
+						     _mm_add_epi16(th1, bh1)), 2);
+		ycbcr_sse2_cbcr(c0, c1, &vCb, &vCr);
+		c0 = ycbcr_sse2_bytes(vCb, vCr);
+		ycbcr_store32(&Cb[i], c0);
+		ycbcr_store32(&Cr[i], _mm_srli_si128(c0, 4));
+	}
+
+	for (; i < n; i++)
+		ycbcr_block_bgrx(&top[i * 8], &bottom[i * 8], &Ytop[i * 2], &Ybottom[i * 2],
+				 &Cb[i], &Cr[i]);
+}
+
+static void ycbcr_half_row_sse2(const unsigned char *src[4], unsigned int n,
+				unsigned char *Ytop, unsigned char *Ybottom,
+				unsigned char *Cb, unsigned char *Cr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i l[4][4], h[4][4], a[4], c[4], v, vCb, vCr;
+	unsigned int i, j, r;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		for (r = 0; r < 4; r++) {
+			for (j = 0; j < 4; j++) {
+				v = _mm_loadu_si128((const __m128i *) &src[r][i * 16 + j * 16]);
+				l[r][j] = _mm_unpacklo_epi8(v, zero);
+				h[r][j] = _mm_unpackhi_epi8(v, zero);
+			}
+		}
+
+		/* upper Y' row from source rows 2 and 3 */
+		for (j = 0; j < 4; j++)
+			a[j] = _mm_srli_epi16(ycbcr_sse2_pairs(_mm_add_epi16(l[2][j], l[3][j]),
+							       _mm_add_epi16(h[2][j], h[3][j])), 2);
+		v = ycbcr_sse2_bytes(ycbcr_sse2_y(a[0], a[1]), ycbcr_sse2_y(a[2], a[3]));
+		_mm_storel_epi64((__m128i *) &Ytop[i * 2], v);
+
+		for (j = 0; j < 4; j++)
+			a[j] = _mm_srli_epi16(ycbcr_sse2_pairs(_mm_add_epi16(l[0][j], l[1][j]),
+							       _mm_add_epi16(h[0][j], h[1][j])), 2);
+		v = ycbcr_sse2_bytes(ycbcr_sse2_y(a[0], a[1]), ycbcr_sse2_y(a[2], a[3]));
+		_mm_storel_epi64((__m128i *) &Ybottom[i * 2], v);
+
+		/* CbCr from the center 2x2 pixels of rows 1 and 2 */
+		for (j = 0; j < 4; j++)
+			c[j] = _mm_add_epi16(_mm_srli_si128(_mm_add_epi16(l[1][j], l[2][j]), 8),
+					     _mm_add_epi16(h[1][j], h[2][j]));
+		ycbcr_sse2_cbcr(_mm_srli_epi16(_mm_unpacklo_epi64(c[0], c[1]), 2),
+				_mm_srli_epi16(_mm_unpacklo_epi64(c[2], c[3]), 2),
+				&vCb, &vCr);
+		v = ycbcr_sse2_bytes(vCb, vCr);
+		ycbcr_store32(&Cb[i], v);
+		ycbcr_store32(&Cr[i], _mm_srli_si128(v, 4));
+	}
+
+	for (; i < n; i++)
+		ycbcr_half_block_bgrx(src, i * 16, &Ytop[i * 2], &Ybottom[i * 2],
+				      &Cb[i], &Cr[i]);
+}
+
+static void ycbcr_vertical_sse2(const unsigned char *a, const unsigned char *b,
+				unsigned int f, unsigned int n, short *to)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i fa = _mm_set1_epi16(YCBCR_SCALE_ONE - f);
+	const __m128i fb = _mm_set1_epi16(f);
+	__m128i va, vb;
+	unsigned int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		va = _mm_loadu_si128((const __m128i *) &a[i]);
+		vb = _mm_loadu_si128((const __m128i *) &b[i]);
+		_mm_storeu_si128((__m128i *) &to[i],
+				 _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), fa),
+					       _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), fb)));
+		_mm_storeu_si128((__m128i *) &to[i + 8],
+				 _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), fa),
+					       _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), fb)));
+	}
+
+	ycbcr_vertical_c(&a[i], &b[i], f, n - i, &to[i]);
+}
+
+/* both taps of a pixel interleaved per channel, one pmaddwd per pixel */
+static inline __m128i ycbcr_sse2_lerp(const short *p, unsigned int bpp, __m128i w)
+{
+	return _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(
+		_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *) p),
+				   _mm_loadl_epi64((const __m128i *) &p[bpp])), w),
+		_mm_set1_epi32(YCBCR_SCALE_ROUND)), 2 * YCBCR_SCALE_BITS);
+}
+
+static void ycbcr_horizontal_sse2(const short *from, unsigned int bpp,
+				  const unsigned int *pos, const unsigned char *factor,
+				  unsigned int n, unsigned char *to)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i f, w, s0, s1, s2, s3;
+	unsigned int i, fi;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		/* (f << 16) | (YCBCR_SCALE_ONE - f) for 4 pixels */
+		memcpy(&fi, &factor[i], sizeof(fi));
+		f = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(fi), zero), zero);
+		w = _mm_or_si128(_mm_slli_epi32(f, 16),
+				 _mm_sub_epi32(_mm_set1_epi32(YCBCR_SCALE_ONE), f));
+
+		s0 = ycbcr_sse2_lerp(&from[pos[i] * bpp], bpp, _mm_shuffle_epi32(w, 0x00));
+		s1 = ycbcr_sse2_lerp(&from[pos[i + 1] * bpp], bpp, _mm_shuffle_epi32(w, 0x55));
+		s2 = ycbcr_sse2_lerp(&from[pos[i + 2] * bpp], bpp, _mm_shuffle_epi32(w, 0xaa));
+		s3 = ycbcr_sse2_lerp(&from[pos[i + 3] * bpp], bpp, _mm_shuffle_epi32(w, 0xff));
+		_mm_storeu_si128((__m128i *) &to[i * 4],
+				 _mm_and_si128(_mm_packus_epi16(_mm_packs_epi32(s0, s1),
+								_mm_packs_epi32(s2, s3)),
+					       _mm_set1_epi32(0x00ffffff)));
+	}
+
+	ycbcr_horizontal_c(from, bpp, &pos[i], &factor[i], n - i, &to[i * 4]);
+}
+
+/* SSSE3 */
+
+__attribute__((target("ssse3")))
+static void ycbcr_expand_ssse3(const unsigned char *from, unsigned char *to, unsigned int n)
+{
+	const __m128i mask = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+					   6, 7, 8, -1, 9, 10, 11, -1);
+	unsigned int i;
+
+	/* 16 byte loads, stay clear of the end of the row */
+	for (i = 0; i + 6 <= n; i += 4)
+		_mm_storeu_si128((__m128i *) &to[i * 4],
+				 _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) &from[i * 3]),
+						  mask));
+
+	ycbcr_expand_c(&from[i * 3], &to[i * 4], n - i);
+}
+
+/* AVX2 */
+
+/* undo the lane interleaving of in-lane horizontal adds */
+__attribute__((target("avx2")))
+static inline __m256i ycbcr_avx2_order(__m256i v)
+{
+	return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i ycbcr_avx2_hadd(__m256i a, __m256i b)
+{
+	__m256 fa = _mm256_castsi256_ps(a), fb = _mm256_castsi256_ps(b);
+	return _mm256_add_epi32(_mm256_castps_si256(_mm256_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0))),
+				_mm256_castps_si256(_mm256_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1))));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i ycbcr_avx2_y(__m256i a, __m256i b)
+{
+	const __m256i k = _mm256_setr_epi16(117, 601, 306, 0, 117, 601, 306, 0,
+					    117, 601, 306, 0, 117, 601, 306, 0);
+	return _mm256_srli_epi32(ycbcr_avx2_hadd(_mm256_madd_epi16(a, k),
+						 _mm256_madd_epi16(b, k)), 10);
+}
+
+__attribute__((target("avx2")))
+static inline void ycbcr_avx2_cbcr(__m256i a, __m256i b, __m256i *Cb, __m256i *Cr)
+{
+	const __m256i kb = _mm256_setr_epi16(-512, 339, 173, 0, -512, 339, 173, 0,
+					     -512, 339, 173, 0, -512, 339, 173, 0);
+	const __m256i kr = _mm256_setr_epi16(-83, -429, 512, 0, -83, -429, 512, 0,
+					     -83, -429, 512, 0, -83, -429, 512, 0);
+	const __m256i c128 = _mm256_set1_epi32(128);
+
+	*Cb = _mm256_sub_epi32(c128, _mm256_srai_epi32(ycbcr_avx2_hadd(_mm256_madd_epi16(a, kb),
+									_mm256_madd_epi16(b, kb)), 10));
+	*Cr = _mm256_add_epi32(c128, _mm256_srai_epi32(ycbcr_avx2_hadd(_mm256_madd_epi16(a, kr),
+									_mm256_madd_epi16(b, kr)), 10));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i ycbcr_avx2_pairs(__m256i a, __m256i b)
+{
+	return _mm256_add_epi16(_mm256_unpacklo_epi64(a, b), _mm256_unpackhi_epi64(a, b));
+}
+
+/* 2 x 8 32 bit values into 16 bytes with unsigned char truncation */
+__attribute__((target("avx2")))
+static inline __m128i ycbcr_avx2_bytes(__m256i a, __m256i b)
+{
+	__m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+	v = _mm256_and_si256(v, _mm256_set1_epi16(0xff));
+	return _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+}
+
+__attribute__((target("avx2")))
+static void ycbcr_row_avx2(const unsigned char *top, const unsigned char *bottom,
+			   unsigned int n, unsigned char *Ytop, unsigned char *Ybottom,
+			   unsigned char *Cb, unsigned char *Cr)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i t0, t1, b0, b1, tl0, th0, tl1, th1, bl0, bh0, bl1, bh1;
+	__m256i c0, c1, vCb, vCr;
+	__m128i v;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		t0 = _mm256_loadu_si256((const __m256i *) &top[i * 8]);
+		t1 = _mm256_loadu_si256((const __m256i *) &top[i * 8 + 32]);
+		b0 = _mm256_loadu_si256((const __m256i *) &bottom[i * 8]);
+		b1 = _mm256_loadu_si256((const __m256i *) &bottom[i * 8 + 32]);
+
+		tl0 = _mm256_unpacklo_epi8(t0, zero);
+		th0 = _mm256_unpackhi_epi8(t0, zero);
+		tl1 = _mm256_unpacklo_epi8(t1, zero);
+		th1 = _mm256_unpackhi_epi8(t1, zero);
+		bl0 = _mm256_unpacklo_epi8(b0, zero);
+		bh0 = _mm256_unpackhi_epi8(b0, zero);
+		bl1 = _mm256_unpacklo_epi8(b1, zero);
+		bh1 = _mm256_unpackhi_epi8(b1, zero);
+
+		/* unpack + in-lane hadd keeps Y' in order */
+		_mm_storeu_si128((__m128i *) &Ytop[i * 2],
+				 ycbcr_avx2_bytes(ycbcr_avx2_y(tl0, th0), ycbcr_avx2_y(tl1, th1)));
+		_mm_storeu_si128((__m128i *) &Ybottom[i * 2],
+				 ycbcr_avx2_bytes(ycbcr_avx2_y(bl0, bh0), ycbcr_avx2_y(bl1, bh1)));
+
+		c0 = _mm256_srli_epi16(ycbcr_avx2_pairs(_mm256_add_epi16(tl0, bl0),
+							_mm256_add_epi16(th0, bh0)), 2);
+		c1 = _mm256_srli_epi16(ycbcr_avx2_pairs(_mm256_add_epi16(tl1, bl1),
+							_mm256_add_epi16(th1, bh1)), 2);
+		ycbcr_avx2_cbcr(c0, c1, &vCb, &vCr);
+		v = ycbcr_avx2_bytes(ycbcr_avx2_order(vCb), ycbcr_avx2_order(vCr));
+		_mm_storel_epi64((__m128i *) &Cb[i], v);
+		_mm_storel_epi64((__m128i *) &Cr[i], _mm_srli_si128(v, 8));
+	}
+
+	ycbcr_row_sse2(&top[i * 8], &bottom[i * 8], n - i,
+		       &Ytop[i * 2], &Ybottom[i * 2], &Cb[i], &Cr[i]);
+}
+
+__attribute__((target("avx2")))
+static void ycbcr_half_row_avx2(const unsigned char *src[4], unsigned int n,
+				unsigned char *Ytop, unsigned char *Ybottom,
+				unsigned char *Cb, unsigned char *Cr)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i l[4][4], h[4][4], a[4], c[4], v, vCb, vCr;
+	const unsigned char *rest[4];
+	__m128i b;
+	unsigned int i, j, r;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		for (r = 0; r < 4; r++) {
+			for (j = 0; j < 4; j++) {
+				v = _mm256_loadu_si256((const __m256i *) &src[r][i * 16 + j * 32]);
+				l[r][j] = _mm256_unpacklo_epi8(v, zero);
+				h[r][j] = _mm256_unpackhi_epi8(v, zero);
+			}
+		}
+
+		for (j = 0; j < 4; j++)
+			a[j] = _mm256_srli_epi16(ycbcr_avx2_pairs(_mm256_add_epi16(l[2][j], l[3][j]),
+								  _mm256_add_epi16(h[2][j], h[3][j])), 2);
+		b = ycbcr_avx2_bytes(ycbcr_avx2_order(ycbcr_avx2_y(a[0], a[1])),
+				     ycbcr_avx2_order(ycbcr_avx2_y(a[2], a[3])));
+		_mm_storeu_si128((__m128i *) &Ytop[i * 2], b);
+
+		for (j = 0; j < 4; j++)
+			a[j] = _mm256_srli_epi16(ycbcr_avx2_pairs(_mm256_add_epi16(l[0][j], l[1][j]),
+								  _mm256_add_epi16(h[0][j], h[1][j])), 2);
+		b = ycbcr_avx2_bytes(ycbcr_avx2_order(ycbcr_avx2_y(a[0], a[1])),
+				     ycbcr_avx2_order(ycbcr_avx2_y(a[2], a[3])));
+		_mm_storeu_si128((__m128i *) &Ybottom[i * 2], b);
+
+		for (j = 0; j < 4; j++)
+			c[j] = _mm256_add_epi16(_mm256_srli_si256(_mm256_add_epi16(l[1][j], l[2][j]), 8),
+						_mm256_add_epi16(h[1][j], h[2][j]));
+		ycbcr_avx2_cbcr(_mm256_srli_epi16(_mm256_unpacklo_epi64(c[0], c[1]), 2),
+				_mm256_srli_epi16(_mm256_unpacklo_epi64(c[2], c[3]), 2),
+				&vCb, &vCr);
+		/* even blocks came out in the low lane, odd ones in the high lane */
+		v = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+		b = ycbcr_avx2_bytes(_mm256_permutevar8x32_epi32(vCb, v),
+				     _mm256_permutevar8x32_epi32(vCr, v));
+		_mm_storel_epi64((__m128i *) &Cb[i], b);
+		_mm_storel_epi64((__m128i *) &Cr[i], _mm_srli_si128(b, 8));
+	}
+
+	for (r = 0; r < 4; r++)
+		rest[r] = &src[r][i * 16];
+	ycbcr_half_row_sse2(rest, n - i, &Ytop[i * 2], &Ybottom[i * 2], &Cb[i], &Cr[i]);
+}
+
+/* pixels p0 and p1 in the low and high lane */
+__attribute__((target("avx2")))
+static inline __m256i ycbcr_avx2_lerp(const short *p0, const short *p1,
+				      unsigned int bpp, __m256i w)
+{
+	__m256i p, q;
+
+	p = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i *) p0)),
+				    _mm_loadl_epi64((const __m128i *) p1), 1);
+	q = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i *) &p0[bpp])),
+				    _mm_loadl_epi64((const __m128i *) &p1[bpp]), 1);
+
+	return _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(p, q), w),
+						  _mm256_set1_epi32(YCBCR_SCALE_ROUND)),
+				 2 * YCBCR_SCALE_BITS);
+}
+
+/* lanes hold pixels i..i+3 and i+4..i+7, in-lane packs keep them in order */
+__attribute__((target("avx2")))
+static void ycbcr_horizontal_avx2(const short *from, unsigned int bpp,
+				  const unsigned int *pos, const unsigned char *factor,
+				  unsigned int n, unsigned char *to)
+{
+	__m256i f, w, s0, s1, s2, s3;
+	long long fi;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		memcpy(&fi, &factor[i], sizeof(fi));
+		f = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(fi));
+		w = _mm256_or_si256(_mm256_slli_epi32(f, 16),
+				    _mm256_sub_epi32(_mm256_set1_epi32(YCBCR_SCALE_ONE), f));
+
+#define YCBCR_AVX2_LERP(j) \
+	ycbcr_avx2_lerp(&from[pos[i + (j)] * bpp], &from[pos[i + (j) + 4] * bpp], bpp, \
+			_mm256_permutevar8x32_epi32(w, _mm256_setr_epi32((j), (j), (j), (j), \
+			(j) + 4, (j) + 4, (j) + 4, (j) + 4)))
+		s0 = YCBCR_AVX2_LERP(0);
+		s1 = YCBCR_AVX2_LERP(1);
+		s2 = YCBCR_AVX2_LERP(2);
+		s3 = YCBCR_AVX2_LERP(3);
+#undef YCBCR_AVX2_LERP
+
+		_mm256_storeu_si256((__m256i *) &to[i * 4],
+				    _mm256_and_si256(_mm256_packus_epi16(_mm256_packs_epi32(s0, s1),
+									 _mm256_packs_epi32(s2, s3)),
+						     _mm256_set1_epi32(0x00ffffff)));
+	}
+
+	ycbcr_horizontal_sse2(from, bpp, &pos[i], &factor[i], n - i, &to[i * 4]);
+}
+
+__attribute__((target("avx2")))
+static void ycbcr_vertical_avx2(const unsigned char *a, const unsigned char *b,
+				unsigned int f, unsigned int n, short *to)
+{
+	const __m256i fa = _mm256_set1_epi16(YCBCR_SCALE_ONE - f);
+	const __m256i fb = _mm256_set1_epi16(f);
+	unsigned int i;
+
+	for (i = 0; i + 16 <= n; i += 16)
+		_mm256_storeu_si256((__m256i *) &to[i],
+				    _mm256_add_epi16(
+					_mm256_mullo_epi16(_mm256_cvtepu8_epi16(
+						_mm_loadu_si128((const __m128i *) &a[i])), fa),
+					_mm256_mullo_epi16(_mm256_cvtepu8_epi16(
+						_mm_loadu_si128((const __m128i *) &b[i])), fb)));
+
+	ycbcr_vertical_c(&a[i], &b[i], f, n - i, &to[i]);
+}
+
+static const struct ycbcr_kernels_s ycbcr_kernels[] = {
+	{"avx2", GLC_SIMD_AVX2, &ycbcr_expand_ssse3, &ycbcr_row_avx2,
+	 &ycbcr_half_row_avx2, &ycbcr_vertical_avx2, &ycbcr_horizontal_avx2},
+	{"ssse3", GLC_SIMD_SSSE3, &ycbcr_expand_ssse3, &ycbcr_row_sse2,
+	 &ycbcr_half_row_sse2, &ycbcr_vertical_sse2, &ycbcr_horizontal_sse2},
+	{"sse2", GLC_SIMD_SSE2, &ycbcr_expand_c, &ycbcr_row_sse2,
+	 &ycbcr_half_row_sse2, &ycbcr_vertical_sse2, &ycbcr_horizontal_sse2},
+	{NULL, 0, NULL, NULL, NULL, NULL, NULL}
+};
+
+#else
+
+static const struct ycbcr_kernels_s ycbcr_kernels[] = {
+	{NULL, 0, NULL, NULL, NULL, NULL, NULL}
+};
+
+#endif
+
+/* self-test frame, odd width leaves every tail */
+#define YCBCR_TEST_W (2 * YCBCR_SIMD_CHUNK + 54)
+#define YCBCR_TEST_H 38
+
+void ycbcr_select_kernels(ycbcr_t ycbcr)
+{
+	/* NULL selects the scalar converters */
+	ycbcr->kernels = glc_simd_select(ycbcr->glc, "ycbcr", ycbcr_kernels,
+					 sizeof(struct ycbcr_kernels_s), NULL,
+					 &ycbcr_test_kernels, ycbcr,
+					 (YCBCR_TEST_W * 4 + 8) * YCBCR_TEST_H,
+					 YCBCR_TEST_W * YCBCR_TEST_H * 2);
+}
+
+/**
+ * Self-test: convert a synthetic frame with both the scalar and the
+ * given kernels. Odd sizes exercise the scalar tails, row padding and
+ * saturated colors the Cb wrap-around.
+ */
+int ycbcr_test_kernels(void *ptr, const void *kernels, glc_simd_test_t *test)
+{
+	static const double scales[] = {1.0, 0.5, 0.7};
+	ycbcr_t ycbcr = ptr;
+	const struct ycbcr_kernels_s *saved = ycbcr->kernels;
+	struct ycbcr_video_stream_s video;
+	unsigned char *from = test->from, *ref = test->ref, *out = test->out;
+	unsigned int bpp, s;
+	int ret = 0;
+
+	memset(&video, 0, sizeof(video));
+	video.w = YCBCR_TEST_W;
+	video.h = YCBCR_TEST_H;
+
+	/* simd converters use ycbcr->kernels */
+	ycbcr->kernels = kernels;
+	for (bpp = 3; bpp <= 4 && !ret; bpp++) {
+		video.bpp = bpp;
+		video.row = video.w * bpp;
+		if (video.row % 8 != 0)
+			video.row += 8 - video.row % 8;
+
+		for (s = 0; s < sizeof(scales) / sizeof(scales[0]) && !ret; s++) {
+			video.scale = scales[s];
+			video.yw = video.w * video.scale;
+			video.yh = video.h * video.scale;
+			video.yw -= video.yw % 2;
+			video.yh -= video.yh % 2;
+			video.cw = video.yw / 2;
+			video.ch = video.yh / 2;
+			video.size = video.yw * video.yh + 2 * (video.cw * video.ch);
+
+			memset(ref, 0, video.size);
+			memset(out, 0xaa, video.size);
+
+			if (video.scale == 1.0) {
+				ycbcr_bgr_to_jpeg420(ycbcr, &video, from, ref, NULL,
+						     0, video.yh / 2);
+				ycbcr_bgr_to_jpeg420_simd(ycbcr, &video, from, out, NULL,
+							  0, video.yh / 2);
+			} else if (video.scale == 0.5) {
+				ycbcr_bgr_to_jpeg420_half(ycbcr, &video, from, ref, NULL,
+							  0, video.yh / 2);
+				ycbcr_bgr_to_jpeg420_half_simd(ycbcr, &video, from, out, NULL,
+							       0, video.yh / 2);
+			} else {
+				video.blend_size = video.w * bpp + YCBCR_SCALE_PAD;
+				if (unlikely((ret = ycbcr_generate_map(ycbcr, &video))))
+					break;
+				ycbcr_bgr_to_jpeg420_scale(ycbcr, &video, from, ref,
+							   video.blend[0].buf, 0, video.yh / 2);
+				ycbcr_bgr_to_jpeg420_scale_simd(ycbcr, &video, from, out,
+								video.blend[0].buf, 0, video.yh / 2);
+			}
+
+			ret = glc_simd_test_compare(test, ref, out, video.size);
+		}
+	}
+
+	ycbcr->kernels = saved;
+	free(video.xpos);
+	free(video.ypos);
+	free(video.xfactor);
+	free(video.yfactor);
+	ycbcr_blend_free(&video);
+	return ret;
 }
 
 int ycbcr_video_format_message(ycbcr_t ycbcr, glc_video_format_message_t *video_format)
 {
 	struct ycbcr_video_stream_s *video;
+	int ret = 0;
 
 	ycbcr_get_video_stream(ycbcr, video_format->id, &video);
 	pthread_rwlock_wrlock(&video->update);
@@ -451,6 +1471,7 @@ int ycbcr_video_format_message(ycbcr_t ycbcr, glc_video_format_message_t *video_
 	video->h = video_format->height;
 
 	video->row = video->w * video->bpp;
+	video->blend_size = 0;
 
 	if (video_format->flags & GLC_VIDEO_DWORD_ALIGNED) {
 		if (video->row % 8 != 0)
@@ -466,138 +1487,161 @@ int ycbcr_video_format_message(ycbcr_t ycbcr, glc_video_format_message_t *video_
 	video->cw = video->yw / 2;
 	video->ch = video->yh / 2;
 
-	/* nuke old flags */
-	video_format->flags &= ~GLC_VIDEO_DWORD_ALIGNED;
-	video_format->format = GLC_VIDEO_YCBCR_420JPEG;
-	video_format->width = video->yw;
-	video_format->height = video->yh;
-
 	if (video->scale == 1.0)
-		video->convert = &ycbcr_bgr_to_jpeg420;
+		video->convert = ycbcr->kernels ? &ycbcr_bgr_to_jpeg420_simd
+						: &ycbcr_bgr_to_jpeg420;
 	else if (video->scale == 0.5) {
 		glc_log(ycbcr->glc, GLC_DEBUG, "ycbcr",
 			 "scaling to half-size (from %ux%u to %ux%u)",
 			 video->w, video->h, video->yw, video->yh);
-		video->convert = &ycbcr_bgr_to_jpeg420_half;
+		video->convert = ycbcr->kernels ? &ycbcr_bgr_to_jpeg420_half_simd
+						: &ycbcr_bgr_to_jpeg420_half;
 	} else {
 		glc_log(ycbcr->glc, GLC_DEBUG, "ycbcr",
 			 "scaling with factor %f (from %ux%u to %ux%u)",
 			 video->scale, video->w, video->h, video->yw, video->yh);
-		video->convert = &ycbcr_bgr_to_jpeg420_scale;
-		ycbcr_generate_map(ycbcr, video);
+		video->convert = ycbcr->kernels ? &ycbcr_bgr_to_jpeg420_scale_simd
+						: &ycbcr_bgr_to_jpeg420_scale;
+		video->blend_size = video->w * video->bpp + YCBCR_SCALE_PAD;
+		if (unlikely((ret = ycbcr_generate_map(ycbcr, video))))
+			video->convert = NULL;
 	}
 
 	video->size = video->yw * video->yh + 2 * (video->cw * video->ch);
 
+	/* frames without a map are passed through unconverted */
+	if (likely(video->convert)) {
+		/* nuke old flags */
+		video_format->flags &= ~GLC_VIDEO_DWORD_ALIGNED;
+		video_format->format = GLC_VIDEO_YCBCR_420JPEG;
+		video_format->width = video->yw;
+		video_format->height = video->yh;
+	}
+
 	pthread_rwlock_unlock(&video->update);
-	return 0;
+	return ret;
 }
 
 /**
- * \todo smaller map is sometimes possible, should inflict better
- *       cache utilization => implement
+ * Tables are per axis, O(yw + yh) instead of one entry per output
+ * sample. Row taps are stored as bottom-up frame rows.
  */
 int ycbcr_generate_map(ycbcr_t ycbcr, struct ycbcr_video_stream_s *video)
 {
-	size_t scale_maps_size;
-	unsigned int tp, x, y, r;
-	float d, ofx, ofy, fx0, fx1, fy0, fy1;
+	unsigned int *xpos, *ypos;
+	unsigned char *xfactor, *yfactor;
+	unsigned int y, w, count;
+	int ret = 0;
+
+	glc_log(ycbcr->glc, GLC_DEBUG, "ycbcr", "generating %zd byte scale map for video %d",
+		 (video->yw + video->yh) * (sizeof(unsigned int) + sizeof(unsigned char)),
+		 video->id);
+
+	/* old tables stay in place until all new ones are allocated */
+	xpos = (unsigned int *) malloc(sizeof(unsigned int) * video->yw);
+	ypos = (unsigned int *) malloc(sizeof(unsigned int) * video->yh);
+	xfactor = (unsigned char *) malloc(video->yw);
+	yfactor = (unsigned char *) malloc(video->yh);
+	if (unlikely((!xpos) || (!ypos) || (!xfactor) || (!yfactor))) {
+		free(xpos);
+		free(ypos);
+		free(xfactor);
+		free(yfactor);
+		return ENOMEM;
+	}
 
-	scale_maps_size = video->yw * video->yh * 4 + video->cw * video->ch * 4;
-	glc_log(ycbcr->glc, GLC_DEBUG, "ycbcr", "generating %zd + %zd byte scale map for video %d",
-		 scale_maps_size * sizeof(unsigned int), scale_maps_size * sizeof(float), video->id);
+	/* one row for ycbcr_convert_frame() callers and one per band worker */
+	count = ycbcr->bands ? glc_frame_threads(ycbcr->glc) : 1;
+	if (video->blend_count != count) {
+		ycbcr_blend_free(video);
+		if (unlikely(!(video->blend = (struct ycbcr_blend_s *)
+			       calloc(count, sizeof(struct ycbcr_blend_s)))))
+			ret = ENOMEM;
+		else
+			video->blend_count = count;
+	}
+	for (w = 0; (!ret) && (w < video->blend_count); w++)
+		ret = ycbcr_blend_reserve(&video->blend[w], video->blend_size);
+	if (unlikely(ret)) {
+		free(xpos);
+		free(ypos);
+		free(xfactor);
+		free(yfactor);
+		return ret;
+	}
 
-	if (video->pos)
-		video->pos = (unsigned int *) realloc(video->pos, sizeof(unsigned int) * scale_maps_size);
-	else
-		video->pos = (unsigned int *) malloc(sizeof(unsigned int) * scale_maps_size);
+	free(video->xpos);
+	free(video->ypos);
+	free(video->xfactor);
+	free(video->yfactor);
+	video->xpos = xpos;
+	video->ypos = ypos;
+	video->xfactor = xfactor;
+	video->yfactor = yfactor;
 
-	if (video->factor)
-		video->factor = (float *) realloc(video->factor, sizeof(float) * scale_maps_size);
-	else
-		video->factor = (float *) malloc(sizeof(float) * scale_maps_size);
-
-	/* Y' */
-	/* NEVER trust CPU with fp mathematics :/ */
-	r = 0;
-	do {
-		d = (float) (video->w - r++) / (float) video->yw;
-		glc_log(ycbcr->glc, GLC_DEBUG, "ycbcr", "Y: d = %f", d);
-	} while ((d * (float) (video->yh - 1) + 1.0 > video->h) |
-		 (d * (float) (video->yw - 1) + 1.0 > video->w));
-
-	ofx = ofy = 0;
-
-	for (y = 0; y < video->yh; y++) {
-		for (x = 0; x < video->yw; x++) {
-			tp = (x + y * video->yw) * 4;
-
-			video->pos[tp + 0] = ((unsigned int) ofx + 0) * video->bpp +
-			                   (video->h - 1 - (unsigned int) ofy) * video->row;
-			video->pos[tp + 1] = ((unsigned int) ofx + 1) * video->bpp +
-			                   (video->h - 1 - (unsigned int) ofy) * video->row;
-			video->pos[tp + 2] = ((unsigned int) ofx + 0) * video->bpp +
-			                   (video->h - 2 - (unsigned int) ofy) * video->row;
-			video->pos[tp + 3] = ((unsigned int) ofx + 1) * video->bpp +
-			                   (video->h - 2 - (unsigned int) ofy) * video->row;
-
-			fx1 = (float) x * d - (float) ((unsigned int) ofx);
-			fx0 = 1.0 - fx1;
-			fy1 = (float) y * d - (float) ((unsigned int) ofy);
-			fy0 = 1.0 - fy1;
-
-			video->factor[tp + 0] = fx0 * fy0;
-			video->factor[tp + 1] = fx1 * fy0;
-			video->factor[tp + 2] = fx0 * fy1;
-			video->factor[tp + 3] = fx1 * fy1;
-
-			ofx += d;
-		}
-		ofy += d;
-		ofx = 0;
-	}
+	ycbcr_generate_axis(video->w, video->yw, video->xpos, video->xfactor);
+	ycbcr_generate_axis(video->h, video->yh, video->ypos, video->yfactor);
+	for (y = 0; y < video->yh; y++)
+		video->ypos[y] = video->h - 1 - video->ypos[y];
 
-	/* CbCr */
-	/* try to match Y */
-	r = (r < 2) ? (0) : (r - 2);
-	do {
-		d = (float) (video->w - r++) / (float) video->cw;
-		glc_log(ycbcr->glc, GLC_DEBUG, "ycbcr", "C: d = %f", d);
-	} while ((d * (float) (video->ch - 1) + 1.0 > video->h) |
-		 (d * (float) (video->cw - 1) + 1.0 > video->w));
-
-	ofx = ofy = 0;
-
-	for (y = 0; y < video->ch; y++) {
-		for (x = 0; x < video->cw; x++) {
-			tp = (video->yw * video->yh * 4) + (x + y * video->cw) * 4;
-
-			video->pos[tp + 0] = ((unsigned int) ofx + 0) * video->bpp +
-			                   (video->h - 1 - (unsigned int) ofy) * video->row;
-			video->pos[tp + 1] = ((unsigned int) ofx + 1) * video->bpp +
-			                   (video->h - 1 - (unsigned int) ofy) * video->row;
-			video->pos[tp + 2] = ((unsigned int) ofx + 0) * video->bpp +
-			                   (video->h - 2 - (unsigned int) ofy) * video->row;
-			video->pos[tp + 3] = ((unsigned int) ofx + 1) * video->bpp +
-			                   (video->h - 2 - (unsigned int) ofy) * video->row;
-
-			fx1 = (float) x * d - (float) ((unsigned int) ofx);
-			fx0 = 1.0 - fx1;
-			fy1 = (float) y * d - (float) ((unsigned int) ofy);
-			fy0 = 1.0 - fy1;
-
-			video->factor[tp + 0] = fx0 * fy0;
-			video->factor[tp + 1] = fx1 * fy0;
-			video->factor[tp + 2] = fx0 * fy1;
-			video->factor[tp + 3] = fx1 * fy1;
-
-			ofx += d;
-		}
-		ofy += d;
-		ofx = 0;
-	}
+	return 0;
+}
 
+int ycbcr_blend_reserve(struct ycbcr_blend_s *blend, size_t size)
+{
+	short *buf;
+
+	if (blend->size >= size)
+		return 0;
+	if (unlikely(!(buf = (short *) calloc(size, sizeof(short)))))
+		return ENOMEM;
+	free(blend->buf);
+	blend->buf = buf;
+	blend->size = size;
 	return 0;
 }
 
+void ycbcr_blend_free(struct ycbcr_video_stream_s *video)
+{
+	unsigned int w;
+
+	for (w = 0; w < video->blend_count; w++)
+		free(video->blend[w].buf);
+	free(video->blend);
+	video->blend = NULL;
+	video->blend_count = 0;
+}
+
+/**
+ * Sample centers are aligned, output sample i reads source samples
+ * pos[i] and pos[i] + 1, the second one weighted by factor[i] out of
+ * YCBCR_SCALE_ONE. Done in integers, NEVER trust CPU with fp
+ * mathematics.
+ */
+void ycbcr_generate_axis(unsigned int n, unsigned int sn,
+			 unsigned int *pos, unsigned char *factor)
+{
+	long long c, max = (long long) (n - 1) * YCBCR_SCALE_ONE;
+	unsigned int i;
+
+	for (i = 0; i < sn; i++) {
+		/* ((i + 0.5) * n / sn - 0.5) * YCBCR_SCALE_ONE rounded */
+		c = ((2 * (long long) i + 1) * n * YCBCR_SCALE_ONE + sn) / (2 * (long long) sn) -
+		    YCBCR_SCALE_ONE / 2;
+		if (c < 0)
+			c = 0;
+		if (c > max)
+			c = max;
+
+		pos[i] = c >> YCBCR_SCALE_BITS;
+		factor[i] = c & (YCBCR_SCALE_ONE - 1);
+		/* last source sample, second tap must stay inside */
+		if ((pos[i] == n - 1) && (n > 1)) {
+			pos[i]--;
+			factor[i] = YCBCR_SCALE_ONE;
+		}
+	}
+}
+
+
 /**  \} */
@@ -69,6 +69,36 @@ __PUBLIC int ycbcr_process_start(ycbcr_t ycbcr, ps_buffer_t *from,
  */
 __PUBLIC int ycbcr_process_wait(ycbcr_t ycbcr);
 
+/**
+ * \brief configure stream for ycbcr_convert_frame()
+ *
+ * Same as passing video format message through ycbcr process,
+ * video_format is updated to describe converted frames. This
+ * allows converting frames in place of a separate ycbcr thread,
+ * directly from captured pixels into destination buffer.
+ * \param ycbcr ycbcr object, must not be running
+ * \param video_format video format message, updated
+ * \param size returned converted frame size, 0 if stream is not
+ *             converted
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int ycbcr_convert_format(ycbcr_t ycbcr,
+				  glc_video_format_message_t *video_format,
+				  size_t *size);
+
+/**
+ * \brief convert one frame in calling thread
+ *
+ * Can be called concurrently for different streams.
+ * \param ycbcr ycbcr object
+ * \param id stream configured with ycbcr_convert_format()
+ * \param from frame data in format given to ycbcr_convert_format()
+ * \param to destination for converted frame
+ * \return 0 on success otherwise an error code
+ */
+__PUBLIC int ycbcr_convert_frame(ycbcr_t ycbcr, glc_stream_id_t id,
+				 const unsigned char *from, unsigned char *to);
+
 /**
  * \brief destroy ycbcr object
  * \param ycbcr ycbcr object to destroy
@@ -104,6 +104,7 @@ int img_init(img_t *img, glc_t *glc)
 	(*img)->thread.read_callback = &img_read_callback;
 	(*img)->thread.finish_callback = &img_finish_callback;
 	(*img)->thread.threads = 1;
+	(*img)->thread.name = "img";
 
 	return 0;
 }
@@ -91,6 +91,7 @@ int yuv4mpeg_init(yuv4mpeg_t *yuv4mpeg, glc_t *glc)
 	(*yuv4mpeg)->thread.read_callback = &yuv4mpeg_read_callback;
 	(*yuv4mpeg)->thread.finish_callback = &yuv4mpeg_finish_callback;
 	(*yuv4mpeg)->thread.threads = 1;
+	(*yuv4mpeg)->thread.name = "yuv4mpeg";
 
 	return 0;
 }
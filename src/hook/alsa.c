@@ -94,7 +94,7 @@ int alsa_init(glc_t *glc)
 		if (unlikely((ret = alsa_hook_init(&alsa.alsa_hook, alsa.glc))))
 			return ret;
 
-		alsa_hook_allow_skip(alsa.alsa_hook, 0);
+		alsa_hook_allow_skip(alsa.alsa_hook, 1);
 		if ((env_var = getenv("GLC_AUDIO_SKIP")))
 			alsa_hook_allow_skip(alsa.alsa_hook, atoi(env_var));
 	}
@@ -43,9 +43,11 @@
 #include <glc/common/core.h>
 #include <glc/common/log.h>
 #include <glc/common/util.h>
+#include <glc/common/metrics.h>
 #include <glc/common/state.h>
 #include <glc/core/pack.h>
 #include <glc/core/file.h>
+#include <glc/core/batch.h>
 #include <glc/core/pipe.h>
 
 #include "lib.h"
@@ -58,6 +60,13 @@
 #define MAIN_SYNC                 0x20
 #define MAIN_COMPRESS_LZJB        0x40
 #define MAIN_START                0x80
+#define MAIN_PIPE_SPLICE         0x100
+#define MAIN_FILE_BATCH          0x200
+#define MAIN_FILE_DIRECT         0x400
+#define MAIN_COMPRESS_LZ4        0x800
+#define MAIN_COMPRESS_ZSTD      0x1000
+#define MAIN_COMPRESS_ADAPTIVE  0x2000
+#define MAIN_PERF               0x4000
 
 #define SINK_CB_RELOAD_ARG         (void *)0x1
 #define SINK_CB_STOP_ARG           (void *)0x2
@@ -75,6 +84,9 @@ struct main_private_s {
 
 	unsigned int capture_id;
 	unsigned pipe_delay_ms;
+	unsigned pipe_shm_frames;
+	int compress_level;
+	unsigned int keyframe_interval;
 	const char *pipe_exec_file;
 	const char *stream_file_fmt;
 	char *stream_file;
@@ -161,6 +173,8 @@ int load_environ()
 {
 	char *log_file;
 	char *env_val;
+	double perf_interval = 0.0;
+	int ret;
 
 	if ((env_val = getenv("GLC_START"))) {
 		if (atoi(env_val))
@@ -189,6 +203,15 @@ int load_environ()
 			mpriv.flags |= MAIN_SYNC;
 	}
 
+	if ((env_val = getenv("GLC_FILE_BATCH"))) {
+		if (atoi(env_val))
+			mpriv.flags |= MAIN_FILE_BATCH;
+	}
+	if ((env_val = getenv("GLC_FILE_DIRECT"))) {
+		if (atoi(env_val))
+			mpriv.flags |= MAIN_FILE_BATCH | MAIN_FILE_DIRECT;
+	}
+
 	mpriv.uncompressed_size = 1024 * 1024 * 25;
 	if ((env_val = getenv("GLC_UNCOMPRESSED_BUFFER_SIZE")))
 		mpriv.uncompressed_size = atoi(env_val) * 1024 * 1024;
@@ -208,11 +231,19 @@ int load_environ()
 			if (atoi(env_val))
 				mpriv.flags |= MAIN_PIPE_VFLIP;
 		}
+		/* splicing shrinks the pipe, keep the deep one unless asked */
+		if ((env_val = getenv("GLC_PIPE_SPLICE"))) {
+			if (atoi(env_val))
+				mpriv.flags |= MAIN_PIPE_SPLICE;
+		}
 	}
 
 	if ((env_val = getenv("GLC_PIPE_DELAY")))
 		mpriv.pipe_delay_ms = atoi(env_val);
 
+	if ((env_val = getenv("GLC_PIPE_SHM")))
+		mpriv.pipe_shm_frames = atoi(env_val);
+
 	/*
 	 * pipe sink sends only raw uncompressed data.
 	 */
@@ -224,16 +255,86 @@ int load_environ()
 				mpriv.flags |= MAIN_COMPRESS_QUICKLZ;
 			else if (!strcmp(env_val, "lzjb"))
 				mpriv.flags |= MAIN_COMPRESS_LZJB;
-			else
+			else if (!strncmp(env_val, "lz4", 3) &&
+				 (!env_val[3] || env_val[3] == ':')) {
+				mpriv.flags |= MAIN_COMPRESS_LZ4;
+				if (env_val[3])
+					mpriv.compress_level = atoi(&env_val[4]);
+			} else if (!strncmp(env_val, "zstd", 4) &&
+				   (!env_val[4] || env_val[4] == ':')) {
+				mpriv.flags |= MAIN_COMPRESS_ZSTD;
+				if (env_val[4])
+					mpriv.compress_level = atoi(&env_val[5]);
+			} else if (!strncmp(env_val, "adaptive", 8) &&
+				   (!env_val[8] || env_val[8] == ':')) {
+				mpriv.flags |= MAIN_COMPRESS_ADAPTIVE;
+				/* level is the cpu budget */
+				if (env_val[8])
+					mpriv.compress_level = atoi(&env_val[9]);
+			} else
 				mpriv.flags |= MAIN_COMPRESS_NONE;
 		} else
 			mpriv.flags |= MAIN_COMPRESS_LZO;
 	} else
 		 mpriv.flags |= MAIN_COMPRESS_NONE;
 
+	if ((env_val = getenv("GLC_COMPRESS_DELTA")))
+		mpriv.keyframe_interval = atoi(env_val);
+
 	if ((env_val = getenv("GLC_RTPRIO")))
 		glc_set_allow_rt(&mpriv.glc, atoi(env_val));
 
+	if ((env_val = getenv("GLC_SIMD"))) {
+		if (!strcmp(env_val, "none"))
+			glc_set_simd_mask(&mpriv.glc, 0);
+		else if (!strcmp(env_val, "sse2"))
+			glc_set_simd_mask(&mpriv.glc, GLC_SIMD_SSE2);
+		else if (!strcmp(env_val, "ssse3"))
+			glc_set_simd_mask(&mpriv.glc, GLC_SIMD_SSE2 | GLC_SIMD_SSSE3);
+		else if (strcmp(env_val, "avx2"))
+			glc_log(&mpriv.glc, GLC_WARN, "main",
+				"unknown simd level '%s'", env_val);
+	}
+
+	if ((env_val = getenv("GLC_FRAME_THREADS")))
+		glc_set_frame_threads(&mpriv.glc, atoi(env_val));
+
+	/*
+	 * init_glc() runs on whichever thread first calls a hooked GLX,
+	 * GL, ALSA or X11 function, often but not always the rendering
+	 * thread. "node", "llc" and "current" refer to its processor,
+	 * capture threads may already be started below so they can't
+	 * wait for the first glXSwapBuffers().
+	 */
+	if ((env_val = getenv("GLC_AFFINITY")))
+		glc_set_affinity(&mpriv.glc, env_val, getenv("GLC_AFFINITY_AVOID"));
+
+	if ((env_val = getenv("GLC_PERF_FILE"))) {
+		/* %d is replaced by pid, like in GLC_LOG_FILE */
+		log_file = malloc(1024);
+		snprintf(log_file, 1024, env_val, getpid());
+		log_file[1023] = '\0';
+
+		if (unlikely((ret = glc_metrics_open_file(&mpriv.glc, log_file))))
+			glc_log(&mpriv.glc, GLC_ERROR, "main", "can't open %s: %s (%d)",
+				log_file, strerror(ret), ret);
+		else
+			mpriv.flags |= MAIN_PERF;
+		free(log_file);
+	}
+
+	if ((env_val = getenv("GLC_PERF"))) {
+		perf_interval = atof(env_val);
+		if (perf_interval > 0.0) {
+			mpriv.flags |= MAIN_PERF;
+			if (glc_log_get_level(&mpriv.glc) < GLC_PERF)
+				glc_log_set_level(&mpriv.glc, GLC_PERF);
+		}
+	}
+
+	if (mpriv.flags & MAIN_PERF)
+		glc_metrics_start(&mpriv.glc, (glc_utime_t) (perf_interval * 1000000000.0));
+
 	/* Account for sink thread and possibly compress filter ones */
 	glc_account_threads(&mpriv.glc, 1, !(mpriv.flags & MAIN_COMPRESS_NONE));
 
@@ -490,9 +591,15 @@ int start_glc()
 		if (unlikely((ret = pipe_sink_init(&mpriv.sink, &mpriv.glc,
 						mpriv.pipe_exec_file,
 						mpriv.flags & MAIN_PIPE_VFLIP,
+						mpriv.flags & MAIN_PIPE_SPLICE,
+						mpriv.pipe_shm_frames,
 						mpriv.pipe_delay_ms,
 						&stop_capture))))
 			return ret;
+	} else if (mpriv.flags & MAIN_FILE_BATCH) {
+		if (unlikely((ret = batch_sink_init(&mpriv.sink, &mpriv.glc,
+						    mpriv.flags & MAIN_FILE_DIRECT))))
+			return ret;
 	} else {
 		if (unlikely((ret = file_sink_init(&mpriv.sink, &mpriv.glc))))
 			return ret;
@@ -517,6 +624,18 @@ int start_glc()
 			pack_set_compression(mpriv.pack, PACK_LZO);
 		else if (mpriv.flags & MAIN_COMPRESS_LZJB)
 			pack_set_compression(mpriv.pack, PACK_LZJB);
+		else if (mpriv.flags & MAIN_COMPRESS_LZ4)
+			pack_set_compression(mpriv.pack, PACK_LZ4);
+		else if (mpriv.flags & MAIN_COMPRESS_ZSTD)
+			pack_set_compression(mpriv.pack, PACK_ZSTD);
+
+		if (mpriv.flags & MAIN_COMPRESS_ADAPTIVE) {
+			if (mpriv.compress_level)
+				pack_set_cpu_budget(mpriv.pack, mpriv.compress_level);
+			pack_set_compression(mpriv.pack, PACK_ADAPTIVE);
+		} else
+			pack_set_compression_level(mpriv.pack, mpriv.compress_level);
+		pack_set_keyframe_interval(mpriv.pack, mpriv.keyframe_interval);
 
 		if (unlikely((ret = pack_process_start(mpriv.pack, mpriv.uncompressed,
 						       mpriv.compressed))))
@@ -595,6 +714,9 @@ void lib_close()
 	ps_buffer_destroy(mpriv.uncompressed);
 	free(mpriv.uncompressed);
 
+	if (mpriv.flags & MAIN_PERF)
+		glc_metrics_stop(&mpriv.glc);
+
 	if (mpriv.flags & MAIN_CUSTOM_LOG)
 		glc_log_close(&mpriv.glc);
 
@@ -66,6 +66,10 @@ struct opengl_private_s {
 
 	int capture_glfinish;
 	int colorspace;
+	int fused_convert;
+	int gpu_convert;
+	int try_pbo;
+	int pbo_async;
 	double scale_factor;
 	GLenum read_buffer;
 	double fps;
@@ -91,6 +95,10 @@ int opengl_init(glc_t *glc)
 	opengl.started          = 0;
 	opengl.scale_factor     = 1.0;
 	opengl.capture_glfinish = 0;
+	opengl.fused_convert    = -1;
+	opengl.gpu_convert      = 0;
+	opengl.try_pbo          = 0;
+	opengl.pbo_async        = 1;
 	opengl.read_buffer      = GL_FRONT;
 	opengl.capturing        = 0;
 
@@ -120,6 +128,12 @@ int opengl_init(glc_t *glc)
 	} else
 		opengl.colorspace = CS_YCBCR_420JPEG;
 
+	if ((env_val = getenv("GLC_FUSED_CONVERT")))
+		opengl.fused_convert = atoi(env_val);
+
+	if ((env_val = getenv("GLC_GPU_CONVERT")))
+		opengl.gpu_convert = atoi(env_val);
+
 	if ((env_val = getenv("GLC_UNSCALED_BUFFER_SIZE")))
 		opengl.unscaled_size = atoi(env_val) * 1024 * 1024;
 	else
@@ -143,7 +157,31 @@ int opengl_init(glc_t *glc)
 		opengl.scale_factor = atof(env_val);
 
 	if ((env_val = getenv("GLC_TRY_PBO")))
-		gl_capture_try_pbo(opengl.gl_capture, atoi(env_val));
+		opengl.try_pbo = atoi(env_val);
+	gl_capture_try_pbo(opengl.gl_capture, opengl.try_pbo);
+
+	if ((env_val = getenv("GLC_PBO_ASYNC")))
+		opengl.pbo_async = atoi(env_val);
+	gl_capture_async_readback(opengl.gl_capture, opengl.pbo_async);
+
+	/*
+	 * fused conversion runs where pixels are read back, only default
+	 * to it when that is the readback thread. GPU conversion needs it.
+	 */
+	if (opengl.fused_convert < 0)
+		opengl.fused_convert = (opengl.try_pbo && opengl.pbo_async) ||
+				       opengl.gpu_convert;
+	else if (opengl.fused_convert && (opengl.colorspace == CS_YCBCR_420JPEG) &&
+		 !(opengl.try_pbo && opengl.pbo_async))
+		glc_log(opengl.glc, GLC_INFO, "opengl",
+			 "fused conversion without asynchronous PBO readback, "
+			 "converting in application rendering thread");
+
+	if ((env_val = getenv("GLC_PBO_DEPTH"))) {
+		if (unlikely(gl_capture_set_pbo_depth(opengl.gl_capture, atoi(env_val))))
+			glc_log(opengl.glc, GLC_WARN, "opengl",
+				 "invalid PBO depth '%s'", env_val);
+	}
 
 	gl_capture_set_pack_alignment(opengl.gl_capture, 8);
 	if ((env_val = getenv("GLC_CAPTURE_DWORD_ALIGNED"))) {
@@ -169,9 +207,11 @@ int opengl_init(glc_t *glc)
 		gl_capture_lock_fps(opengl.gl_capture, atoi(env_val));
 
 	get_real_opengl();
-	/* Count host app rendering thread and possible filter threads on glcs side */
-	glc_account_threads(opengl.glc, 1, (opengl.scale_factor != 1.0) ||
-					   opengl.colorspace == CS_YCBCR_420JPEG);
+	/* Count host app rendering thread, PBO readback and possible filter threads on glcs side */
+	glc_account_threads(opengl.glc, 1 + (opengl.try_pbo && opengl.pbo_async),
+			    (opengl.colorspace == CS_YCBCR_420JPEG) ?
+			    !opengl.fused_convert :
+			    (opengl.scale_factor != 1.0));
 	return 0;
 }
 
@@ -182,8 +222,25 @@ int opengl_start(ps_buffer_t *buffer)
 
 	opengl.buffer = buffer;
 
-	/* init unscaled buffer if it is needed */
-	if ((opengl.scale_factor != 1.0) || opengl.colorspace == CS_YCBCR_420JPEG) {
+	if ((opengl.colorspace == CS_YCBCR_420JPEG) && (opengl.fused_convert)) {
+		/*
+		 * crop, scale, conversion and flip are done in one pass from
+		 * read back pixels into buffer, without unscaled buffer
+		 */
+		gl_capture_set_pixel_format(opengl.gl_capture, GL_BGRA);
+
+		ycbcr_init(&opengl.ycbcr, opengl.glc);
+		ycbcr_set_scale(opengl.ycbcr, opengl.scale_factor);
+		gl_capture_set_ycbcr(opengl.gl_capture, opengl.ycbcr);
+
+		/* ycbcr is still used when GPU can't convert */
+		gl_capture_set_scale(opengl.gl_capture, opengl.scale_factor);
+		gl_capture_try_gpu(opengl.gl_capture, opengl.gpu_convert);
+
+		gl_capture_set_buffer(opengl.gl_capture, opengl.buffer);
+	} else if ((opengl.scale_factor != 1.0) ||
+		   (opengl.colorspace == CS_YCBCR_420JPEG)) {
+		/* init unscaled buffer, scale or ycbcr runs in own threads */
 		/* if scaling is enabled, it is faster to capture as GL_BGRA */
 		gl_capture_set_pixel_format(opengl.gl_capture, GL_BGRA);
 
@@ -230,6 +287,10 @@ int opengl_close()
 		gl_capture_stop(opengl.gl_capture);
 	gl_capture_destroy(opengl.gl_capture);
 
+	/* used directly by gl_capture */
+	if ((!opengl.unscaled) && (opengl.ycbcr))
+		ycbcr_destroy(opengl.ycbcr);
+
 	if (opengl.unscaled) {
 		if (lib.running) {
 			if (unlikely((ret = glc_util_write_end_of_stream(opengl.glc,
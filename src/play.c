@@ -70,6 +70,7 @@ struct play_s {
 
 	double scale_factor;
 	unsigned int scale_width, scale_height;
+	int scale_filter;
 
 	size_t buffer_size_arr[BUFFER_SIZE_ARR_SZ];
 
@@ -91,6 +92,7 @@ struct play_s {
 
 	int log_level;
 	int allow_rt;
+	long int frame_threads;
 };
 
 int show_info_value(struct play_s *play, const char *value);
@@ -116,6 +118,7 @@ int main(int argc, char *argv[])
 		{"out",			1, NULL, 'o'},
 		{"fps",			1, NULL, 'f'},
 		{"resize",		1, NULL, 'r'},
+		{"resize-filter",	1, NULL, 'R'},
 		{"adjust",		1, NULL, 'g'},
 		{"silence",		1, NULL, 'l'},
 		{"alsa-device",		1, NULL, 'd'},
@@ -127,6 +130,7 @@ int main(int argc, char *argv[])
 		{"help",		0, NULL, 'h'},
 		{"version",		0, NULL, 'V'},
 		{"rtprio",		0, NULL, 'P'},
+		{"frame-threads",	1, NULL, 'F'},
 		{0, 0, 0, 0}
 	};
 	memset(&play, 0, sizeof(struct play_s));
@@ -140,6 +144,7 @@ int main(int argc, char *argv[])
 	/* don't scale by default */
 	play.scale_factor = 1;
 	play.scale_width = play.scale_height = 0;
+	play.scale_filter = SCALE_FILTER_BILINEAR;
 
 	/* default buffer size is 10MiB */
 	play.buffer_size_arr[COMPRESSED_IDX] = 10 * 1024 * 1024;
@@ -161,7 +166,7 @@ int main(int argc, char *argv[])
 	play.green_gamma = 1.0;
 	play.blue_gamma  = 1.0;
 
-	while ((opt = getopt_long(argc, argv, "i:a:b:p:y:o:f:r:g:l:td:c:u:s:v:hVP",
+	while ((opt = getopt_long(argc, argv, "i:a:b:p:y:o:f:r:R:g:l:td:c:u:s:v:hVPF:",
 				  long_options, &optind)) != -1) {
 		switch (opt) {
 		case 'i':
@@ -207,6 +212,16 @@ int main(int argc, char *argv[])
 					goto usage;
 			}
 			break;
+		case 'R':
+			if (!strcmp(optarg, "bilinear"))
+				play.scale_filter = SCALE_FILTER_BILINEAR;
+			else if (!strcmp(optarg, "area"))
+				play.scale_filter = SCALE_FILTER_AREA;
+			else if (!strcmp(optarg, "lanczos"))
+				play.scale_filter = SCALE_FILTER_LANCZOS3;
+			else
+				goto usage;
+			break;
 		case 'g':
 			play.override_color_correction = 1;
 			sscanf(optarg, "%f;%f;%f;%f;%f", &play.brightness, &play.contrast,
@@ -254,6 +269,11 @@ int main(int argc, char *argv[])
 		case 'P':
 			play.allow_rt = 1;
 			break;
+		case 'F':
+			play.frame_threads = atoi(optarg);
+			if (play.frame_threads < 1)
+				goto usage;
+			break;
 		case 'h':
 		default:
 			goto usage;
@@ -277,10 +297,12 @@ int main(int argc, char *argv[])
 	glc_state_init(&play.glc);
 	glc_log_set_level(&play.glc, play.log_level);
 	glc_set_allow_rt(&play.glc, play.allow_rt);
+	if (play.frame_threads)
+		glc_set_frame_threads(&play.glc, play.frame_threads);
 	glc_util_log_version(&play.glc);
 
 	/* open stream file */
-	if (unlikely(file_source_init(&play.file, &play.glc)))
+	if (unlikely(file_mmap_source_init(&play.file, &play.glc)))
 		return EXIT_FAILURE;
 	if (unlikely(play.file->ops->open_source(play.file, play.stream_file)))
 		return EXIT_FAILURE;
@@ -349,6 +371,8 @@ usage:
 	       "  -o, --out=FILE           write to FILE\n"
 	       "  -f, --fps=FPS            save images or video at FPS\n"
 	       "  -r, --resize=VAL         resize pictures with scale factor VAL or WxH\n"
+	       "  -R, --resize-filter=NAME resize filter, possible values are:\n"
+	       "                             bilinear (default), area, lanczos\n"
 	       "  -g, --color=ADJUST       adjust colors\n"
 	       "                             format is brightness;contrast;red;green;blue\n"
 	       "  -l, --silence=SECONDS    audio silence threshold in seconds\n"
@@ -364,6 +388,8 @@ usage:
 	       "                             all, signature, version, flags, fps,\n"
 	       "                             pid, name, date\n"
 	       "  -P, --rtprio             use rt priority for alsa threads\n"
+	       "  -F, --frame-threads=NUM  split each video frame into bands\n"
+	       "                             processed by NUM threads\n"
 	       "  -v, --verbosity=LEVEL    verbosity level\n"
 	       "  -h, --help               show help\n");
 
@@ -427,6 +453,24 @@ static void destroy_buffers(ps_buffer_t *buffer_arr, unsigned nm)
 		ps_buffer_destroy(&buffer_arr[i]);
 }
 
+/*
+ * Neutral override discards color messages from stream so color
+ * would only copy frames, scale then writes straight to color_buffer.
+ */
+static int color_needed(struct play_s *play)
+{
+	int neutral;
+
+	if (!play->override_color_correction)
+		return 1;
+	/* keep color in the pipeline if neutrality can't be decided */
+	if (unlikely(color_neutral(play->brightness, play->contrast,
+				   play->red_gamma, play->green_gamma,
+				   play->blue_gamma, &neutral)))
+		return 1;
+	return !neutral;
+}
+
 #define compressed_buffer   buffer_arr[0]
 #define uncompressed_buffer buffer_arr[1]
 #define rgb_buffer          buffer_arr[2]
@@ -469,6 +513,7 @@ int play_stream(struct play_s *play)
 	scale_t scale;
 	unpack_t unpack;
 	rgb_t rgb;
+	int use_color = color_needed(play);
 	int ret = 0;
 
 	if (unlikely((ret = init_buffers(buffer_arr, play->buffer_size_arr, nm_arr))))
@@ -487,6 +532,7 @@ int play_stream(struct play_s *play)
 		scale_set_size(scale, play->scale_width, play->scale_height);
 	else
 		scale_set_scale(scale, play->scale_factor);
+	scale_set_filter(scale, play->scale_filter);
 	if (unlikely((ret = color_init(&color, &play->glc))))
 		goto err;
 	if (play->override_color_correction)
@@ -514,9 +560,11 @@ int play_stream(struct play_s *play)
 	if (unlikely((ret = unpack_process_start(unpack, &compressed_buffer,
 						&uncompressed_buffer))))
 		goto err;
-	if (unlikely((ret = scale_process_start(scale, &rgb_buffer, &scale_buffer))))
+	if (unlikely((ret = scale_process_start(scale, &rgb_buffer,
+					use_color ? &scale_buffer : &color_buffer))))
 		goto err;
-	if (unlikely((ret = color_process_start(color, &scale_buffer, &color_buffer))))
+	if ((use_color) &&
+	    (unlikely((ret = color_process_start(color, &scale_buffer, &color_buffer)))))
 		goto err;
 
 	/* the pipeline is ready - lets give it some data */
@@ -526,7 +574,7 @@ int play_stream(struct play_s *play)
 	/* we've done our part - just wait for the threads */
 	if (unlikely((ret = demux_process_wait(demux))))
 		goto err; /* wait for demux, since when it quits, others should also */
-	if (unlikely((ret = color_process_wait(color))))
+	if ((use_color) && (unlikely((ret = color_process_wait(color)))))
 		goto err;
 	if (unlikely((ret = scale_process_wait(scale))))
 		goto err;
@@ -632,6 +680,7 @@ int export_img(struct play_s *play)
 	scale_t scale;
 	unpack_t unpack;
 	rgb_t rgb;
+	int use_color = color_needed(play);
 	int ret = 0;
 
 	if (unlikely((ret = init_buffers(buffer_arr, play->buffer_size_arr, nm_arr))))
@@ -650,6 +699,7 @@ int export_img(struct play_s *play)
 		scale_set_size(scale, play->scale_width, play->scale_height);
 	else
 		scale_set_scale(scale, play->scale_factor);
+	scale_set_filter(scale, play->scale_filter);
 	if (unlikely((ret = color_init(&color, &play->glc))))
 		goto err;
 	if (play->override_color_correction)
@@ -668,9 +718,11 @@ int export_img(struct play_s *play)
 		goto err;
 	if (unlikely((ret = rgb_process_start(rgb, &uncompressed_buffer, &rgb_buffer))))
 		goto err;
-	if (unlikely((ret = scale_process_start(scale, &rgb_buffer, &scale_buffer))))
+	if (unlikely((ret = scale_process_start(scale, &rgb_buffer,
+					use_color ? &scale_buffer : &color_buffer))))
 		goto err;
-	if (unlikely((ret = color_process_start(color, &scale_buffer, &color_buffer))))
+	if ((use_color) &&
+	    (unlikely((ret = color_process_start(color, &scale_buffer, &color_buffer)))))
 		goto err;
 	if (unlikely((ret = img_process_start(img, &color_buffer))))
 		goto err;
@@ -682,7 +734,7 @@ int export_img(struct play_s *play)
 	/* wait 'till its done and clean up the mess... */
 	if (unlikely((ret = img_process_wait(img))))
 		goto err;
-	if (unlikely((ret = color_process_wait(color))))
+	if ((use_color) && (unlikely((ret = color_process_wait(color)))))
 		goto err;
 	if (unlikely((ret = scale_process_wait(scale))))
 		goto err;
@@ -725,6 +777,7 @@ int export_yuv4mpeg(struct play_s *play)
 	scale_t scale;
 	unpack_t unpack;
 	color_t color;
+	int use_color = color_needed(play);
 	int ret = 0;
 
 	if (unlikely((ret = init_buffers(buffer_arr, play->buffer_size_arr, nm_arr))))
@@ -743,6 +796,7 @@ int export_yuv4mpeg(struct play_s *play)
 		scale_set_size(scale, play->scale_width, play->scale_height);
 	else
 		scale_set_scale(scale, play->scale_factor);
+	scale_set_filter(scale, play->scale_filter);
 	if (unlikely((ret = color_init(&color, &play->glc))))
 		goto err;
 	if (play->override_color_correction)
@@ -760,9 +814,10 @@ int export_yuv4mpeg(struct play_s *play)
 						&uncompressed_buffer))))
 		goto err;
 	if (unlikely((ret = scale_process_start(scale, &uncompressed_buffer,
-						&scale_buffer))))
+					use_color ? &scale_buffer : &color_buffer))))
 		goto err;
-	if (unlikely((ret = color_process_start(color, &scale_buffer, &color_buffer))))
+	if ((use_color) &&
+	    (unlikely((ret = color_process_start(color, &scale_buffer, &color_buffer)))))
 		goto err;
 	if (unlikely((ret = ycbcr_process_start(ycbcr, &color_buffer, &ycbcr_buffer))))
 		goto err;
@@ -776,7 +831,7 @@ int export_yuv4mpeg(struct play_s *play)
 	/* threads will do the dirty work... */
 	if (unlikely((ret = yuv4mpeg_process_wait(yuv4mpeg))))
 		goto err;
-	if (unlikely((ret = color_process_wait(color))))
+	if ((use_color) && (unlikely((ret = color_process_wait(color)))))
 		goto err;
 	if (unlikely((ret = scale_process_wait(scale))))
 		goto err;
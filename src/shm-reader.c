@@ -0,0 +1,137 @@
+/**
+ * \file shm-reader.c
+ * \brief minimal GLC_PIPE_SHM consumer
+ * \author agent <agent@local>
+ * \date 2026
+
+    Copyright 2026 agent
+
+    This file is part of glcs.
+
+    glcs is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    glcs is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with glcs.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+/*
+ * Stands for the external program of the pipe sink when GLC_PIPE_SHM
+ * is set. It is started with the same arguments as any pipe program,
+ * reads the ring from stdin, optionally writes the raw frames to the
+ * target file ('-' is stdout) and reports on stderr what it received,
+ * so that the writer side can be checked without an encoder:
+ *
+ *   GLC_PIPE=glc-shm-reader GLC_PIPE_SHM=4 glc-capture ...
+ *   glc-shm-reader 640x480 bgra 30 frames.raw < ring
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+
+#include <glc/common/glc.h>
+#include <glc/core/shm_ring.h>
+
+static int shm_reader_bpp(const char *format);
+static int shm_reader_write(int fd, const char *buf, size_t size);
+
+int main(int argc, char *argv[])
+{
+	shm_ring_t ring;
+	const char *frame;
+	size_t size, expected = 0;
+	unsigned long long frames = 0, bytes = 0;
+	u_int64_t hash = 0xcbf29ce484222325ULL; /* FNV-1a */
+	unsigned int width, height;
+	int bpp, fd = -1, ret;
+	size_t i;
+
+	if ((argc > 2) && (sscanf(argv[1], "%ux%u", &width, &height) == 2) &&
+	    ((bpp = shm_reader_bpp(argv[2])) > 0))
+		expected = (size_t) width * height * bpp;
+
+	if ((argc > 4) && (argv[4][0]) && (strcmp(argv[4], "/dev/null"))) {
+		if (!strcmp(argv[4], "-"))
+			fd = STDOUT_FILENO;
+		else if ((fd = open(argv[4], O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+			fprintf(stderr, "glc-shm-reader: can't open %s: %s (%d)\n",
+				argv[4], strerror(errno), errno);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if ((ret = shm_ring_open(&ring, STDIN_FILENO))) {
+		fprintf(stderr, "glc-shm-reader: stdin is not a frame ring: %s (%d)\n",
+			strerror(ret), ret);
+		return EXIT_FAILURE;
+	}
+
+	while (!(ret = shm_ring_read(ring, &frame, &size))) {
+		if (expected && (size < expected)) {
+			fprintf(stderr, "glc-shm-reader: frame %llu has %zu bytes, "
+				"%zu expected\n", frames, size, expected);
+			ret = EINVAL;
+			break;
+		}
+		for (i = 0; i < size; i++) {
+			hash ^= (unsigned char) frame[i];
+			hash *= 0x100000001b3ULL;
+		}
+		if ((fd >= 0) && (shm_reader_write(fd, frame, size))) {
+			fprintf(stderr, "glc-shm-reader: write failed: %s (%d)\n",
+				strerror(errno), errno);
+			ret = errno;
+			break;
+		}
+		frames++;
+		bytes += size;
+		shm_ring_read_done(ring);
+	}
+
+	fprintf(stderr, "glc-shm-reader: %llu frames, %llu bytes, fnv1a %016llx\n",
+		frames, bytes, (unsigned long long) hash);
+
+	shm_ring_destroy(ring);
+	if ((fd >= 0) && (fd != STDOUT_FILENO))
+		close(fd);
+	return (ret == EPIPE) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int shm_reader_bpp(const char *format)
+{
+	if ((!strcmp(format, "bgr24")) || (!strcmp(format, "rgb24")))
+		return 3;
+	if (!strcmp(format, "bgra"))
+		return 4;
+	return 0;
+}
+
+int shm_reader_write(int fd, const char *buf, size_t size)
+{
+	ssize_t ret;
+
+	while (size) {
+		ret = write(fd, buf, size);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		size -= ret;
+	}
+	return 0;
+}
@@ -0,0 +1,283 @@
+/**
+ * \file tests/gpu_convert.c
+ * \brief GLC_GPU_CONVERT output checked against ycbcr
+ * \author agent <agent@local>
+ * \date 2026
+
+    Copyright 2026 agent
+
+    This file is part of glcs.
+
+    glcs is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    glcs is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with glcs.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+/*
+ * Draws test patterns in an EGL pbuffer, converts them on the GPU the
+ * way gl_capture does with GLC_GPU_CONVERT and compares the planes with
+ * what ycbcr makes of the same pixels read back as BGRA. Every plane
+ * must be within GPU_CONVERT_TOLERANCE levels at scale 1 and 0.5, one
+ * more at other scales where ycbcr and the texture unit quantize the
+ * bilinear weights differently, and the PBO path must be byte-identical
+ * to the direct read. OpenGL errors fail the test too.
+ *
+ * gl_capture GPU helpers are static, the file is included. No window
+ * system is needed: Mesa surfaceless platform is tried first, then the
+ * default display, so this runs headless or under Xvfb, e.g.
+ *
+ *   LIBGL_ALWAYS_SOFTWARE=1 glc-test-gpu-convert
+ *   xvfb-run -a glc-test-gpu-convert
+ */
+
+#include "glc/capture/gl_capture.c"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#define GPU_CONVERT_TOLERANCE 2
+#define GPU_CONVERT_TOLERANCE_SCALED 3
+#define GPU_CONVERT_PBUFFER   2048
+
+struct gpu_convert_case_s {
+	unsigned int w, h;
+	double scale;
+	int noise;
+};
+
+static const struct gpu_convert_case_s gpu_convert_cases[] = {
+	{ 640,  480, 1.0,  0},
+	{ 640,  480, 1.0,  1},
+	{ 640,  480, 0.5,  0},
+	{ 640,  480, 0.5,  1},
+	{1280,  720, 0.75, 0},
+	{1280,  720, 0.75, 1},
+	{1000,  600, 0.7,  1},
+	{1920, 1080, 1.0,  1},
+	{1920, 1080, 0.5,  0},
+	{   0,    0, 0,    0}
+};
+
+static int gpu_convert_egl(void);
+static int gpu_convert_run(gl_capture_t gl, glc_t *glc,
+			   const struct gpu_convert_case_s *c);
+static int gpu_convert_cmp(const char *plane, const unsigned char *gpu,
+			   const unsigned char *cpu, size_t n, int tolerance);
+
+int main(int argc, char *argv[])
+{
+	const struct gpu_convert_case_s *c;
+	gl_capture_t gl;
+	glc_t glc;
+	GLint read;
+	int ret = 0;
+
+	if (gpu_convert_egl())
+		return 77; /* skipped */
+	printf("%s, OpenGL %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+
+	glc_init(&glc);
+	glc_state_init(&glc);
+	gl_capture_init(&gl, &glc);
+
+	/* pbuffers are single buffered whatever GL_DRAW_BUFFER says */
+	glGetIntegerv(GL_READ_BUFFER, &read);
+	gl_capture_set_read_buffer(gl, read);
+	if (gl_capture_init_gpu(gl)) {
+		fprintf(stderr, "GPU conversion is not supported\n");
+		return 77;
+	}
+	gl->flags |= GL_CAPTURE_USE_GPU;
+
+	for (c = gpu_convert_cases; c->w; c++)
+		ret |= gpu_convert_run(gl, &glc, c);
+
+	printf("%s\n", ret ? "FAIL" : "PASS");
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int gpu_convert_egl(void)
+{
+	EGLint config_attribs[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+				   EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+				   EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8,
+				   EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+				   EGL_NONE};
+	EGLint pbuffer_attribs[] = {EGL_WIDTH, GPU_CONVERT_PBUFFER,
+				    EGL_HEIGHT, GPU_CONVERT_PBUFFER,
+				    EGL_NONE};
+	EGLDisplay dpy;
+	EGLConfig config;
+	EGLSurface surface;
+	EGLContext ctx;
+	EGLint major, minor, n;
+
+	dpy = eglGetPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+				    EGL_DEFAULT_DISPLAY, NULL);
+	if ((dpy == EGL_NO_DISPLAY) || (!eglInitialize(dpy, &major, &minor))) {
+		dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		if ((dpy == EGL_NO_DISPLAY) || (!eglInitialize(dpy, &major, &minor))) {
+			fprintf(stderr, "can't initialize EGL\n");
+			return ENODEV;
+		}
+	}
+
+	if ((!eglChooseConfig(dpy, config_attribs, &config, 1, &n)) || (!n)) {
+		fprintf(stderr, "no EGL config with OpenGL pbuffers\n");
+		return ENODEV;
+	}
+	if ((surface = eglCreatePbufferSurface(dpy, config, pbuffer_attribs)) ==
+	    EGL_NO_SURFACE) {
+		fprintf(stderr, "can't create %dx%d pbuffer\n",
+			GPU_CONVERT_PBUFFER, GPU_CONVERT_PBUFFER);
+		return ENODEV;
+	}
+	eglBindAPI(EGL_OPENGL_API);
+	if (((ctx = eglCreateContext(dpy, config, EGL_NO_CONTEXT, NULL)) ==
+	     EGL_NO_CONTEXT) || (!eglMakeCurrent(dpy, surface, surface, ctx))) {
+		fprintf(stderr, "can't create OpenGL context\n");
+		return ENODEV;
+	}
+	return 0;
+}
+
+int gpu_convert_run(gl_capture_t gl, glc_t *glc, const struct gpu_convert_case_s *c)
+{
+	struct gl_capture_video_stream_s video;
+	glc_video_format_message_t format;
+	unsigned char *src, *bgra, *gpu, *cpu = NULL, *pbo;
+	unsigned int x, y, w, h;
+	size_t size, cpu_size;
+	ycbcr_t ycbcr;
+	GLenum err;
+	int tolerance, ret = 0;
+
+	if ((c->scale == 1.0) || (c->scale == 0.5))
+		tolerance = GPU_CONVERT_TOLERANCE;
+	else
+		tolerance = GPU_CONVERT_TOLERANCE_SCALED;
+
+	src = malloc(c->w * c->h * 4);
+	bgra = malloc(c->w * c->h * 4);
+
+	/* gradients or noise */
+	srand(1);
+	for (y = 0; y < c->h; y++) {
+		for (x = 0; x < c->w; x++) {
+			src[(y * c->w + x) * 4 + 0] = c->noise ? rand() : x * 255 / c->w;
+			src[(y * c->w + x) * 4 + 1] = c->noise ? rand() : y * 255 / c->h;
+			src[(y * c->w + x) * 4 + 2] = c->noise ? rand() : (x + y) & 255;
+			src[(y * c->w + x) * 4 + 3] = 255;
+		}
+	}
+	glViewport(0, 0, c->w, c->h);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	glRasterPos2f(-1, -1);
+	glDrawPixels(c->w, c->h, GL_BGRA, GL_UNSIGNED_BYTE, src);
+
+	memset(&video, 0, sizeof(video));
+	video.id = 1;
+	video.cw = c->w;
+	video.ch = c->h;
+	gl->scale = c->scale;
+	if (gl_capture_create_gpu(gl, &video)) {
+		printf("%ux%u scale %.2f: can't create GPU conversion\n",
+		       c->w, c->h, c->scale);
+		ret = 1;
+		goto finish;
+	}
+	w = video.gpu_w * 4;
+	h = video.gpu_h - video.gpu_h / 3;
+	size = video.gpu_w * video.gpu_h * 4;
+	gpu = malloc(size);
+	gl_capture_gpu_read(gl, &video, gpu);
+
+	printf("%ux%u scale %.2f %s -> %ux%u\n", c->w, c->h, c->scale,
+	       c->noise ? "noise" : "gradient", w, h);
+
+	/* PBO path reads the same FBO asynchronously */
+	video.gpu = 1;
+	video.size = size;
+	if ((gl->glGenBuffers) || (!gl_capture_init_pbo(gl))) {
+		gl_capture_create_pbo(gl, &video);
+		gl_capture_start_pbo(gl, &video, 0);
+		gl->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, video.pbo[0]);
+		pbo = gl->glMapBuffer(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY);
+		if ((!pbo) || (memcmp(pbo, gpu, size))) {
+			printf("  pbo differs from direct read\n");
+			ret = 1;
+		}
+		if (pbo)
+			gl->glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+		gl->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+		gl_capture_destroy_pbo(gl, &video);
+	} else
+		printf("  no pbo support, pbo path not checked\n");
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadBuffer(gl->capture_buffer);
+	glReadPixels(0, 0, c->w, c->h, GL_BGRA, GL_UNSIGNED_BYTE, bgra);
+
+	ycbcr_init(&ycbcr, glc);
+	ycbcr_set_scale(ycbcr, c->scale);
+	memset(&format, 0, sizeof(format));
+	format.id = 1;
+	format.width = c->w;
+	format.height = c->h;
+	format.format = GLC_VIDEO_BGRA;
+	ycbcr_convert_format(ycbcr, &format, &cpu_size);
+	if ((format.width != w) || (format.height != h)) {
+		printf("  ycbcr makes %ux%u frames\n", format.width, format.height);
+		ret = 1;
+	} else {
+		cpu = malloc(cpu_size);
+		ycbcr_convert_frame(ycbcr, 1, bgra, cpu);
+		ret |= gpu_convert_cmp("Y", gpu, cpu, w * h, tolerance);
+		ret |= gpu_convert_cmp("Cb", &gpu[w * h], &cpu[w * h], w * h / 4,
+				       tolerance);
+		ret |= gpu_convert_cmp("Cr", &gpu[w * h * 5 / 4], &cpu[w * h * 5 / 4],
+				       w * h / 4, tolerance);
+	}
+	ycbcr_destroy(ycbcr);
+	gl_capture_destroy_gpu(gl, &video);
+	if ((err = glGetError()) != GL_NO_ERROR) {
+		printf("  OpenGL error 0x%x\n", err);
+		ret = 1;
+	}
+	free(cpu);
+	free(gpu);
+finish:
+	free(src);
+	free(bgra);
+	return ret;
+}
+
+int gpu_convert_cmp(const char *plane, const unsigned char *gpu,
+		    const unsigned char *cpu, size_t n, int tolerance)
+{
+	double sum = 0;
+	int d, max = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		d = abs(gpu[i] - cpu[i]);
+		if (d > max)
+			max = d;
+		sum += d;
+	}
+	printf("  %-2s max %d mean %.3f\n", plane, max, sum / n);
+	return max > tolerance;
+}